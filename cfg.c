@@ -0,0 +1,873 @@
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fadec.h>
+#include <fadec-analysis.h>
+
+
+// Allocate from the arena, aligned to 8 bytes; NULL if it is exhausted.
+static void*
+arena_alloc(FdArena* arena, size_t size) {
+    uintptr_t base = (uintptr_t) arena->mem;
+    size_t off = ((base + arena->used + 7) & ~(uintptr_t) 7) - base;
+    if (off > arena->size || size > arena->size - off)
+        return NULL;
+    arena->used = off + size;
+    return (char*) arena->mem + off;
+}
+
+// Grow an array to new_size bytes, in place if it is the last allocation.
+static void*
+arena_grow(FdArena* arena, void* old, size_t old_size, size_t new_size) {
+    if (old && (char*) old + old_size == (char*) arena->mem + arena->used &&
+        new_size - old_size <= arena->size - arena->used) {
+        arena->used += new_size - old_size;
+        return old;
+    }
+    char* copy = arena_alloc(arena, new_size);
+    if (copy)
+        for (size_t i = 0; i < old_size; i++)
+            copy[i] = ((const char*) old)[i];
+    return copy;
+}
+
+#define EMPTY UINT64_MAX
+
+enum {
+    INSTR_LEADER = 1 << 0, // starts a block
+    INSTR_END = 1 << 1, // ends a block
+    INSTR_ENTRY = 1 << 2,
+    INSTR_CALL = 1 << 3, // direct call
+};
+
+struct CfgInstr {
+    uint64_t addr;
+    uint8_t size;
+    uint8_t flags;
+};
+
+// Open-addressing hash set of the decoded instructions, keyed by address.
+struct CfgMap {
+    struct CfgInstr* slots;
+    size_t mask;
+    size_t count;
+};
+
+struct CfgState {
+    FdArena* arena;
+    const uint8_t* buf;
+    size_t len;
+    uint64_t base;
+    int mode;
+    struct CfgMap map;
+    uint64_t* work;
+    size_t nwork;
+    size_t workcap;
+    // When patching: the previous graph, whose blocks in [old_first,
+    // old_last) are replaced, and the addresses where the others are split.
+    const FdCfg* old;
+    uint32_t old_first;
+    uint32_t old_last;
+    uint64_t* splits;
+    size_t nsplits;
+    size_t splitcap;
+};
+
+static size_t
+map_hash(const struct CfgMap* map, uint64_t addr) {
+    return (addr * 0x9e3779b97f4a7c15) >> 32 & map->mask;
+}
+
+static struct CfgInstr*
+map_find(const struct CfgMap* map, uint64_t addr) {
+    for (size_t i = map_hash(map, addr); ; i = (i + 1) & map->mask) {
+        if (map->slots[i].addr == addr)
+            return &map->slots[i];
+        if (map->slots[i].addr == EMPTY)
+            return NULL;
+    }
+}
+
+static bool
+map_init(struct CfgMap* map, FdArena* arena, size_t cap) {
+    map->slots = arena_alloc(arena, cap * sizeof *map->slots);
+    if (!map->slots)
+        return false;
+    for (size_t i = 0; i < cap; i++)
+        map->slots[i].addr = EMPTY;
+    map->mask = cap - 1;
+    map->count = 0;
+    return true;
+}
+
+// Insert an instruction which is not in the map yet.
+static struct CfgInstr*
+map_insert(struct CfgMap* map, FdArena* arena, uint64_t addr) {
+    // Keep the load factor at most one half.
+    if (2 * (map->count + 1) > map->mask + 1) {
+        struct CfgMap old = *map;
+        if (!map_init(map, arena, 2 * (old.mask + 1)))
+            return NULL;
+        for (size_t i = 0; i <= old.mask; i++) {
+            if (old.slots[i].addr == EMPTY)
+                continue;
+            size_t j = map_hash(map, old.slots[i].addr);
+            while (map->slots[j].addr != EMPTY)
+                j = (j + 1) & map->mask;
+            map->slots[j] = old.slots[i];
+        }
+        map->count = old.count;
+    }
+    size_t i = map_hash(map, addr);
+    while (map->slots[i].addr != EMPTY)
+        i = (i + 1) & map->mask;
+    map->slots[i] = (struct CfgInstr) { .addr = addr };
+    map->count++;
+    return &map->slots[i];
+}
+
+static bool
+push(FdArena* arena, uint64_t** arr, size_t* count, size_t* cap,
+     uint64_t val) {
+    if (*count == *cap) {
+        size_t new_cap = *cap ? 2 * *cap : 64;
+        *arr = arena_grow(arena, *arr, *cap * sizeof **arr,
+                          new_cap * sizeof **arr);
+        if (!*arr)
+            return false;
+        *cap = new_cap;
+    }
+    (*arr)[(*count)++] = val;
+    return true;
+}
+
+static bool
+cfg_in_region(const struct CfgState* st, uint64_t addr) {
+    return addr - st->base < st->len;
+}
+
+// Whether addr starts an instruction when decoding from start; the number of
+// instructions before addr is stored in *ninstrs.
+static bool
+cfg_boundary(const struct CfgState* st, uint64_t start, uint64_t addr,
+             uint32_t* ninstrs) {
+    *ninstrs = 0;
+    while (start < addr) {
+        FdInstr instr;
+        size_t off = start - st->base;
+        int ret = fd_decode(st->buf + off, st->len - off, st->mode, 0, &instr);
+        if (ret < 0)
+            return false;
+        start += ret;
+        ++*ninstrs;
+    }
+    return start == addr;
+}
+
+// When patching, whether a path joins a block which is kept: 1 if it does,
+// at its start or at an instruction where the block is split; 0 if addr is
+// decoded as new code; -1 if the arena is exhausted.
+static int
+cfg_join(struct CfgState* st, uint64_t addr) {
+    const FdCfg* old = st->old;
+    size_t lo = 0, hi = old->nblocks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (old->blocks[mid].start <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (!lo || (lo - 1 >= st->old_first && lo - 1 < st->old_last))
+        return 0;
+    const FdCfgBlock* block = &old->blocks[lo - 1];
+    uint32_t ninstrs;
+    if (addr >= block->end)
+        return 0;
+    if (addr == block->start)
+        return 1;
+    // A jump into the middle of an instruction starts overlapping code.
+    if (!cfg_boundary(st, block->start, addr, &ninstrs))
+        return 0;
+    return push(st->arena, &st->splits, &st->nsplits, &st->splitcap, addr)
+           ? 1 : -1;
+}
+
+// Decode linearly from addr until the path ends or joins decoded code.
+static bool
+cfg_trace(struct CfgState* st, uint64_t addr) {
+    bool leader = true;
+    while (cfg_in_region(st, addr)) {
+        struct CfgInstr* ci = map_find(&st->map, addr);
+        if (ci) {
+            // A second path or a branch target enters a block.
+            ci->flags |= INSTR_LEADER;
+            return true;
+        }
+        if (st->old) {
+            int joined = cfg_join(st, addr);
+            if (joined)
+                return joined > 0;
+        }
+
+        FdInstr instr;
+        size_t off = addr - st->base;
+        int ret = fd_decode(st->buf + off, st->len - off, st->mode, 0, &instr);
+        if (ret < 0)
+            return true;
+        ci = map_insert(&st->map, st->arena, addr);
+        if (!ci)
+            return false;
+        ci->size = ret;
+        ci->flags = leader ? INSTR_LEADER : 0;
+        leader = false;
+
+        FdCfKind kind = fd_cf_kind(&instr);
+        switch (kind) {
+        case FD_CF_JMP:
+        case FD_CF_JCC:
+        case FD_CF_LOOP:
+            if (!push(st->arena, &st->work, &st->nwork, &st->workcap,
+                      fd_branch_target(&instr, addr)))
+                return false;
+            ci->flags |= INSTR_END;
+            if (kind == FD_CF_JMP)
+                return true;
+            // The next instruction starts a block.
+            leader = true;
+            break;
+        case FD_CF_CALL:
+            ci->flags |= INSTR_CALL;
+            break;
+        case FD_CF_JMP_IND:
+        case FD_CF_RET:
+        case FD_CF_FAR:
+        case FD_CF_TRAP:
+            ci->flags |= INSTR_END;
+            return true;
+        default:
+            if (FD_TYPE(&instr) == FDI_HLT) {
+                ci->flags |= INSTR_END;
+                return true;
+            }
+            break;
+        }
+        addr += ret;
+    }
+    return true;
+}
+
+static bool
+instr_less(const struct CfgInstr* a, const struct CfgInstr* b) {
+    return a->addr < b->addr;
+}
+
+static void
+instr_sift_down(struct CfgInstr* instrs, size_t root, size_t count) {
+    struct CfgInstr tmp = instrs[root];
+    for (size_t child; (child = 2 * root + 1) < count; root = child) {
+        if (child + 1 < count && instr_less(&instrs[child], &instrs[child + 1]))
+            child++;
+        if (!instr_less(&tmp, &instrs[child]))
+            break;
+        instrs[root] = instrs[child];
+    }
+    instrs[root] = tmp;
+}
+
+static void
+instr_sort(struct CfgInstr* instrs, size_t count) {
+    for (size_t i = count / 2; i-- > 0; )
+        instr_sift_down(instrs, i, count);
+    for (size_t i = count; i-- > 1; ) {
+        struct CfgInstr tmp = instrs[0];
+        instrs[0] = instrs[i];
+        instrs[i] = tmp;
+        instr_sift_down(instrs, 0, i);
+    }
+}
+
+// Find the block starting at addr.
+static uint32_t
+cfg_block_at(const FdCfg* cfg, uint64_t addr) {
+    size_t lo = 0, hi = cfg->nblocks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cfg->blocks[mid].start < addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < cfg->nblocks && cfg->blocks[lo].start == addr)
+        return lo;
+    return FD_CFG_NO_BLOCK;
+}
+
+static void
+cfg_add_edge(FdCfg* cfg, uint32_t src, uint64_t target, unsigned kind) {
+    cfg->edges[cfg->nedges++] = (FdCfgEdge) {
+        .target = target, .src = src, .dst = cfg_block_at(cfg, target),
+        .kind = kind,
+    };
+}
+
+// Mark the instructions which start a block; returns the number of blocks.
+static size_t
+cfg_leaders(struct CfgInstr* instrs, size_t count) {
+    size_t nblocks = 0;
+    for (size_t i = 0; i < count; i++) {
+        const struct CfgInstr* prev = i ? &instrs[i - 1] : NULL;
+        if (!prev || (instrs[i].flags & INSTR_LEADER) ||
+            (prev->flags & INSTR_END) ||
+            prev->addr + prev->size != instrs[i].addr) {
+            instrs[i].flags |= INSTR_LEADER;
+            nblocks++;
+        }
+    }
+    return nblocks;
+}
+
+// Form the blocks of the sorted instructions after cfg_leaders, storing the
+// address of the last instruction of each block in lasts.
+static void
+cfg_form(const struct CfgInstr* instrs, size_t count, FdCfgBlock* blocks,
+         uint64_t* lasts) {
+    FdCfgBlock* block = NULL;
+    for (size_t i = 0; i < count; i++) {
+        if (instrs[i].flags & INSTR_LEADER) {
+            block = block ? block + 1 : blocks;
+            *block = (FdCfgBlock) { .start = instrs[i].addr };
+        }
+        lasts[block - blocks] = instrs[i].addr;
+        block->end = instrs[i].addr + instrs[i].size;
+        block->ninstrs++;
+        if (instrs[i].flags & INSTR_ENTRY)
+            block->flags |= FD_CFG_BLOCK_ENTRY;
+    }
+}
+
+// Add the outgoing edges of a block from its last instruction at addr.
+static void
+cfg_add_succ(const struct CfgState* st, FdCfg* cfg, uint32_t b,
+             uint64_t addr) {
+    FdCfgBlock* block = &cfg->blocks[b];
+    block->succ = cfg->nedges;
+    // Decode the last instruction again for its kind and target.
+    FdInstr instr;
+    size_t off = addr - st->base;
+    fd_decode(st->buf + off, st->len - off, st->mode, 0, &instr);
+    block->kind = fd_cf_kind(&instr);
+
+    bool fall = false;
+    switch (block->kind) {
+    case FD_CF_JMP:
+        cfg_add_edge(cfg, b, fd_branch_target(&instr, addr),
+                     FD_CFG_EDGE_JUMP);
+        break;
+    case FD_CF_JCC:
+    case FD_CF_LOOP:
+        cfg_add_edge(cfg, b, fd_branch_target(&instr, addr),
+                     FD_CFG_EDGE_TAKEN);
+        fall = true;
+        break;
+    case FD_CF_JMP_IND:
+    case FD_CF_RET:
+    case FD_CF_FAR:
+    case FD_CF_TRAP:
+        break;
+    default:
+        fall = FD_TYPE(&instr) != FDI_HLT;
+        break;
+    }
+    if (fall) {
+        cfg_add_edge(cfg, b, block->end, FD_CFG_EDGE_FALL);
+        if (cfg->edges[cfg->nedges - 1].dst == FD_CFG_NO_BLOCK)
+            block->flags |= FD_CFG_BLOCK_TRUNCATED;
+    }
+    block->nsucc = cfg->nedges - block->succ;
+}
+
+// Fill the predecessors: count, prefix sums, then fill.
+static void
+cfg_link_preds(FdCfg* cfg) {
+    for (size_t b = 0; b < cfg->nblocks; b++)
+        cfg->blocks[b].npred = 0;
+    for (size_t e = 0; e < cfg->nedges; e++)
+        if (cfg->edges[e].dst != FD_CFG_NO_BLOCK)
+            cfg->blocks[cfg->edges[e].dst].npred++;
+    uint32_t sum = 0;
+    for (size_t b = 0; b < cfg->nblocks; b++) {
+        cfg->blocks[b].pred = sum;
+        sum += cfg->blocks[b].npred;
+        cfg->blocks[b].npred = 0;
+    }
+    for (size_t e = 0; e < cfg->nedges; e++) {
+        if (cfg->edges[e].dst != FD_CFG_NO_BLOCK) {
+            FdCfgBlock* dst = &cfg->blocks[cfg->edges[e].dst];
+            cfg->preds[dst->pred + dst->npred++] = cfg->edges[e].src;
+        }
+    }
+}
+
+// Form blocks from the sorted instructions and connect them.
+static bool
+cfg_blocks(struct CfgState* st, FdCfg* cfg, struct CfgInstr* instrs,
+           size_t count) {
+    size_t nblocks = cfg_leaders(instrs, count);
+    cfg->nblocks = nblocks;
+    cfg->blocks = arena_alloc(st->arena, nblocks * sizeof *cfg->blocks);
+    cfg->edges = arena_alloc(st->arena, 2 * nblocks * sizeof *cfg->edges);
+    cfg->blockcap = nblocks;
+    cfg->edgecap = 2 * nblocks;
+    // Address of the last instruction of each block.
+    uint64_t* lasts = arena_alloc(st->arena, nblocks * sizeof *lasts);
+    if (!cfg->blocks || !cfg->edges || !lasts)
+        return false;
+    cfg_form(instrs, count, cfg->blocks, lasts);
+
+    cfg->nedges = 0;
+    for (uint32_t b = 0; b < nblocks; b++)
+        cfg_add_succ(st, cfg, b, lasts[b]);
+
+    cfg->preds = arena_alloc(st->arena, cfg->edgecap * sizeof *cfg->preds);
+    if (!cfg->preds && cfg->edgecap)
+        return false;
+    cfg_link_preds(cfg);
+    return true;
+}
+
+// Store the direct calls of the sorted instructions in calls, unless it is
+// NULL; returns the number of calls.
+static size_t
+cfg_calls(const struct CfgState* st, const struct CfgInstr* instrs,
+          size_t count, FdCfgCall* calls) {
+    size_t ncalls = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!(instrs[i].flags & INSTR_CALL))
+            continue;
+        if (calls) {
+            // Decode the call again for its target.
+            FdInstr instr;
+            uint64_t addr = instrs[i].addr;
+            size_t off = addr - st->base;
+            fd_decode(st->buf + off, st->len - off, st->mode, 0, &instr);
+            calls[ncalls] = (FdCfgCall) {
+                .addr = addr, .target = fd_branch_target(&instr, addr),
+            };
+        }
+        ncalls++;
+    }
+    return ncalls;
+}
+
+int
+fd_cfg_build(FdCfg* cfg, FdArena* arena, const uint8_t* buf, size_t len,
+             uint64_t base, int mode, const uint64_t* entries,
+             size_t nentries) {
+    struct CfgState st = {
+        .arena = arena, .buf = buf, .len = len, .base = base, .mode = mode,
+    };
+    // Instructions are usually some four bytes long; size the map for that
+    // to avoid growing it, unless the region is large.
+    size_t cap = 64;
+    while (cap < len / 2 && cap < (1 << 16))
+        cap *= 2;
+    if (!map_init(&st.map, arena, cap))
+        return -1;
+
+    for (size_t i = 0; i < nentries; i++)
+        if (!push(arena, &st.work, &st.nwork, &st.workcap, entries[i]))
+            return -1;
+    while (st.nwork)
+        if (!cfg_trace(&st, st.work[--st.nwork]))
+            return -1;
+    for (size_t i = 0; i < nentries; i++) {
+        struct CfgInstr* ci = cfg_in_region(&st, entries[i])
+                            ? map_find(&st.map, entries[i]) : NULL;
+        if (ci)
+            ci->flags |= INSTR_ENTRY;
+    }
+
+    // Collect the instructions in address order.
+    size_t count = st.map.count;
+    struct CfgInstr* instrs = arena_alloc(arena, count * sizeof *instrs);
+    if (!instrs && count)
+        return -1;
+    for (size_t i = 0, j = 0; i <= st.map.mask; i++)
+        if (st.map.slots[i].addr != EMPTY)
+            instrs[j++] = st.map.slots[i];
+    instr_sort(instrs, count);
+
+    if (!cfg_blocks(&st, cfg, instrs, count))
+        return -1;
+    size_t ncalls = cfg_calls(&st, instrs, count, NULL);
+    cfg->calls = arena_alloc(arena, ncalls * sizeof *cfg->calls);
+    if (!cfg->calls && ncalls)
+        return -1;
+    cfg->ncalls = cfg_calls(&st, instrs, count, cfg->calls);
+    cfg->callcap = ncalls;
+    return 0;
+}
+
+// Number of the sorted addresses below addr.
+static size_t
+addr_lower(const uint64_t* addrs, size_t count, uint64_t addr) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (addrs[mid] < addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Block indices when patching: the previous blocks in [first, last) are
+// removed, and the new blocks and the pieces of split blocks are inserted at
+// the sorted addresses in inserts.
+struct CfgShift {
+    const FdCfgBlock* blocks;
+    size_t nblocks;
+    uint32_t first;
+    uint32_t last;
+    const uint64_t* inserts;
+    size_t ninserts;
+    const uint64_t* splits;
+    size_t nsplits;
+};
+
+// Index after the patch of the block which starts at addr.
+static uint32_t
+shift_index(const struct CfgShift* sh, uint64_t addr) {
+    size_t lo = 0, hi = sh->nblocks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (sh->blocks[mid].start < addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > sh->first)
+        lo -= (lo < sh->last ? lo : sh->last) - sh->first;
+    return lo + addr_lower(sh->inserts, sh->ninserts, addr);
+}
+
+// Index after the patch of the kept block b, or of its last piece if it is
+// split and last_piece is set. Like in cfg_join, a split belongs to the kept
+// block with the last start before it.
+static uint32_t
+shift_kept(const struct CfgShift* sh, uint32_t b, bool last_piece) {
+    const FdCfgBlock* block = &sh->blocks[b];
+    if (last_piece) {
+        uint32_t next = b + 1 == sh->first ? sh->last : b + 1;
+        uint64_t bound = block->end;
+        if (next < sh->nblocks && sh->blocks[next].start < bound)
+            bound = sh->blocks[next].start;
+        size_t k = addr_lower(sh->splits, sh->nsplits, bound);
+        if (k && sh->splits[k - 1] > block->start)
+            return shift_index(sh, sh->splits[k - 1]);
+    }
+    uint32_t kept = b < sh->first ? b : b - (sh->last - sh->first);
+    return kept + addr_lower(sh->inserts, sh->ninserts, block->start);
+}
+
+// Whether addr starts an instruction of a kept block when patching, which
+// only happens next to the replaced blocks if code overlaps.
+static bool
+cfg_kept_at(const struct CfgState* st, uint64_t addr) {
+    const FdCfgBlock* blocks = st->old->blocks;
+    uint32_t ninstrs;
+    for (uint32_t b = st->old_last; b < st->old->nblocks; b++) {
+        if (blocks[b].start > addr)
+            break;
+        if (blocks[b].end > addr &&
+            cfg_boundary(st, blocks[b].start, addr, &ninstrs))
+            return true;
+    }
+    if (!st->old_first)
+        return false;
+    const FdCfgBlock* block = &blocks[st->old_first - 1];
+    return block->end > addr && cfg_boundary(st, block->start, addr, &ninstrs);
+}
+
+// Grow an array of the graph from cap to new_cap elements of size bytes, if
+// it is smaller; NULL if the arena is exhausted.
+static void*
+cfg_grow(FdArena* arena, void* arr, size_t cap, size_t new_cap, size_t size) {
+    if (new_cap <= cap)
+        return arr;
+    return arena_grow(arena, arr, cap * size, new_cap * size);
+}
+
+// Capacity for count elements, doubled to amortize the copies.
+static size_t
+cfg_cap(size_t cap, size_t count) {
+    if (count <= cap)
+        return cap;
+    return 2 * cap > count ? 2 * cap : count;
+}
+
+static int
+cfg_patch(FdCfg* cfg, FdArena* arena, const uint8_t* buf, size_t len,
+          uint64_t base, int mode, uint64_t lo, uint64_t hi) {
+    // The replaced blocks are those overlapping [lo, hi): blocks are sorted
+    // by start and, unless code overlaps, disjoint.
+    uint32_t last = 0, first;
+    for (uint32_t count = cfg->nblocks; count; ) {
+        uint32_t half = count / 2;
+        if (cfg->blocks[last + half].start < hi) {
+            last += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    for (first = last; first && cfg->blocks[first - 1].end > lo; first--) {}
+    if (first == last)
+        return 0;
+
+    struct CfgState st = {
+        .arena = arena, .buf = buf, .len = len, .base = base, .mode = mode,
+        .old = cfg, .old_first = first, .old_last = last,
+    };
+    if (!map_init(&st.map, arena, 64))
+        return -1;
+    for (uint32_t b = first; b < last; b++)
+        if (!push(arena, &st.work, &st.nwork, &st.workcap,
+                  cfg->blocks[b].start))
+            return -1;
+    while (st.nwork)
+        if (!cfg_trace(&st, st.work[--st.nwork]))
+            return -1;
+    for (uint32_t b = first; b < last; b++) {
+        struct CfgInstr* ci = map_find(&st.map, cfg->blocks[b].start);
+        if (ci && (cfg->blocks[b].flags & FD_CFG_BLOCK_ENTRY))
+            ci->flags |= INSTR_ENTRY;
+    }
+
+    size_t count = st.map.count;
+    struct CfgInstr* instrs = arena_alloc(arena, count * sizeof *instrs);
+    if (!instrs && count)
+        return -1;
+    for (size_t i = 0, j = 0; i <= st.map.mask; i++)
+        if (st.map.slots[i].addr != EMPTY)
+            instrs[j++] = st.map.slots[i];
+    instr_sort(instrs, count);
+    size_t nnew = cfg_leaders(instrs, count);
+    FdCfgBlock* news = arena_alloc(arena, nnew * sizeof *news);
+    uint64_t* lasts = arena_alloc(arena, nnew * sizeof *lasts);
+    uint32_t* newidx = arena_alloc(arena, nnew * sizeof *newidx);
+    if (nnew && (!news || !lasts || !newidx))
+        return -1;
+    cfg_form(instrs, count, news, lasts);
+    size_t nnewcalls = cfg_calls(&st, instrs, count, NULL);
+    FdCfgCall* newcalls = arena_alloc(arena, nnewcalls * sizeof *newcalls);
+    if (!newcalls && nnewcalls)
+        return -1;
+    cfg_calls(&st, instrs, count, newcalls);
+
+    // Splits are few, from jumps of the new code into kept blocks; a block
+    // may be entered at the same instruction more than once.
+    uint64_t* splits = st.splits;
+    for (size_t i = 1; i < st.nsplits; i++) {
+        uint64_t tmp = splits[i];
+        size_t j = i;
+        for (; j && splits[j - 1] > tmp; j--)
+            splits[j] = splits[j - 1];
+        splits[j] = tmp;
+    }
+    size_t nsplits = 0;
+    for (size_t i = 0; i < st.nsplits; i++)
+        if (!nsplits || splits[nsplits - 1] != splits[i])
+            splits[nsplits++] = splits[i];
+    uint32_t* pieces = arena_alloc(arena, nsplits * sizeof *pieces);
+    uint64_t* inserts = arena_alloc(arena, (nnew + nsplits) * sizeof *inserts);
+    if (nsplits && !pieces)
+        return -1;
+    if (nnew + nsplits && !inserts)
+        return -1;
+    for (size_t i = 0, n = 0, k = 0; i < nnew + nsplits; i++) {
+        if (k == nsplits || (n < nnew && news[n].start < splits[k]))
+            inserts[i] = news[n++].start;
+        else
+            inserts[i] = splits[k++];
+    }
+
+    // Grow the arrays before changing anything, so that the graph stays
+    // unchanged if the arena is exhausted.
+    size_t nkept = cfg->nblocks - (last - first);
+    size_t nblocks = nkept + nnew + nsplits;
+    size_t maxedges = cfg->nedges + nsplits + 2 * nnew;
+    for (uint32_t b = first; b < last; b++)
+        maxedges -= cfg->blocks[b].nsucc;
+    size_t blockcap = cfg_cap(cfg->blockcap, nblocks);
+    size_t edgecap = cfg_cap(cfg->edgecap, maxedges);
+    size_t callcap = cfg_cap(cfg->callcap, cfg->ncalls + nnewcalls);
+    FdCfgBlock* blocks = cfg_grow(arena, cfg->blocks, cfg->blockcap, blockcap,
+                                  sizeof *blocks);
+    FdCfgEdge* edges = cfg_grow(arena, cfg->edges, cfg->edgecap, edgecap,
+                                sizeof *edges);
+    uint32_t* preds = cfg_grow(arena, cfg->preds, cfg->edgecap, edgecap,
+                               sizeof *preds);
+    FdCfgCall* calls = cfg_grow(arena, cfg->calls, cfg->callcap, callcap,
+                                sizeof *calls);
+    if ((!blocks && blockcap) || (!edges && edgecap) || (!preds && edgecap))
+        return -1;
+    if (!calls && callcap)
+        return -1;
+    cfg->blocks = blocks;
+    cfg->blockcap = blockcap;
+    cfg->edges = edges;
+    cfg->preds = preds;
+    cfg->edgecap = edgecap;
+    cfg->calls = calls;
+    cfg->callcap = callcap;
+
+    // Drop the calls of the replaced blocks and merge those of the new code.
+    size_t i = 0, ncalls;
+    for (size_t n = cfg->ncalls; n; ) {
+        size_t half = n / 2;
+        if (calls[i + half].addr < blocks[first].start) {
+            i += half + 1;
+            n -= half + 1;
+        } else {
+            n = half;
+        }
+    }
+    ncalls = i;
+    for (uint32_t b = first; i < cfg->ncalls; i++) {
+        while (b < last && blocks[b].end <= calls[i].addr)
+            b++;
+        if (b < last && blocks[b].start <= calls[i].addr &&
+            !cfg_kept_at(&st, calls[i].addr))
+            continue;
+        calls[ncalls++] = calls[i];
+    }
+    size_t r = ncalls, w = ncalls + nnewcalls;
+    for (size_t n = nnewcalls; n; ) {
+        if (r && calls[r - 1].addr > newcalls[n - 1].addr) {
+            calls[--w] = calls[--r];
+            continue;
+        }
+        // Overlapping code may decode a kept call again.
+        if (r && calls[r - 1].addr == newcalls[n - 1].addr)
+            r--;
+        calls[--w] = newcalls[--n];
+    }
+    cfg->ncalls = ncalls + nnewcalls - (w - r);
+    for (size_t j = r; w > r && j < cfg->ncalls; j++)
+        calls[j] = calls[j + (w - r)];
+
+    // Drop the edges of the replaced blocks and shift the indices of the
+    // others; only edges into replaced blocks or outside of any block are
+    // resolved again.
+    const struct CfgShift sh = {
+        .blocks = blocks, .nblocks = cfg->nblocks, .first = first,
+        .last = last, .inserts = inserts, .ninserts = nnew + nsplits,
+        .splits = splits, .nsplits = nsplits,
+    };
+    size_t nedges = 0;
+    uint32_t prev = FD_CFG_NO_BLOCK;
+    for (size_t e = 0; e < cfg->nedges; e++) {
+        FdCfgEdge edge = edges[e];
+        if (edge.src >= first && edge.src < last)
+            continue;
+        FdCfgBlock* src = &blocks[edge.src];
+        if (edge.src != prev) {
+            src->succ = nedges;
+            prev = edge.src;
+        }
+        if (edge.dst != FD_CFG_NO_BLOCK &&
+            (edge.dst < first || edge.dst >= last)) {
+            edge.dst = shift_kept(&sh, edge.dst, false);
+        } else if (cfg_in_region(&st, edge.target)) {
+            size_t j = addr_lower(inserts, nnew + nsplits, edge.target);
+            if (j < nnew + nsplits && inserts[j] == edge.target)
+                edge.dst = shift_index(&sh, edge.target);
+            else
+                edge.dst = FD_CFG_NO_BLOCK;
+            if (edge.kind == FD_CFG_EDGE_FALL && edge.dst == FD_CFG_NO_BLOCK)
+                src->flags |= FD_CFG_BLOCK_TRUNCATED;
+            else if (edge.kind == FD_CFG_EDGE_FALL)
+                src->flags &= ~FD_CFG_BLOCK_TRUNCATED;
+        }
+        edge.src = shift_kept(&sh, edge.src, true);
+        edges[nedges++] = edge;
+    }
+    cfg->nedges = nedges;
+
+    // Remove the replaced blocks, then insert the new blocks and the pieces
+    // from the back, until the blocks before the first insertion are reached.
+    for (size_t b = first; b < nkept; b++)
+        blocks[b] = blocks[b + (last - first)];
+    size_t n = nnew, k = nsplits, npieces = 0;
+    r = nkept;
+    w = nblocks;
+    FdCfgBlock cur = {0};
+    bool have = false, piece = false;
+    while (n || k || have) {
+        if (!have && r) {
+            cur = blocks[--r];
+            have = true;
+            piece = false;
+        }
+        bool split = have && k && splits[k - 1] > cur.start;
+        uint64_t start = split ? splits[k - 1] : cur.start;
+        w--;
+        if (n && (!have || news[n - 1].start > start)) {
+            blocks[w] = news[--n];
+            newidx[n] = w;
+        } else if (split) {
+            // The part of the block after its last split; the part before
+            // is a piece which falls through.
+            uint32_t ninstrs;
+            cfg_boundary(&st, cur.start, splits[--k], &ninstrs);
+            blocks[w] = cur;
+            blocks[w].start = splits[k];
+            blocks[w].ninstrs -= ninstrs;
+            blocks[w].flags &= ~FD_CFG_BLOCK_ENTRY;
+            if (piece)
+                pieces[npieces++] = w;
+            cur = (FdCfgBlock) {
+                .start = cur.start, .end = splits[k], .ninstrs = ninstrs,
+                .kind = FD_CF_NONE, .flags = cur.flags & FD_CFG_BLOCK_ENTRY,
+            };
+            piece = true;
+        } else {
+            blocks[w] = cur;
+            have = false;
+            if (piece)
+                pieces[npieces++] = w;
+        }
+    }
+    cfg->nblocks = nblocks;
+
+    // Only the new blocks and the pieces need new edges.
+    for (size_t p = 0; p < npieces; p++) {
+        FdCfgBlock* block = &blocks[pieces[p]];
+        block->succ = cfg->nedges;
+        cfg_add_edge(cfg, pieces[p], block->end, FD_CFG_EDGE_FALL);
+        block->nsucc = 1;
+    }
+    for (size_t b = 0; b < nnew; b++)
+        cfg_add_succ(&st, cfg, newidx[b], lasts[b]);
+    cfg_link_preds(cfg);
+    return 0;
+}
+
+int
+fd_cfg_patch(FdCfg* cfg, FdArena* arena, const uint8_t* buf, size_t len,
+             uint64_t base, int mode, uint64_t lo, uint64_t hi) {
+    // The temporary data is freed again, unless an array of the graph had to
+    // grow after it.
+    const FdCfg prev = *cfg;
+    size_t used = arena->used;
+    int ret = cfg_patch(cfg, arena, buf, len, base, mode, lo, hi);
+    if (ret || (cfg->blocks == prev.blocks && cfg->edges == prev.edges &&
+                cfg->preds == prev.preds && cfg->calls == prev.calls))
+        arena->used = used;
+    return ret;
+}
@@ -0,0 +1,184 @@
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fadec.h>
+#include <fadec-columns.h>
+
+
+#define ALIGN8(x) (((x) + 7) & ~(size_t) 7)
+
+// Instructions decoded at once by fd_columns_decode.
+#define BATCH 64
+
+#define DESC(name, kind, width) { name, kind, width, {0} }
+
+// In the order of FdColumns.
+static const FdColumnDesc columns[FD_COLUMNS] = {
+    DESC("addr", 'u', 8), DESC("size", 'u', 1), DESC("type", 'u', 2),
+    DESC("flags", 'u', 1), DESC("segment", 'u', 1),
+    DESC("op0_kind", 'u', 1), DESC("op1_kind", 'u', 1),
+    DESC("op2_kind", 'u', 1), DESC("op3_kind", 'u', 1),
+    DESC("op0_size", 'u', 1), DESC("op1_size", 'u', 1),
+    DESC("op2_size", 'u', 1), DESC("op3_size", 'u', 1),
+    DESC("op0_reg", 'u', 1), DESC("op1_reg", 'u', 1),
+    DESC("op2_reg", 'u', 1), DESC("op3_reg", 'u', 1),
+    DESC("op0_misc", 'u', 1), DESC("op1_misc", 'u', 1),
+    DESC("op2_misc", 'u', 1), DESC("op3_misc", 'u', 1),
+    DESC("disp", 'i', 8), DESC("imm", 'i', 8), DESC("target", 'u', 8),
+};
+
+// Place the next column at *pos; buf may be NULL to only compute the size.
+// The padding is cleared, so that written buffers are deterministic.
+static void*
+column(uint8_t* buf, size_t* pos, size_t nrows, unsigned idx) {
+    void* col = buf ? buf + *pos : NULL;
+    size_t size = nrows * columns[idx].width;
+    if (buf)
+        for (size_t i = size; i < ALIGN8(size); i++)
+            buf[*pos + i] = 0;
+    *pos += ALIGN8(size);
+    return col;
+}
+
+size_t
+fd_columns_layout(FdColumns* cols, void* buf, size_t nrows,
+                  FdColumnDesc* desc) {
+    FdColumns tmp;
+    if (!cols)
+        cols = &tmp;
+    size_t pos = 0;
+    unsigned idx = 0;
+    cols->addr = column(buf, &pos, nrows, idx++);
+    cols->size = column(buf, &pos, nrows, idx++);
+    cols->type = column(buf, &pos, nrows, idx++);
+    cols->flags = column(buf, &pos, nrows, idx++);
+    cols->segment = column(buf, &pos, nrows, idx++);
+    for (unsigned i = 0; i < 4; i++)
+        cols->op_kind[i] = column(buf, &pos, nrows, idx++);
+    for (unsigned i = 0; i < 4; i++)
+        cols->op_size[i] = column(buf, &pos, nrows, idx++);
+    for (unsigned i = 0; i < 4; i++)
+        cols->op_reg[i] = column(buf, &pos, nrows, idx++);
+    for (unsigned i = 0; i < 4; i++)
+        cols->op_misc[i] = column(buf, &pos, nrows, idx++);
+    cols->disp = column(buf, &pos, nrows, idx++);
+    cols->imm = column(buf, &pos, nrows, idx++);
+    cols->target = column(buf, &pos, nrows, idx++);
+    if (desc)
+        for (unsigned i = 0; i < FD_COLUMNS; i++)
+            desc[i] = columns[i];
+    return pos;
+}
+
+uint64_t
+fd_columns_fill(const FdColumns* cols, size_t row, const FdInstr* instrs,
+                size_t count, uint64_t addr) {
+    for (size_t i = 0; i < count; i++, row++) {
+        const FdInstr* instr = &instrs[i];
+        unsigned size = FD_SIZE(instr);
+        unsigned flags = (FD_HAS_LOCK(instr) ? FD_COL_LOCK : 0) |
+                         (FD_HAS_REP(instr) ? FD_COL_REP : 0) |
+                         (FD_HAS_REPNZ(instr) ? FD_COL_REPNZ : 0);
+        int64_t disp = 0, imm = 0;
+        uint64_t target = 0;
+        for (unsigned j = 0; j < 4; j++) {
+            FdOpType kind = FD_OP_TYPE(instr, j);
+            unsigned reg = 0, misc = 0;
+            switch (kind) {
+            case FD_OT_REG:
+                reg = FD_OP_REG(instr, j);
+                misc = FD_OP_REG_TYPE(instr, j);
+                break;
+            case FD_OT_MEM:
+            case FD_OT_MEMBCST:
+                reg = FD_OP_BASE(instr, j);
+                misc = FD_OP_INDEX(instr, j) | FD_OP_SCALE(instr, j) << 6;
+                disp = FD_OP_DISP(instr, j);
+                if (reg == FD_REG_IP) {
+                    target = addr + size + disp;
+                    flags |= FD_COL_TARGET;
+                }
+                break;
+            case FD_OT_IMM:
+                imm = FD_OP_IMM(instr, j);
+                break;
+            case FD_OT_OFF:
+                target = fd_branch_target(instr, addr);
+                flags |= FD_COL_TARGET;
+                break;
+            case FD_OT_NONE:
+            default:
+                break;
+            }
+            cols->op_kind[j][row] = kind;
+            cols->op_size[j][row] = kind != FD_OT_NONE ? FD_OP_SIZE(instr, j)
+                                                       : 0;
+            cols->op_reg[j][row] = reg;
+            cols->op_misc[j][row] = misc;
+        }
+        cols->addr[row] = addr;
+        cols->size[row] = size;
+        cols->type[row] = FD_TYPE(instr);
+        cols->flags[row] = flags;
+        cols->segment[row] = FD_SEGMENT(instr);
+        cols->disp[row] = disp;
+        cols->imm[row] = imm;
+        cols->target[row] = target;
+        addr += size;
+    }
+    return addr;
+}
+
+// An undecodable byte is a row of size zero, like in an FdIndexRecord.
+static void
+fill_bad(const FdColumns* cols, size_t row, uint64_t addr) {
+    cols->addr[row] = addr;
+    cols->size[row] = 0;
+    cols->type[row] = 0;
+    cols->flags[row] = 0;
+    cols->segment[row] = FD_REG_NONE;
+    for (unsigned j = 0; j < 4; j++) {
+        cols->op_kind[j][row] = FD_OT_NONE;
+        cols->op_size[j][row] = 0;
+        cols->op_reg[j][row] = 0;
+        cols->op_misc[j][row] = 0;
+    }
+    cols->disp[row] = 0;
+    cols->imm[row] = 0;
+    cols->target[row] = 0;
+}
+
+size_t
+fd_columns_decode(const FdColumns* cols, size_t row, size_t cap,
+                  const uint8_t* buf, size_t len, uint64_t base, int mode,
+                  size_t start, size_t end) {
+    FdInstr instrs[BATCH];
+    size_t total = 0;
+    size_t off = start;
+    while (off < end && off < len) {
+        size_t batch_start = off;
+        size_t n = 0;
+        int ret = 0;
+        while (n < BATCH && off < end && off < len) {
+            ret = fd_decode(buf + off, len - off, mode, 0, &instrs[n]);
+            if (ret < 0)
+                break;
+            off += ret;
+            n++;
+        }
+        // Rows beyond cap are only counted.
+        size_t fit = total < cap ? cap - total : 0;
+        fd_columns_fill(cols, row + total, instrs, n < fit ? n : fit,
+                        base + batch_start);
+        total += n;
+        if (ret < 0) {
+            if (total < cap)
+                fill_bad(cols, row + total, base + off);
+            total++;
+            off++;
+        }
+    }
+    return total;
+}
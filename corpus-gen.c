@@ -0,0 +1,734 @@
+
+#define _POSIX_C_SOURCE 200809L
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fadec.h>
+#include <fadec-enc.h>
+
+
+// Operand kinds, see corpus_table in parseinstrs.py.
+enum {
+    CK_GP, CK_GP8H, CK_XMM, CK_MMX, CK_FPU, CK_MASK, CK_SEG, CK_CR, CK_DR,
+    CK_BND, CK_TMM, CK_MEM, CK_MOFFS, CK_IMM, CK_OFF,
+};
+
+enum {
+    CORPUS_PREFIXED = 1 << 0,
+    CORPUS_VSIB = 1 << 1,
+    CORPUS_MASK = 1 << 2,
+    CORPUS_BCST = 1 << 3,
+    CORPUS_SAE = 1 << 4,
+    CORPUS_ER = 1 << 5,
+};
+
+enum {
+#define CORPUS_FAMILY(name) FAM_ ## name,
+#include <fadec-corpus-public.inc>
+#undef CORPUS_FAMILY
+    FAM_COUNT
+};
+
+static const char* const family_names[] = {
+#define CORPUS_FAMILY(name) #name,
+#include <fadec-corpus-public.inc>
+#undef CORPUS_FAMILY
+};
+
+enum { ENC_LEGACY, ENC_VEX, ENC_EVEX, ENC_COUNT };
+static const char* const enc_names[] = { "legacy", "vex", "evex" };
+
+enum {
+    ADDR_BASE, ADDR_DISP8, ADDR_DISP32, ADDR_SIB, ADDR_RIP, ADDR_ABS, ADDR_COUNT
+};
+static const char* const addr_names[] = {
+    "base", "disp8", "disp32", "sib", "rip", "abs"
+};
+
+struct CorpusRow {
+    uint64_t mnem;
+    struct {
+        uint8_t pp, mmm, w, l, opc;
+        int8_t modreg;
+        char mod;
+    } evex;
+    uint8_t enc;
+    uint8_t family;
+    uint8_t flags;
+    uint8_t nops;
+    struct {
+        char ot;
+        uint8_t kind;
+        uint8_t size;
+        int8_t fixed;
+        uint8_t slot;
+    } ops[4];
+};
+
+static const struct CorpusRow rows[] = {
+#include <fadec-corpus-private.inc>
+};
+#define NROWS (sizeof rows / sizeof rows[0])
+
+struct Config {
+    double enc_weights[ENC_COUNT];
+    double family_weights[FAM_COUNT];
+    double addr_weights[ADDR_COUNT];
+    double prefix_density;
+    double mem_ratio;
+    double imm8_ratio;
+    uint64_t seed;
+    size_t size;
+    uint64_t base;
+};
+
+// Rows are bucketed by encoding, family, memory operand and prefixes, so that
+// each of these dimensions can be weighted independently.
+#define NBUCKETS (ENC_COUNT * FAM_COUNT * 2 * 2)
+
+struct Gen {
+    const struct Config* cfg;
+    uint64_t rng;
+    unsigned* bucket_rows[NBUCKETS];
+    unsigned bucket_len[NBUCKETS];
+    unsigned bucket_live[NBUCKETS];
+    bool row_dead[NROWS];
+    uint64_t enc_count[ENC_COUNT];
+    uint64_t family_count[FAM_COUNT];
+    uint64_t rejected;
+};
+
+static uint64_t
+rnd(struct Gen* g) {
+    // xorshift64*
+    g->rng ^= g->rng >> 12;
+    g->rng ^= g->rng << 25;
+    g->rng ^= g->rng >> 27;
+    return g->rng * 0x2545f4914f6cdd1d;
+}
+
+static unsigned
+rnd_n(struct Gen* g, unsigned n) {
+    return (rnd(g) >> 32) % n;
+}
+
+static double
+rnd_f(struct Gen* g) {
+    return (rnd(g) >> 11) * 0x1.0p-53;
+}
+
+static unsigned
+rnd_weighted(struct Gen* g, const double* weights, unsigned n) {
+    double sum = 0;
+    for (unsigned i = 0; i < n; i++)
+        sum += weights[i];
+    double r = rnd_f(g) * sum;
+    for (unsigned i = 0; i < n; i++) {
+        if (r < weights[i])
+            return i;
+        r -= weights[i];
+    }
+    return n - 1;
+}
+
+static bool
+row_has_mem(const struct CorpusRow* row) {
+    for (unsigned i = 0; i < row->nops; i++)
+        if (row->ops[i].kind == CK_MEM || row->ops[i].ot == 'M')
+            return true;
+    return false;
+}
+
+static unsigned
+row_bucket(const struct CorpusRow* row) {
+    return ((row->enc * FAM_COUNT + row->family) * 2 + row_has_mem(row)) * 2 +
+           !!(row->flags & CORPUS_PREFIXED);
+}
+
+static void
+gen_update_buckets(struct Gen* g) {
+    for (unsigned b = 0; b < NBUCKETS; b++) {
+        g->bucket_live[b] = 0;
+        for (unsigned i = 0; i < g->bucket_len[b]; i++)
+            g->bucket_live[b] += !g->row_dead[g->bucket_rows[b][i]];
+    }
+}
+
+// Pick a weighted index among the buckets base + i * stride that still have
+// rows with a non-zero weight in the remaining dimensions.
+static int
+gen_pick_dim(struct Gen* g, const double* weights, unsigned n, unsigned base,
+             unsigned stride, unsigned span) {
+    double avail[FAM_COUNT];
+    bool any = false;
+    for (unsigned i = 0; i < n; i++) {
+        unsigned live = 0;
+        for (unsigned j = 0; j < span; j++)
+            live += g->bucket_live[base + i * stride + j];
+        avail[i] = live ? weights[i] : 0;
+        any |= avail[i] > 0;
+    }
+    return any ? (int) rnd_weighted(g, avail, n) : -1;
+}
+
+static const struct CorpusRow*
+gen_pick_row(struct Gen* g) {
+    const struct Config* cfg = g->cfg;
+    const unsigned fam_span = 4, enc_span = FAM_COUNT * fam_span;
+    double mem_weights[2] = { 1 - cfg->mem_ratio, cfg->mem_ratio };
+    double pfx_weights[2] = { 1 - cfg->prefix_density, cfg->prefix_density };
+
+    // Select encoding, family, memory and prefix class in turn, so that each
+    // ratio applies independently of how many forms a class contains.
+    double enc_weights[ENC_COUNT];
+    for (unsigned e = 0; e < ENC_COUNT; e++) {
+        enc_weights[e] = 0;
+        for (unsigned f = 0; f < FAM_COUNT; f++)
+            for (unsigned j = 0; j < fam_span; j++)
+                if (cfg->family_weights[f] > 0 &&
+                    g->bucket_live[e * enc_span + f * fam_span + j])
+                    enc_weights[e] = cfg->enc_weights[e];
+    }
+    int enc = gen_pick_dim(g, enc_weights, ENC_COUNT, 0, enc_span, enc_span);
+    if (enc < 0)
+        return NULL;
+    unsigned base = enc * enc_span;
+    int fam = gen_pick_dim(g, cfg->family_weights, FAM_COUNT, base, fam_span, fam_span);
+    if (fam < 0)
+        return NULL;
+    base += fam * fam_span;
+    int mem = gen_pick_dim(g, mem_weights, 2, base, 2, 2);
+    if (mem < 0)
+        mem = g->bucket_live[base + 2] || g->bucket_live[base + 3];
+    base += mem * 2;
+    int pfx = gen_pick_dim(g, pfx_weights, 2, base, 1, 1);
+    if (pfx < 0)
+        pfx = g->bucket_live[base + 1] > 0;
+    unsigned b = base + pfx;
+
+    for (;;) {
+        unsigned idx = g->bucket_rows[b][rnd_n(g, g->bucket_len[b])];
+        if (!g->row_dead[idx])
+            return &rows[idx];
+    }
+}
+
+static int32_t
+gen_disp(struct Gen* g, unsigned form) {
+    if (form == ADDR_DISP8) {
+        int8_t disp = (int8_t) rnd(g);
+        return disp ? disp : 8;
+    }
+    int32_t disp = (int32_t) rnd(g);
+    if (disp >= -128 && disp < 128)
+        disp += 0x1000;
+    return disp;
+}
+
+struct MemOp {
+    unsigned form;
+    unsigned base; // 0-15
+    unsigned index; // 0-31, or 4 for none (non-VSIB)
+    unsigned scale;
+    int32_t disp;
+};
+
+static struct MemOp
+gen_memop(struct Gen* g, bool vsib) {
+    struct MemOp m;
+    m.form = rnd_weighted(g, g->cfg->addr_weights, ADDR_COUNT);
+    if (vsib && m.form != ADDR_SIB && m.form != ADDR_ABS)
+        m.form = ADDR_SIB;
+    m.base = rnd_n(g, 16);
+    m.index = 4;
+    m.scale = 0;
+    m.disp = 0;
+    switch (m.form) {
+    default:
+    case ADDR_BASE: break;
+    case ADDR_DISP8: m.disp = gen_disp(g, ADDR_DISP8); break;
+    case ADDR_DISP32: m.disp = gen_disp(g, ADDR_DISP32); break;
+    case ADDR_SIB:
+    case ADDR_ABS:
+        if (m.form == ADDR_SIB || vsib) {
+            do
+                m.index = rnd_n(g, vsib ? 32 : 16);
+            while (!vsib && m.index == 4);
+            m.scale = rnd_n(g, 4);
+        }
+        m.disp = m.form == ADDR_ABS ? gen_disp(g, ADDR_DISP32) :
+                 gen_disp(g, rnd_n(g, 2) ? ADDR_DISP8 : ADDR_DISP32);
+        if (m.form == ADDR_SIB && rnd_n(g, 3) == 0)
+            m.disp = 0;
+        break;
+    case ADDR_RIP: m.disp = gen_disp(g, ADDR_DISP32); break;
+    }
+    return m;
+}
+
+static FeOp
+gen_fe_mem(struct Gen* g, bool vsib) {
+    struct MemOp m = gen_memop(g, vsib);
+    FeOp idx = FE_NOREG;
+    if (m.index != 4 || vsib)
+        idx = vsib ? FE_XMM0 + (m.index & 15) : FE_AX + m.index;
+    unsigned scale = idx ? 1 << m.scale : 0;
+    switch (m.form) {
+    case ADDR_RIP: return FE_MEM(FE_IP, 0, FE_NOREG, m.disp);
+    case ADDR_ABS: return FE_MEM(FE_NOREG, scale, idx, m.disp);
+    default: return FE_MEM(FE_AX + m.base, scale, idx, m.disp);
+    }
+}
+
+static int64_t
+gen_imm(struct Gen* g, unsigned size) {
+    if (size == 0)
+        return 1; // constant 1, e.g. for shifts
+    if (size == 1 || rnd_f(g) < g->cfg->imm8_ratio)
+        return (int8_t) rnd(g);
+    if (size == 2)
+        return (int16_t) rnd(g);
+    if (size == 3)
+        return rnd(g) & 0xffffff;
+    return (int32_t) rnd(g);
+}
+
+static FeOp
+gen_fe_reg(struct Gen* g, unsigned kind) {
+    static const uint8_t crs[] = {0, 2, 3, 4, 8};
+    switch (kind) {
+    default:
+    case CK_GP: return FE_AX + rnd_n(g, 16);
+    case CK_GP8H: return rnd_n(g, 4) ? FE_AX + rnd_n(g, 16) : FE_AH + rnd_n(g, 4);
+    case CK_XMM: return FE_XMM0 + rnd_n(g, 16);
+    case CK_MMX: return FE_MM0 + rnd_n(g, 8);
+    case CK_FPU: return FE_ST0 + rnd_n(g, 8);
+    case CK_MASK: return FE_K0 + rnd_n(g, 8);
+    case CK_SEG: return FE_ES + rnd_n(g, 6);
+    // The encoder only uses the register index for these.
+    case CK_CR: return 0x900 + crs[rnd_n(g, sizeof crs)];
+    case CK_DR: return 0xa00 + rnd_n(g, 8);
+    }
+}
+
+static FeOp
+gen_fe_fixed(unsigned kind, unsigned idx) {
+    switch (kind) {
+    default: return FE_AX + idx;
+    case CK_XMM: return FE_XMM0 + idx;
+    case CK_FPU: return FE_ST0 + idx;
+    }
+}
+
+// Legacy and VEX instructions go through the encoder.
+static unsigned
+gen_encoder(struct Gen* g, const struct CorpusRow* row, uint8_t* buf) {
+    FeOp ops[4] = {0};
+    uint64_t mnem = row->mnem;
+    bool has_mem = false;
+    for (unsigned i = 0; i < row->nops; i++) {
+        unsigned kind = row->ops[i].kind;
+        switch (kind) {
+        case CK_MEM:
+            ops[i] = gen_fe_mem(g, row->flags & CORPUS_VSIB);
+            has_mem = true;
+            break;
+        case CK_MOFFS: ops[i] = (int32_t) rnd(g); break;
+        case CK_IMM: ops[i] = gen_imm(g, row->ops[i].size); break;
+        case CK_OFF: {
+            int64_t delta = row->ops[i].size == 1 || rnd_n(g, 2) ?
+                            (int8_t) rnd(g) : (int32_t) (rnd(g) >> 40);
+            ops[i] = (intptr_t) buf + delta;
+            break;
+        }
+        default:
+            if (row->ops[i].fixed >= 0)
+                ops[i] = gen_fe_fixed(kind, row->ops[i].fixed);
+            else
+                ops[i] = gen_fe_reg(g, kind);
+            break;
+        }
+    }
+    if (has_mem && rnd_f(g) < g->cfg->prefix_density)
+        mnem |= FE_SEG(rnd_n(g, 2) ? FE_FS : FE_GS);
+    if (has_mem && rnd_f(g) < g->cfg->prefix_density / 4)
+        mnem |= FE_ADDR32;
+
+    uint8_t* cur = buf;
+    if (fe_enc64(&cur, mnem, ops[0], ops[1], ops[2], ops[3]))
+        return 0;
+    return cur - buf;
+}
+
+// EVEX instructions are not supported by the encoder, assemble them here.
+static unsigned
+gen_evex(struct Gen* g, const struct CorpusRow* row, uint8_t* buf) {
+    const struct Config* cfg = g->cfg;
+    unsigned reg = row->evex.modreg >= 0 ? row->evex.modreg : 0;
+    unsigned vvvv = 0, rm = 0, aaa = 0, z = 0, bcst = 0, imm = 0;
+    bool mem = row->evex.mod == 'm' ||
+               (row->evex.mod == 'b' && rnd_f(g) < cfg->mem_ratio);
+    struct MemOp m = {0};
+
+    for (unsigned i = 0; i < row->nops; i++) {
+        unsigned kind = row->ops[i].kind;
+        unsigned idx = kind == CK_XMM ? rnd_n(g, 32) :
+                       kind == CK_MASK ? rnd_n(g, 8) : rnd_n(g, 16);
+        switch (row->ops[i].slot) {
+        case 0: // ModRM.r/m
+            if (mem || kind == CK_MEM) {
+                mem = true;
+                m = gen_memop(g, row->flags & CORPUS_VSIB);
+            } else {
+                rm = idx;
+            }
+            break;
+        case 1: reg = idx; break; // ModRM.reg
+        case 2: vvvv = idx; break;
+        case 3: imm = rnd(g) & 0xff; break;
+        default: break;
+        }
+    }
+
+    unsigned w = row->evex.w < 2 ? row->evex.w : rnd_n(g, 2);
+    unsigned l;
+    do
+        l = rnd_n(g, 3);
+    while (!(row->evex.l >> l & 1));
+    if (row->flags & CORPUS_MASK && (row->flags & CORPUS_VSIB || rnd_n(g, 2))) {
+        aaa = 1 + rnd_n(g, 7);
+        z = !(mem && row->ops[0].slot == 0) && rnd_n(g, 4) == 0;
+    }
+    if (mem && row->flags & CORPUS_BCST && rnd_n(g, 5) == 0)
+        bcst = 1;
+    if (!mem && row->flags & (CORPUS_SAE | CORPUS_ER) && rnd_n(g, 8) == 0) {
+        bcst = 1; // EVEX.b selects SAE/rounding for register operands
+        l = rnd_n(g, 4);
+    }
+
+    unsigned idx = 0;
+    unsigned b = mem ? m.base : rm;
+    unsigned x = mem ? (m.index != 4 || (row->flags & CORPUS_VSIB) ? m.index >> 3 : 0) :
+                 rm >> 4;
+    unsigned vhi = row->flags & CORPUS_VSIB ? m.index >> 4 : vvvv >> 4;
+    if (mem && m.form == ADDR_RIP)
+        b = x = 0;
+    buf[idx++] = 0x62;
+    buf[idx++] = (~reg >> 3 & 1) << 7 | (~x & 1) << 6 | (~b >> 3 & 1) << 5 |
+                 (~reg >> 4 & 1) << 4 | row->evex.mmm;
+    buf[idx++] = w << 7 | (~vvvv & 15) << 3 | 4 | row->evex.pp;
+    buf[idx++] = z << 7 | l << 5 | bcst << 4 | (~vhi & 1) << 3 | aaa;
+    buf[idx++] = row->evex.opc;
+
+    if (!mem) {
+        buf[idx++] = 0xc0 | (reg & 7) << 3 | (rm & 7);
+    } else {
+        unsigned mod = m.disp == 0 ? 0 : (int8_t) m.disp == m.disp ? 1 : 2;
+        bool sib = m.index != 4 || (b & 7) == 4 || (row->flags & CORPUS_VSIB);
+        if (m.form == ADDR_RIP) {
+            buf[idx++] = (reg & 7) << 3 | 5;
+            mod = 2; // for the displacement
+        } else if (m.form == ADDR_ABS) {
+            buf[idx++] = (reg & 7) << 3 | 4;
+            buf[idx++] = m.scale << 6 | (m.index & 7) << 3 | 5;
+            mod = 2;
+        } else {
+            if (mod == 0 && (b & 7) == 5)
+                mod = 1; // rBP/r13 require a displacement
+            buf[idx++] = mod << 6 | (reg & 7) << 3 | (sib ? 4 : b & 7);
+            if (sib)
+                buf[idx++] = m.scale << 6 | (m.index & 7) << 3 | (b & 7);
+        }
+        if (mod == 1)
+            buf[idx++] = m.disp;
+        else if (mod == 2)
+            for (unsigned i = 0; i < 4; i++)
+                buf[idx++] = (uint32_t) m.disp >> (8 * i);
+    }
+    for (unsigned i = 0; i < row->nops; i++)
+        if (row->ops[i].slot == 3)
+            buf[idx++] = imm;
+    return idx;
+}
+
+static bool
+gen_instr(struct Gen* g, const struct CorpusRow* row, uint8_t* buf,
+          size_t avail, FdInstr* instr) {
+    unsigned len = row->enc == ENC_EVEX ? gen_evex(g, row, buf) :
+                                          gen_encoder(g, row, buf);
+    if (!len)
+        return false;
+    // Only keep instructions that decode to exactly the generated bytes.
+    int ret = fd_decode(buf, avail, 64, 0, instr);
+    return ret > 0 && (unsigned) ret == len;
+}
+
+static int
+gen_init(struct Gen* g, const struct Config* cfg) {
+    memset(g, 0, sizeof *g);
+    g->cfg = cfg;
+    g->rng = cfg->seed ? cfg->seed : 1;
+
+    for (unsigned i = 0; i < NROWS; i++)
+        g->bucket_len[row_bucket(&rows[i])]++;
+    for (unsigned b = 0; b < NBUCKETS; b++) {
+        g->bucket_rows[b] = malloc((g->bucket_len[b] + 1) * sizeof(unsigned));
+        if (!g->bucket_rows[b])
+            return -1;
+        g->bucket_len[b] = 0;
+    }
+    for (unsigned i = 0; i < NROWS; i++) {
+        unsigned b = row_bucket(&rows[i]);
+        g->bucket_rows[b][g->bucket_len[b]++] = i;
+    }
+
+    // Drop rows the encoder or decoder do not support in 64-bit mode, e.g.
+    // PUSH ES, so that the requested distribution is not skewed by retries.
+    uint8_t buf[32];
+    FdInstr instr;
+    for (unsigned i = 0; i < NROWS; i++) {
+        unsigned tries = 0;
+        while (tries < 64 && !gen_instr(g, &rows[i], buf, sizeof buf, &instr))
+            tries++;
+        g->row_dead[i] = tries == 64;
+    }
+    gen_update_buckets(g);
+    return 0;
+}
+
+static int
+gen_corpus(struct Gen* g, FILE* bin, FILE* txt) {
+    const struct Config* cfg = g->cfg;
+    size_t cap = cfg->size + 32;
+    uint8_t* code = malloc(cap);
+    if (!code)
+        return -1;
+
+    size_t off = 0;
+    FdInstr instr;
+    char fmt[128];
+    while (off < cfg->size) {
+        const struct CorpusRow* row = gen_pick_row(g);
+        if (!row)
+            break;
+        if (!gen_instr(g, row, code + off, cap - off, &instr)) {
+            g->rejected++;
+            continue;
+        }
+        fd_format_abs(&instr, cfg->base + off, fmt, sizeof fmt);
+        fprintf(txt, "%" PRIx64 "\t%s\n", cfg->base + off, fmt);
+        g->enc_count[row->enc]++;
+        g->family_count[row->family]++;
+        off += FD_SIZE(&instr);
+    }
+
+    int res = fwrite(code, 1, off, bin) == off ? 0 : -1;
+    free(code);
+    return res;
+}
+
+// Decode a corpus and compare against the expected text.
+static int
+check_corpus(FILE* bin, FILE* txt) {
+    size_t cap = 1 << 20, len = 0;
+    uint8_t* code = malloc(cap);
+    size_t n;
+    while (code && (n = fread(code + len, 1, cap - len, bin)) > 0) {
+        len += n;
+        if (len == cap)
+            code = realloc(code, cap *= 2);
+    }
+    if (!code)
+        return -1;
+
+    char line[256], fmt[128];
+    uint64_t addr = 0;
+    size_t off = 0, count = 0, failed = 0;
+    while (fgets(line, sizeof line, txt)) {
+        char* tab = strchr(line, '\t');
+        char* nl = strchr(line, '\n');
+        if (!tab)
+            continue;
+        if (nl)
+            *nl = '\0';
+        uint64_t line_addr = strtoull(line, NULL, 16);
+        if (!count)
+            addr = line_addr - off;
+        FdInstr instr;
+        int ret = fd_decode(code + off, len - off, 64, 0, &instr);
+        if (ret < 0)
+            strcpy(fmt, ret == FD_ERR_UD ? "UD" : "PARTIAL");
+        else
+            fd_format_abs(&instr, addr + off, fmt, sizeof fmt);
+        if (addr + off != line_addr || strcmp(fmt, tab + 1)) {
+            if (failed++ < 20)
+                printf("Mismatch at %" PRIx64 ":\n  Exp: %s\n  Got: %s\n",
+                       line_addr, tab + 1, fmt);
+        }
+        count++;
+        off += ret > 0 ? ret : 1;
+        if (off >= len)
+            break;
+    }
+    free(code);
+    printf("%zu instructions checked, %zu mismatches\n", count, failed);
+    return failed ? -1 : 0;
+}
+
+// Parse a list of name=weight pairs into the weights array.
+static int
+parse_weights(const char* arg, const char* const* names, unsigned count,
+              double* weights) {
+    char* copy = strdup(arg);
+    char* save = NULL;
+    int res = 0;
+    for (unsigned i = 0; i < count; i++)
+        weights[i] = 0;
+    for (char* tok = strtok_r(copy, ",", &save); tok;
+         tok = strtok_r(NULL, ",", &save)) {
+        char* eq = strchr(tok, '=');
+        unsigned i;
+        if (eq)
+            *eq = '\0';
+        for (i = 0; i < count; i++)
+            if (!strcmp(tok, names[i]))
+                break;
+        if (i == count || !eq) {
+            fprintf(stderr, "invalid weight: %s\n", tok);
+            res = -1;
+            break;
+        }
+        weights[i] = strtod(eq + 1, NULL);
+    }
+    free(copy);
+    return res;
+}
+
+static void
+usage(const char* prog) {
+    fprintf(stderr, "usage: %s [options] -o prefix\n"
+                    "       %s -c prefix\n"
+                    "Writes prefix.bin (64-bit code) and prefix.txt (expected "
+                    "fd_format_abs output).\n"
+                    "  -s MiB      corpus size (default: 16)\n"
+                    "  -S seed     random seed (default: 1)\n"
+                    "  -b addr     base address (default: 0x400000)\n"
+                    "  -e list     encodings, e.g. legacy=80,vex=15,evex=5\n"
+                    "  -f list     ISA families: base x87 mmx sse avx bmi "
+                    "avx512 system other\n"
+                    "  -a list     addressing: base disp8 disp32 sib rip abs\n"
+                    "  -p ratio    prefix density (default: 0.05)\n"
+                    "  -m ratio    ratio of memory operand forms (default: 0.4)\n"
+                    "  -i ratio    ratio of imm8 vs. wider immediates "
+                    "(default: 0.7)\n"
+                    "  -c prefix   check prefix.bin against prefix.txt\n",
+            prog, prog);
+}
+
+static FILE*
+open_suffixed(const char* prefix, const char* suffix, const char* mode) {
+    char path[4096];
+    snprintf(path, sizeof path, "%s%s", prefix, suffix);
+    FILE* f = fopen(path, mode);
+    if (!f)
+        perror(path);
+    return f;
+}
+
+int
+main(int argc, char** argv) {
+    struct Config cfg = {
+        .enc_weights = { 80, 15, 5 },
+        .family_weights = {
+            [FAM_base] = 60, [FAM_x87] = 2, [FAM_mmx] = 1, [FAM_sse] = 15,
+            [FAM_avx] = 12, [FAM_bmi] = 3, [FAM_avx512] = 6, [FAM_system] = 0,
+            [FAM_other] = 1,
+        },
+        .addr_weights = { 20, 35, 10, 20, 15, 0 },
+        .prefix_density = 0.05,
+        .mem_ratio = 0.4,
+        .imm8_ratio = 0.7,
+        .seed = 1,
+        .size = 16 << 20,
+        .base = 0x400000,
+    };
+    const char* out = NULL;
+    const char* check = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:S:b:e:f:a:p:m:i:o:c:h")) != -1) {
+        int err = 0;
+        switch (opt) {
+        case 's': cfg.size = strtod(optarg, NULL) * (1 << 20); break;
+        case 'S': cfg.seed = strtoull(optarg, NULL, 0); break;
+        case 'b': cfg.base = strtoull(optarg, NULL, 0); break;
+        case 'e': err = parse_weights(optarg, enc_names, ENC_COUNT, cfg.enc_weights); break;
+        case 'f': err = parse_weights(optarg, family_names, FAM_COUNT, cfg.family_weights); break;
+        case 'a': err = parse_weights(optarg, addr_names, ADDR_COUNT, cfg.addr_weights); break;
+        case 'p': cfg.prefix_density = strtod(optarg, NULL); break;
+        case 'm': cfg.mem_ratio = strtod(optarg, NULL); break;
+        case 'i': cfg.imm8_ratio = strtod(optarg, NULL); break;
+        case 'o': out = optarg; break;
+        case 'c': check = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (err)
+            return EXIT_FAILURE;
+    }
+
+    if (check) {
+        FILE* bin = open_suffixed(check, ".bin", "rb");
+        FILE* txt = open_suffixed(check, ".txt", "r");
+        if (!bin || !txt)
+            return EXIT_FAILURE;
+        int res = check_corpus(bin, txt);
+        fclose(bin);
+        fclose(txt);
+        return res ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    if (!out) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct Gen g;
+    if (gen_init(&g, &cfg)) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    FILE* bin = open_suffixed(out, ".bin", "wb");
+    FILE* txt = open_suffixed(out, ".txt", "w");
+    if (!bin || !txt)
+        return EXIT_FAILURE;
+    int res = gen_corpus(&g, bin, txt);
+    res |= fclose(bin);
+    res |= fclose(txt);
+    if (res) {
+        perror(out);
+        return EXIT_FAILURE;
+    }
+
+    unsigned dead = 0;
+    for (unsigned i = 0; i < NROWS; i++)
+        dead += g.row_dead[i];
+    uint64_t total = 0;
+    for (unsigned i = 0; i < ENC_COUNT; i++)
+        total += g.enc_count[i];
+    fprintf(stderr, "%" PRIu64 " instructions (%" PRIu64 " rejected), "
+                    "%u/%zu forms usable\n", total, g.rejected,
+            (unsigned) (NROWS - dead), NROWS);
+    for (unsigned i = 0; i < ENC_COUNT; i++)
+        fprintf(stderr, "  %-8s %10" PRIu64 "\n", enc_names[i], g.enc_count[i]);
+    for (unsigned i = 0; i < FAM_COUNT; i++)
+        fprintf(stderr, "  %-8s %10" PRIu64 "\n", family_names[i], g.family_count[i]);
+    for (unsigned b = 0; b < NBUCKETS; b++)
+        free(g.bucket_rows[b]);
+    return EXIT_SUCCESS;
+}
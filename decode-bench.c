@@ -0,0 +1,564 @@
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <fadec.h>
+
+
+struct Corpus {
+    const char* name;
+    int mode;
+    uint8_t* data;
+    size_t size;
+    size_t cap;
+    unsigned files;
+};
+
+static void
+corpus_append(struct Corpus* c, const uint8_t* buf, size_t len) {
+    if (c->size + len > c->cap) {
+        size_t cap = c->cap ? c->cap : 1 << 20;
+        while (cap < c->size + len)
+            cap *= 2;
+        c->data = realloc(c->data, cap);
+        if (!c->data) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        c->cap = cap;
+    }
+    memcpy(c->data + c->size, buf, len);
+    c->size += len;
+}
+
+static uint64_t
+xorshift64(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// Append the executable sections of an x86-64 ELF file, or the entire file if
+// it is not an ELF file and raw is set. Returns the number of bytes added.
+static size_t
+corpus_add_file(struct Corpus* c, const char* path, bool raw, size_t limit) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    size_t fsize = st.st_size;
+    const uint8_t* map = mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+
+    size_t added = 0;
+    // Headers are copied out, the mapping has no alignment guarantees.
+    Elf64_Ehdr eh;
+    if (fsize >= sizeof eh)
+        memcpy(&eh, map, sizeof eh);
+    if (fsize >= sizeof eh && !memcmp(eh.e_ident, ELFMAG, SELFMAG) &&
+        eh.e_ident[EI_CLASS] == ELFCLASS64 && eh.e_machine == EM_X86_64 &&
+        eh.e_shentsize == sizeof(Elf64_Shdr) &&
+        eh.e_shoff + (uint64_t) eh.e_shnum * sizeof(Elf64_Shdr) <= fsize) {
+        for (unsigned i = 0; i < eh.e_shnum && added < limit; i++) {
+            Elf64_Shdr sh;
+            memcpy(&sh, map + eh.e_shoff + i * sizeof sh, sizeof sh);
+            if (sh.sh_type != SHT_PROGBITS || !(sh.sh_flags & SHF_EXECINSTR))
+                continue;
+            if (sh.sh_offset + sh.sh_size > fsize)
+                continue;
+            size_t len = sh.sh_size;
+            if (len > limit - added)
+                len = limit - added;
+            corpus_append(c, map + sh.sh_offset, len);
+            added += len;
+        }
+    } else if (raw) {
+        added = fsize < limit ? fsize : limit;
+        corpus_append(c, map, added);
+    }
+
+    munmap((void*) map, fsize);
+    if (added)
+        c->files++;
+    return added;
+}
+
+static int
+cmp_str(const void* a, const void* b) {
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+static void
+corpus_add_dir(struct Corpus* c, const char* dirname, size_t limit) {
+    DIR* dir = opendir(dirname);
+    if (!dir)
+        return;
+    // Sort entries so that the corpus is stable for a given host.
+    size_t count = 0, cap = 256;
+    char** names = malloc(cap * sizeof *names);
+    struct dirent* ent;
+    while (names && (ent = readdir(dir))) {
+        if (ent->d_name[0] == '.')
+            continue;
+        if (count == cap) {
+            // Keep the entries read so far if the array cannot grow.
+            char** grown = realloc(names, 2 * cap * sizeof *names);
+            if (!grown)
+                break;
+            names = grown;
+            cap *= 2;
+        }
+        char* name = strdup(ent->d_name);
+        if (name)
+            names[count++] = name;
+    }
+    closedir(dir);
+    if (!names)
+        return;
+    qsort(names, count, sizeof *names, cmp_str);
+
+    char path[4096];
+    for (size_t i = 0; i < count; i++) {
+        if (c->size < limit) {
+            snprintf(path, sizeof path, "%s/%s", dirname, names[i]);
+            corpus_add_file(c, path, false, limit - c->size);
+        }
+        free(names[i]);
+    }
+    free(names);
+}
+
+// Uniformly random bytes; exercises prefix handling and the error paths.
+static void
+corpus_synth_random(struct Corpus* c, size_t size) {
+    uint64_t state = 0x2545f4914f6cdd1d;
+    uint8_t buf[8];
+    for (size_t i = 0; i < size; i += sizeof buf) {
+        uint64_t r = xorshift64(&state);
+        memcpy(buf, &r, sizeof buf);
+        corpus_append(c, buf, sizeof buf);
+    }
+}
+
+// Instructions typical for compiler output, in a fixed pseudo-random order.
+static void
+corpus_synth_mix(struct Corpus* c, size_t size) {
+    static const struct {
+        uint8_t len;
+        uint8_t bytes[15];
+    } instrs[] = {
+        {1, "\x55"},                                // push rbp
+        {3, "\x48\x89\xe5"},                        // mov rbp, rsp
+        {4, "\x48\x83\xec\x20"},                    // sub rsp, 0x20
+        {4, "\x48\x8b\x45\xf8"},                    // mov rax, [rbp-0x8]
+        {4, "\x89\x44\x24\x0c"},                    // mov [rsp+0xc], eax
+        {7, "\x48\x8d\x05\x10\x20\x00\x00"},        // lea rax, [rip+0x2010]
+        {7, "\x48\x8b\x05\x10\x20\x00\x00"},        // mov rax, [rip+0x2010]
+        {5, "\xe8\x00\x01\x00\x00"},                // call rel32
+        {2, "\x74\x10"},                            // jz rel8
+        {6, "\x0f\x85\x00\x01\x00\x00"},            // jnz rel32
+        {2, "\x31\xc0"},                            // xor eax, eax
+        {3, "\x48\x85\xc0"},                        // test rax, rax
+        {4, "\x48\x39\x47\x08"},                    // cmp [rdi+0x8], rax
+        {5, "\xb8\x01\x00\x00\x00"},                // mov eax, 1
+        {4, "\x0f\xb6\x04\x07"},                    // movzx eax, byte [rdi+rax]
+        {5, "\x48\x8b\x44\xc7\x08"},                // mov rax, [rdi+8*rax+0x8]
+        {5, "\x0f\x1f\x44\x00\x00"},                // nop dword [rax+rax]
+        {4, "\x66\x0f\xef\xc0"},                    // pxor xmm0, xmm0
+        {5, "\xc5\xfa\x6f\x04\x24"},                // vmovdqu xmm0, [rsp]
+        {5, "\xc5\xfe\x7f\x47\x20"},                // vmovdqu [rdi+0x20], ymm0
+        {6, "\x62\xf1\x7c\x48\x28\xc1"},            // vmovaps zmm0, zmm1
+        {1, "\x5d"},                                // pop rbp
+        {1, "\xc3"},                                // ret
+        {4, "\xf3\x0f\x1e\xfa"},                    // endbr64
+    };
+    uint64_t state = 0x9e3779b97f4a7c15;
+    while (c->size < size) {
+        unsigned idx = xorshift64(&state) % (sizeof instrs / sizeof instrs[0]);
+        corpus_append(c, instrs[idx].bytes, instrs[idx].len);
+    }
+}
+
+struct Counters {
+    int fd;
+    unsigned count;
+    uint64_t values[3];
+};
+
+static const char* const counter_names[] = {
+    "cycles", "instructions", "l1d_read_misses"
+};
+
+static void
+counters_open(struct Counters* ctr) {
+    ctr->fd = -1;
+    ctr->count = 0;
+#ifdef __linux__
+    static const struct { uint32_t type; uint64_t config; } events[] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                             PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                             PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+    };
+    for (unsigned i = 0; i < sizeof events / sizeof events[0]; i++) {
+        struct perf_event_attr attr = {0};
+        attr.size = sizeof attr;
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = ctr->fd < 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        int fd = syscall(SYS_perf_event_open, &attr, 0, -1, ctr->fd, 0);
+        if (fd < 0)
+            break; // Keep the counters opened so far.
+        if (ctr->fd < 0)
+            ctr->fd = fd;
+        ctr->count++;
+    }
+#endif
+}
+
+static void
+counters_reset(struct Counters* ctr) {
+    memset(ctr->values, 0, sizeof ctr->values);
+}
+
+static void
+counters_start(struct Counters* ctr) {
+#ifdef __linux__
+    if (ctr->fd >= 0) {
+        ioctl(ctr->fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(ctr->fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#else
+    (void) ctr;
+#endif
+}
+
+static void
+counters_stop(struct Counters* ctr) {
+#ifdef __linux__
+    if (ctr->fd >= 0) {
+        ioctl(ctr->fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        uint64_t buf[1 + 3];
+        if (read(ctr->fd, buf, sizeof buf) >= (ssize_t) (8 * (1 + ctr->count)))
+            for (unsigned i = 0; i < ctr->count && i < buf[0]; i++)
+                ctr->values[i] += buf[1 + i];
+    }
+#else
+    (void) ctr;
+#endif
+}
+
+static uint64_t
+now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t
+tsc(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+enum BenchKind {
+    BENCH_DECODE,
+    BENCH_FORMAT,
+    BENCH_FORMAT_ABS,
+    BENCH_COST,
+    BENCH_LISTING,
+    BENCH_FORMAT_ATT,
+    BENCH_TOKENS,
+};
+
+static const char* const bench_names[] = {
+    [BENCH_DECODE] = "decode",
+    [BENCH_FORMAT] = "format",
+    [BENCH_FORMAT_ABS] = "format_abs",
+    [BENCH_COST] = "cost",
+    [BENCH_LISTING] = "listing",
+    [BENCH_FORMAT_ATT] = "format_att",
+    [BENCH_TOKENS] = "tokens",
+};
+
+struct Result {
+    uint64_t instrs;
+    uint64_t errors;
+    uint64_t iterations;
+    uint64_t ns;
+    uint64_t tsc;
+};
+
+#define BATCH 4096
+
+// Only the measured operation is counted: for the formatter and cost
+// benchmarks, instructions are decoded in batches outside of the timed region.
+static void
+run_once(const struct Corpus* c, enum BenchKind kind, struct Result* res,
+         struct Counters* ctr, FdInstr* batch, uint64_t* addrs) {
+    const uint8_t* buf = c->data;
+    size_t len = c->size;
+    char fmt[128];
+
+    if (kind == BENCH_DECODE) {
+        FdInstr instr;
+        uint64_t count = 0, errors = 0;
+        uint64_t t0 = now_ns(), c0 = tsc();
+        counters_start(ctr);
+        for (size_t off = 0; off < len; ) {
+            int ret = fd_decode(buf + off, len - off, c->mode, 0, &instr);
+            if (ret > 0) {
+                off += ret;
+                count++;
+            } else {
+                off++;
+                errors++;
+            }
+        }
+        counters_stop(ctr);
+        res->tsc += tsc() - c0;
+        res->ns += now_ns() - t0;
+        res->instrs += count;
+        res->errors += errors;
+        return;
+    }
+
+    size_t off = 0;
+    while (off < len) {
+        unsigned n = 0;
+        while (n < BATCH && off < len) {
+            int ret = fd_decode(buf + off, len - off, c->mode, 0, &batch[n]);
+            if (ret > 0) {
+                addrs[n++] = 0x400000 + off;
+                off += ret;
+            } else {
+                off++;
+                res->errors++;
+            }
+        }
+
+        uint64_t t0 = now_ns(), c0 = tsc();
+        counters_start(ctr);
+        if (kind == BENCH_FORMAT) {
+            for (unsigned i = 0; i < n; i++)
+                fd_format(&batch[i], fmt, sizeof fmt);
+        } else if (kind == BENCH_COST) {
+            // Basic blocks end after control-flow instructions.
+            FdBlockCost cost;
+            for (unsigned i = 0, start = 0; i < n; i++) {
+                if (fd_cf_kind(&batch[i]) == FD_CF_NONE && i + 1 < n)
+                    continue;
+                fd_block_cost(&batch[start], i + 1 - start, FD_UARCH_SKL,
+                              &cost);
+                start = i + 1;
+            }
+#ifdef __GNUC__
+            __asm__ volatile("" :: "r"(&cost) : "memory");
+#endif
+        } else if (kind == BENCH_LISTING) {
+            // Runs of consecutive instructions are listed into one buffer.
+            static char listing[BATCH * FD_LISTING_LINE_MAX];
+            for (unsigned i = 0, start = 0; i < n; i++) {
+                if (i + 1 < n && addrs[i + 1] == addrs[i] + FD_SIZE(&batch[i]))
+                    continue;
+                fd_format_listing(&batch[start], i + 1 - start, addrs[start],
+                                  buf + (addrs[start] - 0x400000), listing,
+                                  sizeof listing, 0);
+                start = i + 1;
+            }
+#ifdef __GNUC__
+            __asm__ volatile("" :: "r"(listing) : "memory");
+#endif
+        } else if (kind == BENCH_FORMAT_ATT) {
+            for (unsigned i = 0; i < n; i++)
+                fd_format_att(&batch[i], addrs[i], fmt, sizeof fmt);
+        } else if (kind == BENCH_TOKENS) {
+            static FdToken toks[FD_TOKENS_MAX];
+            for (unsigned i = 0; i < n; i++)
+                fd_format_tokens(&batch[i], addrs[i], NULL, 0, fmt, sizeof fmt,
+                                 toks, FD_TOKENS_MAX);
+#ifdef __GNUC__
+            __asm__ volatile("" :: "r"(toks) : "memory");
+#endif
+        } else {
+            for (unsigned i = 0; i < n; i++)
+                fd_format_abs(&batch[i], addrs[i], fmt, sizeof fmt);
+        }
+        counters_stop(ctr);
+        res->tsc += tsc() - c0;
+        res->ns += now_ns() - t0;
+        res->instrs += n;
+#ifdef __GNUC__
+        // Keep the compiler from discarding the formatted string.
+        __asm__ volatile("" :: "r"(fmt) : "memory");
+#endif
+    }
+}
+
+static void
+print_result(const struct Corpus* c, enum BenchKind kind,
+             const struct Result* res, const struct Counters* ctr,
+             bool first) {
+    double instrs = res->instrs ? res->instrs : 1;
+    double secs = res->ns / 1e9;
+    printf("%s    {\"benchmark\": \"%s\", \"corpus\": \"%s\", \"mode\": %d, "
+           "\"files\": %u, \"bytes\": %zu, \"iterations\": %" PRIu64 ", "
+           "\"instructions\": %" PRIu64 ", \"errors\": %" PRIu64 ", "
+           "\"seconds\": %.6f, \"instr_per_sec\": %.1f, "
+           "\"ns_per_instr\": %.4f, ",
+           first ? "" : ",\n", bench_names[kind], c->name, c->mode, c->files,
+           c->size, res->iterations, res->instrs, res->errors, secs,
+           secs > 0 ? res->instrs / secs : 0.0, res->ns / instrs);
+    if (ctr->count >= 1)
+        printf("\"cycles_per_instr\": %.4f, ", ctr->values[0] / instrs);
+    else
+        printf("\"cycles_per_instr\": null, ");
+    if (res->tsc)
+        printf("\"tsc_per_instr\": %.4f, ", res->tsc / instrs);
+    else
+        printf("\"tsc_per_instr\": null, ");
+    printf("\"counters\": {");
+    for (unsigned i = 0; i < ctr->count; i++)
+        printf("%s\"%s\": %" PRIu64, i ? ", " : "", counter_names[i],
+               ctr->values[i]);
+    printf("}}");
+}
+
+static void
+usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-m decode|format|format_abs|cost|listing|format_att|tokens] [-t seconds] "
+                    "[-l bytes] [-d dir] [-n] [file...]\n"
+                    "  -m  benchmark to run (default: all)\n"
+                    "  -t  minimum measuring time per corpus (default: 0.5)\n"
+                    "  -l  maximum bytes taken from the system binaries "
+                    "(default: 64 MiB)\n"
+                    "  -d  directory with system binaries (default: /usr/bin)\n"
+                    "  -n  skip system binaries and synthetic corpora\n"
+                    "  file  additional corpus: executable sections of an ELF "
+                    "file, otherwise raw 64-bit code\n", prog);
+}
+
+int
+main(int argc, char** argv) {
+    int bench = -1;
+    double min_time = 0.5;
+    size_t sys_limit = 64 << 20;
+    const char* sys_dir = "/usr/bin";
+    bool builtin = true;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:t:l:d:nh")) != -1) {
+        switch (opt) {
+        case 'm':
+            for (bench = 0; bench <= BENCH_TOKENS; bench++)
+                if (!strcmp(optarg, bench_names[bench]))
+                    break;
+            if (bench > BENCH_TOKENS) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't': min_time = strtod(optarg, NULL); break;
+        case 'l': sys_limit = strtoull(optarg, NULL, 0); break;
+        case 'd': sys_dir = optarg; break;
+        case 'n': builtin = false; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    struct Corpus corpora[64];
+    unsigned ncorpora = 0;
+    if (builtin) {
+        struct Corpus* c = &corpora[ncorpora];
+        *c = (struct Corpus) { .name = sys_dir, .mode = 64 };
+        corpus_add_dir(c, sys_dir, sys_limit);
+        if (c->size)
+            ncorpora++;
+
+        c = &corpora[ncorpora++];
+        *c = (struct Corpus) { .name = "synthetic-mix", .mode = 64 };
+        corpus_synth_mix(c, 16 << 20);
+
+        c = &corpora[ncorpora++];
+        *c = (struct Corpus) { .name = "synthetic-random", .mode = 64 };
+        corpus_synth_random(c, 4 << 20);
+    }
+    for (int i = optind; i < argc && ncorpora < 64; i++) {
+        struct Corpus* c = &corpora[ncorpora];
+        *c = (struct Corpus) { .name = argv[i], .mode = 64 };
+        if (corpus_add_file(c, argv[i], true, SIZE_MAX))
+            ncorpora++;
+        else
+            fprintf(stderr, "%s: no code found\n", argv[i]);
+    }
+
+    FdInstr* batch = malloc(BATCH * sizeof *batch);
+    uint64_t* addrs = malloc(BATCH * sizeof *addrs);
+    if (!batch || !addrs) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    struct Counters ctr;
+    counters_open(&ctr);
+
+    printf("{\"fadec_bench\": 1, \"results\": [\n");
+    bool first = true;
+    for (int kind = 0; kind <= BENCH_TOKENS; kind++) {
+        if (bench >= 0 && kind != bench)
+            continue;
+        for (unsigned i = 0; i < ncorpora; i++) {
+            struct Result res = {0};
+            counters_reset(&ctr);
+            do {
+                run_once(&corpora[i], kind, &res, &ctr, batch, addrs);
+                res.iterations++;
+            } while (res.ns < min_time * 1e9);
+            print_result(&corpora[i], kind, &res, &ctr, first);
+            first = false;
+        }
+    }
+    printf("\n]}\n");
+
+    for (unsigned i = 0; i < ncorpora; i++)
+        free(corpora[i].data);
+    free(batch);
+    free(addrs);
+    return EXIT_SUCCESS;
+}
@@ -5,6 +5,12 @@
 #include <inttypes.h>
 
 #include <fadec.h>
+#include <fadec-analysis.h>
+#include <fadec-index.h>
+#include <fadec-pattern.h>
+#include <fadec-fingerprint.h>
+#include <fadec-columns.h>
+#include <fadec-profile.h>
 
 
 static
@@ -44,10 +50,1263 @@ test(const void* buf, size_t buf_len, unsigned mode, const char* exp_fmt)
     return -1;
 }
 
+static
+int
+test_att(const void* buf, size_t buf_len, unsigned mode, const char* exp_fmt)
+{
+    FdInstr instr;
+    char fmt[128];
+
+    int retval = fd_decode(buf, buf_len, mode, 0, &instr);
+    if (retval == FD_ERR_INTERNAL)
+        return 0;
+    if (retval < 0)
+        strcpy(fmt, "UD");
+    else
+        fd_format_att(&instr, 0, fmt, sizeof(fmt));
+
+    if ((retval < 0 || (unsigned) retval == buf_len) && !strcmp(fmt, exp_fmt))
+        return 0;
+
+    printf("Failed AT&T case (%u-bit): ", mode);
+    print_hex(buf, buf_len);
+    printf("\n  Exp (%2zu): %s", buf_len, exp_fmt);
+    printf("\n  Got (%2d): %s\n", retval, fmt);
+    return -1;
+}
+
+static
+int
+test_eflags(const void* buf, size_t buf_len, unsigned mode, unsigned exp_read,
+            unsigned exp_written, unsigned exp_undef)
+{
+    FdInstr instr;
+    int retval = fd_decode(buf, buf_len, mode, 0, &instr);
+    if (retval == FD_ERR_INTERNAL)
+        return 0;
+    if (retval < 0) {
+        printf("Failed case (%u-bit): ", mode);
+        print_hex(buf, buf_len);
+        printf("\n  Decode error %d\n", retval);
+        return -1;
+    }
+
+    unsigned read = fd_instr_flags_read(&instr);
+    unsigned written = fd_instr_flags_written(&instr);
+    unsigned undef = fd_instr_flags_undefined(&instr);
+    if (read == exp_read && written == exp_written && undef == exp_undef)
+        return 0;
+
+    printf("Failed case (%u-bit): ", mode);
+    print_hex(buf, buf_len);
+    printf("\n  Exp: read %03x written %03x undef %03x", exp_read, exp_written,
+           exp_undef);
+    printf("\n  Got: read %03x written %03x undef %03x\n", read, written, undef);
+    return -1;
+}
+
+static
+int
+test_liveness(const void* buf, size_t buf_len, unsigned live_out,
+              unsigned exp_live_in, const unsigned* exp_live_after)
+{
+    FdInstr instrs[16];
+    unsigned live_after[16];
+    size_t count = 0;
+    for (size_t off = 0; off < buf_len && count < 16; count++) {
+        int retval = fd_decode((const uint8_t*) buf + off, buf_len - off, 64, 0,
+                               &instrs[count]);
+        if (retval == FD_ERR_INTERNAL)
+            return 0;
+        if (retval < 0)
+            return -1;
+        off += retval;
+    }
+
+    unsigned live_in = fd_flags_liveness(instrs, count, live_out, live_after);
+    int failed = live_in != exp_live_in;
+    for (size_t i = 0; i < count; i++)
+        failed |= live_after[i] != exp_live_after[i];
+    if (!failed)
+        return 0;
+
+    printf("Failed liveness case: ");
+    print_hex(buf, buf_len);
+    printf("\n  Exp: %03x", exp_live_in);
+    for (size_t i = 0; i < count; i++)
+        printf(" %03x", exp_live_after[i]);
+    printf("\n  Got: %03x", live_in);
+    for (size_t i = 0; i < count; i++)
+        printf(" %03x", live_after[i]);
+    printf("\n");
+    return -1;
+}
+
+static
+int
+test_regs(const void* buf, size_t buf_len, unsigned type, uint64_t exp_read,
+          uint64_t exp_written)
+{
+    FdInstr instr;
+    int retval = fd_decode(buf, buf_len, 64, 0, &instr);
+    if (retval == FD_ERR_INTERNAL)
+        return 0;
+    if (retval < 0) {
+        printf("Failed regs case: ");
+        print_hex(buf, buf_len);
+        printf("\n  Decode error %d\n", retval);
+        return -1;
+    }
+
+    uint64_t read[16], written[16];
+    fd_instr_regs_read(&instr, read);
+    fd_instr_regs_written(&instr, written);
+    if (read[type] == exp_read && written[type] == exp_written)
+        return 0;
+
+    printf("Failed regs case (type %u): ", type);
+    print_hex(buf, buf_len);
+    printf("\n  Exp: read %" PRIx64 " written %" PRIx64, exp_read, exp_written);
+    printf("\n  Got: read %" PRIx64 " written %" PRIx64 "\n", read[type],
+           written[type]);
+    return -1;
+}
+
+static
+int
+test_mem(const void* buf, size_t buf_len, unsigned mode, unsigned idx,
+         unsigned exp_access, unsigned exp_size, uint64_t exp_ea)
+{
+    FdInstr instr;
+    int retval = fd_decode(buf, buf_len, mode, 0, &instr);
+    if (retval == FD_ERR_INTERNAL)
+        return 0;
+    if (retval < 0) {
+        printf("Failed mem case (%u-bit): ", mode);
+        print_hex(buf, buf_len);
+        printf("\n  Decode error %d\n", retval);
+        return -1;
+    }
+
+    // Register n holds 0x1000*(n+1), the instruction is at 0x11000.
+    uint64_t regs[17];
+    for (unsigned i = 0; i < 17; i++)
+        regs[i] = 0x1000 * (i + 1);
+    unsigned access = fd_mem_access(&instr, idx);
+    unsigned size = fd_mem_size(&instr, idx);
+    uint64_t ea = fd_mem_ea(&instr, idx, regs, 0x100000, 0x200000);
+    if (access == exp_access && size == exp_size && ea == exp_ea)
+        return 0;
+
+    printf("Failed mem case (%u-bit): ", mode);
+    print_hex(buf, buf_len);
+    printf("\n  Exp: access %u size %u ea %" PRIx64, exp_access, exp_size, exp_ea);
+    printf("\n  Got: access %u size %u ea %" PRIx64 "\n", access, size, ea);
+    return -1;
+}
+
+static
+int
+test_cf(const void* buf, size_t buf_len, unsigned mode, FdCfKind exp_kind,
+        uint64_t exp_target)
+{
+    // Without an address, the target is an offset; with one, it is absolute.
+    for (uint64_t address = 0; address <= 0x1000; address += 0x1000) {
+        FdInstr instr;
+        int retval = fd_decode(buf, buf_len, mode, address, &instr);
+        if (retval == FD_ERR_INTERNAL)
+            return 0;
+        if (retval < 0) {
+            printf("Failed cf case (%u-bit): ", mode);
+            print_hex(buf, buf_len);
+            printf("\n  Decode error %d\n", retval);
+            return -1;
+        }
+
+        FdCfKind kind = fd_cf_kind(&instr);
+        uint64_t target = fd_branch_target(&instr, 0x1000);
+        if (kind == exp_kind && target == exp_target)
+            continue;
+
+        printf("Failed cf case (%u-bit, address %" PRIx64 "): ", mode, address);
+        print_hex(buf, buf_len);
+        printf("\n  Exp: kind %u target %" PRIx64, exp_kind, exp_target);
+        printf("\n  Got: kind %u target %" PRIx64 "\n", kind, target);
+        return -1;
+    }
+    return 0;
+}
+
+static
+int
+test_features(const void* buf, size_t buf_len, unsigned exp_level,
+              const char* exp_features)
+{
+    FdInstr instr;
+    int retval = fd_decode(buf, buf_len, 64, 0, &instr);
+    if (retval == FD_ERR_INTERNAL)
+        return 0;
+    if (retval < 0) {
+        printf("Failed features case: ");
+        print_hex(buf, buf_len);
+        printf("\n  Decode error %d\n", retval);
+        return -1;
+    }
+
+    uint64_t mask[FD_FEATURE_WORDS];
+    fd_instr_features(&instr, mask);
+    char features[128] = "";
+    for (unsigned i = 0; fd_feature_name(i); i++) {
+        if (!(mask[i / 64] >> (i % 64) & 1))
+            continue;
+        if (features[0])
+            strcat(features, " ");
+        strcat(features, fd_feature_name(i));
+    }
+    unsigned level = fd_instr_x86_64_level(&instr);
+    if (level == exp_level && !strcmp(features, exp_features))
+        return 0;
+
+    printf("Failed features case: ");
+    print_hex(buf, buf_len);
+    printf("\n  Exp: v%u %s", exp_level, exp_features);
+    printf("\n  Got: v%u %s\n", level, features);
+    return -1;
+}
+
+static
+int
+test_listing(const void* buf, size_t buf_len, uint64_t base, unsigned flags,
+             size_t cap, const char* exp)
+{
+    FdInstr instrs[16];
+    size_t count = 0;
+    for (size_t off = 0; off < buf_len && count < 16; count++) {
+        int retval = fd_decode((const uint8_t*) buf + off, buf_len - off, 64, 0,
+                               &instrs[count]);
+        if (retval == FD_ERR_INTERNAL)
+            return 0;
+        if (retval < 0)
+            return -1;
+        off += retval;
+    }
+
+    char out[16 * FD_LISTING_LINE_MAX];
+    size_t len = fd_format_listing(instrs, count, base, buf, out,
+                                   cap < sizeof out ? cap : sizeof out, flags);
+    if (len == strlen(exp) && !memcmp(out, exp, len))
+        return 0;
+
+    printf("Failed listing case: ");
+    print_hex(buf, buf_len);
+    printf("\n  Exp:\n%s", exp);
+    printf("\n  Got:\n%.*s\n", (int) len, out);
+    return -1;
+}
+
+static
+int
+test_block_cost(const void* buf, size_t buf_len, FdUarch uarch,
+                unsigned exp_cycles100, int exp_port, unsigned exp_critical,
+                unsigned exp_uops)
+{
+    FdInstr instrs[16];
+    size_t count = 0;
+    for (size_t off = 0; off < buf_len && count < 16; count++) {
+        int retval = fd_decode((const uint8_t*) buf + off, buf_len - off, 64, 0,
+                               &instrs[count]);
+        if (retval == FD_ERR_INTERNAL)
+            return 0;
+        if (retval < 0)
+            return -1;
+        off += retval;
+    }
+
+    FdBlockCost cost;
+    if (fd_block_cost(instrs, count, uarch, &cost) < 0)
+        return -1;
+    unsigned cycles100 = (unsigned) (cost.cycles * 100 + 0.5);
+    if (cycles100 == exp_cycles100 && cost.bottleneck_port == exp_port &&
+        cost.critical_path == exp_critical && cost.uops == exp_uops)
+        return 0;
+
+    printf("Failed cost case (%s): ", fd_uarch_name(uarch));
+    print_hex(buf, buf_len);
+    printf("\n  Exp: %u.%02u cycles, port %d, path %u, %u uops",
+           exp_cycles100 / 100, exp_cycles100 % 100, exp_port, exp_critical,
+           exp_uops);
+    printf("\n  Got: %u.%02u cycles, port %d, path %u, %u uops\n",
+           cycles100 / 100, cycles100 % 100, cost.bottleneck_port,
+           cost.critical_path, cost.uops);
+    return -1;
+}
+
+static
+int
+test_format_sym(const void* buf, size_t buf_len, uint64_t addr,
+                const FdSymbolizer* sym, unsigned flags, const char* exp_fmt)
+{
+    FdInstr instr;
+    char fmt[FD_FORMAT_SYM_MAX];
+    int retval = fd_decode(buf, buf_len, 64, 0, &instr);
+    if (retval == FD_ERR_INTERNAL)
+        return 0;
+    if (retval < 0)
+        strcpy(fmt, "UD");
+    else
+        fd_format_sym(&instr, addr, sym, flags, fmt, sizeof(fmt));
+    if (!strcmp(fmt, exp_fmt))
+        return 0;
+
+    printf("Failed symbol case: ");
+    print_hex(buf, buf_len);
+    printf("\n  Exp: %s\n  Got: %s\n", exp_fmt, fmt);
+    return -1;
+}
+
+// Tokens are written as text/kind with the operand index appended. Text not
+// covered by any token except spaces is appended as "?text".
+static
+int
+test_tokens(const void* buf, size_t buf_len, unsigned flags, size_t len,
+            const char* exp_toks)
+{
+    FdInstr instr;
+    char fmt[FD_FORMAT_SYM_MAX];
+    char rest[FD_FORMAT_SYM_MAX];
+    char got[512] = "UD";
+    FdToken toks[FD_TOKENS_MAX];
+    int retval = fd_decode(buf, buf_len, 64, 0, &instr);
+    if (retval == FD_ERR_INTERNAL)
+        return 0;
+    if (retval >= 0) {
+        size_t count = fd_format_tokens(&instr, 0, NULL, flags, fmt, len, toks,
+                                        FD_TOKENS_MAX);
+        strcpy(rest, fmt);
+        char* cur = got;
+        for (size_t i = 0; i < count && i < FD_TOKENS_MAX; i++) {
+            cur += sprintf(cur, "%s%.*s/%c", i ? " " : "", toks[i].length,
+                           fmt + toks[i].offset, "pmridxs[]yk,"[toks[i].kind]);
+            if (toks[i].operand != FD_TOKEN_NO_OPERAND)
+                cur += sprintf(cur, "%u", toks[i].operand);
+            memset(rest + toks[i].offset, ' ', toks[i].length);
+        }
+        for (size_t i = 0; rest[i]; i++)
+            if (rest[i] != ' ')
+                cur += sprintf(cur, " ?%c", rest[i]);
+    }
+    if (!strcmp(got, exp_toks))
+        return 0;
+
+    printf("Failed token case: ");
+    print_hex(buf, buf_len);
+    printf("\n  Exp: %s\n  Got: %s\n", exp_toks, got);
+    return -1;
+}
+
+// Compare fd_symtab_lookup against a linear scan for pseudo-random symbols.
+static
+int
+test_symtab_random(size_t count)
+{
+    FdSymbol syms[256], sorted[256], nodes[257];
+    uint64_t keys[257];
+    FdSymtab tab;
+    uint64_t seed = count * 0x9e3779b97f4a7c15;
+    for (size_t i = 0; i < count; i++) {
+        seed = seed * 6364136223846793005 + 1442695040888963407;
+        syms[i] = (FdSymbol) { 0x1000 + (seed >> 52) * 16, 0, NULL };
+    }
+    memcpy(sorted, syms, sizeof(syms[0]) * count);
+    size_t unique = fd_symtab_init(&tab, sorted, count, nodes, keys);
+
+    for (uint64_t addr = 0xff0; addr < 0x11010; addr += 8) {
+        uint64_t best = 0;
+        int found = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (syms[i].addr <= addr && (!found || syms[i].addr > best)) {
+                best = syms[i].addr;
+                found = 1;
+            }
+        }
+        const FdSymbol* sym = fd_symtab_lookup(&tab, addr);
+        if (found ? sym && sym->addr == best : !sym)
+            continue;
+        printf("Failed symtab case (%zu symbols, %zu unique): %#" PRIx64 "\n",
+               count, unique, addr);
+        printf("  Exp: %#" PRIx64 "\n  Got: %#" PRIx64 "\n",
+               found ? best : 0, sym ? sym->addr : 0);
+        return -1;
+    }
+    return 0;
+}
+
+static void
+store_le(uint8_t* buf, uint64_t val, unsigned size)
+{
+    for (unsigned i = 0; i < size; i++)
+        buf[i] = val >> (8 * i);
+}
+
+// ELF64 image with a .symtab of main, data, an undefined symbol, a section
+// symbol, and a .dynsym which is truncated to its null symbol.
+static
+int
+test_elf_symbols(void)
+{
+    static const char strtab[] = "\0main\0data\0puts";
+    uint8_t elf[512] = {0x7f, 'E', 'L', 'F', 2, 1, 1};
+    store_le(elf + 0x28, 0x40, 8); // e_shoff
+    store_le(elf + 0x3a, 0x40, 2); // e_shentsize
+    store_le(elf + 0x3c, 4, 2); // e_shnum
+    // [1] .symtab at 0x180 with 5 entries, [2] .strtab at 0x140, [3] .dynsym
+    uint8_t* sh = elf + 0x80;
+    store_le(sh + 0x04, 2, 4);
+    store_le(sh + 0x18, 0x180, 8);
+    store_le(sh + 0x20, 5 * 24, 8);
+    store_le(sh + 0x28, 2, 4);
+    store_le(sh + 0x38, 24, 8);
+    sh = elf + 0xc0;
+    store_le(sh + 0x04, 3, 4);
+    store_le(sh + 0x18, 0x140, 8);
+    store_le(sh + 0x20, sizeof strtab, 8);
+    sh = elf + 0x100;
+    store_le(sh + 0x04, 11, 4);
+    store_le(sh + 0x18, 0x180, 8);
+    store_le(sh + 0x20, 24, 8);
+    store_le(sh + 0x28, 2, 4);
+    store_le(sh + 0x38, 24, 8);
+    memcpy(elf + 0x140, strtab, sizeof strtab);
+    static const struct { uint32_t name; uint8_t info; uint16_t shndx;
+                          uint64_t value, size; } elfsyms[] = {
+        {1, 0x12, 1, 0x401000, 0x10}, // main: global function
+        {6, 0x11, 2, 0x404000, 8}, // data: global object
+        {11, 0x12, 0, 0, 0}, // puts: undefined
+        {0, 0x03, 1, 0x401000, 0}, // section symbol
+    };
+    for (size_t i = 0; i < 4; i++) {
+        uint8_t* sym = elf + 0x180 + 24 * (i + 1);
+        store_le(sym, elfsyms[i].name, 4);
+        sym[4] = elfsyms[i].info;
+        store_le(sym + 6, elfsyms[i].shndx, 2);
+        store_le(sym + 8, elfsyms[i].value, 8);
+        store_le(sym + 16, elfsyms[i].size, 8);
+    }
+
+    FdSymbol syms[4];
+    size_t count = fd_elf_symbols(elf, sizeof elf, syms, 4);
+    if (count == 2 && !strcmp(syms[0].name, "main") &&
+        syms[0].addr == 0x401000 && syms[0].size == 0x10 &&
+        !strcmp(syms[1].name, "data") && syms[1].addr == 0x404000 &&
+        fd_elf_symbols(elf, sizeof elf, NULL, 0) == 2 &&
+        fd_elf_symbols(elf, 0x100, syms, 4) == 0)
+        return 0;
+
+    printf("Failed ELF symbols case: got %zu symbols\n", count);
+    return -1;
+}
+
+// ELF64 image with a .note section of an ABI tag and a 20-byte build ID.
+static
+int
+test_elf_build_id(void)
+{
+    uint8_t elf[0x110] = {0x7f, 'E', 'L', 'F', 2, 1, 1};
+    store_le(elf + 0x28, 0x40, 8); // e_shoff
+    store_le(elf + 0x3a, 0x40, 2); // e_shentsize
+    store_le(elf + 0x3c, 2, 2); // e_shnum
+    uint8_t* sh = elf + 0x80;
+    store_le(sh + 0x04, 7, 4);
+    store_le(sh + 0x18, 0xc0, 8);
+    store_le(sh + 0x20, 32 + 36, 8);
+    uint8_t* note = elf + 0xc0;
+    store_le(note, 4, 4);
+    store_le(note + 4, 16, 4);
+    store_le(note + 8, 1, 4); // NT_GNU_ABI_TAG
+    memcpy(note + 12, "GNU", 4);
+    note += 32;
+    store_le(note, 4, 4);
+    store_le(note + 4, 20, 4);
+    store_le(note + 8, 3, 4); // NT_GNU_BUILD_ID
+    memcpy(note + 12, "GNU", 4);
+    for (unsigned i = 0; i < 20; i++)
+        note[16 + i] = 0xa0 + i;
+
+    uint8_t id[20];
+    size_t len = fd_elf_build_id(elf, sizeof elf, id, 4);
+    if (len == 20 && id[0] == 0xa0 && id[3] == 0xa3 &&
+        fd_elf_build_id(elf, sizeof elf, id, 20) == 20 && id[19] == 0xb3 &&
+        fd_elf_build_id(elf, 0xc0 + 32 + 35, id, 20) == 0)
+        return 0;
+
+    printf("Failed ELF build ID case: got %zu bytes\n", len);
+    return -1;
+}
+
+// Pseudo-random code with long instructions (movabs, lea with disp32), which
+// diverge often when decoded from a wrong offset.
+static
+void
+sweep_code(uint8_t* code, size_t len, uint64_t* state)
+{
+    for (size_t i = 0; i < len; i++) {
+        *state = *state * 6364136223846793005 + 1442695040888963407;
+        code[i] = *state >> 56;
+        if ((*state >> 40 & 7) == 0 && i + 10 <= len) {
+            memcpy(code + i, "\x48\xb8\x0f\x0f\x0f\x0f\x48\x8d\x80\x00", 10);
+            i += 9;
+        }
+    }
+}
+
+// Check a resolved sweep against a serial sweep.
+static
+int
+sweep_check(const FdSweep* sweep)
+{
+    static uint8_t exp[4096 / 8];
+    memset(exp, 0, sizeof exp);
+    for (size_t off = 0; off < sweep->len; ) {
+        FdInstr instr;
+        exp[off / 8] |= 1 << (off % 8);
+        int ret = fd_decode(sweep->buf + off, sweep->len - off, sweep->mode, 0,
+                            &instr);
+        off += ret > 0 ? ret : 1;
+    }
+
+    int ok = !memcmp(sweep->starts, exp, (sweep->len + 7) / 8);
+    const FdSweepChunk* chunks = sweep->chunks;
+    for (size_t i = 0; i < sweep->nchunks; i++) {
+        size_t exp_entry = i ? chunks[i - 1].exit : 0;
+        if (chunks[i].entry != exp_entry ||
+            (chunks[i].entry < sweep->len && !(exp[chunks[i].entry / 8] >> (chunks[i].entry % 8) & 1)))
+            ok = 0;
+    }
+    if (sweep->nchunks && chunks[sweep->nchunks - 1].exit != sweep->len)
+        ok = 0;
+    return ok;
+}
+
+// Compare a parallel sweep with three workers against a serial sweep.
+static
+int
+test_sweep(int mode, uint64_t seed, size_t len, size_t chunk_size)
+{
+    static uint8_t code[4096];
+    static uint8_t starts[sizeof code / 8];
+    FdSweepChunk chunks[sizeof code / 64];
+    uint64_t queues[3];
+    uint64_t state = seed;
+    sweep_code(code, len, &state);
+
+    FdSweep sweep;
+    memset(starts, 0xff, sizeof starts);
+    if (fd_sweep_init(&sweep, code, len, mode, chunk_size, starts, chunks,
+                      queues, 3)) {
+        printf("Failed sweep init case\n");
+        return -1;
+    }
+    // Workers one after the other: the last one does its own chunks, the
+    // others steal from each other.
+    fd_sweep_run(&sweep, 2);
+    fd_sweep_run(&sweep, 0);
+    fd_sweep_run(&sweep, 1);
+    size_t redone = fd_sweep_resolve(&sweep);
+    if (sweep_check(&sweep))
+        return 0;
+
+    printf("Failed sweep case: mode %d, seed %" PRIu64 ", len %zu, chunk %zu, "
+           "redone %zu\n", mode, seed, len, chunk_size, redone);
+    return -1;
+}
+
+// Patch a resolved sweep repeatedly at pseudo-random offsets, also across
+// chunk boundaries, and compare it against a serial sweep after each patch.
+// Decoding must converge soon after the patch.
+static
+int
+test_sweep_patch(int mode, uint64_t seed, size_t chunk_size)
+{
+    static uint8_t code[4096];
+    static uint8_t starts[sizeof code / 8];
+    FdSweepChunk chunks[sizeof code / 64];
+    uint64_t queues[1];
+    uint64_t state = seed;
+    sweep_code(code, sizeof code, &state);
+
+    FdSweep sweep;
+    fd_sweep_init(&sweep, code, sizeof code, mode, chunk_size, starts, chunks,
+                  queues, 1);
+    fd_sweep_run(&sweep, 0);
+    fd_sweep_resolve(&sweep);
+    for (unsigned i = 0; i < 64; i++) {
+        state = state * 6364136223846793005 + 1442695040888963407;
+        size_t off = (state >> 32) % sizeof code;
+        size_t len = (state >> 20 & 15) + 1;
+        if (len > sizeof code - off)
+            len = sizeof code - off;
+        sweep_code(code + off, len, &state);
+
+        size_t lo, hi;
+        size_t redone = fd_sweep_patch(&sweep, off, len, &lo, &hi);
+        if (!sweep_check(&sweep) || lo > off || hi < off + len ||
+            redone != hi - lo || redone > 256) {
+            printf("Failed sweep patch case: mode %d, seed %" PRIu64 ", "
+                   "patch %zu+%zu, redone %zu-%zu\n", mode, seed, off, len,
+                   lo, hi);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Format a graph for test_cfg; block sizes are checked against the code.
+// Blocks are written as start-end, followed by the edges as kind:target and
+// flags (e for entry, t for truncated); a target outside of the region is
+// marked with "!".
+static
+void
+cfg_format(const FdCfg* cfg, const uint8_t* buf, uint64_t base, char* got)
+{
+    char* cur = got;
+    for (size_t b = 0; b < cfg->nblocks; b++) {
+        const FdCfgBlock* block = &cfg->blocks[b];
+        cur += sprintf(cur, "%s%" PRIx64 "-%" PRIx64, b ? " " : "",
+                       block->start, block->end);
+        for (size_t e = block->succ; e < block->succ + block->nsucc; e++)
+            cur += sprintf(cur, " %c:%" PRIx64 "%s",
+                           "fjt"[cfg->edges[e].kind], cfg->edges[e].target,
+                           cfg->edges[e].dst == FD_CFG_NO_BLOCK ? "!" : "");
+        if (block->flags & FD_CFG_BLOCK_ENTRY)
+            cur += sprintf(cur, " e");
+        if (block->flags & FD_CFG_BLOCK_TRUNCATED)
+            cur += sprintf(cur, " t");
+        // Predecessors must match the edges.
+        for (size_t p = block->pred; p < block->pred + block->npred; p++) {
+            const FdCfgBlock* src = &cfg->blocks[cfg->preds[p]];
+            size_t e = src->succ;
+            while (e < src->succ + src->nsucc && cfg->edges[e].dst != b)
+                e++;
+            if (e == src->succ + src->nsucc)
+                cur += sprintf(cur, " bad-pred");
+        }
+        size_t ninstrs = 0;
+        for (uint64_t addr = block->start; addr < block->end; ninstrs++) {
+            FdInstr instr;
+            int ret = fd_decode(buf + (addr - base), block->end - addr, 64,
+                                0, &instr);
+            addr += ret > 0 ? (size_t) ret : block->end - addr;
+        }
+        if (ninstrs != block->ninstrs)
+            cur += sprintf(cur, " bad-count");
+        cur += sprintf(cur, ";");
+    }
+    for (size_t i = 0; i < cfg->ncalls; i++)
+        cur += sprintf(cur, " call:%" PRIx64, cfg->calls[i].target);
+}
+
+static
+int
+test_cfg(const void* buf, size_t buf_len, uint64_t base, uint64_t entry,
+         const char* exp_cfg)
+{
+    static uint64_t mem[4096];
+    FdArena arena = { mem, sizeof mem, 0 };
+    FdCfg cfg;
+    char got[512] = "no memory";
+    if (!fd_cfg_build(&cfg, &arena, buf, buf_len, base, 64, &entry, 1))
+        cfg_format(&cfg, buf, base, got);
+    if (!strcmp(got, exp_cfg))
+        return 0;
+
+    printf("Failed CFG case: ");
+    print_hex(buf, buf_len);
+    printf("\n  Exp: %s\n  Got: %s\n", exp_cfg, got);
+    return -1;
+}
+
+// Build the graph of the code, patch size bytes at off, and update it. The
+// code is at most 64 bytes.
+static
+int
+test_cfg_patch(const void* buf, size_t buf_len, uint64_t base, uint64_t entry,
+               size_t off, const void* patch, size_t size, const char* exp_cfg)
+{
+    static uint64_t mem[4096];
+    FdArena arena = { mem, sizeof mem, 0 };
+    uint8_t code[64];
+    memcpy(code, buf, buf_len);
+    FdCfg cfg;
+    char got[512] = "no memory";
+    if (!fd_cfg_build(&cfg, &arena, code, buf_len, base, 64, &entry, 1)) {
+        memcpy(code + off, patch, size);
+        if (!fd_cfg_patch(&cfg, &arena, code, buf_len, base, 64, base + off,
+                          base + off + size))
+            cfg_format(&cfg, code, base, got);
+    }
+    if (!strcmp(got, exp_cfg))
+        return 0;
+
+    printf("Failed CFG patch case: ");
+    print_hex(code, buf_len);
+    printf("\n  Exp: %s\n  Got: %s\n", exp_cfg, got);
+    return -1;
+}
+
+static
+int
+test_funcs(const void* buf, size_t buf_len, uint64_t base,
+           const FdSymbol* known, size_t nknown, const char* exp_funcs)
+{
+    // Split the code at every instruction boundary; the candidates of both
+    // parts must give the same result as those of a single scan.
+    int failed = 0;
+    size_t split = 0;
+    do {
+        FdFuncCand cands[64];
+        size_t count = fd_func_scan(buf, buf_len, base, 64, 0, split, cands,
+                                    64);
+        count += fd_func_scan(buf, buf_len, base, 64, split, buf_len,
+                              cands + count, 64 - count);
+        count = fd_func_reconcile(cands, count, known, nknown);
+
+        char got[256] = "";
+        char* cur = got;
+        for (size_t i = 0; i < count; i++) {
+            cur += sprintf(cur, "%s%" PRIx64 ":", i ? " " : "",
+                           cands[i].addr);
+            for (unsigned bit = 0; bit < 7; bit++)
+                if (cands[i].sources >> bit & 1)
+                    *cur++ = "cbpgaej"[bit];
+            *cur = '\0';
+        }
+        if (strcmp(got, exp_funcs)) {
+            printf("Failed function entry case, split at %zu: ", split);
+            print_hex(buf, buf_len);
+            printf("\n  Exp: %s\n  Got: %s\n", exp_funcs, got);
+            failed = -1;
+        }
+
+        FdInstr instr;
+        int ret = fd_decode((const uint8_t*) buf + split, buf_len - split, 64,
+                            0, &instr);
+        split += ret > 0 ? (size_t) ret : 1;
+    } while (split < buf_len);
+    return failed;
+}
+
+// Build an index with three workers, which run one after the other.
+static
+void
+xref_build(FdXrefIndex* index, const FdXref* refs, const uint8_t* kinds,
+           size_t count, FdXref* scratch)
+{
+    static uint64_t hist[FD_XREF_HIST(3)];
+    fd_xref_init(index, refs, kinds, count, scratch, hist, 3);
+    while (fd_xref_step(index))
+        for (unsigned w = 0; w < 3; w++)
+            fd_xref_run(index, 2 - w);
+}
+
+// References are written as from>to with the kind (cjbam), then the targets
+// as to<sources.
+static
+int
+test_xref(int mode, const void* buf, size_t buf_len, uint64_t base,
+          const char* exp_xrefs)
+{
+    FdXref refs[16], scratch[2 * 16 + 1];
+    uint8_t kinds[16];
+    size_t count = fd_xref_scan(buf, buf_len, base, mode, 0, buf_len, refs,
+                                kinds, 16);
+    char got[512] = "too many";
+    if (count <= 16) {
+        FdXrefIndex index;
+        xref_build(&index, refs, kinds, count, scratch);
+        char* cur = got;
+        for (size_t i = 0; i < count; i++)
+            cur += sprintf(cur, "%" PRIx64 ">%" PRIx64 "%c ", refs[i].from,
+                           refs[i].to, "cjbam"[kinds[i]]);
+        cur += sprintf(cur, "|");
+        for (size_t t = 0; t < index.ntargets; t++) {
+            // Each target must be found by a query for its address.
+            size_t first;
+            size_t n = fd_xref_to(&index, index.targets[t],
+                                  index.targets[t] + 1, &first);
+            cur += sprintf(cur, " %" PRIx64 "<", index.targets[t]);
+            for (size_t i = first; i < first + n; i++)
+                cur += sprintf(cur, "%s%" PRIx64, i > first ? "," : "",
+                               index.sources[i]);
+        }
+        for (size_t i = 0; i < count; i++) {
+            size_t first;
+            if (fd_xref_from(&index, refs[i].from, refs[i].from + 1,
+                             &first) != 1 || first != i)
+                cur += sprintf(cur, " bad-from:%" PRIx64, refs[i].from);
+        }
+    }
+    if (!strcmp(got, exp_xrefs))
+        return 0;
+
+    printf("Failed xref case: ");
+    print_hex(buf, buf_len);
+    printf("\n  Exp: %s\n  Got: %s\n", exp_xrefs, got);
+    return -1;
+}
+
+// Build an index of one section with the records written in two halves and
+// query it. Instructions are written as address:size with the reference kind
+// and target, then the targets as in test_xref and the function at the end.
+static
+int
+test_index(int mode, const void* buf, size_t buf_len, uint64_t base,
+           const char* exp_index)
+{
+    static uint64_t data[1024];
+    uint8_t starts[64] = {0};
+    for (size_t off = 0; off < buf_len; ) {
+        FdInstr instr;
+        int ret = fd_decode((const uint8_t*) buf + off, buf_len - off, mode, 0,
+                            &instr);
+        if (ret < 0) {
+            off++;
+            continue;
+        }
+        starts[off / 8] |= 1 << off % 8;
+        off += ret;
+    }
+    FdXref refs[16], scratch[2 * 16 + 1];
+    uint8_t kinds[16];
+    size_t count = fd_xref_scan(buf, buf_len, base, mode, 0, buf_len, refs,
+                                kinds, 16);
+    FdXrefIndex xrefs;
+    xref_build(&xrefs, refs, kinds, count, scratch);
+    FdIndexFunc func = { base, buf_len, FD_FUNC_SYMBOL };
+    FdIndexInput sec = { ".text", base, buf, buf_len, mode, starts, &xrefs,
+                         &func, 1 };
+
+    char got[512] = "init failed";
+    size_t size = fd_index_init(data, sizeof data, (const uint8_t*) "\x12\x34",
+                                2, &sec, 1);
+    FdIndex index;
+    if (size && size <= sizeof data) {
+        fd_index_fill(data, &sec, 0, buf_len / 2, buf_len);
+        fd_index_fill(data, &sec, 0, 0, buf_len / 2);
+        strcpy(got, "open failed");
+    }
+    if (size && size <= sizeof data && !fd_index_open(&index, data, size)) {
+        char* cur = got;
+        uint64_t addr = base;
+        const FdIndexRecord* rec;
+        while ((rec = fd_index_next(&index, addr, &addr))) {
+            cur += sprintf(cur, "%" PRIx64 ":%u", addr, rec->size);
+            if (FD_INDEX_HAS_REF(rec))
+                cur += sprintf(cur, "%c>%" PRIx64, "cjbam"[FD_INDEX_REF_KIND(rec)],
+                               fd_index_target(&index, rec, addr));
+            cur += sprintf(cur, " ");
+            // Every byte of the instruction must find it.
+            for (unsigned i = 0; i < rec->size; i++) {
+                uint64_t start;
+                if (fd_index_instr(&index, addr + i, &start) != rec ||
+                    start != addr)
+                    cur += sprintf(cur, "bad-instr:%" PRIx64 " ", addr + i);
+            }
+            addr += rec->size;
+        }
+        cur += sprintf(cur, "|");
+        const FdIndexSection* text = fd_index_section(&index, ".text");
+        for (size_t t = 0; text && t < xrefs.ntargets; t++) {
+            const uint64_t* sources;
+            size_t n = fd_index_refs_to(&index, text, xrefs.targets[t],
+                                        xrefs.targets[t] + 1, &sources);
+            cur += sprintf(cur, " %" PRIx64 "<", xrefs.targets[t]);
+            for (size_t i = 0; i < n; i++)
+                cur += sprintf(cur, "%s%" PRIx64, i ? "," : "", sources[i]);
+        }
+        const FdIndexFunc* f = fd_index_func(&index, base + buf_len - 1);
+        if (f && !fd_index_func(&index, base + buf_len))
+            cur += sprintf(cur, " | f:%" PRIx64 "+%" PRIx32, f->addr, f->size);
+    }
+    if (!strcmp(got, exp_index))
+        return 0;
+
+    printf("Failed index case: ");
+    print_hex(buf, buf_len);
+    printf("\n  Exp: %s\n  Got: %s\n", exp_index, got);
+    return -1;
+}
+
+// A valid index must be rejected when truncated or when it was built with
+// other decode tables.
+static
+int
+test_index_open(void)
+{
+    static uint64_t data[64];
+    uint8_t starts[1] = {1};
+    FdIndexInput sec = { ".init", 0x1000, (const uint8_t*) "\xc3", 1, 64,
+                         starts, NULL, NULL, 0 };
+    size_t size = fd_index_init(data, sizeof data, NULL, 0, &sec, 1);
+    fd_index_fill(data, &sec, 0, 0, 1);
+    FdIndex index;
+    int valid = fd_index_open(&index, data, size);
+    int truncated = fd_index_open(&index, data, size - 8);
+    FdIndexHeader* hdr = (FdIndexHeader*) data;
+    hdr->table_hash ^= 1;
+    int stale = fd_index_open(&index, data, size);
+    hdr->table_hash ^= 1;
+    hdr->nsections = 1000;
+    int corrupt = fd_index_open(&index, data, size);
+    if (size && size <= sizeof data && !valid && truncated == -1 &&
+        stale == -2 && corrupt == -1)
+        return 0;
+    printf("Failed index open case: size %zu, %d %d %d %d\n", size, valid,
+           truncated, stale, corrupt);
+    return -1;
+}
+
+// Sort pseudo-random references with targets spanning the given number of
+// bits and check the CSR arrays against the input.
+static
+int
+test_xref_sort(uint64_t seed, size_t count, unsigned span_bits)
+{
+    static FdXref refs[4096], scratch[2 * 4096 + 1];
+    static uint8_t kinds[4096];
+    uint64_t state = seed;
+    uint64_t mask = span_bits < 64 ? ((uint64_t) 1 << span_bits) - 1 : ~(uint64_t) 0;
+    for (size_t i = 0; i < count; i++) {
+        state = state * 6364136223846793005 + 1442695040888963407;
+        refs[i].from = 0x400000 + 4 * i;
+        // Few distinct targets, so that most have several sources.
+        refs[i].to = (0x1234000 + (state >> 20) % 97 * 0x10001357) & mask;
+        kinds[i] = FD_XREF_CALL;
+    }
+    FdXrefIndex index;
+    xref_build(&index, refs, kinds, count, scratch);
+
+    int ok = index.first[index.ntargets] == count;
+    for (size_t t = 0; ok && t < index.ntargets; t++) {
+        ok &= t == 0 || index.targets[t - 1] < index.targets[t];
+        for (size_t i = index.first[t]; ok && i < index.first[t + 1]; i++) {
+            // The source must reference the target, in ascending order.
+            size_t pos = (index.sources[i] - 0x400000) / 4;
+            ok &= pos < count && refs[pos].to == index.targets[t];
+            ok &= i == index.first[t] || index.sources[i - 1] < index.sources[i];
+        }
+    }
+    if (ok)
+        return 0;
+
+    printf("Failed xref sort case: seed %" PRIu64 ", count %zu, span %u\n",
+           seed, count, span_bits);
+    return -1;
+}
+
+// Matches are written as pattern:start-end, sorted by start and pattern, with
+// the captures as type.index. The code is split at every instruction
+// boundary; both parts must give the matches of a single scan.
+static
+int
+test_pat(const char* const* pats, size_t npats, const void* buf,
+         size_t buf_len, const char* exp_matches)
+{
+    FdPatStep steps[64];
+    uint64_t index[64];
+    size_t nsteps = 0;
+    for (size_t i = 0; i < npats; i++) {
+        size_t err;
+        size_t n = fd_pat_compile(pats[i], i, steps + nsteps, 64 - nsteps,
+                                  &err);
+        if (!n || n > 64 - nsteps) {
+            printf("Failed pattern case: %s at %zu\n", pats[i], err);
+            return -1;
+        }
+        nsteps += n;
+    }
+    FdPatSet set;
+    if (fd_pat_init(&set, steps, nsteps, index, 64)) {
+        printf("Failed pattern init case\n");
+        return -1;
+    }
+
+    int failed = 0;
+    size_t split = 0;
+    do {
+        FdPatThread threads[2 * 8];
+        FdPatMatch matches[32];
+        size_t count = fd_pat_scan(&set, buf, buf_len, 0x1000, 64, 0, split,
+                                   threads, 8, matches, 32);
+        count += fd_pat_scan(&set, buf, buf_len, 0x1000, 64, split, buf_len,
+                             threads, 8, matches + count, 32 - count);
+        for (size_t i = 1; i < count; i++) {
+            FdPatMatch tmp = matches[i];
+            size_t j = i;
+            for (; j && (matches[j - 1].start > tmp.start ||
+                         (matches[j - 1].start == tmp.start &&
+                          matches[j - 1].pattern > tmp.pattern)); j--)
+                matches[j] = matches[j - 1];
+            matches[j] = tmp;
+        }
+
+        char got[256] = "";
+        char* cur = got;
+        for (size_t i = 0; i < count; i++) {
+            cur += sprintf(cur, "%s%u:%" PRIx64 "-%" PRIx64, i ? " " : "",
+                           matches[i].pattern, matches[i].start,
+                           matches[i].end);
+            for (unsigned c = 0; c < FD_PAT_CAPTURES; c++)
+                if (matches[i].regs[c] != FD_REG_NONE)
+                    cur += sprintf(cur, " %u.%u", matches[i].reg_types[c],
+                                   matches[i].regs[c]);
+        }
+        if (strcmp(got, exp_matches)) {
+            printf("Failed pattern case, split at %zu: ", split);
+            print_hex(buf, buf_len);
+            printf("\n  Exp: %s\n  Got: %s\n", exp_matches, got);
+            failed = -1;
+        }
+
+        FdInstr instr;
+        int ret = fd_decode((const uint8_t*) buf + split, buf_len - split, 64,
+                            0, &instr);
+        split += ret > 0 ? (size_t) ret : 1;
+    } while (split < buf_len);
+    return failed;
+}
+
+static
+int
+test_pat_error(const char* pat, size_t exp_err)
+{
+    size_t err = SIZE_MAX;
+    size_t n = fd_pat_compile(pat, 0, NULL, 0, &err);
+    if (!n && err == exp_err)
+        return 0;
+    printf("Failed pattern error case: %s\n  Exp: %zu\n  Got: %zu steps, "
+           "error %zu\n", pat, exp_err, n, err);
+    return -1;
+}
+
+// push rbp; mov rbp, rsp; mov rax, [rip+disp]; test eax, eax; je 0x14;
+// call rel; pop rbp; ret. The RIP-relative displacement and the call target
+// differ between builds.
+#define FP_CODE(disp, call) \
+        "\x55\x48\x89\xe5\x48\x8b\x05" disp "\x00\x00\x85\xc0\x74\x05" \
+        "\xe8" call "\x00\x00\x5d\xc3"
+
+static
+int
+test_fp(void)
+{
+    static const uint8_t code[] = FP_CODE("\x00\x01", "\xf0\xff")
+                                  FP_CODE("\x00\x02", "\x34\x12");
+    static const uint8_t other_reg[] = FP_CODE("\x00\x01", "\xf0\xff");
+    FdSymbol funcs[] = { { 0x1000, 0, NULL }, { 0x1016, 0, NULL } };
+    FdFingerprint fps[3];
+    int failed = 0;
+
+    // The second copy is moved and links to other addresses.
+    if (fd_fp_scan(code, sizeof code - 1, 0x1000, 64, funcs, 2, fps) != 2 ||
+        fps[0].hash != fps[1].hash || fps[0].simhash != fps[1].simhash ||
+        fd_fp_similarity(&fps[0], &fps[1]) != FD_FP_SLOTS ||
+        fps[0].ninstrs != 8) {
+        printf("Failed fingerprint case, moved function\n");
+        failed = -1;
+    }
+
+    // Streaming the instructions gives the same fingerprint.
+    FdFpState st;
+    fd_fp_begin(&st, 0x5000, 0x5016);
+    for (size_t off = 0; off < 0x16; ) {
+        FdInstr instr;
+        int ret = fd_decode(code + off, 0x16 - off, 64, 0, &instr);
+        fd_fp_add(&st, &instr, 0x5000 + off);
+        off += ret;
+    }
+    fd_fp_end(&st, &fps[2]);
+    if (fps[0].hash != fps[2].hash || fps[0].simhash != fps[2].simhash ||
+        fps[0].ninstrs != fps[2].ninstrs ||
+        memcmp(fps[0].minhash, fps[2].minhash, sizeof fps[0].minhash)) {
+        printf("Failed fingerprint case, streaming\n");
+        failed = -1;
+    }
+
+    // test ecx, ecx instead of test eax, eax: a different function, but
+    // similar.
+    FdSymbol func = { 0x1000, sizeof other_reg - 1, NULL };
+    uint8_t changed[sizeof other_reg];
+    memcpy(changed, other_reg, sizeof other_reg);
+    changed[12] = 0xc9;
+    fd_fp_scan(changed, sizeof changed - 1, 0x1000, 64, &func, 1, &fps[2]);
+    unsigned sim = fd_fp_similarity(&fps[0], &fps[2]);
+    if (fps[0].hash == fps[2].hash || sim < FD_FP_SLOTS / 2 ||
+        sim == FD_FP_SLOTS || __builtin_popcountll(fps[0].simhash ^
+                                                   fps[2].simhash) > 24) {
+        printf("Failed fingerprint case, changed register\n  Got: %u slots, "
+               "%d bits\n", sim,
+               __builtin_popcountll(fps[0].simhash ^ fps[2].simhash));
+        failed = -1;
+    }
+
+    // Functions outside of the code are skipped.
+    FdSymbol outside = { 0x2000, 0x10, NULL };
+    if (fd_fp_scan(code, sizeof code - 1, 0x1000, 64, &outside, 1, fps) != 0 ||
+        fps[0].ninstrs != 0) {
+        printf("Failed fingerprint case, outside\n");
+        failed = -1;
+    }
+    return failed;
+}
+
+static
+int
+test_columns(void)
+{
+    // mov rax, [rip+0x10]; jmp 0x100b; mov eax, -1;
+    // lock add [rdi+4*rcx+8], eax; (bad); ret
+    static const uint8_t code[] = "\x48\x8b\x05\x10\x00\x00\x00\xeb\x02\xb8"
+                                  "\xff\xff\xff\xff\xf0\x01\x44\x8f\x08\x06"
+                                  "\xc3";
+    char exp[512];
+    snprintf(exp, sizeof exp,
+             "1000 7 %u 8 16 0 1017 1:8:0:1 3:8:16:63 0:0:0:0 0:0:0:0\n"
+             "1007 2 %u 8 0 0 100b 4:8:0:0 0:0:0:0 0:0:0:0 0:0:0:0\n"
+             "1009 5 %u 0 0 -1 0 1:4:0:1 2:4:0:0 0:0:0:0 0:0:0:0\n"
+             "100e 5 %u 1 8 0 0 3:4:7:129 1:4:0:1 0:0:0:0 0:0:0:0\n"
+             "1013 0 0 0 0 0 0 0:0:0:0 0:0:0:0 0:0:0:0 0:0:0:0\n"
+             "1014 1 %u 0 0 0 0 0:0:0:0 0:0:0:0 0:0:0:0 0:0:0:0\n",
+             FDI_MOV, FDI_JMP, FDI_MOVABS, FDI_ADD, FDI_RET);
+
+    int failed = 0;
+    uint64_t buf[256];
+    FdColumns cols;
+    FdColumnDesc desc[FD_COLUMNS];
+    size_t size = fd_columns_layout(&cols, buf, 6, desc);
+    if (size > sizeof buf || size != fd_columns_layout(NULL, NULL, 6, NULL) ||
+        strcmp(desc[0].name, "addr") || desc[FD_COLUMNS - 1].width != 8 ||
+        (uint8_t*) cols.target + 6 * 8 != (uint8_t*) buf + size) {
+        printf("Failed column layout case\n");
+        return -1;
+    }
+    // Split in two chunks at every instruction start.
+    for (size_t split = 0; split < sizeof code - 1; ) {
+        size_t rows = fd_columns_decode(&cols, 0, 6, code, sizeof code - 1,
+                                        0x1000, 64, 0, split);
+        rows += fd_columns_decode(&cols, rows, 6 - rows, code, sizeof code - 1,
+                                  0x1000, 64, split, sizeof code - 1);
+        char got[512] = "";
+        char* cur = got;
+        for (size_t r = 0; r < rows && r < 6; r++) {
+            cur += sprintf(cur, "%" PRIx64 " %u %u %u %" PRId64 " %" PRId64
+                           " %" PRIx64, cols.addr[r], cols.size[r],
+                           cols.type[r], cols.flags[r], cols.disp[r],
+                           cols.imm[r], cols.target[r]);
+            for (unsigned i = 0; i < 4; i++)
+                cur += sprintf(cur, " %u:%u:%u:%u", cols.op_kind[i][r],
+                               cols.op_size[i][r], cols.op_reg[i][r],
+                               cols.op_misc[i][r]);
+            *cur++ = '\n';
+            *cur = '\0';
+        }
+        if (rows != 6 || strcmp(got, exp)) {
+            printf("Failed column case, split at %zu\n  Exp:\n%s  Got:\n%s",
+                   split, exp, got);
+            failed = -1;
+        }
+        FdInstr instr;
+        int ret = fd_decode(code + split, sizeof code - 1 - split, 64, 0,
+                            &instr);
+        split += ret > 0 ? (size_t) ret : 1;
+    }
+
+    // Rows beyond the capacity are counted, but not written.
+    cols.addr[2] = 0;
+    if (fd_columns_decode(&cols, 0, 2, code, sizeof code - 1, 0x1000, 64, 0,
+                          sizeof code - 1) != 6 || cols.addr[2] != 0) {
+        printf("Failed column capacity case\n");
+        failed = -1;
+    }
+    return failed;
+}
+
+static
+int
+test_profile(void)
+{
+    // test eax, eax; je 0x1005; nop; inc eax; (bad); ret
+    static const uint8_t code[] = "\x85\xc0\x74\x01\x90\xff\xc0\x06\xc3";
+    uint64_t ips[] = {
+        0x1008, 0x1000, 0x7f0000001000, 0x1005, 0x1008, 0x1001, 0x1008,
+        0x1000, 0xfff, 0x1007, 0x1008, 0x1005, 0x1000, 0x1008,
+    };
+    size_t nips = sizeof ips / sizeof ips[0];
+    uint64_t tmp[sizeof ips / sizeof ips[0]];
+    int failed = 0;
+
+    fd_profile_sort(ips, nips, tmp);
+    FdProfileSample samples[sizeof ips / sizeof ips[0]];
+    size_t nsamples = fd_profile_count(ips, nips, samples);
+    char got[256] = "";
+    char* cur = got;
+    for (size_t i = 0; i < nsamples; i++)
+        cur += sprintf(cur, "%" PRIx64 ":%" PRIu64 " ", samples[i].addr,
+                       samples[i].count);
+    const char* exp = "fff:1 1000:3 1001:1 1005:2 1007:1 1008:5 "
+                      "7f0000001000:1 ";
+    if (strcmp(got, exp)) {
+        printf("Failed profile sort case\n  Exp: %s\n  Got: %s\n", exp, got);
+        failed = -1;
+    }
+
+    // Blocks start after the branch, at its target, and after the bad byte.
+    FdProfileInstr instrs[8];
+    size_t count = fd_profile_sweep(code, sizeof code - 1, 0x1000, 64, 0,
+                                    sizeof code - 1, samples, nsamples,
+                                    instrs, 8);
+    cur = got;
+    for (size_t i = 0; i < count && i < 8; i++)
+        cur += sprintf(cur, "%" PRIx64 ":%u:%u:%" PRIu64 " ", instrs[i].addr,
+                       instrs[i].size, instrs[i].flags, instrs[i].samples);
+    exp = "1000:2:1:4 1002:2:2:0 1004:1:1:0 1005:2:1:2 1007:0:2:1 "
+          "1008:1:3:5 ";
+    if (count != 6 || strcmp(got, exp)) {
+        printf("Failed profile case\n  Exp: %s\n  Got: %s\n", exp, got);
+        failed = -1;
+    }
+
+    // Instructions beyond the capacity are counted, but not written.
+    instrs[3].addr = 0;
+    if (fd_profile_sweep(code, sizeof code - 1, 0x1000, 64, 0, sizeof code - 1,
+                         samples, nsamples, instrs, 3) != 6 ||
+        instrs[3].addr != 0 || instrs[0].samples != 4) {
+        printf("Failed profile capacity case\n");
+        failed = -1;
+    }
+    return failed;
+}
+
 #define TEST1(mode, buf, exp_fmt) test(buf, sizeof(buf)-1, mode, exp_fmt)
 #define TEST32(...) failed |= TEST1(32, __VA_ARGS__)
 #define TEST64(...) failed |= TEST1(64, __VA_ARGS__)
 #define TEST(...) failed |= TEST1(32, __VA_ARGS__) | TEST1(64, __VA_ARGS__)
+#define TEST_ATT32(buf, ...) failed |= test_att(buf, sizeof(buf)-1, 32, __VA_ARGS__)
+#define TEST_ATT64(buf, ...) failed |= test_att(buf, sizeof(buf)-1, 64, __VA_ARGS__)
+#define TEST_EFL(buf, ...) failed |= test_eflags(buf, sizeof(buf)-1, 64, __VA_ARGS__)
+#define TEST_LIVE(buf, live_out, live_in, ...) \
+        failed |= test_liveness(buf, sizeof(buf)-1, live_out, live_in, \
+                                (const unsigned[]) {__VA_ARGS__})
+#define TEST_REGS(buf, ...) failed |= test_regs(buf, sizeof(buf)-1, __VA_ARGS__)
+#define TEST_MEM32(buf, ...) failed |= test_mem(buf, sizeof(buf)-1, 32, __VA_ARGS__)
+#define TEST_MEM64(buf, ...) failed |= test_mem(buf, sizeof(buf)-1, 64, __VA_ARGS__)
+#define TEST_CF32(buf, ...) failed |= test_cf(buf, sizeof(buf)-1, 32, __VA_ARGS__)
+#define TEST_CF64(buf, ...) failed |= test_cf(buf, sizeof(buf)-1, 64, __VA_ARGS__)
+#define TEST_FEAT(buf, ...) failed |= test_features(buf, sizeof(buf)-1, __VA_ARGS__)
+#define TEST_LISTING(buf, ...) failed |= test_listing(buf, sizeof(buf)-1, __VA_ARGS__)
+#define TEST_TOK(buf, ...) failed |= test_tokens(buf, sizeof(buf)-1, __VA_ARGS__)
+#define TEST_SYM(buf, ...) failed |= test_format_sym(buf, sizeof(buf)-1, __VA_ARGS__)
+#define TEST_COST(uarch, buf, ...) \
+        failed |= test_block_cost(buf, sizeof(buf)-1, FD_UARCH_ ## uarch, __VA_ARGS__)
 
 int
 main(int argc, char** argv)
@@ -2759,6 +4018,470 @@ main(int argc, char** argv)
     TEST("\x62\xf5\x66\x4c\x11\xd5", "vmovsh xmm5{k4}, xmm3, xmm2");
     TEST64("\x62\x25\x66\x4c\x11\xd5", "vmovsh xmm21{k4}, xmm3, xmm26");
 
+    // EFLAGS
+    unsigned efl_arith = FD_EFL_STATUS;
+    TEST_EFL("\x90", 0, 0, 0); // nop
+    TEST_EFL("\x01\xc0", 0, efl_arith, 0); // add eax, eax
+    TEST_EFL("\x11\xc0", FD_EFL_CF, efl_arith, 0); // adc eax, eax
+    TEST_EFL("\x21\xc0", 0, efl_arith, FD_EFL_AF); // and eax, eax
+    TEST_EFL("\xff\xc0", 0, efl_arith & ~FD_EFL_CF, 0); // inc eax
+    TEST_EFL("\x74\x00", FD_EFL_ZF, 0, 0); // jz
+    TEST_EFL("\x0f\x4f\xc1", FD_EFL_ZF|FD_EFL_SF|FD_EFL_OF, 0, 0); // cmovg
+    TEST_EFL("\xf9", 0, FD_EFL_CF, 0); // stc
+    TEST_EFL("\xfc", 0, FD_EFL_DF, 0); // cld
+    TEST_EFL("\xf5", FD_EFL_CF, FD_EFL_CF, 0); // cmc
+    TEST_EFL("\x9c", FD_EFL_STATUS|FD_EFL_IF|FD_EFL_DF, 0, 0); // pushf
+    TEST_EFL("\xc1\xe0\x04", 0, efl_arith, FD_EFL_AF); // shl eax, 4
+    TEST_EFL("\xc1\xe0\x20", 0, 0, 0); // shl eax, 32: count masked to 0
+    TEST_EFL("\x48\xc1\xe0\x20", 0, efl_arith, FD_EFL_AF); // shl rax, 32
+    TEST_EFL("\xd3\xe0", efl_arith, efl_arith, FD_EFL_AF); // shl eax, cl
+    TEST_EFL("\xd1\xd0", FD_EFL_CF, FD_EFL_CF|FD_EFL_OF, 0); // rcl eax, 1
+    TEST_EFL("\xa6", FD_EFL_DF, efl_arith, 0); // cmpsb
+    TEST_EFL("\xf3\xa6", efl_arith|FD_EFL_DF, efl_arith, 0); // repz cmpsb
+    TEST_EFL("\xf3\xa4", FD_EFL_DF, 0, 0); // rep movsb
+    TEST_EFL("\x0f\xbc\xc1", 0, efl_arith, efl_arith & ~FD_EFL_ZF); // bsf
+
+    // cmp eax, ebx; jz
+    TEST_LIVE("\x39\xd8\x74\x00", 0, 0, FD_EFL_ZF, 0);
+    // add eax, 1; adc edx, 0; setc al -- only CF of the add is needed
+    TEST_LIVE("\x83\xc0\x01\x83\xd2\x00\x0f\x92\xc0", 0, 0,
+              FD_EFL_CF, FD_EFL_CF, 0);
+    // inc eax; jc -- CF not written by inc, live across it
+    TEST_LIVE("\xff\xc0\x72\x00", 0, FD_EFL_CF, FD_EFL_CF, 0);
+    // test eax, eax; shl eax, cl; jz -- shift may keep ZF of the test
+    TEST_LIVE("\x85\xc0\xd3\xe0\x74\x00", 0, 0,
+              FD_EFL_ZF, FD_EFL_ZF, 0);
+    // add eax, eax; mov eax, ebx -- flags live out of the block
+    TEST_LIVE("\x01\xc0\x89\xd8", FD_EFL_STATUS, 0,
+              FD_EFL_STATUS, FD_EFL_STATUS);
+
+    // Register sets; bit n of GPL is register n, bit 16 is rip.
+    TEST_REGS("\x01\xc8", FD_RT_GPL, 0x3, 0x1); // add eax, ecx
+    TEST_REGS("\x89\xc8", FD_RT_GPL, 0x2, 0x1); // mov eax, ecx
+    TEST_REGS("\x66\x89\xc8", FD_RT_GPL, 0x3, 0x1); // mov ax, cx: partial
+    TEST_REGS("\x88\xe0", FD_RT_GPL, 0x1, 0x1); // mov al, ah
+    TEST_REGS("\xf7\xe1", FD_RT_GPL, 0x3, 0x5); // mul ecx
+    TEST_REGS("\xf6\xe1", FD_RT_GPL, 0x3, 0x1); // mul cl
+    TEST_REGS("\xc4\xe2\xf3\xf6\xc2", FD_RT_GPL, 0x4, 0x3); // mulx rax, rcx, rdx
+    TEST_REGS("\xf7\xf1", FD_RT_GPL, 0x7, 0x5); // div ecx
+    TEST_REGS("\x6b\xc1\x05", FD_RT_GPL, 0x2, 0x1); // imul eax, ecx, 5
+    TEST_REGS("\xf3\xa4", FD_RT_GPL, 0xc2, 0xc2); // rep movsb
+    TEST_REGS("\x50", FD_RT_GPL, 0x11, 0x10); // push rax
+    TEST_REGS("\x58", FD_RT_GPL, 0x10, 0x11); // pop rax
+    TEST_REGS("\xc9", FD_RT_GPL, 0x30, 0x30); // leave
+    TEST_REGS("\x0f\xa2", FD_RT_GPL, 0x3, 0xf); // cpuid
+    TEST_REGS("\x99", FD_RT_GPL, 0x1, 0x4); // cdq
+    TEST_REGS("\x87\xca", FD_RT_GPL, 0x6, 0x6); // xchg edx, ecx
+    TEST_REGS("\x0f\xc7\x0f", FD_RT_GPL, 0x8f, 0x5); // cmpxchg8b [rdi]
+    TEST_REGS("\xec", FD_RT_GPL, 0x5, 0x1); // in al, dx
+    TEST_REGS("\x8b\x04\x8b", FD_RT_GPL, 0xa, 0x1); // mov eax, [rbx+4*rcx]
+    TEST_REGS("\x8b\x05\x00\x00\x00\x00", FD_RT_GPL, 0x10000, 0x1);
+    TEST_REGS("\x64\x8b\x00", FD_RT_SEG, 0x10, 0); // mov eax, fs:[rax]
+    TEST_REGS("\x0f\x58\xc1", FD_RT_VEC, 0x3, 0x1); // addps: upper kept
+    TEST_REGS("\xc5\xf0\x58\xc2", FD_RT_VEC, 0x6, 0x1); // vaddps
+    TEST_REGS("\xc4\xe2\x71\xa8\xc2", FD_RT_VEC, 0x7, 0x1); // vfmadd213ps
+    TEST_REGS("\x62\xf1\x74\x09\x58\xc2", FD_RT_VEC, 0x7, 0x1); // {k1}
+    TEST_REGS("\x62\xf1\x74\x89\x58\xc2", FD_RT_VEC, 0x6, 0x1); // {k1}{z}
+    TEST_REGS("\x62\xf1\x74\x89\x58\xc2", FD_RT_MASK, 0x2, 0);
+    TEST_REGS("\xc5\xf8\x77", FD_RT_VEC, 0xffff, 0xffff); // vzeroupper
+    TEST_REGS("\xd8\xc1", FD_RT_FPU, 0x3, 0x1); // fadd st(0), st(1)
+    TEST_REGS("\xd9\xc1", FD_RT_FPU, 0xff, 0xff); // fld st(1)
+
+    // Memory operands: index, access, size, effective address
+    const unsigned rd = FD_MEM_READ, wr = FD_MEM_WRITE;
+    TEST_MEM64("\x01\x03", 0, rd|wr, 4, 0x4000); // add [rbx], eax
+    TEST_MEM64("\x03\x03", 1, rd, 4, 0x4000); // add eax, [rbx]
+    TEST_MEM64("\x89\x03", 0, wr, 4, 0x4000); // mov [rbx], eax
+    TEST_MEM64("\x8d\x44\x8b\x10", 1, 0, 0, 0xc010); // lea eax, [rbx+4*rcx+16]
+    TEST_MEM64("\x8b\x05\x10\x00\x00\x00", 1, rd, 4, 0x11016); // [rip+16]
+    TEST_MEM64("\x67\x8b\x40\xff", 1, rd, 4, 0xfff); // [eax-1]
+    TEST_MEM64("\x67\x8b\x40\xfe", 1, rd, 4, 0xffe);
+    TEST_MEM32("\x8b\x40\xff", 1, rd, 4, 0xfff); // mov eax, [eax-1]
+    TEST_MEM32("\x8b\x05\xfc\xff\xff\xff", 1, rd, 4, 0xfffffffc);
+    TEST_MEM64("\x64\x8b\x00", 1, rd, 4, 0x101000); // mov eax, fs:[rax]
+    TEST_MEM64("\x65\x48\x8b\x04\x25\x28\x00\x00\x00", 1, rd, 8, 0x200028);
+    TEST_MEM64("\xa1\x00\x00\x00\x00\x01\x00\x00\x00", 1, rd, 4, 0x100000000);
+    TEST_MEM64("\x0f\x29\x00", 0, wr, 16, 0x1000); // movaps [rax], xmm0
+    TEST_MEM64("\x0f\x28\x00", 1, rd, 16, 0x1000); // movaps xmm0, [rax]
+    TEST_MEM64("\x62\xf1\x7c\x58\x58\x00", 2, rd, 4, 0x1000); // {1to16}
+    TEST_MEM64("\x0f\x18\x08", 0, 0, 0, 0x1000); // prefetcht0 [rax]
+    TEST_MEM64("\xdb\x28", 0, rd, 10, 0x1000); // fld tbyte ptr [rax]
+    TEST_MEM64("\xd8\x00", 0, rd, 4, 0x1000); // fadd dword ptr [rax]
+    TEST_MEM64("\xdd\x18", 0, wr, 8, 0x1000); // fstp qword ptr [rax]
+    TEST_MEM64("\xd9\x20", 0, rd, 28, 0x1000); // fldenv [rax]
+    TEST_MEM64("\x0f\xae\x00", 0, wr, 512, 0x1000); // fxsave [rax]
+    TEST_MEM64("\x0f\xae\x20", 0, wr, 0, 0x1000); // xsave [rax]
+    TEST_MEM64("\x0f\x01\x10", 0, rd, 10, 0x1000); // lgdt [rax]
+    TEST_MEM32("\x0f\x01\x10", 0, rd, 6, 0x1000);
+    TEST_MEM64("\x48\x0f\xc7\x0f", 0, rd|wr, 16, 0x8000); // cmpxchg16b
+    TEST_MEM64("\xff\x28", 0, rd, 6, 0x1000); // jmp far [rax]
+    TEST_MEM64("\xc4\xe2\xe9\x93\x04\xe7", 1, rd, 8, 0x8000); // vgatherqpd
+
+    // Control flow; the instruction is at 0x1000.
+    TEST_CF64("\x90", FD_CF_NONE, 0);
+    TEST_CF64("\xeb\xfe", FD_CF_JMP, 0x1000);
+    TEST_CF64("\xe9\x00\x01\x00\x00", FD_CF_JMP, 0x1105);
+    TEST_CF64("\xff\xe0", FD_CF_JMP_IND, 0); // jmp rax
+    TEST_CF64("\xff\x20", FD_CF_JMP_IND, 0); // jmp [rax]
+    TEST_CF64("\x74\x10", FD_CF_JCC, 0x1012);
+    TEST_CF64("\x0f\x8f\xf0\xef\xff\xff", FD_CF_JCC, 0xfffffffffffffff6);
+    TEST_CF64("\xe3\x00", FD_CF_LOOP, 0x1002); // jrcxz
+    TEST_CF64("\xe2\xfe", FD_CF_LOOP, 0x1000); // loop
+    TEST_CF64("\xe8\x00\x00\x00\x00", FD_CF_CALL, 0x1005);
+    TEST_CF64("\xff\xd0", FD_CF_CALL_IND, 0); // call rax
+    TEST_CF64("\xc3", FD_CF_RET, 0);
+    TEST_CF64("\xc2\x08\x00", FD_CF_RET, 0);
+    TEST_CF64("\x0f\x05", FD_CF_SYSCALL, 0);
+    TEST_CF64("\xcd\x80", FD_CF_SYSCALL, 0);
+    TEST_CF64("\x48\xcf", FD_CF_FAR, 0); // iretq
+    TEST_CF64("\xff\x28", FD_CF_FAR, 0); // jmp far [rax]
+    TEST_CF64("\xcc", FD_CF_TRAP, 0);
+    TEST_CF64("\x0f\x0b", FD_CF_TRAP, 0);
+    TEST_CF64("\xc7\xf8\x00\x00\x00\x00", FD_CF_JCC, 0x1006); // xbegin
+    TEST_CF32("\xe9\x00\xf0\xff\xff", FD_CF_JMP, 0x5);
+    TEST_CF32("\xe9\xf0\xef\xff\xff", FD_CF_JMP, 0xfffffff5);
+    TEST_CF32("\x66\xe9\x00\xf0", FD_CF_JMP, 0x4);
+    TEST_CF32("\xea\x00\x00\x00\x00\x08\x00", FD_CF_FAR, 0); // jmp far
+
+    TEST_FEAT("\x01\xc0", 1, ""); // add eax, eax
+    TEST_FEAT("\x0f\x44\xc1", 1, "CMOV"); // cmovz eax, ecx
+    TEST_FEAT("\x0f\x58\xc1", 1, "SSE"); // addps
+    TEST_FEAT("\x9f", 2, ""); // lahf
+    TEST_FEAT("\x0f\xc7\x0f", 1, "586"); // cmpxchg8b
+    TEST_FEAT("\x48\x0f\xc7\x0f", 2, "586"); // cmpxchg16b
+    TEST_FEAT("\xf3\x0f\xb8\xc1", 2, "POPCNT");
+    TEST_FEAT("\x66\x0f\x38\x00\xc1", 2, "SSSE3"); // pshufb
+    TEST_FEAT("\xc5\xf0\x58\xc2", 3, "AVX"); // vaddps
+    TEST_FEAT("\xc4\xe2\x71\xa8\xc2", 3, "FMA"); // vfmadd213ps
+    TEST_FEAT("\xc4\xe2\x73\xf6\xc2", 3, "BMI2"); // mulx
+    TEST_FEAT("\x62\xf1\x74\x48\x58\xc2", 4, "AVX512F"); // vaddps zmm
+    TEST_FEAT("\x66\x0f\x38\xdc\xc1", 1, "AESNI"); // aesenc
+    TEST_FEAT("\xc4\xe2\x71\xdc\xc2", 3, "AESNI AVX"); // vaesenc
+
+    // push rbp; mov rbp, rsp; mov rax, imm64; call
+#define LISTING_CODE "\x55\x48\x89\xe5\x48\xb8\x88\x77\x66\x55\x44\x33\x22\x11\xe8\x00\x00\x00\x00"
+    TEST_LISTING(LISTING_CODE, 0x401000, 0, SIZE_MAX,
+                 "401000: 55                      push rbp\n"
+                 "401001: 48 89 e5                mov rbp, rsp\n"
+                 "401004: 48 b8 88 77 66 55 44 33 mov rax, 0x1122334455667788\n"
+                 "40100c: 22 11\n"
+                 "40100e: e8 00 00 00 00          call 0x401013\n");
+    TEST_LISTING(LISTING_CODE, 0xfff8, FD_LISTING_NO_BYTES, SIZE_MAX,
+                 " fff8: push rbp\n"
+                 " fff9: mov rbp, rsp\n"
+                 " fffc: mov rax, 0x1122334455667788\n"
+                 "10006: call 0x1000b\n");
+    TEST_LISTING(LISTING_CODE, 0, FD_LISTING_NO_ADDR, SIZE_MAX,
+                 "55                      push rbp\n"
+                 "48 89 e5                mov rbp, rsp\n"
+                 "48 b8 88 77 66 55 44 33 mov rax, 0x1122334455667788\n"
+                 "22 11\n"
+                 "e8 00 00 00 00          call 0x13\n");
+    TEST_LISTING(LISTING_CODE, 0, FD_LISTING_NO_ADDR | FD_LISTING_NO_BYTES,
+                 SIZE_MAX, "push rbp\nmov rbp, rsp\n"
+                 "mov rax, 0x1122334455667788\ncall 0x13\n");
+    // Only complete lines are written.
+    TEST_LISTING(LISTING_CODE, 0x401000, 0, 90,
+                 "401000: 55                      push rbp\n"
+                 "401001: 48 89 e5                mov rbp, rsp\n");
+    TEST_LISTING(LISTING_CODE, 0x401000, 0, 10, "");
+    TEST_LISTING(LISTING_CODE, 0, FD_LISTING_NO_ADDR | FD_LISTING_NO_BYTES |
+                 FD_LISTING_ATT, SIZE_MAX, "push %rbp\nmov %rsp,%rbp\n"
+                 "movabs $0x1122334455667788,%rax\ncall 0x13\n");
+
+    TEST_ATT64("\x48\x89\xe5", "mov %rsp,%rbp");
+    TEST_ATT64("\x48\x8b\x45\xf8", "mov -0x8(%rbp),%rax");
+    TEST_ATT64("\x8b\x04\xc8", "mov (%rax,%rcx,8),%eax");
+    TEST_ATT64("\x8b\x04\x8d\x10\x00\x00\x00", "mov 0x10(,%rcx,4),%eax");
+    TEST_ATT64("\x48\x8b\x05\x00\x01\x00\x00", "mov 0x100(%rip),%rax");
+    TEST_ATT64("\x64\x48\x8b\x04\x25\x28\x00\x00\x00", "mov %fs:0x28,%rax");
+    TEST_ATT64("\x67\x8b\x40\xfc", "mov -0x4(%eax),%eax");
+    TEST_ATT32("\x8b\x05\x00\x10\x00\x00", "mov 0x1000,%eax");
+    TEST_ATT64("\xc7\x00\x01\x00\x00\x00", "movl $0x1,(%rax)");
+    TEST_ATT64("\x48\x83\x00\xff", "addq $0xffffffffffffffff,(%rax)");
+    TEST_ATT64("\xc6\x00\x01", "movb $0x1,(%rax)");
+    TEST_ATT64("\xd3\x20", "shll %cl,(%rax)");
+    TEST_ATT64("\xd3\xe0", "shl %cl,%eax");
+    TEST_ATT64("\xff\x30", "pushq (%rax)");
+    TEST_ATT64("\x0f\x1f\x44\x00\x00", "nopl (%rax,%rax,1)");
+    TEST_ATT64("\xf2\x0f\x38\xf0\x00", "crc32b (%rax),%eax");
+    TEST_ATT64("\x48\xb8\x01\x00\x00\x00\x00\x00\x00\x00", "movabs $0x1,%rax");
+    TEST_ATT64("\xb8\x06\x00\x00\x00", "mov $0x6,%eax");
+    TEST_ATT64("\x66\xb8\x05\x00", "mov $0x5,%ax");
+    TEST_ATT64("\xb0\x05", "mov $0x5,%al");
+    TEST_ATT64("\xa1\x00\x00\x00\x00\x00\x00\x00\x00", "movabs 0x0,%eax");
+    TEST_ATT64("\x48\xa3\x11\x00\x00\x00\x00\x00\x00\x00", "movabs %rax,0x11");
+    TEST_ATT64("\x67\xa1\x00\x00\x00\x00", "mov 0x0,%eax");
+    TEST_ATT32("\xa1\x00\x00\x00\x00", "mov 0x0,%eax");
+    TEST_ATT64("\x8b\x04\x25\x00\x00\x00\x00", "mov 0x0,%eax");
+    TEST_ATT64("\x0f\xb6\xc0", "movzbl %al,%eax");
+    TEST_ATT64("\x48\x0f\xb7\x00", "movzwq (%rax),%rax");
+    TEST_ATT64("\x48\x63\xc0", "movslq %eax,%rax");
+    TEST_ATT64("\x66\x98", "cbtw");
+    TEST_ATT64("\x48\x98", "cltq");
+    TEST_ATT64("\x99", "cltd");
+    TEST_ATT64("\x48\x99", "cqto");
+    TEST_ATT64("\xd9\x00", "flds (%rax)");
+    TEST_ATT64("\xdd\x18", "fstpl (%rax)");
+    TEST_ATT64("\xdb\x28", "fldt (%rax)");
+    TEST_ATT64("\xdf\x00", "filds (%rax)");
+    TEST_ATT64("\xdf\x28", "fildll (%rax)");
+    TEST_ATT64("\xd8\xc1", "fadd %st(1),%st(0)");
+    TEST_ATT64("\xd8\xe1", "fsub %st(1),%st(0)");
+    TEST_ATT64("\xd8\xf9", "fdivr %st(1),%st(0)");
+    TEST_ATT64("\xdc\xe1", "fsub %st(0),%st(1)");
+    TEST_ATT64("\xdc\xe9", "fsubr %st(0),%st(1)");
+    TEST_ATT64("\xdc\xf1", "fdiv %st(0),%st(1)");
+    TEST_ATT64("\xdc\xf9", "fdivr %st(0),%st(1)");
+    TEST_ATT64("\xde\xe1", "fsubp %st(0),%st(1)");
+    TEST_ATT64("\xde\xe9", "fsubrp %st(0),%st(1)");
+    TEST_ATT64("\xde\xf1", "fdivp %st(0),%st(1)");
+    TEST_ATT64("\xde\xf9", "fdivrp %st(0),%st(1)");
+    TEST_ATT64("\xdc\x20", "fsubl (%rax)");
+    TEST_ATT64("\xf2\x48\x0f\x2a\x00", "cvtsi2sdq (%rax),%xmm0");
+    TEST_ATT64("\xf2\x0f\x2a\xc0", "cvtsi2sd %eax,%xmm0");
+    TEST_ATT64("\xff\xe0", "jmp *%rax");
+    TEST_ATT64("\xff\x10", "call *(%rax)");
+    TEST_ATT64("\xff\x28", "ljmp *(%rax)");
+    TEST_ATT32("\xea\x00\x10\x00\x00\x08\x00", "ljmp $0x8,$0x1000");
+    TEST_ATT64("\x48\xcb", "lretq");
+    TEST_ATT64("\xe8\x00\x00\x00\x00", "call 0x5");
+    TEST_ATT64("\xc8\x10\x00\x00", "enter $0x10,$0x0");
+    TEST_ATT64("\x66\x0f\x78\xc0\x01\x02", "extrq $0x2,$0x1,%xmm0");
+    TEST_ATT64("\x66\x0f\x3a\x0f\xc1\x08", "palignr $0x8,%xmm1,%xmm0");
+    TEST_ATT64("\xf3\x48\xa5", "rep movsq");
+    TEST_ATT64("\xf0\x0f\xc1\x08", "lock xadd %ecx,(%rax)");
+    TEST_ATT64("\xc4\xe2\x7d\x92\x04\xc8", "vgatherdps %ymm0,(%rax,%ymm1,8),%ymm0");
+    TEST_ATT64("\x62\xf1\xfd\x58\x58\x00", "vaddpd (%rax){1to8},%zmm0,%zmm0");
+    TEST_ATT64("\x62\xf1\x7c\x99\x58\xc2", "vaddps {rn-sae},%zmm2,%zmm0,%zmm0{%k1}{z}");
+
+    {
+        FdSymbol syms[] = {
+            {0x2000, 8, "var"}, {0x1000, 0, "alias"}, {0x1000, 0x40, "func"},
+            {0x3000, 0, "end"},
+        };
+        FdSymbol nodes[5];
+        uint64_t keys[5];
+        FdSymtab tab;
+        size_t count = fd_symtab_init(&tab, syms, 4, nodes, keys);
+        const FdSymbol* sym1 = fd_symtab_lookup(&tab, 0x101c);
+        const FdSymbol* sym2 = fd_symtab_lookup(&tab, 0x2fff);
+        const FdSymbol* sym3 = fd_symtab_lookup(&tab, UINT64_MAX);
+        if (count != 3 || fd_symtab_lookup(&tab, 0xfff) != NULL ||
+            !sym1 || strcmp(sym1->name, "func") ||
+            !sym2 || strcmp(sym2->name, "var") ||
+            !sym3 || strcmp(sym3->name, "end")) {
+            printf("Failed symtab case\n");
+            failed = 1;
+        }
+
+        FdSymbolizer symbolizer = { fd_symtab_symbolize, &tab };
+        // call 0x101c; jmp 0x1000; mov eax, [rip+0xffa]; lea rax, [rip+0xffd]
+        TEST_SYM("\xe8\x17\x00\x00\x00", 0x1000, &symbolizer, 0, "call func+0x1c");
+        TEST_SYM("\xe8\x17\x00\x00\x00", 0x1000, &symbolizer, FD_FORMAT_ATT, "call func+0x1c");
+        TEST_SYM("\xeb\xfe", 0x1000, &symbolizer, 0, "jmp func");
+        TEST_SYM("\x8b\x05\xfa\x0f\x00\x00", 0x1000, &symbolizer, 0, "mov eax, dword ptr [rip+var]");
+        TEST_SYM("\x8b\x05\xfa\x0f\x00\x00", 0x1000, &symbolizer, FD_FORMAT_ATT, "mov var(%rip),%eax");
+        TEST_SYM("\x48\x8d\x05\xfd\x0f\x00\x00", 0x1000, &symbolizer, 0, "lea rax, [rip+var+0x4]");
+        TEST_SYM("\x48\x8d\x05\xfd\x0f\x00\x00", 0x1000, &symbolizer, FD_FORMAT_ATT, "lea var+0x4(%rip),%rax");
+        // No symbol at or before the target, or no symbolizer.
+        TEST_SYM("\xe8\x00\x00\x00\x00", 0x10, &symbolizer, 0, "call 0x15");
+        TEST_SYM("\x8b\x05\xf0\xff\xff\xff", 0x10, &symbolizer, 0, "mov eax, dword ptr [rip-0x10]");
+        TEST_SYM("\xe8\x17\x00\x00\x00", 0x1000, NULL, 0, "call 0x101c");
+        TEST_SYM("\x8b\x04\x25\x00\x20\x00\x00", 0x1000, &symbolizer, 0, "mov eax, dword ptr [0x2000]");
+
+        for (size_t i = 0; i <= 256; i += i < 20 ? 1 : 59)
+            failed |= test_symtab_random(i);
+        failed |= test_elf_symbols();
+        failed |= test_elf_build_id();
+    }
+
+    for (uint64_t seed = 1; seed <= 16; seed++) {
+        failed |= test_sweep(64, seed, 4096, 64);
+        failed |= test_sweep(32, seed, 4000 + seed, 128);
+    }
+    failed |= test_sweep(64, 1, 0, 64);
+    failed |= test_sweep(64, 1, 100, 1024);
+    for (uint64_t seed = 1; seed <= 8; seed++) {
+        failed |= test_sweep_patch(64, seed, 64);
+        failed |= test_sweep_patch(32, seed, 256);
+    }
+
+    // xor eax, eax; test edi, edi; jz 0x100e; inc eax; dec edi; jnz 0x1006;
+    // jmp 0x1014; call 0x2000; nop; ret
+    failed |= test_cfg("\x31\xc0\x85\xff\x74\x08\xff\xc0\xff\xcf\x75\xfa\xeb\x06"
+                       "\xe8\xed\x0f\x00\x00\x90\xc3", 21, 0x1000, 0x1000,
+                       "1000-1006 t:100e f:1006 e; 1006-100c t:1006 f:100c; "
+                       "100c-100e j:1014; 100e-1014 f:1014; 1014-1015; call:2000");
+    // Jump into the middle of a block, tail jump out of the region, and a
+    // path which runs into undecodable bytes.
+    // nop; nop; jnz 0x1001; jz 0x1007; jmp 0x3000; at 0x1007: cmc; then
+    // pop ds, which is invalid in 64-bit mode
+    failed |= test_cfg("\x90\x90\x75\xfd\x74\x01\xe9\xf5\x1f\x00\x00", 11,
+                       0x1000, 0x1000,
+                       "1000-1001 f:1001 e; 1001-1004 t:1001 f:1004; "
+                       "1004-1006 t:1007 f:1006; 1006-100b j:3000!; 1007-1008 f:1008! t;");
+    // Patch the loop to jnz 0x1004, which splits the entry block like a
+    // full rebuild; jz to the ret, which keeps the unreachable blocks; jmp
+    // into the middle of a block; and a jump which now decodes differently.
+#define CFG_CODE "\x31\xc0\x85\xff\x74\x08\xff\xc0\xff\xcf\x75\xfa\xeb\x06" \
+                 "\xe8\xed\x0f\x00\x00\x90\xc3"
+    failed |= test_cfg_patch(CFG_CODE, 21, 0x1000, 0x1000, 11, "\xf8", 1,
+                             "1000-1004 f:1004 e; 1004-1006 t:100e f:1006; "
+                             "1006-100c t:1004 f:100c; 100c-100e j:1014; "
+                             "100e-1014 f:1014; 1014-1015; call:2000");
+    failed |= test_cfg_patch(CFG_CODE, 21, 0x1000, 0x1000, 5, "\x0e", 1,
+                             "1000-1006 t:1014 f:1006 e; 1006-100c t:1006 f:100c; "
+                             "100c-100e j:1014; 100e-1014 f:1014; 1014-1015; "
+                             "call:2000");
+    failed |= test_cfg_patch(CFG_CODE, 21, 0x1000, 0x1000, 13, "\x05", 1,
+                             "1000-1006 t:100e f:1006 e; 1006-100c t:1006 f:100c; "
+                             "100c-100e j:1013; 100e-1013 f:1013; 1013-1014 f:1014; "
+                             "1014-1015; call:2000");
+    // jmp 0x1014 becomes mov al, 0x06 and runs into the call, which is in a
+    // kept block.
+    failed |= test_cfg_patch(CFG_CODE, 21, 0x1000, 0x1000, 12, "\xb0", 1,
+                             "1000-1006 t:100e f:1006 e; 1006-100c t:1006 f:100c; "
+                             "100c-100e f:100e; 100e-1014 f:1014; 1014-1015; "
+                             "call:2000");
+    // The call of a replaced block is replaced, not appended.
+    failed |= test_cfg_patch(CFG_CODE, 21, 0x1000, 0x1000, 15, "\xee", 1,
+                             "1000-1006 t:100e f:1006 e; 1006-100c t:1006 f:100c; "
+                             "100c-100e j:1014; 100e-1014 f:1014; 1014-1015; "
+                             "call:2001");
+
+    // Prologue at the start, call target with ENDBR, a gap which is a branch
+    // target, a padded gap which is a jump target, a call to the next
+    // instruction, and an ENDBR after a call.
+#define FUNCS_CODE "\x55\x48\x89\xe5\xe8\x07\x00\x00\x00\x5d\xc3" \
+                   "\x0f\x1f\x44\x00\x00\xf3\x0f\x1e\xfa\x85\xff\x74\x02" \
+                   "\xeb\x06\x31\xc0\xc3\xcc\xcc\xcc\xe8\x00\x00\x00\x00" \
+                   "\x58\xc3\x90\xe8\xe3\xff\xff\xff\xf3\x0f\x1e\xfa\xc3"
+    failed |= test_funcs(FUNCS_CODE, 50, 0x1000, NULL, 0,
+                         "1000:pga 1010:cbga 1028:ga");
+    failed |= test_funcs(FUNCS_CODE, 50, 0x1000,
+                         &(FdSymbol) { 0x1000, 0x28, NULL }, 1,
+                         "1000:pga 1010:cbga 1028:ga");
+    // Padding inside a known function, e.g. before a switch case.
+    failed |= test_funcs(FUNCS_CODE, 50, 0x1000,
+                         &(FdSymbol) { 0x1000, 0x32, NULL }, 1,
+                         "1000:pga 1010:cbga");
+    // Higher-half kernel addresses use all 64 bits.
+    failed |= test_funcs(FUNCS_CODE, 50, 0xffffffff81000000, NULL, 0,
+                         "ffffffff81000000:pga ffffffff81000010:cbga "
+                         "ffffffff81000028:ga");
+#undef FUNCS_CODE
+
+    failed |= test_xref(64, "\xe8\x0b\x00\x00\x00\x48\x8d\x05\x04\x00\x00\x00"
+                        "\x74\x02\xeb\x00\x8b\x05\xf6\xff\xff\xff\x64\x8b"
+                        "\x04\x25\x28\x00\x00\x00\xff\x25\x00\x00\x00\x00"
+                        "\xc3", 37, 0x1000,
+                        "1000>1010c 1005>1010a 100c>1010b 100e>1010j "
+                        "1010>100cm 101e>1024m | 100c<1010 "
+                        "1010<1000,1005,100c,100e 1024<101e");
+    failed |= test_xref(32, "\xa1\x78\x56\x34\x12\x8b\x04\x85\x00\x10\x00\x00"
+                        "\xff\x15\x00\x20\x00\x00\x65\xa1\x14\x00\x00\x00", 24,
+                        0x1000, "1000>12345678m 100c>2000m | 2000<100c "
+                        "12345678<1000");
+    failed |= test_xref(64, "\x90", 1, 0x1000, "|");
+    for (unsigned span = 0; span <= 64; span += 8)
+        failed |= test_xref_sort(span + 1, 4096, span);
+    failed |= test_xref_sort(1, 2, 40);
+
+    failed |= test_index(64, "\xe8\x0b\x00\x00\x00\x48\x8d\x05\x04\x00\x00\x00"
+                         "\x74\x02\xeb\x00\x8b\x05\xf6\xff\xff\xff\x06\x48"
+                         "\xa1\x88\x77\x66\x55\x44\x33\x22\x11\xc3", 34, 0x1000,
+                         "1000:5c>1010 1005:7a>1010 100c:2b>1010 100e:2j>1010 "
+                         "1010:6m>100c 1017:10m>1122334455667788 1021:1 | "
+                         "100c<1010 1010<1000,1005,100c,100e "
+                         "1122334455667788<1017 | f:1000+22");
+    // The target wraps around and is not representable relative to the call.
+    failed |= test_index(32, "\x90\xe8\x20\x00\x00\x00", 6, 0xfffffff0,
+                         "fffffff0:1 fffffff1:5c>16 | 16<fffffff1 | "
+                         "f:fffffff0+6");
+    failed |= test_index_open();
+
+    // mov eax, 0x3c; mov edi, 0; syscall; lock cmpxchg [rdi], rsi;
+    // jnz 0x100c; mov rax, [rip+0x10]; ret
+    {
+        static const char* const pats[] = {
+            "mov $r:gp32, imm[0..0x100]; *{0,2}; syscall",
+            "lock cmpxchg mem[$p], *; jnz rel",
+            "MOV reg, mem[rip, 0..0x10]; ret",
+            "*; syscall",
+            "lea|mov $x:gp, 0",
+            "mov $a, ...; mov $a, *",
+            "mov eax, -1; syscall",
+        };
+        failed |= test_pat(pats, 7, "\xb8\x3c\x00\x00\x00\xbf\x00\x00\x00"
+                           "\x00\x0f\x05\xf0\x48\x0f\xb1\x37\x75\xf9\x48"
+                           "\x8b\x05\x10\x00\x00\x00\xc3", 27,
+                           "0:1000-100c 1.0 0:1005-100c 1.7 3:1005-100c "
+                           "4:1005-100a 1.7 1:100c-1013 1.7 2:1013-101b");
+    }
+    // Gaps: the same match through different paths is reported once; and
+    // immediates match sign- or zero-extended.
+    {
+        static const char* const pats[] = {
+            "nop; *{0,3}; nop; *{0,3}; ret",
+            "mov eax, 0xffffffff",
+            "mov eax, imm[-1..-1]",
+        };
+        failed |= test_pat(pats, 3, "\x90\x90\x90\x90\xc3\xb8\xff\xff\xff\xff",
+                           10, "0:1000-1005 0:1001-1005 0:1002-1005 "
+                           "1:1005-100a 2:1005-100a");
+    }
+    failed |= test_pat_error("mov rax,", 8);
+    failed |= test_pat_error("*{0,2}; ret", 0);
+    failed |= test_pat_error("ret; *{1,2}", 11);
+    failed |= test_pat_error("nop; *{1,2}; *{0,1}; ret", 13);
+    failed |= test_pat_error("frobnicate", 10);
+    failed |= test_pat_error("mov $a, $b; mov $c, $d; add $e, *", 30);
+    failed |= test_pat_error("mov rax, imm[5..1]", 17);
+    failed |= test_fp();
+    failed |= test_columns();
+    failed |= test_profile();
+
+    TEST_TOK("\xf0\x48\x01\x44\x88\x10", 0, 128, "lock/p add/m qword ptr/s0 [/[0 rax/r0 +/,0 4/x0 */,0 rcx/r0 +/,0 0x10/d0 ]/]0 ,/, rax/r1");
+    TEST_TOK("\xf0\x48\x01\x44\x88\x10", FD_FORMAT_ATT, 128, "lock/p add/m %rax/r1 ,/, 0x10/d0 (/[0 %rax/r0 ,/,0 %rcx/r0 ,/,0 4/x0 )/]0");
+    TEST_TOK("\x64\x8b\x04\x25\x28\x00\x00\x00", 0, 128, "mov/m eax/r0 ,/, dword ptr/s1 fs/r1 :/,1 [/[1 0x28/d1 ]/]1");
+    TEST_TOK("\x48\x8b\x45\xf8", 0, 128, "mov/m rax/r0 ,/, qword ptr/s1 [/[1 rbp/r1 -/,1 0x8/d1 ]/]1");
+    TEST_TOK("\x48\x8b\x45\xf8", FD_FORMAT_ATT, 128, "mov/m -/,1 0x8/d1 (/[1 %rbp/r1 )/]1 ,/, %rax/r0");
+    TEST_TOK("\xc8\x10\x00\x01", FD_FORMAT_ATT, 128, "enter/m $0x10/i0 ,/,0 $0x1/i0");
+    TEST_TOK("\xff\xd0", FD_FORMAT_ATT, 128, "call/m */,0 %rax/r0");
+    TEST_TOK("\xeb\xfe", 0, 128, "jmp/m 0x0/i0");
+    TEST_TOK("\x62\xf1\x7c\xc9\x58\x40\x01", 0, 128, "vaddps/m zmm0/r0 {k1}/k0 {z}/k0 ,/, zmm0/r1 ,/, zmmword ptr/s2 [/[2 rax/r2 +/,2 0x40/d2 ]/]2");
+    TEST_TOK("\x62\xf1\x7c\x18\x58\xc1", FD_FORMAT_ATT, 128, "vaddps/m {rn-sae}/k ,/, %zmm1/r2 ,/, %zmm0/r1 ,/, %zmm0/r0");
+    TEST_TOK("\xf3\xa4", 0, 128, "rep/p movsb/m");
+    // Truncated text: tokens are clipped or dropped.
+    TEST_TOK("\x48\x8b\x45\xf8", 0, 11, "mov/m rax/r0 ,/, q/s1");
+
+    // add rax, 1 (x4): latency-bound dependency chain
+    TEST_COST(SKL, "\x48\x83\xc0\x01\x48\x83\xc0\x01\x48\x83\xc0\x01\x48\x83\xc0\x01", 400, 0, 4, 4);
+    // add rax/rbx/rcx/rdx, 1: independent, limited by issue width
+    TEST_COST(SKL, "\x48\x83\xc0\x01\x48\x83\xc3\x01\x48\x83\xc1\x01\x48\x83\xc2\x01", 100, 0, 1, 4);
+    TEST_COST(ZEN2, "\x48\x83\xc0\x01\x48\x83\xc3\x01\x48\x83\xc1\x01\x48\x83\xc2\x01", 100, 0, 1, 4);
+    // imul rcx, rbx, 3; imul rdx, rbx, 3: port 1 bound
+    TEST_COST(SKL, "\x48\x6b\xcb\x03\x48\x6b\xd3\x03", 200, 1, 3, 2);
+    // imul rcx, rbx: the destination is also a source
+    TEST_COST(SKL, "\x48\x0f\xaf\xcb", 300, 1, 3, 1);
+    // mov rax, [rax]: pointer chasing
+    TEST_COST(SKL, "\x48\x8b\x00", 500, 2, 5, 1);
+    TEST_COST(ZEN2, "\x48\x8b\x00", 400, 4, 4, 1);
+    // mov [rdi], rax: store micro-ops only
+    TEST_COST(SKL, "\x48\x89\x07", 100, 4, 0, 2);
+    // xor eax, eax; add rax, 1: zero idiom breaks the dependency
+    TEST_COST(SKL, "\x31\xc0\x48\x83\xc0\x01", 50, 0, 2, 2);
+    TEST_COST(SKL, "\x31\xc8\x48\x83\xc0\x01", 200, 0, 2, 2);
+    // vxorps xmm0, xmm1, xmm1; vaddps xmm0, xmm0, xmm0
+    TEST_COST(SKL, "\xc5\xf0\x57\xc1\xc5\xf8\x58\xc0", 83, 0, 5, 2);
+    // adc rax, rbx: dependency through rax and CF
+    TEST_COST(SKL, "\x48\x11\xd8", 100, 0, 1, 1);
+    // vfmadd231ps ymm0, ymm1, [rdi]; add rdi, 32
+    TEST_COST(SKL, "\xc4\xe2\x75\xb8\x07\x48\x83\xc7\x20", 400, 0, 9, 3);
+    // pdep eax, ecx, edx: microcoded on Zen 2
+    TEST_COST(ZEN2, "\xc4\xe2\x73\xf5\xc2", 3325, 0, 250, 133);
+
     puts(failed ? "Some tests FAILED" : "All tests PASSED");
     return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
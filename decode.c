@@ -14,7 +14,8 @@
 #define UNLIKELY(x) (x)
 #endif
 
-// Defines FD_TABLE_OFFSET_32 and FD_TABLE_OFFSET_64, if available
+// Defines FD_TABLE_OFFSET_32 and FD_TABLE_OFFSET_64, if available, and
+// FD_TABLE_HASH
 #define FD_DECODE_TABLE_DEFINES
 #include <fadec-decode-private.inc>
 #undef FD_DECODE_TABLE_DEFINES
@@ -577,6 +578,7 @@ prefix_end:
     {
         // 2 = memory, address-sized, used for mov with moffs operand
         FdOp* operand = &instr->operands[DESC_IMM_IDX(desc)];
+        instr->flags |= FD_FLAG_MOFFS;
         operand->type = FD_OT_MEM;
         operand->size = op_size;
         operand->reg = FD_REG_NONE;
@@ -718,3 +720,8 @@ skip_modrm:
 
     return off;
 }
+
+uint64_t
+fd_table_hash(void) {
+    return (uint64_t) FD_TABLE_HASH;
+}
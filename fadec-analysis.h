@@ -0,0 +1,462 @@
+
+#ifndef FD_FADEC_ANALYSIS_H_
+#define FD_FADEC_ANALYSIS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fadec.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** State of a chunk of a parallel linear sweep, see FdSweep. **/
+typedef struct FdSweepChunk {
+    /** Offset of the first instruction which starts in the chunk. After
+     * fd_sweep_resolve, the offset where the serial sweep enters the chunk. **/
+    size_t entry;
+    /** Offset after the last instruction which starts in the chunk. **/
+    size_t exit;
+} FdSweepChunk;
+
+/** Parallel linear sweep over a code region. The region is split into chunks
+ * which are decoded independently, each from its first byte as speculative
+ * start; fd_sweep_resolve then follows the serial sweep across the chunk
+ * boundaries and decodes again only where a chunk was entered at a different
+ * offset, until the decoding converges with the speculative one. The result
+ * is identical to a serial sweep with fd_decode, where an undecodable byte is
+ * skipped as in objdump.
+ *
+ * The library does not create threads: the caller runs fd_sweep_run once for
+ * each worker, usually on a thread of its own. Chunks are initially split
+ * evenly between the workers; a worker without chunks steals half of the
+ * remaining chunks of another one. **/
+typedef struct FdSweep {
+    const uint8_t* buf;
+    size_t len;
+    int mode;
+    size_t chunk_size;
+    size_t nchunks;
+    /** Bitmap of instruction starts, bit i%8 of byte i/8 for offset i. **/
+    uint8_t* starts;
+    FdSweepChunk* chunks;
+    /** Work queue of each worker; internal use only. **/
+    uint64_t* queues;
+    unsigned nworkers;
+} FdSweep;
+
+/** Number of chunks of a sweep over len bytes. **/
+#define FD_SWEEP_CHUNKS(len, chunk_size) (((len) + (chunk_size) - 1) / (chunk_size))
+
+/** Prepare a parallel linear sweep.
+ *
+ * \param sweep The sweep to initialize.
+ * \param buf The code.
+ * \param len The size of the code.
+ * \param mode The decoding mode, see fd_decode.
+ * \param chunk_size Bytes per chunk, a multiple of 64. Chunks of some ten
+ *        kilobytes keep the divergent prefixes negligible.
+ * \param starts Receives the instruction start bitmap, (len + 7) / 8 bytes.
+ * \param chunks Receives the chunk states, FD_SWEEP_CHUNKS(len, chunk_size).
+ * \param queues Storage for the work queues, nworkers elements.
+ * \param nworkers The number of workers which call fd_sweep_run.
+ * \return Zero on success, -1 if a parameter is invalid.
+ **/
+int fd_sweep_init(FdSweep* sweep, const uint8_t* buf, size_t len, int mode,
+                  size_t chunk_size, uint8_t* starts, FdSweepChunk* chunks,
+                  uint64_t* queues, unsigned nworkers);
+
+/** Decode chunks speculatively until no chunk is left. Call once for each
+ * worker, concurrently or one after the other.
+ *
+ * \param sweep The sweep.
+ * \param worker The index of the worker, less than nworkers.
+ **/
+void fd_sweep_run(FdSweep* sweep, unsigned worker);
+
+/** Fix the chunks at their boundaries after all fd_sweep_run calls returned.
+ * Afterwards, starts contains the instruction starts of the serial sweep and
+ * every chunk can be processed independently from its entry offset.
+ *
+ * \param sweep The sweep.
+ * \return The number of bytes which were decoded again.
+ **/
+size_t fd_sweep_resolve(FdSweep* sweep);
+
+/** Update a resolved sweep after the code in [off, off + len) was changed in
+ * place, e.g. by a JIT compiler or live patching. Decoding starts at the last
+ * instruction start whose decoding cannot involve the patch, at least 15
+ * bytes before it, and ends after the patch at the first offset which
+ * already started an instruction, where the serial sweep synchronizes with
+ * the previous one again; the chunk entries and exits on the way are
+ * updated. The cost is proportional to the patch, not to the region.
+ *
+ * \param sweep The sweep, after fd_sweep_resolve.
+ * \param off The offset of the changed bytes.
+ * \param len The number of changed bytes.
+ * \param lo Receives the offset where decoding started.
+ * \param hi Receives the offset where decoding synchronized; the instruction
+ *        starts changed only in [lo, hi).
+ * \return The number of bytes which were decoded again.
+ **/
+size_t fd_sweep_patch(FdSweep* sweep, size_t off, size_t len, size_t* lo,
+                      size_t* hi);
+
+/** Bump allocator over caller-provided memory, e.g. one per thread. Reset
+ * used to zero (or to an earlier value) to free everything allocated since. **/
+typedef struct FdArena {
+    void* mem;
+    size_t size;
+    size_t used;
+} FdArena;
+
+/** Edge kinds of FdCfgEdge. **/
+typedef enum {
+    /** To the next instruction, after a conditional jump or when the next
+     * instruction starts another block **/
+    FD_CFG_EDGE_FALL,
+    /** Direct jump **/
+    FD_CFG_EDGE_JUMP,
+    /** Taken conditional jump, including LOOP and JCXZ **/
+    FD_CFG_EDGE_TAKEN,
+} FdCfgEdgeKind;
+
+/** Flags of FdCfgBlock. **/
+enum {
+    /** The block starts at an entry point **/
+    FD_CFG_BLOCK_ENTRY = 1 << 0,
+    /** The block would continue, but the next instruction is undecodable or
+     * outside of the code region **/
+    FD_CFG_BLOCK_TRUNCATED = 1 << 1,
+};
+
+/** Marks an edge target outside of the code region in FdCfgEdge.dst. **/
+#define FD_CFG_NO_BLOCK UINT32_MAX
+
+/** A basic block of an FdCfg. **/
+typedef struct FdCfgBlock {
+    uint64_t start;
+    /** Address after the last instruction **/
+    uint64_t end;
+    uint32_t ninstrs;
+    /** Outgoing edges: edges[succ] to edges[succ + nsucc - 1] **/
+    uint32_t succ;
+    uint32_t nsucc;
+    /** Predecessor blocks: preds[pred] to preds[pred + npred - 1] **/
+    uint32_t pred;
+    uint32_t npred;
+    /** Control-flow kind of the last instruction, see FdCfKind **/
+    uint8_t kind;
+    /** Combination of FD_CFG_BLOCK_* flags **/
+    uint8_t flags;
+} FdCfgBlock;
+
+/** A control-flow edge of an FdCfg. **/
+typedef struct FdCfgEdge {
+    uint64_t target;
+    uint32_t src;
+    /** Index of the target block, or FD_CFG_NO_BLOCK **/
+    uint32_t dst;
+    /** Edge kind, see FdCfgEdgeKind **/
+    uint32_t kind;
+} FdCfgEdge;
+
+/** A direct call in an FdCfg. **/
+typedef struct FdCfgCall {
+    /** Address of the call instruction **/
+    uint64_t addr;
+    uint64_t target;
+} FdCfgCall;
+
+/** Control-flow graph with blocks sorted by address and index-based
+ * adjacency arrays. All arrays are allocated from the arena passed to
+ * fd_cfg_build, and grown by fd_cfg_patch. **/
+typedef struct FdCfg {
+    FdCfgBlock* blocks;
+    size_t nblocks;
+    FdCfgEdge* edges;
+    size_t nedges;
+    uint32_t* preds;
+    /** Direct calls, sorted by address **/
+    FdCfgCall* calls;
+    size_t ncalls;
+    /** Allocated elements of blocks, of edges and preds, and of calls **/
+    size_t blockcap;
+    size_t edgecap;
+    size_t callcap;
+} FdCfg;
+
+/** Build the control-flow graph of a function by recursive traversal from its
+ * entry points. Direct jumps and conditional jumps are followed within the
+ * code region, calls fall through to the next instruction, and blocks are
+ * split where a branch target or a second path enters them. Blocks end after
+ * jumps, returns, traps, HLT, and other instructions which do not continue
+ * with the next one; indirect jumps have no edges.
+ *
+ * The function uses no global state and allocates only from the arena, so
+ * the graphs of different functions can be built concurrently with one arena
+ * per thread.
+ *
+ * \param cfg Receives the graph.
+ * \param arena The allocator for the graph and temporary data.
+ * \param buf The code region.
+ * \param len The size of the code region.
+ * \param base The address of the code region.
+ * \param mode The decoding mode, see fd_decode.
+ * \param entries The entry point addresses; addresses outside of the region
+ *        are ignored.
+ * \param nentries The number of entry points.
+ * \return Zero on success, -1 if the arena is exhausted.
+ **/
+int fd_cfg_build(FdCfg* cfg, FdArena* arena, const uint8_t* buf, size_t len,
+                 uint64_t base, int mode, const uint64_t* entries,
+                 size_t nentries);
+
+/** Update a graph after the code in [lo, hi) was changed in place. Only the
+ * blocks overlapping the patch are decoded again, by recursive traversal
+ * from their starts until the paths join a kept block; a kept block which is
+ * entered at one of its instructions is split. The calls of the replaced
+ * blocks are replaced by those of the new code.
+ *
+ * The decoding is proportional to the patch. The arrays are updated in
+ * place: the blocks after the first change are shifted, the indices in the
+ * edges are adjusted, and only edges into replaced blocks or to addresses
+ * without block are resolved again; the predecessors are counted again. This
+ * is a linear pass over the blocks and edges, but much cheaper than a
+ * rebuild.
+ *
+ * Kept blocks which are no longer reachable are not removed and blocks are
+ * not merged; so the graph may differ from the one of fd_cfg_build on the
+ * patched code where the patch removed control flow.
+ *
+ * \param cfg The graph from fd_cfg_build or fd_cfg_patch, updated in place.
+ *        An array which is too small is moved to new memory of the arena
+ *        with twice the size; the previous one is not freed.
+ * \param arena The allocator for grown arrays and temporary data. The
+ *        temporary data is freed again unless an array had to grow.
+ * \param buf The patched code region.
+ * \param len The size of the code region.
+ * \param base The address of the code region.
+ * \param mode The decoding mode, see fd_decode.
+ * \param lo The address of the first changed byte.
+ * \param hi The address after the last changed byte.
+ * \return Zero on success, -1 if the arena is exhausted; then the graph is
+ *         unchanged.
+ **/
+int fd_cfg_patch(FdCfg* cfg, FdArena* arena, const uint8_t* buf, size_t len,
+                 uint64_t base, int mode, uint64_t lo, uint64_t hi);
+
+/** Evidence for a function start in an FdFuncCand. **/
+enum {
+    /** Target of a direct call, except a call to the next instruction **/
+    FD_FUNC_CALL = 1 << 0,
+    /** ENDBR64 or ENDBR32 which does not follow a call **/
+    FD_FUNC_ENDBR = 1 << 1,
+    /** push rbp; mov rbp, rsp, or the ENDBR before it **/
+    FD_FUNC_PROLOGUE = 1 << 2,
+    /** First instruction after a jump, return, trap or HLT and any padding
+     * INT3 and NOP instructions, or at the start of the code region **/
+    FD_FUNC_GAP = 1 << 3,
+    /** Together with FD_FUNC_GAP: the padding was not empty **/
+    FD_FUNC_PADDED = 1 << 4,
+    /** Start of an FDE, see fd_elf_eh_frame **/
+    FD_FUNC_EH_FRAME = 1 << 5,
+    /** Target of a direct jump or conditional jump, evidence against a gap
+     * being a function start **/
+    FD_FUNC_JUMP = 1 << 6,
+    /** Start of a function symbol, see fd_elf_symbols; like
+     * FD_FUNC_EH_FRAME, supplied by the caller **/
+    FD_FUNC_SYMBOL = 1 << 7,
+};
+
+/** Candidate function start. **/
+typedef struct FdFuncCand {
+    uint64_t addr;
+    /** Combination of FD_FUNC_* **/
+    uint32_t sources;
+    uint32_t reserved;
+} FdFuncCand;
+
+/** Collect function start candidates from the instructions which start in
+ * [start, end) of a code region, e.g. the entry and exit of a chunk after
+ * fd_sweep_resolve. Decoding continues after end while the instructions are
+ * padding after a jump or return, so that the candidates of all chunks
+ * together are the same as of a single call over the whole region. Call
+ * targets are only collected within the region.
+ *
+ * \param buf The code region.
+ * \param len The size of the code region.
+ * \param base The address of the code region.
+ * \param mode The decoding mode, see fd_decode.
+ * \param start The offset of the first instruction.
+ * \param end The offset where no further instruction starts.
+ * \param out Array for the candidates; may be NULL if cap is zero. The
+ *        same address may occur several times.
+ * \param cap The capacity of out.
+ * \return The total number of candidates, which may exceed cap.
+ **/
+size_t fd_func_scan(const uint8_t* buf, size_t len, uint64_t base, int mode,
+                    size_t start, size_t end, FdFuncCand* out, size_t cap);
+
+/** Merge function start candidates, e.g. of fd_func_scan on all chunks and
+ * of fd_elf_eh_frame, and keep the likely function starts. Candidates are
+ * sorted by address and the evidence for the same address is combined. A
+ * start is kept if it is a call target, an FDE or symbol start, an ENDBR or a
+ * prologue, or if it is a gap after padding or aligned to 16 bytes, but
+ * neither a jump target nor inside a known function, e.g. after a switch case.
+ * Unlike the scan, this runs serially and sorts in O(n log n) time.
+ *
+ * \param cands The candidates; sorted and reduced in place.
+ * \param count The number of candidates.
+ * \param known Known function ranges, e.g. FDEs, ascending by address; may
+ *        be NULL if nknown is zero.
+ * \param nknown The number of known functions.
+ * \return The number of function starts, which are at the beginning of
+ *         cands, ascending and with all their FD_FUNC_* evidence.
+ **/
+size_t fd_func_reconcile(FdFuncCand* cands, size_t count,
+                         const FdSymbol* known, size_t nknown);
+
+/** Kinds of cross references, see FdXrefIndex. **/
+typedef enum {
+    /** Direct call **/
+    FD_XREF_CALL,
+    /** Direct jump **/
+    FD_XREF_JUMP,
+    /** Direct conditional jump, including LOOP and JCXZ **/
+    FD_XREF_BRANCH,
+    /** Address computation with LEA **/
+    FD_XREF_ADDR,
+    /** Memory operand, including indirect calls and jumps through memory **/
+    FD_XREF_MEM,
+} FdXrefKind;
+
+/** A reference from an instruction to a branch target or memory address. **/
+typedef struct FdXref {
+    /** Address of the instruction **/
+    uint64_t from;
+    uint64_t to;
+} FdXref;
+
+/** Bits sorted per radix sort pass of an FdXrefIndex. **/
+#define FD_XREF_RADIX_BITS 11
+/** Elements of the histogram memory of an FdXrefIndex. **/
+#define FD_XREF_HIST(nworkers) ((size_t) (nworkers) << FD_XREF_RADIX_BITS)
+
+/** Cross-reference index in both directions. By source, the references are
+ * the array passed to fd_xref_init; by target, they are stored in CSR layout,
+ * where the sources of targets[i] are sources[first[i]] up to
+ * sources[first[i + 1] - 1].
+ *
+ * The references are sorted by target with a parallel LSD radix sort over
+ * the bits in which the targets differ. Like FdSweep, the library does not
+ * create threads: the caller alternates between fd_xref_step and running
+ * fd_xref_run once for each worker, until fd_xref_step returns zero. **/
+typedef struct FdXrefIndex {
+    /** By source, ascending by from; at most one per instruction **/
+    const FdXref* refs;
+    /** FdXrefKind of each reference **/
+    const uint8_t* kinds;
+    size_t count;
+    /** By target, ascending; the sources of each target are ascending.
+     * Stored in the scratch memory. **/
+    const uint64_t* targets;
+    size_t ntargets;
+    const uint64_t* first;
+    const uint64_t* sources;
+    /** Sort state; internal use only. **/
+    FdXref* scratch;
+    uint64_t* hist;
+    unsigned nworkers;
+    unsigned phase;
+    unsigned pass;
+    unsigned npasses;
+    unsigned bits;
+    uint64_t min;
+} FdXrefIndex;
+
+/** Collect the references of the instructions which start in [start, end)
+ * of a code region: the targets of direct calls, jumps and conditional jumps,
+ * RIP-relative memory operands, and memory operands with an absolute address
+ * outside of FS and GS. Like fd_func_scan, this is usually called for the
+ * chunks of an FdSweep in parallel, whose outputs concatenated in chunk order
+ * are ascending by source.
+ *
+ * \param buf The code region.
+ * \param len The size of the code region.
+ * \param base The address of the code region.
+ * \param mode The decoding mode, see fd_decode.
+ * \param start The offset of the first instruction.
+ * \param end The offset where no further instruction starts.
+ * \param out Array for the references in address order, may be NULL if cap
+ *        is zero.
+ * \param kinds Array for the FdXrefKind of each reference.
+ * \param cap The capacity of out and kinds.
+ * \return The total number of references, which may exceed cap.
+ **/
+size_t fd_xref_scan(const uint8_t* buf, size_t len, uint64_t base, int mode,
+                    size_t start, size_t end, FdXref* out, uint8_t* kinds,
+                    size_t cap);
+
+/** Prepare building a cross-reference index. No memory is allocated; refs and
+ * kinds must be valid as long as the index is used.
+ *
+ * \param index The index to initialize.
+ * \param refs The references, ascending by source.
+ * \param kinds The FdXrefKind of each reference.
+ * \param count The number of references.
+ * \param scratch Storage for sorting, 2 * count + 1 elements, which holds the
+ *        by-target arrays afterwards.
+ * \param hist Storage for the histograms, FD_XREF_HIST(nworkers) elements.
+ * \param nworkers The number of workers which call fd_xref_run.
+ * \return Zero on success, -1 if nworkers is zero.
+ **/
+int fd_xref_init(FdXrefIndex* index, const FdXref* refs, const uint8_t* kinds,
+                 size_t count, FdXref* scratch, uint64_t* hist,
+                 unsigned nworkers);
+
+/** Advance the index construction to its next phase.
+ *
+ * \param index The index.
+ * \return Non-zero if fd_xref_run must be called for all workers before the
+ *         next call; zero if the index is complete.
+ **/
+int fd_xref_step(FdXrefIndex* index);
+
+/** Run the share of a worker in the current phase. Call once for each worker
+ * after fd_xref_step, concurrently or one after the other.
+ *
+ * \param index The index.
+ * \param worker The index of the worker, less than nworkers.
+ **/
+void fd_xref_run(FdXrefIndex* index, unsigned worker);
+
+/** Find the references from the instructions in [lo, hi).
+ *
+ * \param index The index.
+ * \param lo The lowest instruction address.
+ * \param hi The address after the range.
+ * \param first Receives the position of the first reference in refs.
+ * \return The number of references.
+ **/
+size_t fd_xref_from(const FdXrefIndex* index, uint64_t lo, uint64_t hi,
+                    size_t* first);
+
+/** Find the references to addresses in [lo, hi), e.g. hi = lo + 1 for the
+ * callers of a function.
+ *
+ * \param index The complete index.
+ * \param lo The lowest target address.
+ * \param hi The address after the range.
+ * \param first Receives the position of the first source in sources.
+ * \return The number of references, ordered by target and source.
+ **/
+size_t fd_xref_to(const FdXrefIndex* index, uint64_t lo, uint64_t hi,
+                  size_t* first);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,390 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include <fadec.h>
+#include <fadec-analysis.h>
+#include <fadec-columns.h>
+
+#include "tools-common.h"
+
+
+// Rows of a chunk of the column file are the instructions of a chunk of this
+// many code bytes of a parallel linear sweep.
+#define CHUNK_SIZE (256 << 10)
+// Chunks per thread in one window. The columns of a window are written while
+// the workers fill the next one.
+#define WINDOW_CHUNKS 4
+
+// A sweep chunk, which is filled by one worker and becomes a column chunk.
+struct Unit {
+    const struct Section* section;
+    size_t entry;
+    size_t exit;
+    size_t nrows;
+    // Columns in the buffer of the worker.
+    unsigned worker;
+    size_t out_off;
+    size_t out_len;
+};
+
+struct Buf {
+    uint8_t* data;
+    size_t len;
+    size_t cap;
+};
+
+struct Pool;
+
+struct Worker {
+    struct Pool* pool;
+    unsigned id;
+    pthread_t thread;
+    // One buffer is filled while the other one is written.
+    struct Buf bufs[2];
+};
+
+struct Pool {
+    pthread_barrier_t start;
+    pthread_barrier_t done;
+    struct Binary* bin;
+    struct Unit* units;
+    size_t nunits;
+    size_t cap;
+    FdSweep* sweep; // if set, the workers run the sweep instead
+    size_t end; // end of the units of the current window
+    atomic_size_t next;
+    unsigned set; // buffer of the current window
+    bool quit;
+};
+
+static int
+cmp_section(const void* a, const void* b) {
+    const struct Section* sa = a;
+    const struct Section* sb = b;
+    return sa->addr < sb->addr ? -1 : sa->addr > sb->addr;
+}
+
+// Number of instruction starts in [lo, hi) of a sweep bitmap.
+static size_t
+count_starts(const uint8_t* starts, size_t lo, size_t hi) {
+    size_t count = 0;
+    for (; lo < hi && lo % 8; lo++)
+        count += starts[lo / 8] >> lo % 8 & 1;
+    for (; lo + 8 <= hi; lo += 8)
+        count += __builtin_popcount(starts[lo / 8]);
+    for (; lo < hi; lo++)
+        count += starts[lo / 8] >> lo % 8 & 1;
+    return count;
+}
+
+// Split the sections into the chunks of a parallel sweep, which the workers
+// run, and count the rows of each chunk.
+static void
+binary_split(struct Binary* bin, struct Pool* pool, unsigned nworkers) {
+    qsort(bin->sections, bin->nsections, sizeof *bin->sections, cmp_section);
+    uint64_t* queues = xrealloc(NULL, nworkers * sizeof *queues);
+    for (size_t i = 0; i < bin->nsections; i++) {
+        const struct Section* s = &bin->sections[i];
+        FdSweep sweep;
+        size_t nchunks = FD_SWEEP_CHUNKS(s->size, CHUNK_SIZE);
+        uint8_t* starts = xrealloc(NULL, (s->size + 7) / 8);
+        FdSweepChunk* chunks = xrealloc(NULL, nchunks * sizeof *chunks);
+        fd_sweep_init(&sweep, s->code, s->size, bin->mode, CHUNK_SIZE,
+                      starts, chunks, queues, nworkers);
+        pool->sweep = &sweep;
+        pthread_barrier_wait(&pool->start);
+        pthread_barrier_wait(&pool->done);
+        pool->sweep = NULL;
+        fd_sweep_resolve(&sweep);
+
+        if (pool->cap - pool->nunits < nchunks) {
+            pool->cap = pool->nunits + nchunks + pool->cap;
+            pool->units = xrealloc(pool->units,
+                                   pool->cap * sizeof *pool->units);
+        }
+        for (size_t j = 0; j < nchunks; j++) {
+            if (chunks[j].entry >= chunks[j].exit)
+                continue;
+            pool->units[pool->nunits++] = (struct Unit) {
+                .section = s, .entry = chunks[j].entry, .exit = chunks[j].exit,
+                .nrows = count_starts(starts, chunks[j].entry, chunks[j].exit),
+            };
+        }
+        free(starts);
+        free(chunks);
+    }
+    free(queues);
+}
+
+static void
+buf_reserve(struct Buf* buf, size_t len) {
+    if (buf->cap - buf->len >= len)
+        return;
+    size_t cap = buf->cap ? buf->cap : 1 << 24;
+    while (cap - buf->len < len)
+        cap *= 2;
+    buf->data = xrealloc(buf->data, cap);
+    buf->cap = cap;
+}
+
+static void
+fill_unit(struct Worker* w, struct Unit* unit, struct Buf* buf) {
+    const struct Section* s = unit->section;
+    size_t size = fd_columns_layout(NULL, NULL, unit->nrows, NULL);
+    buf_reserve(buf, size);
+    FdColumns cols;
+    // The buffer and all column sizes are multiples of eight bytes.
+    fd_columns_layout(&cols, buf->data + buf->len, unit->nrows, NULL);
+    fd_columns_decode(&cols, 0, unit->nrows, s->code, s->size, s->addr,
+                      w->pool->bin->mode, unit->entry, unit->exit);
+    unit->worker = w->id;
+    unit->out_off = buf->len;
+    unit->out_len = size;
+    buf->len += size;
+}
+
+static void*
+worker(void* arg) {
+    struct Worker* w = arg;
+    struct Pool* pool = w->pool;
+    for (;;) {
+        pthread_barrier_wait(&pool->start);
+        if (pool->quit)
+            break;
+        if (pool->sweep) {
+            fd_sweep_run(pool->sweep, w->id);
+            pthread_barrier_wait(&pool->done);
+            continue;
+        }
+        struct Buf* buf = &w->bufs[pool->set];
+        buf->len = 0;
+        for (;;) {
+            size_t idx = atomic_fetch_add_explicit(&pool->next, 1,
+                                                   memory_order_relaxed);
+            if (idx >= pool->end)
+                break;
+            fill_unit(w, &pool->units[idx], buf);
+        }
+        pthread_barrier_wait(&pool->done);
+    }
+    return NULL;
+}
+
+static bool
+write_all(int fd, struct iovec* iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t ret = writev(fd, iov, cnt);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("write");
+            return false;
+        }
+        for (; cnt > 0 && (size_t) ret >= iov->iov_len; iov++, cnt--)
+            ret -= iov->iov_len;
+        if (cnt > 0) {
+            iov->iov_base = (char*) iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    return true;
+}
+
+// Write the columns of units in order and record their chunks.
+static bool
+write_units(int fd, const struct Unit* units, size_t begin, size_t end,
+            const struct Worker* workers, unsigned set, uint64_t* pos,
+            FdColFileChunk* chunks) {
+    struct iovec iov[IOV_MAX < 1024 ? IOV_MAX : 1024];
+    int cnt = 0;
+    for (size_t i = begin; i < end; i++) {
+        const struct Unit* unit = &units[i];
+        chunks[i] = (FdColFileChunk) { .nrows = unit->nrows, .data = *pos };
+        *pos += unit->out_len;
+        uint8_t* data = workers[unit->worker].bufs[set].data + unit->out_off;
+        if (cnt && (uint8_t*) iov[cnt - 1].iov_base + iov[cnt - 1].iov_len == data) {
+            iov[cnt - 1].iov_len += unit->out_len;
+            continue;
+        }
+        if (cnt == sizeof iov / sizeof iov[0]) {
+            if (!write_all(fd, iov, cnt))
+                return false;
+            cnt = 0;
+        }
+        iov[cnt++] = (struct iovec) { data, unit->out_len };
+    }
+    return write_all(fd, iov, cnt);
+}
+
+// Fill the units in windows; the main thread writes the previous window
+// while the workers fill the next one. Then the column descriptions, the
+// chunk table and the header are written.
+static bool
+binary_export(struct Binary* bin, struct Pool* pool, struct Worker* workers,
+              unsigned nworkers, int fd, uint64_t* nrows, uint64_t* size) {
+    FdColFileHeader hdr = {
+        .magic = FD_COLFILE_MAGIC, .version = FD_COLFILE_VERSION,
+        .ncolumns = FD_COLUMNS, .nchunks = pool->nunits, .mode = bin->mode,
+    };
+    FdColFileChunk* chunks = xrealloc(NULL, (pool->nunits + 1) *
+                                            sizeof *chunks);
+    uint64_t pos = sizeof hdr;
+    bool ok = lseek(fd, pos, SEEK_SET) == (off_t) pos;
+    if (!ok)
+        perror("lseek");
+
+    size_t begin = 0, prev_begin = 0, prev_end = 0;
+    pool->bin = bin;
+    while (begin < pool->nunits || prev_begin < prev_end) {
+        bool run = begin < pool->nunits;
+        size_t end = begin + (size_t) WINDOW_CHUNKS * nworkers;
+        if (end > pool->nunits)
+            end = pool->nunits;
+        if (run) {
+            pool->end = end;
+            atomic_store_explicit(&pool->next, begin, memory_order_relaxed);
+            pthread_barrier_wait(&pool->start);
+        }
+        if (ok && prev_begin < prev_end)
+            ok = write_units(fd, pool->units, prev_begin, prev_end, workers,
+                             pool->set ^ 1, &pos, chunks);
+        prev_begin = prev_end = 0;
+        if (run) {
+            pthread_barrier_wait(&pool->done);
+            prev_begin = begin;
+            prev_end = end;
+            pool->set ^= 1;
+            begin = end;
+        }
+    }
+
+    FdColumnDesc desc[FD_COLUMNS];
+    fd_columns_layout(NULL, NULL, 0, desc);
+    for (size_t i = 0; i < pool->nunits; i++)
+        hdr.nrows += pool->units[i].nrows;
+    hdr.columns = pos;
+    hdr.chunks = pos + sizeof desc;
+    struct iovec iov[2] = {
+        { desc, sizeof desc },
+        { chunks, pool->nunits * sizeof *chunks },
+    };
+    if (ok)
+        ok = write_all(fd, iov, 2);
+    if (ok && pwrite(fd, &hdr, sizeof hdr, 0) != sizeof hdr) {
+        perror("write");
+        ok = false;
+    }
+    *nrows = hdr.nrows;
+    *size = hdr.chunks + pool->nunits * sizeof *chunks;
+    free(chunks);
+    return ok;
+}
+
+static void
+usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-j threads] [-t] file output\n"
+                    "  -j  number of threads (default: number of CPUs)\n"
+                    "  -t  print throughput statistics to stderr\n"
+                    "Writes the instructions of the executable sections of an "
+                    "x86 ELF file as column\nfile, see FdColFileHeader: one "
+                    "row per instruction with address, size, type,\nflags, "
+                    "segment, operand kinds, sizes and registers, "
+                    "displacement, immediate and\nbranch target.\n", prog);
+}
+
+int
+main(int argc, char** argv) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nworkers = ncpus > 0 ? ncpus : 1;
+    bool stats = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:th")) != -1) {
+        switch (opt) {
+        case 'j': nworkers = strtoul(optarg, NULL, 0); break;
+        case 't': stats = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind + 2 != argc || nworkers == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct Binary bin;
+    if (!binary_load(&bin, argv[optind]))
+        return EXIT_FAILURE;
+    // Windows are filled in file order, so read-ahead pays off.
+    madvise((void*) bin.map, bin.map_size, MADV_SEQUENTIAL);
+    const char* out_path = argv[optind + 1];
+    int fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(out_path);
+        return EXIT_FAILURE;
+    }
+
+    struct Pool pool = {0};
+    atomic_init(&pool.next, 0);
+    pthread_barrier_init(&pool.start, NULL, nworkers + 1);
+    pthread_barrier_init(&pool.done, NULL, nworkers + 1);
+    struct Worker* workers = calloc(nworkers, sizeof *workers);
+    if (!workers) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+    for (unsigned i = 0; i < nworkers; i++) {
+        workers[i].pool = &pool;
+        workers[i].id = i;
+        if (pthread_create(&workers[i].thread, NULL, worker, &workers[i])) {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+
+    uint64_t t0 = now_ns();
+    binary_split(&bin, &pool, nworkers);
+    uint64_t nrows, size;
+    bool ok = binary_export(&bin, &pool, workers, nworkers, fd, &nrows, &size);
+    if (close(fd)) {
+        perror(out_path);
+        ok = false;
+    }
+    uint64_t ns = now_ns() - t0;
+
+    if (stats) {
+        size_t code = 0;
+        for (size_t i = 0; i < bin.nsections; i++)
+            code += bin.sections[i].size;
+        fprintf(stderr, "%s: %zu code bytes, %" PRIu64 " rows, %zu chunks, %"
+                PRIu64 " output bytes, %.3f s, %.2f GB/min, %u threads\n",
+                bin.path, code, nrows, pool.nunits, size, ns / 1e9,
+                size * 60.0 / (ns ? ns : 1), nworkers);
+    }
+
+    pool.quit = true;
+    pthread_barrier_wait(&pool.start);
+    for (unsigned i = 0; i < nworkers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        free(workers[i].bufs[0].data);
+        free(workers[i].bufs[1].data);
+    }
+    free(workers);
+    pthread_barrier_destroy(&pool.start);
+    pthread_barrier_destroy(&pool.done);
+    free(pool.units);
+    binary_unload(&bin);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,152 @@
+
+#ifndef FD_FADEC_COLUMNS_H_
+#define FD_FADEC_COLUMNS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fadec.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of columns of decoded instructions, see FdColumns. **/
+#define FD_COLUMNS 24
+
+/** Flags of the flags column of FdColumns. **/
+enum {
+    FD_COL_LOCK = 1 << 0,
+    FD_COL_REP = 1 << 1,
+    FD_COL_REPNZ = 1 << 2,
+    /** The target column is valid **/
+    FD_COL_TARGET = 1 << 3,
+};
+
+/** Decoded instructions column by column, e.g. for export to analytical
+ * databases: every member points to an array with one element per row.
+ * An undecodable byte is a row with size zero. **/
+typedef struct FdColumns {
+    uint64_t* addr;
+    /** Instruction length, zero for an undecodable byte **/
+    uint8_t* size;
+    /** FdInstrType **/
+    uint16_t* type;
+    /** FD_COL_* **/
+    uint8_t* flags;
+    /** FD_SEGMENT **/
+    uint8_t* segment;
+    /** FdOpType of each operand **/
+    uint8_t* op_kind[4];
+    /** FD_OP_SIZE of each operand, zero without operand **/
+    uint8_t* op_size[4];
+    /** FD_OP_REG of register operands, FD_OP_BASE of memory operands **/
+    uint8_t* op_reg[4];
+    /** FD_OP_REG_TYPE of register operands; FD_OP_INDEX of memory operands,
+     * with FD_OP_SCALE in bits 6 and 7 **/
+    uint8_t* op_misc[4];
+    /** FD_OP_DISP of the memory operand, if any **/
+    int64_t* disp;
+    /** FD_OP_IMM of the immediate operand, if any **/
+    int64_t* imm;
+    /** Branch target, or address of a RIP-relative memory operand **/
+    uint64_t* target;
+} FdColumns;
+
+/** Description of a column of FdColumns. **/
+typedef struct FdColumnDesc {
+    /** NUL-padded name, e.g. "addr" or "op0_kind" **/
+    char name[16];
+    /** 'u' for unsigned and 'i' for signed little-endian integers **/
+    uint8_t kind;
+    /** Bytes per element **/
+    uint8_t width;
+    uint8_t reserved[6];
+} FdColumnDesc;
+
+/** Lay out the columns for a number of rows in one buffer, in the order of
+ * FdColumns and each aligned to eight bytes, so that a chunk of rows can be
+ * written to a file as is. The padding after each column is cleared.
+ *
+ * \param cols Receives the column pointers, may be NULL.
+ * \param buf The buffer, aligned to eight bytes; may be NULL to only get the
+ *        size.
+ * \param nrows The number of rows.
+ * \param desc Receives FD_COLUMNS column descriptions, may be NULL.
+ * \return The size of the columns in bytes.
+ **/
+size_t fd_columns_layout(FdColumns* cols, void* buf, size_t nrows,
+                         FdColumnDesc* desc);
+
+/** Fill rows of the columns from a batch of consecutive instructions.
+ *
+ * \param cols The columns.
+ * \param row The first row.
+ * \param instrs The decoded instructions.
+ * \param count The number of instructions.
+ * \param addr The address of the first instruction.
+ * \return The address after the last instruction.
+ **/
+uint64_t fd_columns_fill(const FdColumns* cols, size_t row,
+                         const FdInstr* instrs, size_t count, uint64_t addr);
+
+/** Decode the instructions which start in [start, end) of a code region into
+ * rows of the columns, in batches with fd_columns_fill; an undecodable byte
+ * is skipped as in FdSweep and gets a row of size zero. With a resolved
+ * FdSweep, the rows of a chunk are the instruction starts from its entry to
+ * its exit, so that chunks can be filled in parallel.
+ *
+ * \param cols The columns, may be NULL if cap is zero.
+ * \param row The first row.
+ * \param cap The number of rows available from row on.
+ * \param buf The code region.
+ * \param len The size of the code region.
+ * \param base The address of the code region.
+ * \param mode The decoding mode, see fd_decode.
+ * \param start The offset of the first instruction.
+ * \param end The offset where no further instruction starts.
+ * \return The number of rows, which may exceed cap.
+ **/
+size_t fd_columns_decode(const FdColumns* cols, size_t row, size_t cap,
+                         const uint8_t* buf, size_t len, uint64_t base,
+                         int mode, size_t start, size_t end);
+
+/** Magic of a column file: "FADECCOL" **/
+#define FD_COLFILE_MAGIC 0x4c4f434345444146ull
+/** Version of the column file format **/
+#define FD_COLFILE_VERSION 1
+
+/** Header of a column file, which stores decoded instructions in chunks of
+ * rows laid out by fd_columns_layout. All integers are little-endian; all
+ * offsets are relative to the start of the file and aligned to eight bytes,
+ * so that every column of a chunk can be mapped as an array, e.g. as the
+ * data buffer of an Arrow or NumPy array, without conversion. A writer can
+ * stream the chunks and write the column descriptions, the chunk table and
+ * the header at the end. **/
+typedef struct FdColFileHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t ncolumns;
+    uint64_t nrows;
+    uint64_t nchunks;
+    /** Offset of ncolumns FdColumnDesc **/
+    uint64_t columns;
+    /** Offset of the FdColFileChunk array, ascending by address **/
+    uint64_t chunks;
+    /** Decoding mode of the instructions, see fd_decode **/
+    uint32_t mode;
+    uint32_t reserved;
+} FdColFileHeader;
+
+/** A chunk of rows of a column file. **/
+typedef struct FdColFileChunk {
+    uint64_t nrows;
+    /** Offset of the columns, laid out by fd_columns_layout for nrows **/
+    uint64_t data;
+} FdColFileChunk;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
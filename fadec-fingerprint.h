@@ -0,0 +1,104 @@
+
+#ifndef FD_FADEC_FINGERPRINT_H_
+#define FD_FADEC_FINGERPRINT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fadec.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of MinHash slots of a function fingerprint, as power of two. **/
+#define FD_FP_SLOTS_LG 5
+#define FD_FP_SLOTS (1 << FD_FP_SLOTS_LG)
+
+/** Position-independent fingerprint of a function, see fd_fp_scan. **/
+typedef struct FdFingerprint {
+    /** Hash of the normalized instructions; equal for functions which only
+     * differ in their addresses. **/
+    uint64_t hash;
+    /** SimHash of the instruction features; similar functions differ in few
+     * bits. **/
+    uint64_t simhash;
+    /** One-permutation MinHash of the instruction features; the share of
+     * equal slots estimates the Jaccard similarity, see fd_fp_similarity. **/
+    uint32_t minhash[FD_FP_SLOTS];
+    /** Number of instructions, counting undecodable bytes. **/
+    uint32_t ninstrs;
+} FdFingerprint;
+
+/** State of a fingerprint while adding instructions. **/
+typedef struct FdFpState {
+    uint64_t start;
+    uint64_t end;
+    uint64_t hash;
+    uint64_t prev[2];
+    uint32_t ninstrs;
+    uint32_t nfeatures;
+    uint64_t lanes[8];
+    uint32_t counts[64];
+    uint32_t minhash[FD_FP_SLOTS];
+} FdFpState;
+
+/** Start the fingerprint of a function.
+ * \param st The state.
+ * \param start The function start address.
+ * \param end The address after the function; branch targets in [start, end)
+ *        are kept as offset from start.
+ **/
+void fd_fp_begin(FdFpState* st, uint64_t start, uint64_t end);
+
+/** Add the next instruction of a function to its fingerprint. The
+ * instruction is normalized to its type, prefixes, operand and address
+ * sizes, and its operands: registers are kept, but branch targets outside
+ * of the function, RIP-relative and absolute memory operands, and
+ * immediates and displacements of 32 bits or more with an absolute value of
+ * at least 0x10000, which may be addresses, are masked.
+ *
+ * \param st The state.
+ * \param instr The decoded instruction.
+ * \param addr The address of the instruction.
+ **/
+void fd_fp_add(FdFpState* st, const FdInstr* instr, uint64_t addr);
+
+/** Complete a fingerprint.
+ * \param st The state.
+ * \param out Receives the fingerprint.
+ **/
+void fd_fp_end(FdFpState* st, FdFingerprint* out);
+
+/** Compute the fingerprints of functions in a single pass, e.g. to find
+ * identical or similar functions across builds. Each function is decoded
+ * linearly from its start and fingerprinted with fd_fp_add; undecodable
+ * bytes are skipped and count as an instruction.
+ *
+ * \param buf The code region.
+ * \param len The size of the code region.
+ * \param base The address of the code region.
+ * \param mode The decoding mode, see fd_decode.
+ * \param funcs The functions, ascending by address. A function without size
+ *        extends to the next function or the end of the code region. Parts
+ *        outside of the code region are ignored.
+ * \param count The number of functions.
+ * \param out Array of count fingerprints.
+ * \return The number of functions which have code in the region.
+ **/
+size_t fd_fp_scan(const uint8_t* buf, size_t len, uint64_t base, int mode,
+                  const FdSymbol* funcs, size_t count, FdFingerprint* out);
+
+/** Compare the MinHash sketches of two fingerprints.
+ * \param a The first fingerprint.
+ * \param b The second fingerprint.
+ * \return The number of equal slots, up to FD_FP_SLOTS; divided by
+ *         FD_FP_SLOTS, it estimates the Jaccard similarity of the features.
+ **/
+unsigned fd_fp_similarity(const FdFingerprint* a, const FdFingerprint* b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
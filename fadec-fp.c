@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fadec.h>
+#include <fadec-fingerprint.h>
+
+#include "tools-common.h"
+
+
+struct Job {
+    char** paths;
+    size_t npaths;
+    atomic_size_t next;
+    bool minhash;
+    pthread_mutex_t out_lock;
+    atomic_bool failed;
+    atomic_size_t nfuncs;
+    atomic_size_t ninstrs;
+    atomic_size_t code_size;
+};
+
+static int
+cmp_section(const void* a, const void* b) {
+    const struct Section* sa = a;
+    const struct Section* sb = b;
+    return sa->addr < sb->addr ? -1 : sa->addr > sb->addr;
+}
+
+// By address, named symbols first.
+static int
+cmp_symbol(const void* a, const void* b) {
+    const FdSymbol* sa = a;
+    const FdSymbol* sb = b;
+    if (sa->addr != sb->addr)
+        return sa->addr < sb->addr ? -1 : 1;
+    return (sa->name == NULL) - (sb->name == NULL);
+}
+
+// Collect the functions from the symbols and, for stripped files, the FDEs;
+// one per address, ascending.
+static size_t
+binary_funcs(const struct Binary* bin, FdSymbol** funcs) {
+    size_t nsyms = fd_elf_symbols(bin->map, bin->map_size, NULL, 0);
+    size_t nfdes = fd_elf_eh_frame(bin->map, bin->map_size, NULL, 0);
+    FdSymbol* syms = xrealloc(NULL, (nsyms + nfdes + 1) * sizeof *syms);
+    fd_elf_symbols(bin->map, bin->map_size, syms, nsyms);
+    fd_elf_eh_frame(bin->map, bin->map_size, syms + nsyms, nfdes);
+    qsort(syms, nsyms + nfdes, sizeof *syms, cmp_symbol);
+    size_t count = 0;
+    for (size_t i = 0; i < nsyms + nfdes; i++) {
+        if (count && syms[count - 1].addr == syms[i].addr)
+            continue;
+        syms[count++] = syms[i];
+    }
+    *funcs = syms;
+    return count;
+}
+
+static void
+fingerprint_file(struct Job* job, const char* path) {
+    struct Binary bin;
+    if (!binary_load(&bin, path)) {
+        atomic_store(&job->failed, true);
+        return;
+    }
+    qsort(bin.sections, bin.nsections, sizeof *bin.sections, cmp_section);
+    FdSymbol* funcs;
+    size_t nfuncs = binary_funcs(&bin, &funcs);
+    FdFingerprint* fps = xrealloc(NULL, (nfuncs + 1) * sizeof *fps);
+
+    char* text = NULL;
+    size_t text_len = 0;
+    FILE* out = open_memstream(&text, &text_len);
+    if (!out) {
+        perror("open_memstream");
+        exit(EXIT_FAILURE);
+    }
+    size_t first = 0, total = 0, ninstrs = 0, code_size = 0;
+    for (size_t i = 0; i < bin.nsections; i++) {
+        const struct Section* s = &bin.sections[i];
+        code_size += s->size;
+        // Functions without size end at the next one, even in another
+        // section, so only those which start in the section are passed.
+        while (first < nfuncs && funcs[first].addr < s->addr)
+            first++;
+        size_t last = first;
+        while (last < nfuncs && funcs[last].addr - s->addr < s->size)
+            last++;
+        fd_fp_scan(s->code, s->size, s->addr, bin.mode, funcs + first,
+                   last - first, fps + first);
+        for (size_t j = first; j < last; j++) {
+            fprintf(out, "%016" PRIx64 " %016" PRIx64, fps[j].hash,
+                    fps[j].simhash);
+            if (job->minhash) {
+                putc(' ', out);
+                for (unsigned k = 0; k < FD_FP_SLOTS; k++)
+                    fprintf(out, "%08" PRIx32, fps[j].minhash[k]);
+            }
+            fprintf(out, " %6" PRIu32 " %s ", fps[j].ninstrs, path);
+            if (funcs[j].name)
+                fprintf(out, "%s\n", funcs[j].name);
+            else
+                fprintf(out, "%" PRIx64 "\n", funcs[j].addr);
+            ninstrs += fps[j].ninstrs;
+        }
+        total += last - first;
+        first = last;
+    }
+    fclose(out);
+
+    pthread_mutex_lock(&job->out_lock);
+    fwrite(text, 1, text_len, stdout);
+    pthread_mutex_unlock(&job->out_lock);
+    atomic_fetch_add(&job->nfuncs, total);
+    atomic_fetch_add(&job->ninstrs, ninstrs);
+    atomic_fetch_add(&job->code_size, code_size);
+
+    free(text);
+    free(fps);
+    free(funcs);
+    binary_unload(&bin);
+}
+
+static void
+worker(void* arg, unsigned id) {
+    struct Job* job = arg;
+    (void) id;
+    for (;;) {
+        size_t idx = atomic_fetch_add(&job->next, 1);
+        if (idx >= job->npaths)
+            break;
+        fingerprint_file(job, job->paths[idx]);
+    }
+}
+
+static void
+usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-j threads] [-m] [-t] file...\n"
+                    "  -j  number of threads (default: number of CPUs)\n"
+                    "  -m  also print the MinHash sketch\n"
+                    "  -t  print timing statistics to stderr\n"
+                    "Prints a position-independent fingerprint of each "
+                    "function of x86 ELF files:\nexact hash, SimHash, "
+                    "[MinHash,] number of instructions, file, and name or\n"
+                    "address. Functions are taken from the symbols and "
+                    "the .eh_frame section.\n", prog);
+}
+
+int
+main(int argc, char** argv) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nworkers = ncpus > 0 ? ncpus : 1;
+    bool stats = false;
+    struct Job job = { 0 };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:mth")) != -1) {
+        switch (opt) {
+        case 'j': nworkers = strtoul(optarg, NULL, 0); break;
+        case 'm': job.minhash = true; break;
+        case 't': stats = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc || nworkers == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t t0 = now_ns();
+    job.paths = argv + optind;
+    job.npaths = argc - optind;
+    atomic_init(&job.next, 0);
+    atomic_init(&job.failed, false);
+    atomic_init(&job.nfuncs, 0);
+    atomic_init(&job.ninstrs, 0);
+    atomic_init(&job.code_size, 0);
+    pthread_mutex_init(&job.out_lock, NULL);
+    if (nworkers > job.npaths)
+        nworkers = job.npaths;
+    run_workers(nworkers, worker, &job);
+    uint64_t t1 = now_ns();
+
+    if (stats) {
+        double secs = (t1 - t0) / 1e9;
+        size_t code_size = atomic_load(&job.code_size);
+        fprintf(stderr, "%zu files, %zu code bytes, %zu functions, %zu "
+                "instructions; %.3f s, %.1f MB/s, %u threads\n", job.npaths,
+                code_size, atomic_load(&job.nfuncs),
+                atomic_load(&job.ninstrs), secs,
+                secs > 0 ? code_size / secs / 1e6 : 0.0, nworkers);
+    }
+    pthread_mutex_destroy(&job.out_lock);
+    return atomic_load(&job.failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
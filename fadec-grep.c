@@ -0,0 +1,338 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fadec.h>
+#include <fadec-analysis.h>
+#include <fadec-pattern.h>
+
+#include "tools-common.h"
+
+
+#define CHUNK_SIZE (64 << 10)
+// Partial matches per worker; more are only needed for many patterns with
+// wide gaps which start at nearly every instruction.
+#define MAX_THREADS 4096
+
+// Parallel linear sweep of a section.
+struct SectionSweep {
+    FdSweep sweep;
+    size_t first_chunk;
+};
+
+// Matches of one chunk in the buffer of a worker.
+struct Chunk {
+    unsigned worker;
+    size_t section;
+    size_t off;
+    size_t count;
+};
+
+struct Matches {
+    FdPatMatch* matches;
+    size_t len;
+    size_t cap;
+    FdPatThread* threads;
+};
+
+struct Hit {
+    FdPatMatch match;
+    size_t section;
+};
+
+enum Phase {
+    PHASE_SWEEP,
+    PHASE_SCAN,
+};
+
+struct Job {
+    struct Binary* bin;
+    struct SectionSweep* sweeps; // one per section
+    const FdPatSet* set;
+    enum Phase phase;
+    atomic_size_t next;
+    struct Chunk* chunks;
+    size_t nchunks;
+    struct Matches* bufs; // one per worker
+};
+
+static void
+matches_reserve(struct Matches* buf, size_t len) {
+    if (buf->cap - buf->len >= len)
+        return;
+    size_t cap = buf->cap ? buf->cap : 1 << 10;
+    while (cap - buf->len < len)
+        cap *= 2;
+    buf->matches = xrealloc(buf->matches, cap * sizeof *buf->matches);
+    buf->cap = cap;
+}
+
+static int
+cmp_section(const void* a, const void* b) {
+    const struct Section* sa = a;
+    const struct Section* sb = b;
+    return sa->addr < sb->addr ? -1 : sa->addr > sb->addr;
+}
+
+static int
+cmp_hit(const void* a, const void* b) {
+    const FdPatMatch* ma = &((const struct Hit*) a)->match;
+    const FdPatMatch* mb = &((const struct Hit*) b)->match;
+    if (ma->start != mb->start)
+        return ma->start < mb->start ? -1 : 1;
+    return ma->pattern < mb->pattern ? -1 : ma->pattern > mb->pattern;
+}
+
+static void
+scan_chunk(struct Job* job, struct Matches* buf, unsigned worker, size_t idx) {
+    const struct Binary* bin = job->bin;
+    size_t sec = 0;
+    while (idx - job->sweeps[sec].first_chunk >= job->sweeps[sec].sweep.nchunks)
+        sec++;
+    const struct Section* s = &bin->sections[sec];
+    const struct SectionSweep* sw = &job->sweeps[sec];
+    const FdSweepChunk* chunk = &sw->sweep.chunks[idx - sw->first_chunk];
+    for (;;) {
+        size_t avail = buf->cap - buf->len;
+        size_t n = fd_pat_scan(job->set, s->code, s->size, s->addr, bin->mode,
+                               chunk->entry, chunk->exit, buf->threads,
+                               MAX_THREADS, buf->matches + buf->len, avail);
+        if (n <= avail) {
+            job->chunks[idx] = (struct Chunk) {
+                .worker = worker, .section = sec, .off = buf->len, .count = n,
+            };
+            buf->len += n;
+            return;
+        }
+        matches_reserve(buf, n);
+    }
+}
+
+static void
+worker(void* arg, unsigned id) {
+    struct Job* job = arg;
+    switch (job->phase) {
+    case PHASE_SWEEP:
+        for (size_t i = 0; i < job->bin->nsections; i++)
+            fd_sweep_run(&job->sweeps[i].sweep, id);
+        break;
+    case PHASE_SCAN:
+    default:
+        for (;;) {
+            size_t idx = atomic_fetch_add(&job->next, 1);
+            if (idx >= job->nchunks)
+                break;
+            scan_chunk(job, &job->bufs[id], id, idx);
+        }
+        break;
+    }
+}
+
+// Find the matches of all executable sections, sorted by start address and
+// pattern. Returns the number of matches, which are stored in *hits.
+static size_t
+binary_grep(struct Binary* bin, const FdPatSet* set, unsigned nworkers,
+            bool stats, struct Hit** hits) {
+    uint64_t t0 = now_ns();
+    qsort(bin->sections, bin->nsections, sizeof *bin->sections, cmp_section);
+    uint64_t* queues = xrealloc(NULL, (bin->nsections * nworkers + 1) *
+                                      sizeof *queues);
+    struct Job job = { .bin = bin, .set = set };
+    job.sweeps = xrealloc(NULL, (bin->nsections + 1) * sizeof *job.sweeps);
+    atomic_init(&job.next, 0);
+    for (size_t i = 0; i < bin->nsections; i++) {
+        const struct Section* s = &bin->sections[i];
+        struct SectionSweep* sw = &job.sweeps[i];
+        size_t nchunks = FD_SWEEP_CHUNKS(s->size, CHUNK_SIZE);
+        fd_sweep_init(&sw->sweep, s->code, s->size, bin->mode, CHUNK_SIZE,
+                      xrealloc(NULL, (s->size + 7) / 8),
+                      xrealloc(NULL, nchunks * sizeof(FdSweepChunk)),
+                      queues + i * nworkers, nworkers);
+        sw->first_chunk = job.nchunks;
+        job.nchunks += nchunks;
+    }
+    job.chunks = xrealloc(NULL, (job.nchunks + 1) * sizeof *job.chunks);
+    job.bufs = calloc(nworkers, sizeof *job.bufs);
+    if (!job.bufs) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned i = 0; i < nworkers; i++)
+        job.bufs[i].threads = xrealloc(NULL, 2 * MAX_THREADS *
+                                             sizeof(FdPatThread));
+
+    job.phase = PHASE_SWEEP;
+    run_workers(nworkers, worker, &job);
+    for (size_t i = 0; i < bin->nsections; i++)
+        fd_sweep_resolve(&job.sweeps[i].sweep);
+    uint64_t t1 = now_ns();
+    job.phase = PHASE_SCAN;
+    run_workers(nworkers, worker, &job);
+
+    size_t count = 0;
+    for (size_t i = 0; i < job.nchunks; i++)
+        count += job.chunks[i].count;
+    *hits = xrealloc(NULL, (count + 1) * sizeof **hits);
+    size_t pos = 0;
+    for (size_t i = 0; i < job.nchunks; i++) {
+        const struct Chunk* chunk = &job.chunks[i];
+        const struct Matches* buf = &job.bufs[chunk->worker];
+        for (size_t j = 0; j < chunk->count; j++)
+            (*hits)[pos++] = (struct Hit) {
+                .match = buf->matches[chunk->off + j],
+                .section = chunk->section,
+            };
+    }
+    // Within a chunk, matches are ordered by their end.
+    qsort(*hits, count, sizeof **hits, cmp_hit);
+    uint64_t t2 = now_ns();
+
+    if (stats) {
+        size_t code = 0;
+        for (size_t i = 0; i < bin->nsections; i++)
+            code += bin->sections[i].size;
+        double secs = (t2 - t1) / 1e9;
+        fprintf(stderr, "%s: %zu code bytes, %zu matches; sweep %.3f s, "
+                "scan %.3f s, %.1f MB/s, %u threads\n", bin->path, code,
+                count, (t1 - t0) / 1e9, secs,
+                secs > 0 ? code / secs / 1e6 : 0.0, nworkers);
+    }
+
+    for (size_t i = 0; i < bin->nsections; i++) {
+        free(job.sweeps[i].sweep.starts);
+        free(job.sweeps[i].sweep.chunks);
+    }
+    free(job.sweeps);
+    for (unsigned i = 0; i < nworkers; i++) {
+        free(job.bufs[i].matches);
+        free(job.bufs[i].threads);
+    }
+    free(job.bufs);
+    free(job.chunks);
+    free(queues);
+    return count;
+}
+
+static void
+print_hit(const struct Binary* bin, const struct Hit* hit,
+          const char* const* patterns, size_t npatterns) {
+    const struct Section* s = &bin->sections[hit->section];
+    const FdPatMatch* m = &hit->match;
+    printf("%016" PRIx64, m->start);
+    if (npatterns > 1)
+        printf(" [%s]", patterns[m->pattern]);
+    char sep = ' ';
+    for (uint64_t addr = m->start; addr < m->end; ) {
+        FdInstr instr;
+        char fmt[128];
+        int ret = fd_decode(s->code + (addr - s->addr),
+                            s->size - (addr - s->addr), bin->mode, 0, &instr);
+        if (ret < 0)
+            break;
+        fd_format_abs(&instr, addr, fmt, sizeof fmt);
+        printf("%c %s", sep, fmt);
+        sep = ';';
+        addr += ret;
+    }
+    putchar('\n');
+}
+
+static void
+usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-j threads] [-c] [-t] pattern file\n"
+                    "       %s [-j threads] [-c] [-t] -e pattern... file\n"
+                    "  -e  pattern to search, can be given multiple times\n"
+                    "  -c  only print the number of matches per pattern\n"
+                    "  -j  number of threads (default: number of CPUs)\n"
+                    "  -t  print timing statistics to stderr\n"
+                    "Searches the executable sections of an x86 ELF file for "
+                    "instruction sequences,\ne.g. \"lock cmpxchg mem[$p], *; "
+                    "jnz rel\"; see fd_pat_compile for the syntax.\n",
+            prog, prog);
+}
+
+int
+main(int argc, char** argv) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nworkers = ncpus > 0 ? ncpus : 1;
+    bool stats = false;
+    bool count_only = false;
+    const char** patterns = xrealloc(NULL, argc * sizeof *patterns);
+    size_t npatterns = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "e:j:cth")) != -1) {
+        switch (opt) {
+        case 'e': patterns[npatterns++] = optarg; break;
+        case 'j': nworkers = strtoul(optarg, NULL, 0); break;
+        case 'c': count_only = true; break;
+        case 't': stats = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (!npatterns && optind < argc)
+        patterns[npatterns++] = argv[optind++];
+    if (optind + 1 != argc || !npatterns || nworkers == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    size_t nsteps = 0, cap = 64;
+    FdPatStep* steps = xrealloc(NULL, cap * sizeof *steps);
+    for (size_t i = 0; i < npatterns; i++) {
+        size_t error;
+        size_t n;
+        while ((n = fd_pat_compile(patterns[i], i, steps + nsteps,
+                                   cap - nsteps, &error)) > cap - nsteps) {
+            cap *= 2;
+            steps = xrealloc(steps, cap * sizeof *steps);
+        }
+        if (!n) {
+            fprintf(stderr, "%s\n%*s^ invalid pattern\n", patterns[i],
+                    (int) error, "");
+            return EXIT_FAILURE;
+        }
+        nsteps += n;
+    }
+    FdPatSet set;
+    uint64_t* index = xrealloc(NULL, npatterns * FD_PAT_ALTS * sizeof *index);
+    if (fd_pat_init(&set, steps, nsteps, index, npatterns * FD_PAT_ALTS)) {
+        fprintf(stderr, "invalid pattern set\n");
+        return EXIT_FAILURE;
+    }
+
+    struct Binary bin;
+    if (!binary_load(&bin, argv[optind]))
+        return EXIT_FAILURE;
+    struct Hit* hits;
+    size_t count = binary_grep(&bin, &set, nworkers, stats, &hits);
+
+    if (count_only) {
+        size_t* counts = calloc(npatterns, sizeof *counts);
+        if (!counts) {
+            perror("calloc");
+            return EXIT_FAILURE;
+        }
+        for (size_t i = 0; i < count; i++)
+            counts[hits[i].match.pattern]++;
+        for (size_t i = 0; i < npatterns; i++)
+            printf("%zu\t%s\n", counts[i], patterns[i]);
+        free(counts);
+    } else {
+        for (size_t i = 0; i < count; i++)
+            print_hit(&bin, &hits[i], patterns, npatterns);
+    }
+
+    free(hits);
+    free(index);
+    free(steps);
+    free(patterns);
+    binary_unload(&bin);
+    return count ? EXIT_SUCCESS : EXIT_FAILURE;
+}
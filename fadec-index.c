@@ -0,0 +1,562 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <fadec.h>
+#include <fadec-analysis.h>
+#include <fadec-index.h>
+
+#include "tools-common.h"
+
+
+#define CHUNK_SIZE (64 << 10)
+
+// Analysis results of a section of the binary.
+struct SectionIndex {
+    FdSweep sweep;
+    size_t first_chunk;
+    FdXref* refs;
+    uint8_t* kinds;
+    size_t nrefs;
+    FdXref* scratch;
+    FdXrefIndex xrefs;
+    FdIndexFunc* funcs;
+    size_t nfuncs;
+};
+
+// Results of one chunk in the buffers of a worker.
+struct Chunk {
+    unsigned worker;
+    size_t refs_off;
+    size_t nrefs;
+    size_t cands_off;
+    size_t ncands;
+};
+
+struct Buf {
+    FdXref* refs;
+    uint8_t* kinds;
+    size_t nrefs;
+    size_t refs_cap;
+    FdFuncCand* cands;
+    size_t ncands;
+    size_t cands_cap;
+};
+
+enum Phase {
+    PHASE_SWEEP,
+    PHASE_SCAN,
+    PHASE_XREF,
+    PHASE_FILL,
+};
+
+struct Job {
+    struct Binary* bin;
+    struct SectionIndex* secs; // one per section
+    enum Phase phase;
+    atomic_size_t next;
+    struct Chunk* chunks;
+    size_t nchunks;
+    struct Buf* bufs; // one per worker
+    FdXrefIndex* xrefs;
+    void* out;
+    const FdIndexInput* inputs;
+};
+
+static void
+buf_reserve(struct Buf* buf, size_t nrefs, size_t ncands) {
+    if (buf->refs_cap - buf->nrefs < nrefs) {
+        size_t cap = buf->refs_cap ? buf->refs_cap : 1 << 14;
+        while (cap - buf->nrefs < nrefs)
+            cap *= 2;
+        buf->refs = xrealloc(buf->refs, cap * sizeof *buf->refs);
+        buf->kinds = xrealloc(buf->kinds, cap);
+        buf->refs_cap = cap;
+    }
+    if (buf->cands_cap - buf->ncands < ncands) {
+        size_t cap = buf->cands_cap ? buf->cands_cap : 1 << 12;
+        while (cap - buf->ncands < ncands)
+            cap *= 2;
+        buf->cands = xrealloc(buf->cands, cap * sizeof *buf->cands);
+        buf->cands_cap = cap;
+    }
+}
+
+static int
+cmp_section(const void* a, const void* b) {
+    const struct Section* sa = a;
+    const struct Section* sb = b;
+    return sa->addr < sb->addr ? -1 : sa->addr > sb->addr;
+}
+
+static int
+cmp_sym(const void* a, const void* b) {
+    const FdSymbol* sa = a;
+    const FdSymbol* sb = b;
+    return sa->addr < sb->addr ? -1 : sa->addr > sb->addr;
+}
+
+// Chunks are numbered consecutively across the sections.
+static size_t
+chunk_section(const struct Job* job, size_t idx) {
+    size_t sec = 0;
+    while (idx - job->secs[sec].first_chunk >=
+           FD_SWEEP_CHUNKS(job->bin->sections[sec].size, CHUNK_SIZE))
+        sec++;
+    return sec;
+}
+
+static void
+scan_chunk(struct Job* job, struct Buf* buf, unsigned worker, size_t idx) {
+    const struct Binary* bin = job->bin;
+    size_t sec = chunk_section(job, idx);
+    const struct Section* s = &bin->sections[sec];
+    const struct SectionIndex* si = &job->secs[sec];
+    const FdSweepChunk* chunk = &si->sweep.chunks[idx - si->first_chunk];
+    struct Chunk* res = &job->chunks[idx];
+    res->worker = worker;
+    for (;;) {
+        size_t avail = buf->refs_cap - buf->nrefs;
+        size_t n = fd_xref_scan(s->code, s->size, s->addr, bin->mode,
+                                chunk->entry, chunk->exit,
+                                buf->refs + buf->nrefs, buf->kinds + buf->nrefs,
+                                avail);
+        if (n <= avail) {
+            res->refs_off = buf->nrefs;
+            res->nrefs = n;
+            buf->nrefs += n;
+            break;
+        }
+        buf_reserve(buf, n, 0);
+    }
+    for (;;) {
+        size_t avail = buf->cands_cap - buf->ncands;
+        size_t n = fd_func_scan(s->code, s->size, s->addr, bin->mode,
+                                chunk->entry, chunk->exit,
+                                buf->cands + buf->ncands, avail);
+        if (n <= avail) {
+            res->cands_off = buf->ncands;
+            res->ncands = n;
+            buf->ncands += n;
+            break;
+        }
+        buf_reserve(buf, 0, n);
+    }
+}
+
+static void
+worker(void* arg, unsigned id) {
+    struct Job* job = arg;
+    switch (job->phase) {
+    case PHASE_SWEEP:
+        for (size_t i = 0; i < job->bin->nsections; i++)
+            fd_sweep_run(&job->secs[i].sweep, id);
+        break;
+    case PHASE_SCAN:
+        for (;;) {
+            size_t idx = atomic_fetch_add(&job->next, 1);
+            if (idx >= job->nchunks)
+                break;
+            scan_chunk(job, &job->bufs[id], id, idx);
+        }
+        break;
+    case PHASE_XREF:
+        fd_xref_run(job->xrefs, id);
+        break;
+    case PHASE_FILL:
+    default:
+        for (;;) {
+            size_t idx = atomic_fetch_add(&job->next, 1);
+            if (idx >= job->nchunks)
+                break;
+            size_t sec = chunk_section(job, idx);
+            size_t off = (idx - job->secs[sec].first_chunk) * CHUNK_SIZE;
+            fd_index_fill(job->out, job->inputs, sec, off, off + CHUNK_SIZE);
+        }
+        break;
+    }
+}
+
+// Turn the function starts of a section into ranges up to the next start,
+// or the size of a symbol or FDE at the start if it ends earlier.
+static void
+section_funcs(struct SectionIndex* si, const struct Section* s,
+              const FdFuncCand* starts, size_t count, const FdSymbol* known,
+              size_t nknown) {
+    si->funcs = xrealloc(NULL, (count + 1) * sizeof *si->funcs);
+    si->nfuncs = 0;
+    size_t k = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t addr = starts[i].addr;
+        uint64_t end = i + 1 < count ? starts[i + 1].addr : s->addr + s->size;
+        while (k < nknown && known[k].addr < addr)
+            k++;
+        uint64_t size = end - addr;
+        for (size_t j = k; j < nknown && known[j].addr == addr; j++)
+            if (known[j].size && known[j].size < size)
+                size = known[j].size;
+        si->funcs[si->nfuncs++] = (FdIndexFunc) {
+            .addr = addr,
+            .size = size <= UINT32_MAX ? size : UINT32_MAX,
+            .sources = starts[i].sources,
+        };
+    }
+}
+
+// Collect the references and function ranges of each section.
+static void
+binary_analyze(struct Binary* bin, unsigned nworkers, struct Job* job) {
+    uint64_t* queues = xrealloc(NULL, (bin->nsections * nworkers + 1) *
+                                      sizeof *queues);
+    for (size_t i = 0; i < bin->nsections; i++) {
+        const struct Section* s = &bin->sections[i];
+        struct SectionIndex* si = &job->secs[i];
+        size_t nchunks = FD_SWEEP_CHUNKS(s->size, CHUNK_SIZE);
+        fd_sweep_init(&si->sweep, s->code, s->size, bin->mode, CHUNK_SIZE,
+                      xrealloc(NULL, (s->size + 7) / 8),
+                      xrealloc(NULL, nchunks * sizeof(FdSweepChunk)),
+                      queues + i * nworkers, nworkers);
+        si->first_chunk = job->nchunks;
+        job->nchunks += nchunks;
+    }
+    job->chunks = xrealloc(NULL, (job->nchunks + 1) * sizeof *job->chunks);
+    job->bufs = calloc(nworkers, sizeof *job->bufs);
+    if (!job->bufs) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    job->phase = PHASE_SWEEP;
+    run_workers(nworkers, worker, job);
+    for (size_t i = 0; i < bin->nsections; i++)
+        fd_sweep_resolve(&job->secs[i].sweep);
+    job->phase = PHASE_SCAN;
+    atomic_store(&job->next, 0);
+    run_workers(nworkers, worker, job);
+
+    // Symbols and FDEs in code are known functions.
+    size_t nsyms = fd_elf_symbols(bin->map, bin->map_size, NULL, 0);
+    size_t nfdes = fd_elf_eh_frame(bin->map, bin->map_size, NULL, 0);
+    FdSymbol* known = xrealloc(NULL, (nsyms + nfdes + 1) * sizeof *known);
+    fd_elf_symbols(bin->map, bin->map_size, known, nsyms);
+    fd_elf_eh_frame(bin->map, bin->map_size, known + nsyms, nfdes);
+    size_t nknown = 0;
+    for (size_t i = 0; i < nsyms + nfdes; i++)
+        if (known[i].size)
+            known[nknown++] = known[i];
+    qsort(known, nknown, sizeof *known, cmp_sym);
+
+    uint64_t* hist = xrealloc(NULL, FD_XREF_HIST(nworkers) * sizeof *hist);
+    for (size_t i = 0; i < bin->nsections; i++) {
+        // Concatenate the results of the chunks in address order.
+        const struct Section* s = &bin->sections[i];
+        struct SectionIndex* si = &job->secs[i];
+        size_t nchunks = FD_SWEEP_CHUNKS(s->size, CHUNK_SIZE);
+        const struct Chunk* chunks = job->chunks + si->first_chunk;
+        size_t ncands = 0;
+        for (size_t j = 0; j < nchunks; j++) {
+            si->nrefs += chunks[j].nrefs;
+            ncands += chunks[j].ncands;
+        }
+        si->refs = xrealloc(NULL, (si->nrefs + 1) * sizeof *si->refs);
+        si->kinds = xrealloc(NULL, si->nrefs + 1);
+        FdFuncCand* cands = xrealloc(NULL, (ncands + nknown + 1) *
+                                           sizeof *cands);
+        size_t pos = 0, cpos = 0;
+        for (size_t j = 0; j < nchunks; j++) {
+            const struct Buf* buf = &job->bufs[chunks[j].worker];
+            memcpy(si->refs + pos, buf->refs + chunks[j].refs_off,
+                   chunks[j].nrefs * sizeof *si->refs);
+            memcpy(si->kinds + pos, buf->kinds + chunks[j].refs_off,
+                   chunks[j].nrefs);
+            memcpy(cands + cpos, buf->cands + chunks[j].cands_off,
+                   chunks[j].ncands * sizeof *cands);
+            pos += chunks[j].nrefs;
+            cpos += chunks[j].ncands;
+        }
+        for (size_t j = 0; j < nknown; j++)
+            if (known[j].addr - s->addr < s->size)
+                cands[cpos++] = (FdFuncCand) {
+                    .addr = known[j].addr,
+                    .sources = j < nsyms ? FD_FUNC_SYMBOL : FD_FUNC_EH_FRAME,
+                };
+        ncands = fd_func_reconcile(cands, cpos, known, nknown);
+        section_funcs(si, s, cands, ncands, known, nknown);
+        free(cands);
+
+        si->scratch = xrealloc(NULL, (2 * si->nrefs + 1) *
+                                     sizeof *si->scratch);
+        fd_xref_init(&si->xrefs, si->refs, si->kinds, si->nrefs, si->scratch,
+                     hist, nworkers);
+        job->phase = PHASE_XREF;
+        job->xrefs = &si->xrefs;
+        while (fd_xref_step(&si->xrefs))
+            run_workers(nworkers, worker, job);
+    }
+
+    for (unsigned i = 0; i < nworkers; i++) {
+        free(job->bufs[i].refs);
+        free(job->bufs[i].kinds);
+        free(job->bufs[i].cands);
+    }
+    free(job->bufs);
+    free(hist);
+    free(known);
+    free(queues);
+}
+
+// Build the index of a binary; the file is written under a temporary name
+// and renamed, so that readers never map a partial index.
+static bool
+binary_index(struct Binary* bin, const char* out_path, unsigned nworkers,
+             bool stats) {
+    uint64_t t0 = now_ns();
+    qsort(bin->sections, bin->nsections, sizeof *bin->sections, cmp_section);
+    struct Job job = { .bin = bin };
+    job.secs = calloc(bin->nsections + 1, sizeof *job.secs);
+    if (!job.secs) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&job.next, 0);
+    binary_analyze(bin, nworkers, &job);
+    uint64_t t1 = now_ns();
+
+    FdIndexInput* inputs = xrealloc(NULL, (bin->nsections + 1) *
+                                          sizeof *inputs);
+    for (size_t i = 0; i < bin->nsections; i++) {
+        const struct Section* s = &bin->sections[i];
+        const struct SectionIndex* si = &job.secs[i];
+        inputs[i] = (FdIndexInput) {
+            .name = s->name, .addr = s->addr, .buf = s->code, .size = s->size,
+            .mode = bin->mode, .starts = si->sweep.starts, .xrefs = &si->xrefs,
+            .funcs = si->funcs, .nfuncs = si->nfuncs,
+        };
+    }
+    uint8_t build_id[36];
+    size_t build_id_len = fd_elf_build_id(bin->map, bin->map_size, build_id,
+                                          sizeof build_id);
+    if (build_id_len > sizeof build_id)
+        build_id_len = 0;
+    size_t size = fd_index_init(NULL, 0, build_id, build_id_len, inputs,
+                                bin->nsections);
+    bool ok = false;
+    char* tmp_path = xrealloc(NULL, strlen(out_path) + 5);
+    sprintf(tmp_path, "%s.tmp", out_path);
+    int fd = -1;
+    void* out = MAP_FAILED;
+    if (!size) {
+        fprintf(stderr, "%s: overlapping code sections\n", bin->path);
+        goto done;
+    }
+    fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size)) {
+        perror(tmp_path);
+        goto done;
+    }
+    out = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (out == MAP_FAILED) {
+        perror(tmp_path);
+        goto done;
+    }
+    fd_index_init(out, size, build_id, build_id_len, inputs, bin->nsections);
+    job.phase = PHASE_FILL;
+    job.out = out;
+    job.inputs = inputs;
+    atomic_store(&job.next, 0);
+    run_workers(nworkers, worker, &job);
+    if (msync(out, size, MS_SYNC) || rename(tmp_path, out_path)) {
+        perror(out_path);
+        goto done;
+    }
+    ok = true;
+    uint64_t t2 = now_ns();
+
+    if (stats) {
+        size_t code = 0, refs = 0, funcs = 0;
+        for (size_t i = 0; i < bin->nsections; i++) {
+            code += bin->sections[i].size;
+            refs += job.secs[i].nrefs;
+            funcs += job.secs[i].nfuncs;
+        }
+        fprintf(stderr, "%s: %zu code bytes, %zu references, %zu functions, "
+                "%zu index bytes; analysis %.3f s, write %.3f s, %u threads\n",
+                bin->path, code, refs, funcs, size, (t1 - t0) / 1e9,
+                (t2 - t1) / 1e9, nworkers);
+    }
+
+done:
+    if (out != MAP_FAILED)
+        munmap(out, size);
+    if (fd >= 0)
+        close(fd);
+    if (!ok)
+        unlink(tmp_path);
+    for (size_t i = 0; i < bin->nsections; i++) {
+        struct SectionIndex* si = &job.secs[i];
+        free(si->sweep.starts);
+        free(si->sweep.chunks);
+        free(si->refs);
+        free(si->kinds);
+        free(si->scratch);
+        free(si->funcs);
+    }
+    free(tmp_path);
+    free(inputs);
+    free(job.chunks);
+    free(job.secs);
+    return ok;
+}
+
+static const char* const kind_names[] = {
+    [FD_XREF_CALL] = "call",
+    [FD_XREF_JUMP] = "jump",
+    [FD_XREF_BRANCH] = "branch",
+    [FD_XREF_ADDR] = "addr",
+    [FD_XREF_MEM] = "mem",
+};
+
+static void
+query(const FdIndex* index, const struct Binary* bin, uint64_t addr) {
+    uint64_t start;
+    const FdIndexRecord* rec = fd_index_instr(index, addr, &start);
+    const FdIndexSection* sec = fd_index_section_at(index, addr);
+    if (rec) {
+        char fmt[128];
+        snprintf(fmt, sizeof fmt, "type %u", rec->type);
+        for (size_t i = 0; bin && i < bin->nsections; i++) {
+            const struct Section* s = &bin->sections[i];
+            uint64_t off = start - s->addr;
+            FdInstr instr;
+            if (off < s->size && fd_decode(s->code + off, s->size - off,
+                                           bin->mode, 0, &instr) > 0)
+                fd_format_abs(&instr, start, fmt, sizeof fmt);
+        }
+        printf("%016" PRIx64 " %s: %s, %u bytes at %016" PRIx64, addr,
+               sec->name, fmt, rec->size, start);
+        if (FD_INDEX_HAS_REF(rec))
+            printf(", %s %016" PRIx64, kind_names[FD_INDEX_REF_KIND(rec)],
+                   fd_index_target(index, rec, start));
+        printf("\n");
+    } else if (sec) {
+        printf("%016" PRIx64 " %s: no instruction\n", addr, sec->name);
+    }
+    const FdIndexFunc* func = fd_index_func(index, addr);
+    if (func)
+        printf("%016" PRIx64 " in function %016" PRIx64 "+%#" PRIx32 "\n",
+               addr, func->addr, func->size);
+    for (size_t i = 0; i < index->nsections; i++) {
+        const uint64_t* sources;
+        size_t n = fd_index_refs_to(index, &index->sections[i], addr, addr + 1,
+                                    &sources);
+        for (size_t j = 0; j < n; j++)
+            printf("%016" PRIx64 " <- %016" PRIx64 "\n", addr, sources[j]);
+    }
+}
+
+static void
+usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-j threads] [-t] file index\n"
+                    "       %s -q [-e file] index [address...]\n"
+                    "  -j  number of threads (default: number of CPUs)\n"
+                    "  -t  print timing statistics to stderr\n"
+                    "  -q  query an index instead of building it\n"
+                    "  -e  check that the index belongs to a file\n"
+                    "Builds the index of the executable sections of an x86 "
+                    "ELF file with the\ninstructions, references and "
+                    "functions, or looks up addresses in it.\n", prog, prog);
+}
+
+int
+main(int argc, char** argv) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nworkers = ncpus > 0 ? ncpus : 1;
+    bool stats = false, query_mode = false;
+    const char* elf_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:tqe:h")) != -1) {
+        switch (opt) {
+        case 'j': nworkers = strtoul(optarg, NULL, 0); break;
+        case 't': stats = true; break;
+        case 'q': query_mode = true; break;
+        case 'e': elf_path = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (!query_mode) {
+        if (optind + 2 != argc || nworkers == 0) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        struct Binary bin;
+        if (!binary_load(&bin, argv[optind]))
+            return EXIT_FAILURE;
+        bool ok = binary_index(&bin, argv[optind + 1], nworkers, stats);
+        binary_unload(&bin);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char* index_path = argv[optind];
+    size_t size;
+    const uint8_t* map = map_file(index_path, &size);
+    if (!map)
+        return EXIT_FAILURE;
+    FdIndex index;
+    int res = fd_index_open(&index, map, size);
+    if (res) {
+        fprintf(stderr, "%s: %s\n", index_path, res == -2 ?
+                "built with other decode tables, rebuild the index" :
+                "not a valid index");
+        munmap((void*) map, size);
+        return EXIT_FAILURE;
+    }
+
+    // The instructions can only be formatted with the code of the file.
+    struct Binary bin = {0};
+    if (elf_path) {
+        uint8_t build_id[36];
+        size_t len = 0;
+        if (binary_load(&bin, elf_path))
+            len = fd_elf_build_id(bin.map, bin.map_size, build_id,
+                                  sizeof build_id);
+        if (!bin.map || len != index.header->build_id_len ||
+            memcmp(build_id, index.header->build_id, len)) {
+            fprintf(stderr, "%s: index does not belong to %s\n", index_path,
+                    elf_path);
+            if (bin.map)
+                binary_unload(&bin);
+            munmap((void*) map, size);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int ret = EXIT_SUCCESS;
+    for (int i = optind + 1; i < argc; i++) {
+        char* end;
+        uint64_t addr = strtoull(argv[i], &end, 16);
+        if (*end) {
+            fprintf(stderr, "%s: invalid address\n", argv[i]);
+            ret = EXIT_FAILURE;
+            continue;
+        }
+        query(&index, elf_path ? &bin : NULL, addr);
+    }
+    if (elf_path)
+        binary_unload(&bin);
+    munmap((void*) map, size);
+    return ret;
+}
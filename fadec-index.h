@@ -0,0 +1,240 @@
+
+#ifndef FD_FADEC_INDEX_H_
+#define FD_FADEC_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fadec-analysis.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Magic number of an index file, "FADECIDX" in file order. **/
+#define FD_INDEX_MAGIC 0x5844494345444146ull
+/** Format version of index files. **/
+#define FD_INDEX_VERSION 1
+
+/** Header of an index file, which stores the decoding results of the code
+ * sections of a binary, so that analyses can map the file into memory and
+ * query it in place. All integers are little-endian; all offsets are relative
+ * to the start of the file and aligned to eight bytes. **/
+typedef struct FdIndexHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t nsections;
+    /** fd_table_hash of the builder **/
+    uint64_t table_hash;
+    /** Size of the file **/
+    uint64_t size;
+    /** GNU build ID of the indexed binary, see fd_elf_build_id **/
+    uint32_t build_id_len;
+    uint8_t build_id[36];
+    /** Offset of the FdIndexSection array, ascending by address **/
+    uint64_t sections;
+} FdIndexHeader;
+
+/** A code section of an index file. **/
+typedef struct FdIndexSection {
+    /** NUL-padded name, truncated to 31 characters **/
+    char name[32];
+    uint64_t addr;
+    uint64_t size;
+    /** Decoding mode, see fd_decode **/
+    uint32_t mode;
+    uint32_t reserved;
+    /** Bitmap of the instruction starts of a linear sweep as in FdSweep,
+     * bit i%64 of word i/64 for offset i **/
+    uint64_t starts;
+    /** Number of starts before each block of 512 offsets, and the total **/
+    uint64_t ranks;
+    /** FdIndexRecord of each instruction **/
+    uint64_t records;
+    uint64_t ninstrs;
+    /** References by target as FdXrefIndex: the targets ascending, the first
+     * source of each target and the end, and the sources **/
+    uint64_t targets;
+    uint64_t first;
+    uint64_t sources;
+    uint64_t ntargets;
+    uint64_t nsources;
+    /** FdXref array ascending by source with the targets of the records with
+     * FD_INDEX_FAR **/
+    uint64_t fars;
+    uint64_t nfars;
+    /** FdIndexFunc array, ascending **/
+    uint64_t funcs;
+    uint64_t nfuncs;
+} FdIndexSection;
+
+/** Flags of FdIndexRecord. **/
+enum {
+    /** The target is not representable relative to the instruction and
+     * stored in the fars of the section **/
+    FD_INDEX_FAR = 0x80,
+};
+
+/** Compact decoded instruction of an index. **/
+typedef struct FdIndexRecord {
+    /** FdInstrType **/
+    uint16_t type;
+    /** Zero for an undecodable byte, which the linear sweep skips **/
+    uint8_t size;
+    /** Bits 0-3: FdCfKind; bits 4-6: FdXrefKind + 1 of the reference of the
+     * instruction, or zero if it has none; bit 7: FD_INDEX_FAR **/
+    uint8_t flags;
+    /** Reference target relative to the instruction address **/
+    int32_t target;
+} FdIndexRecord;
+
+/** Get the FdCfKind of an FdIndexRecord. **/
+#define FD_INDEX_CF(rec) ((FdCfKind) ((rec)->flags & 0xf))
+/** Get whether an FdIndexRecord has a reference, see fd_index_target. **/
+#define FD_INDEX_HAS_REF(rec) (((rec)->flags & 0x70) != 0)
+/** Get the FdXrefKind of the reference of an FdIndexRecord. **/
+#define FD_INDEX_REF_KIND(rec) ((FdXrefKind) ((((rec)->flags >> 4) & 7) - 1))
+
+/** A function range of an index. **/
+typedef struct FdIndexFunc {
+    uint64_t addr;
+    uint32_t size;
+    /** Combination of FD_FUNC_* **/
+    uint32_t sources;
+} FdIndexFunc;
+
+/** Input of fd_index_init for a code section. **/
+typedef struct FdIndexInput {
+    const char* name;
+    uint64_t addr;
+    const uint8_t* buf;
+    size_t size;
+    int mode;
+    /** Instruction starts of the linear sweep, see FdSweep **/
+    const uint8_t* starts;
+    /** Complete index of the references of the section, or NULL **/
+    const FdXrefIndex* xrefs;
+    /** Function ranges, ascending **/
+    const FdIndexFunc* funcs;
+    size_t nfuncs;
+} FdIndexInput;
+
+/** Lay out an index file and write everything except for the instruction
+ * records, which fd_index_fill writes afterwards. No memory is allocated.
+ *
+ * \param out Buffer for the file, zero-initialized and aligned to eight
+ *        bytes, e.g. a mapping of the file; may be NULL if cap is zero.
+ * \param cap The size of out.
+ * \param build_id The build ID of the binary, see fd_elf_build_id.
+ * \param build_id_len The size of the build ID, at most 36.
+ * \param secs The code sections, ascending by address and not overlapping.
+ * \param nsecs The number of sections.
+ * \return The size of the file, which may exceed cap; nothing is written
+ *         then. Zero if an input is invalid.
+ **/
+size_t fd_index_init(void* out, size_t cap, const uint8_t* build_id,
+                     size_t build_id_len, const FdIndexInput* secs,
+                     size_t nsecs);
+
+/** Write the records of the instructions which start in [start, end) of a
+ * section, e.g. in parallel for the chunks of the FdSweep of the section.
+ *
+ * \param out The file, after fd_index_init.
+ * \param secs The code sections as passed to fd_index_init.
+ * \param sec The index of the section.
+ * \param start The first offset.
+ * \param end The offset after the range.
+ **/
+void fd_index_fill(void* out, const FdIndexInput* secs, size_t sec,
+                   size_t start, size_t end);
+
+/** Read-only view of an index file. **/
+typedef struct FdIndex {
+    const uint8_t* data;
+    size_t size;
+    const FdIndexHeader* header;
+    const FdIndexSection* sections;
+    size_t nsections;
+} FdIndex;
+
+/** Open an index file in memory, e.g. mapped from disk, after checking its
+ * structure; the data is not copied. Whether the index belongs to a binary is
+ * up to the caller, by comparing the build ID.
+ *
+ * \param index The index to initialize.
+ * \param data The file contents, aligned to eight bytes.
+ * \param size The size of the file.
+ * \return Zero on success, -1 if the file is no valid index, -2 if it was
+ *         built with different decode tables and must be rebuilt.
+ **/
+int fd_index_open(FdIndex* index, const void* data, size_t size);
+
+/** Find a section by name.
+ * \param index The index.
+ * \param name The section name.
+ * \return The section, or NULL.
+ **/
+const FdIndexSection* fd_index_section(const FdIndex* index, const char* name);
+
+/** Find the section containing an address.
+ * \param index The index.
+ * \param addr The address.
+ * \return The section, or NULL.
+ **/
+const FdIndexSection* fd_index_section_at(const FdIndex* index, uint64_t addr);
+
+/** Find the instruction containing an address.
+ * \param index The index.
+ * \param addr The address.
+ * \param start Receives the address of the instruction.
+ * \return The record of the instruction, or NULL if no instruction of the
+ *         linear sweep covers the address.
+ **/
+const FdIndexRecord* fd_index_instr(const FdIndex* index, uint64_t addr,
+                                    uint64_t* start);
+
+/** Find the first instruction which starts at or after an address, in the
+ * section containing the address; e.g. to iterate over the instructions.
+ * \param index The index.
+ * \param addr The address.
+ * \param start Receives the address of the instruction.
+ * \return The record of the instruction, or NULL if there is none.
+ **/
+const FdIndexRecord* fd_index_next(const FdIndex* index, uint64_t addr,
+                                   uint64_t* start);
+
+/** Get the reference target of an instruction.
+ * \param index The index.
+ * \param rec The record of the instruction.
+ * \param addr The address of the instruction.
+ * \return The target; zero if the instruction has no reference.
+ **/
+uint64_t fd_index_target(const FdIndex* index, const FdIndexRecord* rec,
+                         uint64_t addr);
+
+/** Find the references from the instructions of a section to addresses in
+ * [lo, hi), like fd_xref_to.
+ *
+ * \param index The index.
+ * \param sec The section of the referencing instructions.
+ * \param lo The lowest target address.
+ * \param hi The address after the range.
+ * \param sources Receives the sources of the references, ordered by target
+ *        and source.
+ * \return The number of references.
+ **/
+size_t fd_index_refs_to(const FdIndex* index, const FdIndexSection* sec,
+                        uint64_t lo, uint64_t hi, const uint64_t** sources);
+
+/** Find the function range containing an address.
+ * \param index The index.
+ * \param addr The address.
+ * \return The function, or NULL.
+ **/
+const FdIndexFunc* fd_index_func(const FdIndex* index, uint64_t addr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
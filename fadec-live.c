@@ -0,0 +1,427 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <fadec.h>
+
+#include "tools-common.h"
+
+
+// Bytes read with one process_vm_readv call.
+#define READ_SIZE (16 << 20)
+// Regions or parts of regions read with one call.
+#define READ_IOVS (IOV_MAX < 1024 ? IOV_MAX : 1024)
+// An instruction which straddles two reads is continued from the bytes kept
+// before the buffer.
+#define CARRY 16
+// Instructions decoded before they are formatted as a listing.
+#define BATCH 256
+
+// An executable mapping of /proc/pid/maps.
+struct Region {
+    uint64_t start;
+    uint64_t end;
+    uint64_t offset;
+    uint64_t inode;
+    char perms[8];
+    char* path; // empty for anonymous mappings
+};
+
+struct Maps {
+    struct Region* regions;
+    size_t count;
+    size_t cap;
+};
+
+struct Buf {
+    char* data;
+    size_t len;
+    size_t cap;
+};
+
+// A part of a region in the read buffer.
+struct Piece {
+    const struct Region* region;
+    uint64_t addr;
+    size_t len;
+};
+
+struct Reader {
+    pid_t pid;
+    int mode;
+    unsigned flags; // FD_LISTING_*
+    // Reused for all reads; CARRY bytes before data hold the start of an
+    // instruction continued from the previous read.
+    uint8_t* data;
+    size_t carry;
+    struct Buf out;
+    struct {
+        size_t regions;
+        size_t bytes;
+        size_t calls;
+        size_t instrs;
+        size_t bad_bytes;
+    } stats;
+};
+
+static void
+buf_reserve(struct Buf* buf, size_t len) {
+    if (buf->cap - buf->len >= len)
+        return;
+    size_t cap = buf->cap ? buf->cap : 1 << 20;
+    while (cap - buf->len < len)
+        cap *= 2;
+    buf->data = xrealloc(buf->data, cap);
+    buf->cap = cap;
+}
+
+static bool
+write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t ret = write(fd, data, len);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("write");
+            return false;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+static void
+maps_clear(struct Maps* maps) {
+    for (size_t i = 0; i < maps->count; i++)
+        free(maps->regions[i].path);
+    maps->count = 0;
+}
+
+// Read the executable mappings of a process, ascending by address.
+static bool
+maps_load(struct Maps* maps, pid_t pid, bool anon_only) {
+    char path[64];
+    snprintf(path, sizeof path, "/proc/%d/maps", (int) pid);
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    maps_clear(maps);
+    char* line = NULL;
+    size_t line_cap = 0;
+    while (getline(&line, &line_cap, f) > 0) {
+        struct Region r = {0};
+        int name = 0;
+        if (sscanf(line, "%" SCNx64 "-%" SCNx64 " %7s %" SCNx64 " %*s %" SCNu64
+                   " %n", &r.start, &r.end, r.perms, &r.offset, &r.inode,
+                   &name) < 5)
+            continue;
+        if (r.perms[0] != 'r' || r.perms[2] != 'x' || r.start >= r.end)
+            continue;
+        line[strcspn(line, "\n")] = '\0';
+        // JIT code is in anonymous mappings or memfd files.
+        const char* file = line + name;
+        if (anon_only && *file && strncmp(file, "[anon", 5) &&
+            strncmp(file, "/memfd:", 7))
+            continue;
+        r.path = strdup(file);
+        if (!r.path) {
+            perror("strdup");
+            exit(EXIT_FAILURE);
+        }
+        if (maps->count == maps->cap) {
+            maps->cap = 2 * maps->cap + 64;
+            maps->regions = xrealloc(maps->regions,
+                                     maps->cap * sizeof *maps->regions);
+        }
+        maps->regions[maps->count++] = r;
+    }
+    free(line);
+    fclose(f);
+    return true;
+}
+
+static bool
+region_equal(const struct Region* a, const struct Region* b) {
+    return a->start == b->start && a->end == b->end &&
+           a->offset == b->offset && a->inode == b->inode &&
+           !strcmp(a->perms, b->perms) && !strcmp(a->path, b->path);
+}
+
+// Select the regions of cur which are not mapped identically in prev; both
+// are sorted by address.
+static size_t
+maps_changed(const struct Maps* cur, const struct Maps* prev,
+             const struct Region** out) {
+    size_t count = 0, j = 0;
+    for (size_t i = 0; i < cur->count; i++) {
+        const struct Region* r = &cur->regions[i];
+        while (j < prev->count && prev->regions[j].start < r->start)
+            j++;
+        if (j < prev->count && region_equal(r, &prev->regions[j]))
+            continue;
+        out[count++] = r;
+    }
+    return count;
+}
+
+// Like objdump, list an undecodable byte as "(bad)" and continue after it.
+static size_t
+format_bad(char* buf, uint64_t addr, uint8_t byte, unsigned flags) {
+    char* cur = buf;
+    if (!(flags & FD_LISTING_NO_ADDR))
+        cur += sprintf(cur, "%" PRIx64 ": ", addr);
+    if (!(flags & FD_LISTING_NO_BYTES))
+        cur += sprintf(cur, "%02x%22s", byte, "");
+    cur += sprintf(cur, "(bad)\n");
+    return cur - buf;
+}
+
+// Decode and format code at addr. Unless the region ends with it, a partial
+// instruction at the end is left over; its length is returned.
+static size_t
+format_code(struct Reader* rd, const uint8_t* code, size_t len, uint64_t addr,
+            bool last) {
+    struct Buf* buf = &rd->out;
+    FdInstr instrs[BATCH];
+    for (size_t off = 0; off < len; ) {
+        size_t start = off;
+        unsigned n = 0;
+        int ret = 0;
+        while (n < BATCH && off < len) {
+            ret = fd_decode(code + off, len - off, rd->mode, 0, &instrs[n]);
+            if (ret < 0)
+                break;
+            off += ret;
+            n++;
+        }
+
+        buf_reserve(buf, (n + 1) * FD_LISTING_LINE_MAX);
+        buf->len += fd_format_listing(instrs, n, addr + start, code + start,
+                                      buf->data + buf->len,
+                                      buf->cap - buf->len, rd->flags);
+        rd->stats.instrs += n;
+        if (ret == FD_ERR_PARTIAL && !last)
+            return len - off;
+        if (ret < 0) {
+            buf->len += format_bad(buf->data + buf->len, addr + off, code[off],
+                                   rd->flags);
+            rd->stats.bad_bytes++;
+            off++;
+        }
+    }
+    return 0;
+}
+
+static void
+format_header(struct Reader* rd, const struct Region* r) {
+    struct Buf* buf = &rd->out;
+    buf_reserve(buf, strlen(r->path) + 96);
+    buf->len += sprintf(buf->data + buf->len, "\nDisassembly of %016" PRIx64
+                        "-%016" PRIx64 " %s %s:\n", r->start, r->end, r->perms,
+                        *r->path ? r->path : "[anon]");
+}
+
+// Decode the pieces of one read; the last may be continued by the next read.
+static void
+format_pieces(struct Reader* rd, const struct Piece* pieces, size_t count,
+              size_t total) {
+    const uint8_t* code = rd->data + CARRY;
+    for (size_t i = 0; i < count && total; i++) {
+        const struct Piece* p = &pieces[i];
+        const struct Region* r = p->region;
+        if (p->addr == r->start)
+            format_header(rd, r);
+        // Bytes of an instruction which straddles the previous read.
+        size_t carry = p->addr != r->start && i == 0 ? rd->carry : 0;
+        size_t len = p->len < total ? p->len : total;
+        bool last = p->addr + len == r->end;
+        size_t left = format_code(rd, code - carry, carry + len,
+                                  p->addr - carry, last);
+        // Keep the rest of a partial instruction before the buffer.
+        memmove(rd->data + CARRY - left, code + len - left, left);
+        rd->carry = left;
+        code += len;
+        total -= len;
+    }
+}
+
+// Read and disassemble regions, batching up to READ_IOVS parts of regions
+// and READ_SIZE bytes into each process_vm_readv call.
+static bool
+read_regions(struct Reader* rd, const struct Region** regions, size_t count) {
+    struct Piece pieces[READ_IOVS];
+    struct iovec remote[READ_IOVS];
+    size_t idx = 0;
+    uint64_t addr = count ? regions[0]->start : 0;
+    while (idx < count) {
+        size_t npieces = 0, size = 0;
+        size_t next = idx;
+        uint64_t next_addr = addr;
+        while (next < count && npieces < READ_IOVS && size < READ_SIZE) {
+            const struct Region* r = regions[next];
+            size_t len = r->end - next_addr;
+            if (len > READ_SIZE - size)
+                len = READ_SIZE - size;
+            pieces[npieces] = (struct Piece) { r, next_addr, len };
+            remote[npieces++] = (struct iovec) {
+                (void*) (uintptr_t) next_addr, len,
+            };
+            size += len;
+            next_addr += len;
+            if (next_addr == r->end && ++next < count)
+                next_addr = regions[next]->start;
+        }
+
+        struct iovec local = { rd->data + CARRY, size };
+        ssize_t ret = process_vm_readv(rd->pid, &local, 1, remote, npieces, 0);
+        rd->stats.calls++;
+        if (ret < 0 && errno != EFAULT && errno != EIO) {
+            perror("process_vm_readv");
+            return false;
+        }
+        size_t done = ret > 0 ? (size_t) ret : 0;
+        rd->stats.bytes += done;
+        format_pieces(rd, pieces, npieces, done);
+        if (!write_all(STDOUT_FILENO, rd->out.data, rd->out.len))
+            return false;
+        rd->out.len = 0;
+        if (done == size) {
+            idx = next;
+            addr = next_addr;
+            continue;
+        }
+
+        // The read stopped at an unreadable page; skip the rest of its
+        // region.
+        size_t skip = 0;
+        while (pieces[skip].len <= done)
+            done -= pieces[skip++].len;
+        const struct Region* r = pieces[skip].region;
+        fprintf(stderr, "cannot read %016" PRIx64 "-%016" PRIx64 " %s\n",
+                pieces[skip].addr + done, r->end,
+                *r->path ? r->path : "[anon]");
+        rd->carry = 0;
+        while (idx < count && regions[idx] != r)
+            idx++;
+        if (++idx < count)
+            addr = regions[idx]->start;
+    }
+    return true;
+}
+
+static void
+usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-m 32|64] [-M intel|att] [-A] [-B] [-x] "
+                    "[-i seconds [-c count]] [-t] pid\n"
+                    "  -m  decoding mode (default: 64)\n"
+                    "  -M  syntax (default: intel)\n"
+                    "  -A  omit addresses\n"
+                    "  -B  omit instruction bytes\n"
+                    "  -x  only anonymous mappings, e.g. JIT code\n"
+                    "  -i  repeat after an interval, listing only mappings "
+                    "which changed\n"
+                    "  -c  number of repetitions (default: until the process "
+                    "exits)\n"
+                    "  -t  print statistics to stderr\n"
+                    "Disassembles the executable mappings of a running "
+                    "process.\n", prog);
+}
+
+int
+main(int argc, char** argv) {
+    struct Reader rd = { .mode = 64 };
+    bool anon_only = false, stats = false;
+    double interval = -1;
+    unsigned long repeat = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:M:ABxi:c:th")) != -1) {
+        switch (opt) {
+        case 'm': rd.mode = strtoul(optarg, NULL, 0); break;
+        case 'M':
+            if (!strcmp(optarg, "intel")) {
+                rd.flags &= ~FD_LISTING_ATT;
+            } else if (!strcmp(optarg, "att")) {
+                rd.flags |= FD_LISTING_ATT;
+            } else {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'A': rd.flags |= FD_LISTING_NO_ADDR; break;
+        case 'B': rd.flags |= FD_LISTING_NO_BYTES; break;
+        case 'x': anon_only = true; break;
+        case 'i': interval = strtod(optarg, NULL); break;
+        case 'c': repeat = strtoul(optarg, NULL, 0); break;
+        case 't': stats = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind + 1 != argc || (rd.mode != 32 && rd.mode != 64)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    rd.pid = strtol(argv[optind], NULL, 0);
+    rd.data = xrealloc(NULL, CARRY + READ_SIZE);
+
+    struct Maps maps[2] = {0};
+    const struct Region** changed = NULL;
+    bool ok = true;
+    for (unsigned long iter = 0; ; iter++) {
+        struct Maps* cur = &maps[iter % 2];
+        struct Maps* prev = &maps[(iter + 1) % 2];
+        if (!maps_load(cur, rd.pid, anon_only)) {
+            // The process exited while it was watched.
+            ok = iter > 0;
+            break;
+        }
+        changed = xrealloc(changed, (cur->count + 1) * sizeof *changed);
+        size_t count = maps_changed(cur, prev, changed);
+
+        uint64_t t0 = now_ns();
+        rd.stats.regions = count;
+        rd.stats.bytes = rd.stats.calls = 0;
+        rd.stats.instrs = rd.stats.bad_bytes = 0;
+        rd.carry = 0;
+        ok = read_regions(&rd, changed, count);
+        uint64_t ns = now_ns() - t0;
+        if (stats) {
+            fprintf(stderr, "%zu of %zu regions changed, %zu bytes in %zu "
+                    "reads, %zu instructions, %zu bad bytes; %.3f s, "
+                    "%.1f MB/s\n", count, cur->count, rd.stats.bytes,
+                    rd.stats.calls, rd.stats.instrs, rd.stats.bad_bytes,
+                    ns / 1e9, rd.stats.bytes * 1e3 / (ns ? ns : 1));
+        }
+        if (!ok || interval < 0 || (repeat && iter + 1 >= repeat))
+            break;
+        struct timespec ts = {
+            .tv_sec = (time_t) interval,
+            .tv_nsec = (long) ((interval - (time_t) interval) * 1e9),
+        };
+        nanosleep(&ts, NULL);
+    }
+
+    maps_clear(&maps[0]);
+    maps_clear(&maps[1]);
+    free(maps[0].regions);
+    free(maps[1].regions);
+    free(changed);
+    free(rd.out.data);
+    free(rd.data);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,485 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include <fadec.h>
+#include <fadec-analysis.h>
+
+#include "tools-common.h"
+
+
+// Code between symbols is split into chunks of this size for the workers, at
+// the instruction boundaries of a parallel linear sweep.
+#define CHUNK_SIZE (256 << 10)
+// Code bytes per thread in one window. The output of a window is written while
+// the workers format the next one.
+#define WINDOW_BYTES (1 << 20)
+// Instructions decoded before they are formatted as a listing.
+#define BATCH 256
+
+// A range of code which is formatted by one worker.
+struct Unit {
+    const uint8_t* code;
+    size_t size;
+    uint64_t addr;
+    const char* label; // symbol at the start or NULL
+    const char* section; // section name for the first unit of a section
+    // Formatted output in the buffer of the worker.
+    unsigned worker;
+    size_t out_off;
+    size_t out_len;
+};
+
+struct Buf {
+    char* data;
+    size_t len;
+    size_t cap;
+};
+
+struct Stats {
+    uint64_t instrs;
+    uint64_t bad_bytes;
+    uint64_t code_bytes;
+    uint64_t out_bytes;
+};
+
+struct Pool;
+
+struct Worker {
+    struct Pool* pool;
+    unsigned id;
+    pthread_t thread;
+    // One buffer is filled while the other one is written.
+    struct Buf bufs[2];
+    struct Stats stats;
+};
+
+struct Pool {
+    pthread_barrier_t start;
+    pthread_barrier_t done;
+    struct Binary* bin;
+    struct Unit* units;
+    size_t nunits;
+    size_t cap;
+    FdSweep* sweep; // if set, the workers run the sweep instead
+    size_t end; // end of the units of the current window
+    atomic_size_t next;
+    unsigned set; // buffer of the current window
+    unsigned flags; // FD_LISTING_*
+    bool quit;
+};
+
+static void
+unit_add(struct Pool* pool, const uint8_t* code, size_t size, uint64_t addr,
+         const char* label, const char* section) {
+    if (!size)
+        return;
+    if (pool->nunits == pool->cap) {
+        pool->cap = pool->cap ? 2 * pool->cap : 256;
+        pool->units = xrealloc(pool->units, pool->cap * sizeof *pool->units);
+    }
+    pool->units[pool->nunits++] = (struct Unit) {
+        .code = code, .size = size, .addr = addr, .label = label,
+        .section = section,
+    };
+}
+
+static int
+cmp_sym(const void* a, const void* b) {
+    const FdSymbol* sa = a;
+    const FdSymbol* sb = b;
+    if (sa->addr != sb->addr)
+        return sa->addr < sb->addr ? -1 : 1;
+    return sa->size > sb->size ? -1 : sa->size < sb->size;
+}
+
+// Split an executable section at its symbols, like objdump, which restarts
+// decoding at every symbol.
+static void
+section_add(struct Pool* pool, const struct Section* s, const FdSymbol* syms,
+            size_t nsyms) {
+    const char* name = *s->name ? s->name : "?";
+    uint64_t end = s->addr + s->size;
+    uint64_t cur = s->addr;
+    const char* label = NULL;
+    for (size_t i = 0; i < nsyms; i++) {
+        const FdSymbol* sym = &syms[i];
+        if (sym->addr < cur || sym->addr >= end ||
+            (label && sym->addr == cur))
+            continue;
+        if (sym->addr > cur) {
+            unit_add(pool, s->code + (cur - s->addr), sym->addr - cur, cur,
+                     label, name);
+            name = NULL;
+        }
+        cur = sym->addr;
+        label = sym->name;
+    }
+    unit_add(pool, s->code + (cur - s->addr), end - cur, cur, label, name);
+}
+
+// Split the executable sections into units; the symbol names point into the
+// mapping of the file.
+static void
+binary_units(const struct Binary* bin, struct Pool* pool) {
+    size_t nsyms = fd_elf_symbols(bin->map, bin->map_size, NULL, 0);
+    FdSymbol* syms = xrealloc(NULL, (nsyms + 1) * sizeof *syms);
+    fd_elf_symbols(bin->map, bin->map_size, syms, nsyms);
+    qsort(syms, nsyms, sizeof *syms, cmp_sym);
+    pool->nunits = 0;
+    for (size_t i = 0; i < bin->nsections; i++)
+        section_add(pool, &bin->sections[i], syms, nsyms);
+    free(syms);
+}
+
+// Split units larger than CHUNK_SIZE at the chunk entries of a parallel sweep,
+// which the workers run, so that the output is the same as with one worker.
+static void
+binary_split(const struct Binary* bin, struct Pool* pool, unsigned nworkers) {
+    struct Unit* units = pool->units;
+    size_t nunits = pool->nunits;
+    pool->units = NULL;
+    pool->nunits = pool->cap = 0;
+
+    uint64_t* queues = xrealloc(NULL, nworkers * sizeof *queues);
+    for (size_t i = 0; i < nunits; i++) {
+        const struct Unit* unit = &units[i];
+        FdSweep sweep;
+        size_t nchunks = FD_SWEEP_CHUNKS(unit->size, CHUNK_SIZE);
+        if (nchunks <= 1) {
+            unit_add(pool, unit->code, unit->size, unit->addr, unit->label,
+                     unit->section);
+            continue;
+        }
+        uint8_t* starts = xrealloc(NULL, (unit->size + 7) / 8);
+        FdSweepChunk* chunks = xrealloc(NULL, nchunks * sizeof *chunks);
+        fd_sweep_init(&sweep, unit->code, unit->size, bin->mode, CHUNK_SIZE,
+                      starts, chunks, queues, nworkers);
+        pool->sweep = &sweep;
+        pthread_barrier_wait(&pool->start);
+        pthread_barrier_wait(&pool->done);
+        pool->sweep = NULL;
+        fd_sweep_resolve(&sweep);
+        for (size_t j = 0; j < nchunks; j++) {
+            size_t entry = chunks[j].entry;
+            unit_add(pool, unit->code + entry, chunks[j].exit - entry,
+                     unit->addr + entry, j ? NULL : unit->label,
+                     j ? NULL : unit->section);
+        }
+        free(starts);
+        free(chunks);
+    }
+    free(queues);
+    free(units);
+}
+
+static void
+buf_reserve(struct Buf* buf, size_t len) {
+    if (buf->cap - buf->len >= len)
+        return;
+    size_t cap = buf->cap ? buf->cap : 1 << 20;
+    while (cap - buf->len < len)
+        cap *= 2;
+    buf->data = xrealloc(buf->data, cap);
+    buf->cap = cap;
+}
+
+// Like objdump, list an undecodable byte as "(bad)" and continue after it.
+static size_t
+format_bad(char* buf, uint64_t addr, uint8_t byte, unsigned flags) {
+    char* cur = buf;
+    if (!(flags & FD_LISTING_NO_ADDR))
+        cur += sprintf(cur, "%" PRIx64 ": ", addr);
+    if (!(flags & FD_LISTING_NO_BYTES))
+        cur += sprintf(cur, "%02x%22s", byte, "");
+    cur += sprintf(cur, "(bad)\n");
+    return cur - buf;
+}
+
+static void
+format_unit(struct Worker* w, struct Unit* unit, struct Buf* buf) {
+    const struct Binary* bin = w->pool->bin;
+    unsigned flags = w->pool->flags;
+    unit->worker = w->id;
+    unit->out_off = buf->len;
+    if (unit->section) {
+        buf_reserve(buf, strlen(unit->section) + 32);
+        buf->len += sprintf(buf->data + buf->len,
+                            "\nDisassembly of section %s:\n", unit->section);
+    }
+    if (unit->label) {
+        buf_reserve(buf, strlen(unit->label) + 32);
+        buf->len += sprintf(buf->data + buf->len, "\n%016" PRIx64 " <%s>:\n",
+                            unit->addr, unit->label);
+    }
+
+    FdInstr instrs[BATCH];
+    for (size_t off = 0; off < unit->size; ) {
+        size_t start = off;
+        unsigned n = 0;
+        int ret = 0;
+        while (n < BATCH && off < unit->size) {
+            ret = fd_decode(unit->code + off, unit->size - off, bin->mode, 0,
+                            &instrs[n]);
+            if (ret < 0)
+                break;
+            off += ret;
+            n++;
+        }
+
+        buf_reserve(buf, (n + 1) * FD_LISTING_LINE_MAX);
+        buf->len += fd_format_listing(instrs, n, unit->addr + start,
+                                      unit->code + start, buf->data + buf->len,
+                                      buf->cap - buf->len, flags);
+        w->stats.instrs += n;
+        if (ret < 0) {
+            buf->len += format_bad(buf->data + buf->len, unit->addr + off,
+                                   unit->code[off], flags);
+            w->stats.bad_bytes++;
+            off++;
+        }
+    }
+    unit->out_len = buf->len - unit->out_off;
+    w->stats.code_bytes += unit->size;
+    w->stats.out_bytes += unit->out_len;
+}
+
+static void*
+worker(void* arg) {
+    struct Worker* w = arg;
+    struct Pool* pool = w->pool;
+    for (;;) {
+        pthread_barrier_wait(&pool->start);
+        if (pool->quit)
+            break;
+        if (pool->sweep) {
+            fd_sweep_run(pool->sweep, w->id);
+            pthread_barrier_wait(&pool->done);
+            continue;
+        }
+        struct Buf* buf = &w->bufs[pool->set];
+        buf->len = 0;
+        for (;;) {
+            size_t idx = atomic_fetch_add_explicit(&pool->next, 1,
+                                                   memory_order_relaxed);
+            if (idx >= pool->end)
+                break;
+            format_unit(w, &pool->units[idx], buf);
+        }
+        pthread_barrier_wait(&pool->done);
+    }
+    return NULL;
+}
+
+static bool
+write_all(int fd, struct iovec* iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t ret = writev(fd, iov, cnt);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("write");
+            return false;
+        }
+        for (; cnt > 0 && (size_t) ret >= iov->iov_len; iov++, cnt--)
+            ret -= iov->iov_len;
+        if (cnt > 0) {
+            iov->iov_base = (char*) iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    return true;
+}
+
+// Write the output of units in order; adjacent pieces of a buffer are merged.
+static bool
+write_units(const struct Unit* units, size_t begin, size_t end,
+            const struct Worker* workers, unsigned set) {
+    struct iovec iov[IOV_MAX < 1024 ? IOV_MAX : 1024];
+    int cnt = 0;
+    for (size_t i = begin; i < end; i++) {
+        const struct Unit* unit = &units[i];
+        char* data = workers[unit->worker].bufs[set].data + unit->out_off;
+        if (cnt && (char*) iov[cnt - 1].iov_base + iov[cnt - 1].iov_len == data) {
+            iov[cnt - 1].iov_len += unit->out_len;
+            continue;
+        }
+        if (cnt == sizeof iov / sizeof iov[0]) {
+            if (!write_all(STDOUT_FILENO, iov, cnt))
+                return false;
+            cnt = 0;
+        }
+        iov[cnt++] = (struct iovec) { data, unit->out_len };
+    }
+    return write_all(STDOUT_FILENO, iov, cnt);
+}
+
+// Format the units in windows; the main thread writes the previous window
+// while the workers format the next one.
+static bool
+binary_disassemble(struct Binary* bin, struct Pool* pool,
+                   struct Worker* workers, unsigned nworkers, bool output) {
+    char header[PATH_MAX + 64];
+    struct iovec iov = { header, 0 };
+    iov.iov_len = snprintf(header, sizeof header, "\n%s:     file format %s\n",
+                           bin->path, bin->mode == 64 ? "elf64-x86-64"
+                                                      : "elf32-i386");
+    if (output && !write_all(STDOUT_FILENO, &iov, 1))
+        return false;
+
+    bool ok = true;
+    size_t begin = 0, prev_begin = 0, prev_end = 0;
+    pool->bin = bin;
+    while (begin < pool->nunits || prev_begin < prev_end) {
+        bool run = begin < pool->nunits;
+        size_t end = begin;
+        if (run) {
+            for (size_t bytes = 0; end < pool->nunits &&
+                 bytes < (size_t) WINDOW_BYTES * nworkers; end++)
+                bytes += pool->units[end].size;
+            pool->end = end;
+            atomic_store_explicit(&pool->next, begin, memory_order_relaxed);
+            pthread_barrier_wait(&pool->start);
+        }
+        if (ok && output && prev_begin < prev_end)
+            ok = write_units(pool->units, prev_begin, prev_end, workers,
+                             pool->set ^ 1);
+        prev_begin = prev_end = 0;
+        if (run) {
+            pthread_barrier_wait(&pool->done);
+            prev_begin = begin;
+            prev_end = end;
+            pool->set ^= 1;
+            begin = end;
+        }
+    }
+    return ok;
+}
+
+static void
+usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-j threads] [-M intel|att] [-A] [-B] [-n] [-t] "
+                    "file...\n"
+                    "  -j  number of threads (default: number of CPUs)\n"
+                    "  -M  syntax (default: att)\n"
+                    "  -A  omit addresses\n"
+                    "  -B  omit raw instruction bytes\n"
+                    "  -n  only decode and format, do not write the listing\n"
+                    "  -t  print throughput statistics to stderr\n"
+                    "Disassembles the executable sections of x86 ELF files "
+                    "like objdump -d.\n", prog);
+}
+
+int
+main(int argc, char** argv) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nworkers = ncpus > 0 ? ncpus : 1;
+    unsigned flags = FD_LISTING_ATT;
+    bool output = true, stats = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:M:ABnth")) != -1) {
+        switch (opt) {
+        case 'j': nworkers = strtoul(optarg, NULL, 0); break;
+        case 'M':
+            if (!strcmp(optarg, "intel")) {
+                flags &= ~FD_LISTING_ATT;
+            } else if (!strcmp(optarg, "att")) {
+                flags |= FD_LISTING_ATT;
+            } else {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'A': flags |= FD_LISTING_NO_ADDR; break;
+        case 'B': flags |= FD_LISTING_NO_BYTES; break;
+        case 'n': output = false; break;
+        case 't': stats = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc || nworkers == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct Pool pool = { .flags = flags };
+    atomic_init(&pool.next, 0);
+    pthread_barrier_init(&pool.start, NULL, nworkers + 1);
+    pthread_barrier_init(&pool.done, NULL, nworkers + 1);
+    struct Worker* workers = calloc(nworkers, sizeof *workers);
+    if (!workers) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+    for (unsigned i = 0; i < nworkers; i++) {
+        workers[i].pool = &pool;
+        workers[i].id = i;
+        if (pthread_create(&workers[i].thread, NULL, worker, &workers[i])) {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+
+    int ret = EXIT_SUCCESS;
+    for (int i = optind; i < argc; i++) {
+        struct Binary bin;
+        if (!binary_load(&bin, argv[i])) {
+            ret = EXIT_FAILURE;
+            continue;
+        }
+        // Windows are formatted in file order, so read-ahead pays off.
+        madvise((void*) bin.map, bin.map_size, MADV_SEQUENTIAL);
+        binary_units(&bin, &pool);
+        for (unsigned j = 0; j < nworkers; j++)
+            workers[j].stats = (struct Stats) {0};
+        uint64_t t0 = now_ns();
+        binary_split(&bin, &pool, nworkers);
+        if (!binary_disassemble(&bin, &pool, workers, nworkers, output))
+            ret = EXIT_FAILURE;
+        uint64_t ns = now_ns() - t0;
+
+        if (stats) {
+            struct Stats total = {0};
+            for (unsigned j = 0; j < nworkers; j++) {
+                total.instrs += workers[j].stats.instrs;
+                total.bad_bytes += workers[j].stats.bad_bytes;
+                total.code_bytes += workers[j].stats.code_bytes;
+                total.out_bytes += workers[j].stats.out_bytes;
+            }
+            fprintf(stderr, "%s: %" PRIu64 " instructions, %" PRIu64
+                    " bad bytes, %" PRIu64 " code bytes, %" PRIu64
+                    " output bytes, %.3f s, %.1f MB/s, %.2f ns/instr, %u threads\n",
+                    bin.path, total.instrs, total.bad_bytes, total.code_bytes,
+                    total.out_bytes, ns / 1e9,
+                    total.code_bytes * 1e3 / (ns ? ns : 1),
+                    total.instrs ? (double) ns / total.instrs : 0.0, nworkers);
+        }
+        binary_unload(&bin);
+    }
+
+    pool.quit = true;
+    pthread_barrier_wait(&pool.start);
+    for (unsigned i = 0; i < nworkers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        free(workers[i].bufs[0].data);
+        free(workers[i].bufs[1].data);
+    }
+    free(workers);
+    free(pool.units);
+    pthread_barrier_destroy(&pool.start);
+    pthread_barrier_destroy(&pool.done);
+    return ret;
+}
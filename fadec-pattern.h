@@ -0,0 +1,165 @@
+
+#ifndef FD_FADEC_PATTERN_H_
+#define FD_FADEC_PATTERN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fadec.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum number of alternative instruction types of a pattern step. **/
+#define FD_PAT_ALTS 4
+/** Maximum number of register captures of a pattern. **/
+#define FD_PAT_CAPTURES 4
+
+/** Operand of a compiled pattern step; internal layout. **/
+typedef struct FdPatOperand {
+    uint8_t kind;
+    uint8_t reg_type;
+    uint8_t reg;
+    uint8_t size;
+    uint8_t capture;
+    int64_t lo;
+    int64_t hi;
+} FdPatOperand;
+
+/** Step of a compiled pattern, see fd_pat_compile; internal layout. **/
+typedef struct FdPatStep {
+    /** Number of the pattern, as passed to fd_pat_compile **/
+    uint32_t pattern;
+    uint16_t types[FD_PAT_ALTS];
+    uint8_t ntypes;
+    uint8_t flags;
+    uint8_t nops;
+    uint16_t min;
+    uint16_t max;
+    FdPatOperand ops[4];
+} FdPatStep;
+
+/** Set of compiled patterns which are matched together, see fd_pat_init. **/
+typedef struct FdPatSet {
+    const FdPatStep* steps;
+    size_t nsteps;
+    /** First steps by instruction type; internal use only. **/
+    const uint64_t* index;
+    size_t nindex;
+} FdPatSet;
+
+/** Partial match of fd_pat_scan; internal layout. **/
+typedef struct FdPatThread {
+    uint64_t start;
+    uint32_t step;
+    uint16_t count;
+    uint8_t regs[FD_PAT_CAPTURES];
+    uint8_t reg_types[FD_PAT_CAPTURES];
+} FdPatThread;
+
+/** A match of fd_pat_scan. **/
+typedef struct FdPatMatch {
+    /** Address of the first instruction **/
+    uint64_t start;
+    /** Address after the last instruction **/
+    uint64_t end;
+    /** Number of the pattern **/
+    uint32_t pattern;
+    /** Captured registers in the order of their first occurrence in the
+     * pattern: the index and the FdRegType; FD_REG_NONE if unused. Memory
+     * base registers have the type FD_RT_GPL. **/
+    uint8_t regs[FD_PAT_CAPTURES];
+    uint8_t reg_types[FD_PAT_CAPTURES];
+} FdPatMatch;
+
+/** Compile a pattern over decoded instructions. A pattern is a sequence of
+ * steps separated by semicolons, each of which is an instruction or a gap:
+ *
+ * - `*{min,max}` skips min to max instructions of any kind; gaps are only
+ *   allowed between instructions.
+ * - An instruction is written as optional prefixes (lock, rep, repnz), the
+ *   instruction type without FDI_ and case-insensitive, up to FD_PAT_ALTS
+ *   alternatives separated by `|` (mov also matches FDI_MOVABS), or `*` for
+ *   any type, and optionally operands separated by commas. Without operands,
+ *   or with `...` after the last one, further operands are allowed;
+ *   otherwise, the number of operands must match.
+ * - Operands are `*` for any operand; a register (rax, r8d, ah, xmm3, k1,
+ *   fs); a register class (reg, gp, gp8, gp16, gp32, gp64, xmm, ymm, zmm,
+ *   vec, k, seg); `imm` or `imm[lo..hi]` for an immediate in a range, where
+ *   the sign- or zero-extended value must be in the range, or a number for
+ *   an exact immediate; `rel` for a branch offset; `mem`, `mem[base]` or
+ *   `mem[base, lo..hi]` for a memory operand with a base register (a 16- to
+ *   64-bit register name, rip, none, `*` or a capture) and a displacement
+ *   range.
+ * - `$name` or `$name:class` captures a register operand: the first use binds
+ *   the register, later uses must refer to the same register number and
+ *   type, regardless of the size. Up to FD_PAT_CAPTURES names are allowed.
+ *
+ * Example: "mov $r:gp, imm[0..0x1000]; *{0,3}; syscall" or
+ * "lock cmpxchg mem[$p], *; jnz rel".
+ *
+ * \param text The pattern, NUL-terminated.
+ * \param pattern The number of the pattern reported in matches.
+ * \param steps Receives the compiled steps, may be NULL if cap is zero.
+ * \param cap The capacity of steps.
+ * \param error Receives the offset of a syntax error.
+ * \return The number of steps, which may exceed cap; zero on a syntax error.
+ **/
+size_t fd_pat_compile(const char* text, uint32_t pattern, FdPatStep* steps,
+                      size_t cap, size_t* error);
+
+/** Prepare matching the concatenated steps of several compiled patterns in
+ * one pass. The first steps are indexed by instruction type, so that only the
+ * patterns which can start at an instruction are tried.
+ *
+ * \param set Receives the pattern set, which refers to steps and index.
+ * \param steps The compiled steps of all patterns.
+ * \param nsteps The number of steps.
+ * \param index Storage for the index; FD_PAT_ALTS entries per pattern
+ *        suffice.
+ * \param cap The capacity of index.
+ * \return Zero on success, -1 if index is too small or a pattern is
+ *         incomplete.
+ **/
+int fd_pat_init(FdPatSet* set, const FdPatStep* steps, size_t nsteps,
+                uint64_t* index, size_t cap);
+
+/** Find the matches of a pattern set which start at the instructions which
+ * start in [start, end) of a code region. The patterns form a
+ * nondeterministic automaton, which is simulated in a single pass over the
+ * decoded instructions: every instruction advances the partial matches and
+ * starts those of the patterns whose first step has its type. Decoding
+ * continues after end until the partial matches are complete or failed, so
+ * the chunks of an FdSweep can be scanned in parallel, like fd_xref_scan. An
+ * undecodable byte ends all partial matches.
+ *
+ * A match is reported once per pattern and start address, when its last
+ * instruction is reached, with the captures of the first path through the
+ * gaps; so the matches are ordered by their end.
+ *
+ * \param set The pattern set.
+ * \param buf The code region.
+ * \param len The size of the code region.
+ * \param base The address of the code region.
+ * \param mode The decoding mode, see fd_decode.
+ * \param start The offset of the first instruction.
+ * \param end The offset where no further match starts.
+ * \param threads Storage for 2 * nthreads partial matches; with more partial
+ *        matches at a time, those started last are dropped.
+ * \param nthreads The maximum number of partial matches.
+ * \param out Array for the matches, may be NULL if cap is zero.
+ * \param cap The capacity of out.
+ * \return The number of matches, which may exceed cap; then it is an upper
+ *         bound, as duplicate matches through gaps are only detected in out.
+ **/
+size_t fd_pat_scan(const FdPatSet* set, const uint8_t* buf, size_t len,
+                   uint64_t base, int mode, size_t start, size_t end,
+                   FdPatThread* threads, size_t nthreads, FdPatMatch* out,
+                   size_t cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,576 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fadec.h>
+#include <fadec-profile.h>
+
+#include "tools-common.h"
+
+
+// Samples are attributed by sweeping the pages which contain samples, each
+// from the closest known instruction boundary before it.
+#define PAGE_SIZE 4096
+
+// A range of code which is swept as a whole: sampled pages, extended back to
+// the start of their function and merged when they overlap.
+struct Region {
+    const struct Section* section;
+    size_t start;
+    size_t end;
+    // Samples in the region.
+    size_t first;
+    size_t nsamples;
+};
+
+// A basic block with samples; its instructions are in the worker's array.
+struct Block {
+    uint64_t addr;
+    uint64_t samples;
+    const struct Section* section;
+    const FdProfileInstr* instrs;
+    size_t ninstrs;
+    size_t idx; // of the first instruction, until instrs is set
+};
+
+struct Job {
+    const struct Binary* bin;
+    const FdProfileSample* samples;
+    const uint64_t* starts;
+    size_t nstarts;
+    struct Region* regions;
+    size_t nregions;
+    atomic_size_t next;
+    struct Worker* workers;
+};
+
+struct Worker {
+    struct Job* job;
+    // Instructions of the current region.
+    FdProfileInstr* scratch;
+    size_t scratch_cap;
+    // Instructions of the blocks with samples.
+    FdProfileInstr* instrs;
+    size_t ninstrs;
+    size_t instrs_cap;
+    struct Block* blocks;
+    size_t nblocks;
+    size_t blocks_cap;
+};
+
+static int
+cmp_section(const void* a, const void* b) {
+    const struct Section* sa = a;
+    const struct Section* sb = b;
+    return sa->addr < sb->addr ? -1 : sa->addr > sb->addr;
+}
+
+static int
+cmp_u64(const void* a, const void* b) {
+    uint64_t ua = *(const uint64_t*) a;
+    uint64_t ub = *(const uint64_t*) b;
+    return ua < ub ? -1 : ua > ub;
+}
+
+// By samples, descending, then by address.
+static int
+cmp_block(const void* a, const void* b) {
+    const struct Block* ba = a;
+    const struct Block* bb = b;
+    if (ba->samples != bb->samples)
+        return ba->samples > bb->samples ? -1 : 1;
+    return ba->addr < bb->addr ? -1 : ba->addr > bb->addr;
+}
+
+// Known instruction boundaries: function starts from the symbols and the
+// .eh_frame section, ascending and unique.
+static size_t
+binary_func_starts(const struct Binary* bin, uint64_t** starts) {
+    size_t nsyms = fd_elf_symbols(bin->map, bin->map_size, NULL, 0);
+    size_t nfdes = fd_elf_eh_frame(bin->map, bin->map_size, NULL, 0);
+    FdSymbol* syms = xrealloc(NULL, (nsyms + nfdes + 1) * sizeof *syms);
+    fd_elf_symbols(bin->map, bin->map_size, syms, nsyms);
+    fd_elf_eh_frame(bin->map, bin->map_size, syms + nsyms, nfdes);
+    uint64_t* addrs = xrealloc(NULL, (nsyms + nfdes + 1) * sizeof *addrs);
+    for (size_t i = 0; i < nsyms + nfdes; i++)
+        addrs[i] = syms[i].addr;
+    free(syms);
+    qsort(addrs, nsyms + nfdes, sizeof *addrs, cmp_u64);
+    size_t count = 0;
+    for (size_t i = 0; i < nsyms + nfdes; i++)
+        if (!count || addrs[count - 1] != addrs[i])
+            addrs[count++] = addrs[i];
+    *starts = addrs;
+    return count;
+}
+
+// Read little-endian 64-bit IPs.
+static bool
+parse_raw(const uint8_t* data, size_t size, uint64_t bias, uint64_t lo,
+          uint64_t hi, uint64_t* ips, size_t* count, size_t* total) {
+    size_t n = 0;
+    for (size_t i = 0; i + 8 <= size; i += 8) {
+        uint64_t ip;
+        memcpy(&ip, data + i, 8);
+        ip -= bias;
+        ips[n] = ip;
+        n += ip >= lo && ip < hi;
+    }
+    *count = n;
+    *total = size / 8;
+    return size % 8 == 0;
+}
+
+static bool
+is_hex(const char* tok, size_t len) {
+    for (size_t i = 0; i < len; i++)
+        if (!((tok[i] >= '0' && tok[i] <= '9') ||
+              (tok[i] >= 'a' && tok[i] <= 'f')))
+            return false;
+    return len > 0 && len <= 16;
+}
+
+static uint64_t
+hex_value(const char* tok, size_t len) {
+    uint64_t val = 0;
+    for (size_t i = 0; i < len; i++)
+        val = val << 4 | (tok[i] <= '9' ? tok[i] - '0' : tok[i] - 'a' + 10);
+    return val;
+}
+
+// Parse the output of perf script. The IP is the first hexadecimal field
+// after the last field ending with ':' (the event name), or the first one
+// if there is none, e.g. with -F ip. With call chains (-g), the IP is on the
+// next line and the rest of the chain up to the empty line is skipped.
+static void
+parse_perf(const char* data, size_t size, uint64_t bias, uint64_t lo,
+           uint64_t hi, uint64_t* ips, size_t* count, size_t* total) {
+    size_t n = 0, samples = 0;
+    bool pending = false, in_chain = false;
+    for (const char* line = data; line < data + size; ) {
+        const char* eol = memchr(line, '\n', data + size - line);
+        if (!eol)
+            eol = data + size;
+        const char* cur = line;
+        line = eol + 1;
+        while (cur < eol && (*cur == ' ' || *cur == '\t'))
+            cur++;
+        if (cur == eol) {
+            in_chain = pending = false;
+            continue;
+        }
+        if (in_chain)
+            continue;
+
+        bool want = true, found = false;
+        uint64_t ip = 0;
+        while (cur < eol) {
+            const char* tok = cur;
+            while (cur < eol && *cur != ' ' && *cur != '\t')
+                cur++;
+            size_t len = cur - tok;
+            while (cur < eol && (*cur == ' ' || *cur == '\t'))
+                cur++;
+            if (tok[len - 1] == ':') {
+                want = true;
+                found = false;
+            } else if (want && is_hex(tok, len)) {
+                ip = hex_value(tok, len);
+                want = false;
+                found = true;
+                if (pending)
+                    break;
+            }
+        }
+        if (!found) {
+            // A sample header without IP: the call chain follows.
+            pending = true;
+            continue;
+        }
+        in_chain = pending;
+        pending = false;
+        samples++;
+        ip -= bias;
+        if (ip >= lo && ip < hi)
+            ips[n++] = ip;
+    }
+    *count = n;
+    *total = samples;
+}
+
+// Index of the first function start above addr.
+static size_t
+first_above(const uint64_t* starts, size_t nstarts, uint64_t addr) {
+    size_t lo = 0, hi = nstarts;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (starts[mid] <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Find the regions to sweep: every sampled page from the last function start
+// before it, or from the end of the previous region, which is an instruction
+// boundary as well.
+static size_t
+find_regions(const struct Binary* bin, const FdProfileSample* samples,
+             size_t nsamples, const uint64_t* starts, size_t nstarts,
+             struct Region* regions) {
+    size_t nregions = 0, sec = 0;
+    for (size_t i = 0; i < nsamples; ) {
+        uint64_t page = samples[i].addr & -(uint64_t) PAGE_SIZE;
+        while (sec < bin->nsections &&
+               bin->sections[sec].addr + bin->sections[sec].size <=
+               samples[i].addr)
+            sec++;
+        if (sec == bin->nsections)
+            break;
+        const struct Section* s = &bin->sections[sec];
+        if (samples[i].addr < s->addr) {
+            i++; // between sections
+            continue;
+        }
+        size_t first = i;
+        while (i < nsamples && samples[i].addr < page + PAGE_SIZE &&
+               samples[i].addr - s->addr < s->size)
+            i++;
+
+        uint64_t lo = page > s->addr ? page : s->addr;
+        uint64_t hi = page + PAGE_SIZE < s->addr + s->size ? page + PAGE_SIZE
+                                                           : s->addr + s->size;
+        // Last function start not above the page.
+        size_t l = first_above(starts, nstarts, lo);
+        uint64_t sync = l && starts[l - 1] >= s->addr ? starts[l - 1] : s->addr;
+        struct Region* prev = nregions ? &regions[nregions - 1] : NULL;
+        if (prev && prev->section == s && s->addr + prev->end >= sync) {
+            prev->end = hi - s->addr;
+            prev->nsamples = i - prev->first;
+            continue;
+        }
+        regions[nregions++] = (struct Region) {
+            .section = s, .start = sync - s->addr, .end = hi - s->addr,
+            .first = first, .nsamples = i - first,
+        };
+    }
+    return nregions;
+}
+
+static void
+sweep_region(struct Worker* w, const struct Region* reg) {
+    const struct Job* job = w->job;
+    const struct Section* s = reg->section;
+    // Instructions are at least one byte long.
+    size_t cap = reg->end - reg->start;
+    if (w->scratch_cap < cap) {
+        w->scratch_cap = cap;
+        w->scratch = xrealloc(w->scratch, cap * sizeof *w->scratch);
+    }
+    // The sweep restarts at every function start, so that padding and data
+    // between functions cannot put it out of step.
+    const FdProfileSample* samples = job->samples + reg->first;
+    size_t count = 0, first = 0;
+    size_t idx = first_above(job->starts, job->nstarts, s->addr + reg->start);
+    for (size_t start = reg->start; start < reg->end; idx++) {
+        size_t end = reg->end;
+        if (idx < job->nstarts && job->starts[idx] - s->addr < end)
+            end = job->starts[idx] - s->addr;
+        size_t last = first;
+        while (last < reg->nsamples && samples[last].addr < s->addr + end)
+            last++;
+        count += fd_profile_sweep(s->code, s->size, s->addr, job->bin->mode,
+                                  start, end, samples + first, last - first,
+                                  w->scratch + count, cap - count);
+        first = last;
+        start = end;
+    }
+
+    // Keep the blocks with samples.
+    for (size_t i = 0; i < count; ) {
+        size_t end = i + 1;
+        uint64_t sum = w->scratch[i].samples;
+        for (; end < count && !(w->scratch[end].flags & FD_PROF_BLOCK); end++)
+            sum += w->scratch[end].samples;
+        if (sum) {
+            if (w->instrs_cap - w->ninstrs < end - i) {
+                w->instrs_cap = 2 * w->instrs_cap + end - i;
+                w->instrs = xrealloc(w->instrs,
+                                     w->instrs_cap * sizeof *w->instrs);
+            }
+            if (w->nblocks == w->blocks_cap) {
+                w->blocks_cap = 2 * w->blocks_cap + 64;
+                w->blocks = xrealloc(w->blocks,
+                                     w->blocks_cap * sizeof *w->blocks);
+            }
+            w->blocks[w->nblocks++] = (struct Block) {
+                .addr = w->scratch[i].addr, .samples = sum,
+                .section = s, .ninstrs = end - i, .idx = w->ninstrs,
+            };
+            memcpy(w->instrs + w->ninstrs, w->scratch + i,
+                   (end - i) * sizeof *w->instrs);
+            w->ninstrs += end - i;
+        }
+        i = end;
+    }
+}
+
+static void
+worker(void* arg, unsigned id) {
+    struct Job* job = arg;
+    struct Worker* w = &job->workers[id];
+    for (;;) {
+        size_t idx = atomic_fetch_add(&job->next, 1);
+        if (idx >= job->nregions)
+            break;
+        sweep_region(w, &job->regions[idx]);
+    }
+}
+
+static void
+print_block(const struct Block* blk, uint64_t total, const FdSymtab* symtab,
+            int mode, unsigned flags) {
+    const FdProfileInstr* last = &blk->instrs[blk->ninstrs - 1];
+    uint64_t end = last->addr + (last->size ? last->size : 1);
+    printf("%" PRIx64 "-%" PRIx64, blk->addr, end);
+    uint64_t off;
+    const char* name = fd_symtab_symbolize((void*) symtab, blk->addr, &off);
+    if (name)
+        printf(" <%s+0x%" PRIx64 ">", name, off);
+    printf(": %" PRIu64 " samples, %.2f%%\n", blk->samples,
+           100.0 * blk->samples / total);
+
+    const struct Section* s = blk->section;
+    for (size_t i = 0; i < blk->ninstrs; i++) {
+        const FdProfileInstr* pi = &blk->instrs[i];
+        const uint8_t* bytes = s->code + (pi->addr - s->addr);
+        char line[FD_LISTING_LINE_MAX];
+        size_t len;
+        FdInstr instr;
+        if (pi->size && fd_decode(bytes, pi->size, mode, 0, &instr) > 0) {
+            len = fd_format_listing(&instr, 1, pi->addr, bytes, line,
+                                    sizeof line, flags);
+        } else {
+            len = snprintf(line, sizeof line, "%8" PRIx64 ":\t%02x\t(bad)\n",
+                           pi->addr, bytes[0]);
+        }
+        // Bytes of long instructions continue on further lines.
+        for (size_t pos = 0; pos < len; ) {
+            const char* eol = memchr(line + pos, '\n', len - pos);
+            size_t n = eol ? (size_t) (eol - line - pos) + 1 : len - pos;
+            if (pos == 0 && pi->samples)
+                printf("%10" PRIu64 " %6.2f%% |", pi->samples,
+                       100.0 * pi->samples / total);
+            else
+                printf("%18s |", "");
+            fwrite(line + pos, 1, n, stdout);
+            pos += n;
+        }
+    }
+    putchar('\n');
+}
+
+static void
+usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-j threads] [-p] [-b bias] [-n blocks] "
+                    "[-M intel|att] [-t] samples file\n"
+                    "  -j  number of threads (default: number of CPUs)\n"
+                    "  -p  the samples are the output of perf script "
+                    "(default: little-endian\n      64-bit IPs)\n"
+                    "  -b  subtract bias, the load address of the file, "
+                    "from the IPs\n"
+                    "  -n  print only the hottest blocks (default: 20, "
+                    "0 for all)\n"
+                    "  -M  syntax of the listing (default: intel)\n"
+                    "  -t  print timing statistics to stderr\n"
+                    "Attributes IP samples to the instructions and basic "
+                    "blocks of an x86 ELF file\nand prints annotated "
+                    "listings of the hottest blocks.\n", prog);
+}
+
+int
+main(int argc, char** argv) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nworkers = ncpus > 0 ? ncpus : 1;
+    bool perf = false, stats = false;
+    uint64_t bias = 0;
+    size_t max_blocks = 20;
+    unsigned flags = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:pb:n:M:th")) != -1) {
+        switch (opt) {
+        case 'j': nworkers = strtoul(optarg, NULL, 0); break;
+        case 'p': perf = true; break;
+        case 'b': bias = strtoull(optarg, NULL, 0); break;
+        case 'n': max_blocks = strtoull(optarg, NULL, 0); break;
+        case 'M':
+            if (!strcmp(optarg, "intel")) {
+                flags &= ~FD_LISTING_ATT;
+            } else if (!strcmp(optarg, "att")) {
+                flags |= FD_LISTING_ATT;
+            } else {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't': stats = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind + 2 != argc || nworkers == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct Binary bin;
+    if (!binary_load(&bin, argv[optind + 1]))
+        return EXIT_FAILURE;
+    qsort(bin.sections, bin.nsections, sizeof *bin.sections, cmp_section);
+    uint64_t lo = UINT64_MAX, hi = 0;
+    for (size_t i = 0; i < bin.nsections; i++) {
+        const struct Section* s = &bin.sections[i];
+        lo = s->addr < lo ? s->addr : lo;
+        hi = s->addr + s->size > hi ? s->addr + s->size : hi;
+    }
+
+    const char* path = argv[optind];
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st)) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    const uint8_t* data = NULL;
+    if (st.st_size) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            perror(path);
+            return EXIT_FAILURE;
+        }
+        madvise((void*) data, st.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    uint64_t t0 = now_ns();
+    // One IP per eight bytes or per line.
+    size_t max_ips = st.st_size / 8 + 1;
+    if (perf)
+        for (off_t i = 0; i < st.st_size; i++)
+            max_ips += data[i] == '\n';
+    uint64_t* ips = xrealloc(NULL, max_ips * sizeof *ips);
+    size_t nips, total;
+    if (perf) {
+        parse_perf((const char*) data, st.st_size, bias, lo, hi, ips, &nips,
+                   &total);
+    } else if (!parse_raw(data, st.st_size, bias, lo, hi, ips, &nips,
+                          &total)) {
+        fprintf(stderr, "%s: size is not a multiple of 8\n", path);
+        return EXIT_FAILURE;
+    }
+    if (data)
+        munmap((void*) data, st.st_size);
+    uint64_t t1 = now_ns();
+
+    uint64_t* tmp = xrealloc(NULL, (nips + 1) * sizeof *tmp);
+    fd_profile_sort(ips, nips, tmp);
+    free(tmp);
+    // The distinct addresses need at most as much space as the IPs.
+    FdProfileSample* samples = xrealloc(NULL, (nips + 1) * sizeof *samples);
+    size_t nsamples = fd_profile_count(ips, nips, samples);
+    free(ips);
+    uint64_t t2 = now_ns();
+
+    uint64_t* starts;
+    size_t nstarts = binary_func_starts(&bin, &starts);
+    struct Region* regions = xrealloc(NULL, (nsamples + 1) * sizeof *regions);
+    struct Job job = {
+        .bin = &bin, .samples = samples, .starts = starts,
+        .nstarts = nstarts, .regions = regions,
+        .nregions = find_regions(&bin, samples, nsamples, starts, nstarts,
+                                 regions),
+    };
+    atomic_init(&job.next, 0);
+    if (nworkers > job.nregions)
+        nworkers = job.nregions ? job.nregions : 1;
+    struct Worker* workers = calloc(nworkers, sizeof *workers);
+    if (!workers) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+    for (unsigned i = 0; i < nworkers; i++)
+        workers[i].job = &job;
+    job.workers = workers;
+    run_workers(nworkers, worker, &job);
+
+    size_t nblocks = 0, ninstrs = 0, swept = 0;
+    for (unsigned i = 0; i < nworkers; i++)
+        nblocks += workers[i].nblocks;
+    for (size_t i = 0; i < job.nregions; i++)
+        swept += regions[i].end - regions[i].start;
+    struct Block* blocks = xrealloc(NULL, (nblocks + 1) * sizeof *blocks);
+    uint64_t attributed = 0;
+    nblocks = 0;
+    for (unsigned i = 0; i < nworkers; i++) {
+        for (size_t j = 0; j < workers[i].nblocks; j++) {
+            struct Block* blk = &blocks[nblocks++];
+            *blk = workers[i].blocks[j];
+            blk->instrs = workers[i].instrs + blk->idx;
+            attributed += blk->samples;
+            ninstrs += blk->ninstrs;
+        }
+    }
+    qsort(blocks, nblocks, sizeof *blocks, cmp_block);
+    uint64_t t3 = now_ns();
+
+    size_t nsyms = fd_elf_symbols(bin.map, bin.map_size, NULL, 0);
+    FdSymbol* syms = xrealloc(NULL, (nsyms + 1) * sizeof *syms);
+    FdSymbol* nodes = xrealloc(NULL, (nsyms + 1) * sizeof *nodes);
+    uint64_t* keys = xrealloc(NULL, (nsyms + 1) * sizeof *keys);
+    fd_elf_symbols(bin.map, bin.map_size, syms, nsyms);
+    FdSymtab symtab;
+    fd_symtab_init(&symtab, syms, nsyms, nodes, keys);
+
+    printf("%s: %zu samples, %" PRIu64 " in %zu blocks, %zu outside of "
+           "the code\n\n", bin.path, total, attributed, nblocks,
+           total - (size_t) attributed);
+    if (max_blocks == 0 || max_blocks > nblocks)
+        max_blocks = nblocks;
+    for (size_t i = 0; i < max_blocks; i++)
+        print_block(&blocks[i], total, &symtab, bin.mode, flags);
+    fflush(stdout);
+
+    if (stats) {
+        fprintf(stderr, "%zu samples at %zu addresses in %zu regions of "
+                "%zu bytes; read %.3f s, sort %.3f s, sweep %.3f s, %u "
+                "threads\n", total, nsamples, job.nregions, swept,
+                (t1 - t0) / 1e9, (t2 - t1) / 1e9, (t3 - t2) / 1e9, nworkers);
+    }
+
+    for (unsigned i = 0; i < nworkers; i++) {
+        free(workers[i].scratch);
+        free(workers[i].instrs);
+        free(workers[i].blocks);
+    }
+    free(workers);
+    free(blocks);
+    free(regions);
+    free(starts);
+    free(samples);
+    free(syms);
+    free(nodes);
+    free(keys);
+    binary_unload(&bin);
+    return EXIT_SUCCESS;
+}
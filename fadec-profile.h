@@ -0,0 +1,89 @@
+
+#ifndef FD_FADEC_PROFILE_H_
+#define FD_FADEC_PROFILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fadec.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of IP samples at one address. **/
+typedef struct FdProfileSample {
+    uint64_t addr;
+    uint64_t count;
+} FdProfileSample;
+
+enum {
+    /** The instruction starts a basic block. **/
+    FD_PROF_BLOCK = 1 << 0,
+    /** The instruction transfers control, so the next one starts a block. **/
+    FD_PROF_CF = 1 << 1,
+};
+
+/** An instruction of a profiled range with its samples. **/
+typedef struct FdProfileInstr {
+    uint64_t addr;
+    /** Samples at addresses inside the instruction **/
+    uint64_t samples;
+    /** Size in bytes, zero for an undecodable byte **/
+    uint8_t size;
+    /** FD_PROF_* **/
+    uint8_t flags;
+    uint8_t reserved[6];
+} FdProfileInstr;
+
+/** Sort IP samples with a least-significant-digit radix sort. Only the bits
+ * which differ between the addresses are sorted, so addresses of one binary
+ * need only a few passes.
+ *
+ * \param ips The addresses, sorted in place.
+ * \param count The number of addresses.
+ * \param tmp Scratch space of count elements.
+ **/
+void fd_profile_sort(uint64_t* ips, size_t count, uint64_t* tmp);
+
+/** Collapse sorted IP samples into one FdProfileSample per address.
+ *
+ * \param ips The sorted addresses.
+ * \param count The number of addresses.
+ * \param out Receives the samples, at most count elements.
+ * \return The number of distinct addresses.
+ **/
+size_t fd_profile_count(const uint64_t* ips, size_t count,
+                        FdProfileSample* out);
+
+/** Attribute samples to the instructions of a linear sweep over a range of
+ * code and mark the basic blocks. Each instruction is decoded once, however
+ * many samples it has; a sample inside an instruction counts for it, and
+ * samples outside of the decoded instructions are ignored. Blocks start at
+ * start, after control-flow instructions and undecodable bytes, and at
+ * targets of direct branches inside the range. Blocks entered only from
+ * outside of the range (e.g. by indirect jumps) cannot be detected.
+ *
+ * \param buf The code.
+ * \param len The size of the code.
+ * \param base The address of buf.
+ * \param mode The decoding mode, see fd_decode.
+ * \param start The offset of the first instruction, e.g. a function start.
+ * \param end The offset where no further instruction starts.
+ * \param samples The samples, sorted by address.
+ * \param nsamples The number of samples.
+ * \param out Receives the instructions.
+ * \param cap The capacity of out.
+ * \return The number of instructions, which may exceed cap; then only the
+ *         first cap are written and branch targets are only marked in them.
+ **/
+size_t fd_profile_sweep(const uint8_t* buf, size_t len, uint64_t base,
+                        int mode, size_t start, size_t end,
+                        const FdProfileSample* samples, size_t nsamples,
+                        FdProfileInstr* out, size_t cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
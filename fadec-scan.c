@@ -0,0 +1,819 @@
+#define _GNU_SOURCE
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include <fadec.h>
+
+#include "tools-common.h"
+
+
+// Larger sections are read in several parts.
+#define MAX_READ (1u << 30)
+
+static const char* type_names[] = {
+#define FD_MNEMONIC(name,value) [value] = #name,
+#include <fadec-decode-public.inc>
+#undef FD_MNEMONIC
+};
+
+#define NTYPES (sizeof type_names / sizeof *type_names)
+
+// Opcode maps of the legacy, REX2, VEX and EVEX encodings.
+enum {
+    FORM_LEGACY,
+    FORM_LEGACY_0F,
+    FORM_LEGACY_0F38,
+    FORM_LEGACY_0F3A,
+    FORM_3DNOW,
+    FORM_REX2,
+    FORM_REX2_0F,
+    FORM_VEX_0F,
+    FORM_VEX_0F38,
+    FORM_VEX_0F3A,
+    FORM_VEX_OTHER,
+    FORM_EVEX_0F,
+    FORM_EVEX_0F38,
+    FORM_EVEX_0F3A,
+    FORM_EVEX_MAP4,
+    FORM_EVEX_MAP5,
+    FORM_EVEX_MAP6,
+    FORM_EVEX_OTHER,
+    NFORMS,
+};
+
+static const char* form_names[NFORMS] = {
+    "legacy", "legacy.0f", "legacy.0f38", "legacy.0f3a", "3dnow",
+    "rex2", "rex2.0f", "vex.0f", "vex.0f38", "vex.0f3a", "vex.other",
+    "evex.0f", "evex.0f38", "evex.0f3a", "evex.map4", "evex.map5",
+    "evex.map6", "evex.other",
+};
+
+enum {
+    PREFIX_NONE,
+    PREFIX_66,
+    PREFIX_67,
+    PREFIX_F2,
+    PREFIX_F3,
+    PREFIX_F0,
+    PREFIX_2E,
+    PREFIX_36,
+    PREFIX_3E,
+    PREFIX_26,
+    PREFIX_64,
+    PREFIX_65,
+    PREFIX_REX,
+    PREFIX_REX_W,
+    NPREFIXES,
+};
+
+static const char* prefix_names[NPREFIXES] = {
+    "none", "66", "67", "f2", "f3", "f0", "2e", "36", "3e", "26", "64", "65",
+    "rex", "rex.w",
+};
+
+// Histograms of a worker, merged after all workers finished.
+struct Stats {
+    uint64_t types[NTYPES];
+    uint64_t forms[NFORMS];
+    uint64_t prefixes[NPREFIXES];
+    uint64_t instrs;
+    uint64_t bad_bytes;
+    uint64_t bytes;
+    uint64_t sections;
+};
+
+struct File {
+    int fd;
+    unsigned refs; // reads not yet completed
+};
+
+// A read of (part of) a code section, queued for the workers when complete.
+struct Read {
+    struct File* file;
+    uint8_t* buf;
+    uint64_t off;
+    size_t size;
+    size_t done;
+    int mode;
+    struct Read* next;
+};
+
+// Completed reads; held counts the buffers between opening a file and the
+// end of decoding, which bounds the memory.
+struct Queue {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t freed;
+    struct Read* head;
+    struct Read** tail;
+    size_t held;
+    bool done;
+};
+
+// Submission and completion rings of io_uring, set up without liburing.
+struct Ring {
+    int fd;
+    unsigned entries;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map;
+    size_t cq_map_size;
+    size_t sqes_size;
+    unsigned queued; // prepared, not yet submitted
+    unsigned pending; // submitted, not yet completed
+};
+
+struct Scan {
+    struct Queue queue;
+    struct Ring ring;
+    size_t depth;
+    uint64_t files;
+    uint64_t skipped;
+};
+
+struct Worker {
+    struct Queue* queue;
+    struct Stats* stats;
+    pthread_t thread;
+};
+
+static char** paths;
+static size_t npaths;
+static size_t pathcap;
+
+static int
+visit(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    (void) ftw;
+    if (flag != FTW_F || !S_ISREG(st->st_mode) || !st->st_size)
+        return 0;
+    if (npaths == pathcap) {
+        pathcap = pathcap ? 2 * pathcap : 1024;
+        paths = xrealloc(paths, pathcap * sizeof *paths);
+    }
+    paths[npaths] = strdup(path);
+    if (!paths[npaths++]) {
+        perror("strdup");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+static bool
+ring_init(struct Ring* ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof params);
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+        return false;
+    ring->entries = params.sq_entries;
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes +
+                        params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP &&
+        ring->cq_map_size > ring->sq_map_size)
+        ring->sq_map_size = ring->cq_map_size;
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_map = ring->sq_map;
+    if (ring->sq_map != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd,
+                            IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED ||
+        ring->sqes == MAP_FAILED) {
+        close(ring->fd);
+        ring->fd = -1;
+        return false;
+    }
+
+    // The kernel aligns the offsets for the fields in the page-aligned maps.
+    char* sq = ring->sq_map;
+    char* cq = ring->cq_map;
+    ring->sq_head = (void*) (sq + params.sq_off.head);
+    ring->sq_tail = (void*) (sq + params.sq_off.tail);
+    ring->sq_mask = (void*) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (void*) (sq + params.sq_off.array);
+    ring->cq_head = (void*) (cq + params.cq_off.head);
+    ring->cq_tail = (void*) (cq + params.cq_off.tail);
+    ring->cq_mask = (void*) (cq + params.cq_off.ring_mask);
+    ring->cqes = (void*) (cq + params.cq_off.cqes);
+    ring->queued = ring->pending = 0;
+    return true;
+}
+
+static void
+ring_fini(struct Ring* ring) {
+    if (ring->fd < 0)
+        return;
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map != ring->sq_map)
+        munmap(ring->cq_map, ring->cq_map_size);
+    munmap(ring->sq_map, ring->sq_map_size);
+    close(ring->fd);
+}
+
+static void
+ring_prep_read(struct Ring* ring, struct Read* rd) {
+    unsigned tail = *ring->sq_tail;
+    unsigned idx = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[idx];
+    size_t len = rd->size - rd->done;
+    memset(sqe, 0, sizeof *sqe);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = rd->file->fd;
+    sqe->addr = (uintptr_t) (rd->buf + rd->done);
+    sqe->len = len < MAX_READ ? len : MAX_READ;
+    sqe->off = rd->off + rd->done;
+    sqe->user_data = (uintptr_t) rd;
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+}
+
+// Submit the prepared reads and wait for min_complete completions.
+static void
+ring_enter(struct Ring* ring, unsigned min_complete) {
+    for (;;) {
+        long ret = syscall(__NR_io_uring_enter, ring->fd, ring->queued,
+                           min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret >= 0) {
+            ring->queued -= ret;
+            ring->pending += ret;
+            return;
+        }
+        if (errno != EINTR) {
+            perror("io_uring_enter");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void
+queue_push(struct Queue* queue, struct Read* rd) {
+    rd->next = NULL;
+    pthread_mutex_lock(&queue->lock);
+    *queue->tail = rd;
+    queue->tail = &rd->next;
+    pthread_cond_signal(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Take a completed read; NULL when all reads are done.
+static struct Read*
+queue_pop(struct Queue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->head && !queue->done)
+        pthread_cond_wait(&queue->ready, &queue->lock);
+    struct Read* rd = queue->head;
+    if (rd) {
+        queue->head = rd->next;
+        if (!queue->head)
+            queue->tail = &queue->head;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return rd;
+}
+
+static void
+queue_hold(struct Queue* queue, ptrdiff_t count) {
+    pthread_mutex_lock(&queue->lock);
+    queue->held += count;
+    if (count < 0)
+        pthread_cond_signal(&queue->freed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void
+file_release(struct File* file) {
+    if (--file->refs == 0) {
+        close(file->fd);
+        free(file);
+    }
+}
+
+// Complete a read, possibly with less data after an error.
+static void
+read_done(struct Scan* scan, struct Read* rd) {
+    rd->size = rd->done;
+    file_release(rd->file);
+    rd->file = NULL;
+    queue_push(&scan->queue, rd);
+}
+
+static void
+read_sync(struct Scan* scan, struct Read* rd) {
+    while (rd->done < rd->size) {
+        ssize_t ret = pread(rd->file->fd, rd->buf + rd->done,
+                            rd->size - rd->done, rd->off + rd->done);
+        if (ret <= 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+        rd->done += ret;
+    }
+    read_done(scan, rd);
+}
+
+// Process the completed reads; short reads are continued.
+static void
+ring_reap(struct Scan* scan) {
+    struct Ring* ring = &scan->ring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        struct Read* rd = (struct Read*) (uintptr_t) cqe->user_data;
+        int res = cqe->res;
+        ring->pending--;
+        if (res > 0) {
+            rd->done += res;
+            if (rd->done < rd->size) {
+                ring_prep_read(ring, rd);
+                continue;
+            }
+            read_done(scan, rd);
+        } else if (res == -EINVAL || res == -EOPNOTSUPP || res == -EAGAIN) {
+            // Kernels before 5.6 have no IORING_OP_READ.
+            read_sync(scan, rd);
+        } else {
+            read_done(scan, rd);
+        }
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void
+read_start(struct Scan* scan, struct File* file, uint64_t off, size_t size,
+           int mode) {
+    struct Read* rd = xrealloc(NULL, sizeof *rd);
+    *rd = (struct Read) {
+        .file = file, .buf = xrealloc(NULL, size), .off = off, .size = size,
+        .mode = mode,
+    };
+    file->refs++;
+    queue_hold(&scan->queue, 1);
+    struct Ring* ring = &scan->ring;
+    if (ring->fd < 0) {
+        read_sync(scan, rd);
+        return;
+    }
+    // Keep room in the submission ring.
+    while (ring->queued + ring->pending >= ring->entries) {
+        ring_enter(ring, 1);
+        ring_reap(scan);
+    }
+    ring_prep_read(ring, rd);
+}
+
+static bool
+read_full(int fd, void* buf, size_t size, uint64_t off) {
+    return pread(fd, buf, size, off) == (ssize_t) size;
+}
+
+// Read the headers of an ELF file and start reading its code sections. The
+// headers are small and read synchronously.
+static void
+file_open(struct Scan* scan, const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        scan->skipped++;
+        return;
+    }
+    uint8_t ehdr[EI_NIDENT];
+    struct stat st;
+    if (fstat(fd, &st) || !read_full(fd, ehdr, EI_NIDENT, 0) ||
+        memcmp(ehdr, ELFMAG, SELFMAG) || ehdr[EI_DATA] != ELFDATA2LSB) {
+        close(fd);
+        scan->skipped++;
+        return;
+    }
+    bool is64 = ehdr[EI_CLASS] == ELFCLASS64;
+    uint64_t shoff = 0;
+    unsigned shnum = 0, shentsize = 0, machine = EM_NONE;
+    Elf64_Ehdr eh64;
+    Elf32_Ehdr eh32;
+    if (is64 && read_full(fd, &eh64, sizeof eh64, 0)) {
+        shoff = eh64.e_shoff;
+        shnum = eh64.e_shnum;
+        shentsize = eh64.e_shentsize;
+        machine = eh64.e_machine;
+    } else if (!is64 && read_full(fd, &eh32, sizeof eh32, 0)) {
+        shoff = eh32.e_shoff;
+        shnum = eh32.e_shnum;
+        shentsize = eh32.e_shentsize;
+        machine = eh32.e_machine;
+    }
+    // x32 code is decoded in 64-bit mode.
+    int mode = machine == EM_X86_64 ? 64 : machine == EM_386 ? 32 : 0;
+    uint64_t size = st.st_size;
+    uint8_t* shdrs = NULL;
+    if (!mode || !shnum ||
+        shentsize != (is64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr)) ||
+        shoff > size || shnum > (size - shoff) / shentsize ||
+        !read_full(fd, shdrs = xrealloc(NULL, shnum * shentsize),
+                   shnum * shentsize, shoff)) {
+        free(shdrs);
+        close(fd);
+        scan->skipped++;
+        return;
+    }
+
+    struct File* file = xrealloc(NULL, sizeof *file);
+    // The reference of the opener is released below.
+    *file = (struct File) { .fd = fd, .refs = 1 };
+    for (unsigned i = 0; i < shnum; i++) {
+        uint64_t type, flags, off, sec_size;
+        if (is64) {
+            Elf64_Shdr shdr;
+            memcpy(&shdr, shdrs + i * shentsize, sizeof shdr);
+            type = shdr.sh_type, flags = shdr.sh_flags;
+            off = shdr.sh_offset, sec_size = shdr.sh_size;
+        } else {
+            Elf32_Shdr shdr;
+            memcpy(&shdr, shdrs + i * shentsize, sizeof shdr);
+            type = shdr.sh_type, flags = shdr.sh_flags;
+            off = shdr.sh_offset, sec_size = shdr.sh_size;
+        }
+        if (type != SHT_PROGBITS || !(flags & SHF_EXECINSTR) || !sec_size ||
+            off > size || sec_size > size - off)
+            continue;
+        read_start(scan, file, off, sec_size, mode);
+    }
+    free(shdrs);
+    file_release(file);
+    scan->files++;
+}
+
+// Read the code of all files with at most depth buffers at a time.
+static void
+read_all(struct Scan* scan) {
+    struct Queue* queue = &scan->queue;
+    struct Ring* ring = &scan->ring;
+    size_t next = 0;
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        size_t held = queue->held;
+        pthread_mutex_unlock(&queue->lock);
+        for (; next < npaths && held < scan->depth; held++)
+            file_open(scan, paths[next++]);
+
+        if (ring->fd >= 0 && (ring->queued || ring->pending)) {
+            ring_enter(ring, 1);
+            ring_reap(scan);
+            continue;
+        }
+        if (next == npaths)
+            break;
+        // The window is full; wait for the workers.
+        pthread_mutex_lock(&queue->lock);
+        while (queue->held >= scan->depth)
+            pthread_cond_wait(&queue->freed, &queue->lock);
+        pthread_mutex_unlock(&queue->lock);
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    queue->done = true;
+    pthread_cond_broadcast(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static unsigned
+form_of(const uint8_t* code, size_t len, int mode, unsigned* prefixes) {
+    size_t i = 0;
+    for (; i < len; i++) {
+        unsigned prefix;
+        switch (code[i]) {
+        case 0x66: prefix = PREFIX_66; break;
+        case 0x67: prefix = PREFIX_67; break;
+        case 0xf2: prefix = PREFIX_F2; break;
+        case 0xf3: prefix = PREFIX_F3; break;
+        case 0xf0: prefix = PREFIX_F0; break;
+        case 0x2e: prefix = PREFIX_2E; break;
+        case 0x36: prefix = PREFIX_36; break;
+        case 0x3e: prefix = PREFIX_3E; break;
+        case 0x26: prefix = PREFIX_26; break;
+        case 0x64: prefix = PREFIX_64; break;
+        case 0x65: prefix = PREFIX_65; break;
+        default: prefix = NPREFIXES; break;
+        }
+        if (prefix == NPREFIXES)
+            break;
+        *prefixes |= 1u << prefix;
+    }
+    if (mode == 64 && i < len && (code[i] & 0xf0) == 0x40) {
+        *prefixes |= 1u << PREFIX_REX;
+        if (code[i] & 0x08)
+            *prefixes |= 1u << PREFIX_REX_W;
+        i++;
+    }
+    if (i + 1 >= len)
+        return FORM_LEGACY;
+
+    // In 32-bit mode, C4, C5 and 62 are LES, LDS and BOUND unless followed
+    // by a register ModRM byte.
+    uint8_t next = code[i + 1];
+    bool vex_ok = mode == 64 || (next & 0xc0) == 0xc0;
+    switch (code[i]) {
+    case 0x0f:
+        return next == 0x38 ? FORM_LEGACY_0F38 : next == 0x3a ? FORM_LEGACY_0F3A :
+               next == 0x0f ? FORM_3DNOW : FORM_LEGACY_0F;
+    case 0xd5:
+        if (mode != 64)
+            return FORM_LEGACY;
+        if (next & 0x08)
+            *prefixes |= 1u << PREFIX_REX_W;
+        return next & 0x80 ? FORM_REX2_0F : FORM_REX2;
+    case 0xc5:
+        return vex_ok ? FORM_VEX_0F : FORM_LEGACY;
+    case 0xc4:
+        if (!vex_ok)
+            return FORM_LEGACY;
+        switch (next & 0x1f) {
+        case 1: return FORM_VEX_0F;
+        case 2: return FORM_VEX_0F38;
+        case 3: return FORM_VEX_0F3A;
+        default: return FORM_VEX_OTHER;
+        }
+    case 0x62:
+        if (!vex_ok)
+            return FORM_LEGACY;
+        switch (next & 0x07) {
+        case 1: return FORM_EVEX_0F;
+        case 2: return FORM_EVEX_0F38;
+        case 3: return FORM_EVEX_0F3A;
+        case 4: return FORM_EVEX_MAP4;
+        case 5: return FORM_EVEX_MAP5;
+        case 6: return FORM_EVEX_MAP6;
+        default: return FORM_EVEX_OTHER;
+        }
+    default:
+        return FORM_LEGACY;
+    }
+}
+
+static void
+scan_code(const uint8_t* code, size_t size, int mode, struct Stats* stats) {
+    for (size_t off = 0; off < size; ) {
+        FdInstr instr;
+        int ret = fd_decode(code + off, size - off, mode, 0, &instr);
+        if (ret < 0) {
+            stats->bad_bytes++;
+            off++;
+            continue;
+        }
+        unsigned prefixes = 0;
+        stats->types[FD_TYPE(&instr)]++;
+        stats->forms[form_of(code + off, ret, mode, &prefixes)]++;
+        if (!prefixes)
+            stats->prefixes[PREFIX_NONE]++;
+        for (; prefixes; prefixes &= prefixes - 1)
+            stats->prefixes[__builtin_ctz(prefixes)]++;
+        stats->instrs++;
+        off += ret;
+    }
+    stats->bytes += size;
+    stats->sections++;
+}
+
+static void*
+worker(void* arg) {
+    struct Worker* w = arg;
+    struct Read* rd;
+    while ((rd = queue_pop(w->queue))) {
+        scan_code(rd->buf, rd->size, rd->mode, w->stats);
+        free(rd->buf);
+        free(rd);
+        queue_hold(w->queue, -1);
+    }
+    return NULL;
+}
+
+static const uint64_t* sort_counts;
+
+static int
+cmp_count(const void* a, const void* b) {
+    uint64_t ca = sort_counts[*(const unsigned*) a];
+    uint64_t cb = sort_counts[*(const unsigned*) b];
+    if (ca != cb)
+        return ca > cb ? -1 : 1;
+    return *(const unsigned*) a > *(const unsigned*) b ? 1 : -1;
+}
+
+// Print the non-zero entries of a histogram, the most frequent first.
+static void
+print_hist(FILE* out, bool json, const char* category, const uint64_t* counts,
+           const char* const* names, unsigned count) {
+    unsigned* order = xrealloc(NULL, count * sizeof *order);
+    unsigned n = 0;
+    for (unsigned i = 0; i < count; i++)
+        if (counts[i])
+            order[n++] = i;
+    sort_counts = counts;
+    qsort(order, n, sizeof *order, cmp_count);
+    if (json)
+        fprintf(out, ",\n  \"%s\": {", category);
+    for (unsigned i = 0; i < n; i++) {
+        if (json)
+            fprintf(out, "%s\n    \"%s\": %" PRIu64, i ? "," : "",
+                    names[order[i]], counts[order[i]]);
+        else
+            fprintf(out, "%s,%s,%" PRIu64 "\n", category, names[order[i]],
+                    counts[order[i]]);
+    }
+    if (json)
+        fprintf(out, "%s}", n ? "\n  " : "");
+    free(order);
+}
+
+static void
+print_stats(FILE* out, bool json, const struct Scan* scan,
+            const struct Stats* total) {
+    const char* summary_names[] = {
+        "files", "skipped", "sections", "bytes", "instructions",
+        "undecodable_bytes",
+    };
+    uint64_t summary[] = {
+        scan->files, scan->skipped, total->sections, total->bytes,
+        total->instrs, total->bad_bytes,
+    };
+    if (json)
+        fprintf(out, "{\n  \"summary\": {");
+    else
+        fprintf(out, "category,name,count\n");
+    for (unsigned i = 0; i < sizeof summary / sizeof *summary; i++) {
+        if (json)
+            fprintf(out, "%s\n    \"%s\": %" PRIu64, i ? "," : "",
+                    summary_names[i], summary[i]);
+        else
+            fprintf(out, "summary,%s,%" PRIu64 "\n", summary_names[i],
+                    summary[i]);
+    }
+    if (json)
+        fprintf(out, "\n  }");
+    print_hist(out, json, "type", total->types, type_names, NTYPES);
+    print_hist(out, json, "form", total->forms, form_names, NFORMS);
+    print_hist(out, json, "prefix", total->prefixes, prefix_names, NPREFIXES);
+    if (json)
+        fprintf(out, "\n}\n");
+}
+
+static void
+usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-j threads] [-d depth] [-f csv|json] [-o file] "
+                    "[-s] [-t] path...\n"
+                    "  -j  number of decoding threads (default: number of CPUs)\n"
+                    "  -d  number of code buffers in flight (default: 64)\n"
+                    "  -f  output format (default: csv)\n"
+                    "  -o  output file (default: standard output)\n"
+                    "  -s  read with pread instead of io_uring\n"
+                    "  -t  print timing statistics to stderr\n"
+                    "Decodes the executable sections of all x86 ELF files in "
+                    "the directory trees\nand prints histograms of the "
+                    "instruction types, encodings and prefixes.\n", prog);
+}
+
+int
+main(int argc, char** argv) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nworkers = ncpus > 0 ? ncpus : 1;
+    size_t depth = 64;
+    bool json = false;
+    bool sync = false;
+    bool timing = false;
+    const char* out_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:d:f:o:sth")) != -1) {
+        switch (opt) {
+        case 'j': nworkers = strtoul(optarg, NULL, 0); break;
+        case 'd': depth = strtoul(optarg, NULL, 0); break;
+        case 'f':
+            json = !strcmp(optarg, "json");
+            if (!json && strcmp(optarg, "csv")) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'o': out_path = optarg; break;
+        case 's': sync = true; break;
+        case 't': timing = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc || nworkers == 0 || depth == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE* out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        perror(out_path);
+        return EXIT_FAILURE;
+    }
+    uint64_t start = now_ns();
+    for (int i = optind; i < argc; i++) {
+        if (nftw(argv[i], visit, 64, FTW_PHYS)) {
+            perror(argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    uint64_t walked = now_ns();
+
+    struct Scan scan = { .depth = depth, .ring.fd = -1 };
+    pthread_mutex_init(&scan.queue.lock, NULL);
+    pthread_cond_init(&scan.queue.ready, NULL);
+    pthread_cond_init(&scan.queue.freed, NULL);
+    scan.queue.tail = &scan.queue.head;
+    if (!sync && !ring_init(&scan.ring, depth < 4096 ? depth : 4096))
+        fprintf(stderr, "io_uring unavailable, using pread\n");
+
+    struct Worker* workers = xrealloc(NULL, nworkers * sizeof *workers);
+    unsigned started = 0;
+    for (; started < nworkers; started++) {
+        workers[started].queue = &scan.queue;
+        workers[started].stats = calloc(1, sizeof(struct Stats));
+        if (!workers[started].stats ||
+            pthread_create(&workers[started].thread, NULL, worker,
+                           &workers[started])) {
+            free(workers[started].stats);
+            break;
+        }
+    }
+    if (!started) {
+        fprintf(stderr, "failed to start workers\n");
+        return EXIT_FAILURE;
+    }
+    read_all(&scan);
+
+    // Merge the histograms of the workers.
+    struct Stats* total = calloc(1, sizeof *total);
+    if (!total) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+    for (unsigned i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        const struct Stats* stats = workers[i].stats;
+        for (size_t j = 0; j < NTYPES; j++)
+            total->types[j] += stats->types[j];
+        for (size_t j = 0; j < NFORMS; j++)
+            total->forms[j] += stats->forms[j];
+        for (size_t j = 0; j < NPREFIXES; j++)
+            total->prefixes[j] += stats->prefixes[j];
+        total->instrs += stats->instrs;
+        total->bad_bytes += stats->bad_bytes;
+        total->bytes += stats->bytes;
+        total->sections += stats->sections;
+        free(workers[i].stats);
+    }
+    uint64_t end = now_ns();
+
+    print_stats(out, json, &scan, total);
+    if (timing) {
+        double secs = (end - walked) / 1e9;
+        fprintf(stderr, "walk %.3f s, %zu files; scan %.3f s, %" PRIu64
+                " files, %.1f MB/s, %.1f M instructions/s, %u threads, %s\n",
+                (walked - start) / 1e9, npaths, secs, scan.files,
+                total->bytes / secs / 1e6, total->instrs / secs / 1e6,
+                started, scan.ring.fd >= 0 ? "io_uring" : "pread");
+    }
+
+    ring_fini(&scan.ring);
+    for (size_t i = 0; i < npaths; i++)
+        free(paths[i]);
+    free(paths);
+    free(workers);
+    free(total);
+    if (out != stdout && fclose(out)) {
+        perror(out_path);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,291 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fadec.h>
+#include <fadec-analysis.h>
+
+#include "tools-common.h"
+
+
+#define CHUNK_SIZE (64 << 10)
+
+// Parallel linear sweep of a section.
+struct SectionSweep {
+    FdSweep sweep;
+    size_t first_chunk;
+};
+
+// References of one chunk in the buffer of a worker.
+struct Chunk {
+    unsigned worker;
+    size_t off;
+    size_t count;
+};
+
+struct Refs {
+    FdXref* refs;
+    uint8_t* kinds;
+    size_t len;
+    size_t cap;
+};
+
+enum Phase {
+    PHASE_SWEEP,
+    PHASE_SCAN,
+    PHASE_INDEX,
+};
+
+struct Job {
+    struct Binary* bin;
+    struct SectionSweep* sweeps; // one per section
+    enum Phase phase;
+    atomic_size_t next;
+    struct Chunk* chunks;
+    size_t nchunks;
+    struct Refs* bufs; // one per worker
+    FdXrefIndex* index;
+};
+
+static void
+refs_reserve(struct Refs* refs, size_t len) {
+    if (refs->cap - refs->len >= len)
+        return;
+    size_t cap = refs->cap ? refs->cap : 1 << 14;
+    while (cap - refs->len < len)
+        cap *= 2;
+    refs->refs = xrealloc(refs->refs, cap * sizeof *refs->refs);
+    refs->kinds = xrealloc(refs->kinds, cap);
+    refs->cap = cap;
+}
+
+static int
+cmp_section(const void* a, const void* b) {
+    const struct Section* sa = a;
+    const struct Section* sb = b;
+    return sa->addr < sb->addr ? -1 : sa->addr > sb->addr;
+}
+
+static void
+scan_chunk(struct Job* job, struct Refs* buf, unsigned worker, size_t idx) {
+    const struct Binary* bin = job->bin;
+    size_t sec = 0;
+    while (idx - job->sweeps[sec].first_chunk >= job->sweeps[sec].sweep.nchunks)
+        sec++;
+    const struct Section* s = &bin->sections[sec];
+    const struct SectionSweep* sw = &job->sweeps[sec];
+    const FdSweepChunk* chunk = &sw->sweep.chunks[idx - sw->first_chunk];
+    for (;;) {
+        size_t avail = buf->cap - buf->len;
+        size_t n = fd_xref_scan(s->code, s->size, s->addr, bin->mode,
+                                chunk->entry, chunk->exit,
+                                buf->refs + buf->len, buf->kinds + buf->len,
+                                avail);
+        if (n <= avail) {
+            job->chunks[idx] = (struct Chunk) {
+                .worker = worker, .off = buf->len, .count = n,
+            };
+            buf->len += n;
+            return;
+        }
+        refs_reserve(buf, n);
+    }
+}
+
+static void
+worker(void* arg, unsigned id) {
+    struct Job* job = arg;
+    switch (job->phase) {
+    case PHASE_SWEEP:
+        for (size_t i = 0; i < job->bin->nsections; i++)
+            fd_sweep_run(&job->sweeps[i].sweep, id);
+        break;
+    case PHASE_SCAN:
+        for (;;) {
+            size_t idx = atomic_fetch_add(&job->next, 1);
+            if (idx >= job->nchunks)
+                break;
+            scan_chunk(job, &job->bufs[id], id, idx);
+        }
+        break;
+    case PHASE_INDEX:
+    default:
+        fd_xref_run(job->index, id);
+        break;
+    }
+}
+
+// Build the cross-reference index of all executable sections. The
+// references and kinds are stored in *refs and *kinds, the index arrays in
+// *scratch.
+static void
+binary_index(struct Binary* bin, FdXrefIndex* index, unsigned nworkers,
+             bool stats, FdXref** refs, uint8_t** kinds, FdXref** scratch) {
+    uint64_t t0 = now_ns();
+    // The references are ascending by source if the sections are.
+    qsort(bin->sections, bin->nsections, sizeof *bin->sections, cmp_section);
+    uint64_t* queues = xrealloc(NULL, (bin->nsections * nworkers + 1) *
+                                      sizeof *queues);
+    struct Job job = { .bin = bin };
+    job.sweeps = xrealloc(NULL, (bin->nsections + 1) * sizeof *job.sweeps);
+    atomic_init(&job.next, 0);
+    for (size_t i = 0; i < bin->nsections; i++) {
+        const struct Section* s = &bin->sections[i];
+        struct SectionSweep* sw = &job.sweeps[i];
+        size_t nchunks = FD_SWEEP_CHUNKS(s->size, CHUNK_SIZE);
+        fd_sweep_init(&sw->sweep, s->code, s->size, bin->mode, CHUNK_SIZE,
+                      xrealloc(NULL, (s->size + 7) / 8),
+                      xrealloc(NULL, nchunks * sizeof(FdSweepChunk)),
+                      queues + i * nworkers, nworkers);
+        sw->first_chunk = job.nchunks;
+        job.nchunks += nchunks;
+    }
+    job.chunks = xrealloc(NULL, (job.nchunks + 1) * sizeof *job.chunks);
+    job.bufs = calloc(nworkers, sizeof *job.bufs);
+    if (!job.bufs) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    job.phase = PHASE_SWEEP;
+    run_workers(nworkers, worker, &job);
+    for (size_t i = 0; i < bin->nsections; i++)
+        fd_sweep_resolve(&job.sweeps[i].sweep);
+    job.phase = PHASE_SCAN;
+    run_workers(nworkers, worker, &job);
+
+    // Concatenate the references of the chunks in address order.
+    size_t count = 0;
+    for (size_t i = 0; i < job.nchunks; i++)
+        count += job.chunks[i].count;
+    *refs = xrealloc(NULL, (count + 1) * sizeof **refs);
+    *kinds = xrealloc(NULL, count + 1);
+    size_t pos = 0;
+    for (size_t i = 0; i < job.nchunks; i++) {
+        const struct Chunk* chunk = &job.chunks[i];
+        const struct Refs* buf = &job.bufs[chunk->worker];
+        memcpy(*refs + pos, buf->refs + chunk->off,
+               chunk->count * sizeof **refs);
+        memcpy(*kinds + pos, buf->kinds + chunk->off, chunk->count);
+        pos += chunk->count;
+    }
+    for (unsigned i = 0; i < nworkers; i++) {
+        free(job.bufs[i].refs);
+        free(job.bufs[i].kinds);
+    }
+    uint64_t t1 = now_ns();
+
+    *scratch = xrealloc(NULL, (2 * count + 1) * sizeof **scratch);
+    uint64_t* hist = xrealloc(NULL, FD_XREF_HIST(nworkers) * sizeof *hist);
+    fd_xref_init(index, *refs, *kinds, count, *scratch, hist, nworkers);
+    job.phase = PHASE_INDEX;
+    job.index = index;
+    while (fd_xref_step(index))
+        run_workers(nworkers, worker, &job);
+    uint64_t t2 = now_ns();
+
+    if (stats) {
+        size_t code = 0;
+        for (size_t i = 0; i < bin->nsections; i++)
+            code += bin->sections[i].size;
+        double secs = (t2 - t0) / 1e9;
+        fprintf(stderr, "%s: %zu code bytes, %zu references, %zu targets; "
+                "sweep and scan %.3f s, index %.3f s, %.1fM references/min, "
+                "%u threads\n", bin->path, code, count, index->ntargets,
+                (t1 - t0) / 1e9, (t2 - t1) / 1e9,
+                secs > 0 ? count / secs * 60 / 1e6 : 0.0, nworkers);
+    }
+
+    for (size_t i = 0; i < bin->nsections; i++) {
+        free(job.sweeps[i].sweep.starts);
+        free(job.sweeps[i].sweep.chunks);
+    }
+    free(hist);
+    free(job.bufs);
+    free(job.chunks);
+    free(job.sweeps);
+    free(queues);
+}
+
+static const char* const kind_names[] = {
+    [FD_XREF_CALL] = "call",
+    [FD_XREF_JUMP] = "jump",
+    [FD_XREF_BRANCH] = "branch",
+    [FD_XREF_ADDR] = "addr",
+    [FD_XREF_MEM] = "mem",
+};
+
+static void
+usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-j threads] [-t] file [address...]\n"
+                    "  -j  number of threads (default: number of CPUs)\n"
+                    "  -t  print timing statistics to stderr\n"
+                    "Builds the cross-reference index of the executable "
+                    "sections of an x86 ELF file\nand lists the references "
+                    "to and from each address.\n", prog);
+}
+
+int
+main(int argc, char** argv) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nworkers = ncpus > 0 ? ncpus : 1;
+    bool stats = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:th")) != -1) {
+        switch (opt) {
+        case 'j': nworkers = strtoul(optarg, NULL, 0); break;
+        case 't': stats = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc || nworkers == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct Binary bin;
+    if (!binary_load(&bin, argv[optind]))
+        return EXIT_FAILURE;
+    FdXrefIndex index;
+    FdXref* refs;
+    uint8_t* kinds;
+    FdXref* scratch;
+    binary_index(&bin, &index, nworkers, stats, &refs, &kinds, &scratch);
+
+    int ret = EXIT_SUCCESS;
+    for (int i = optind + 1; i < argc; i++) {
+        char* end;
+        uint64_t addr = strtoull(argv[i], &end, 16);
+        if (*end) {
+            fprintf(stderr, "%s: invalid address\n", argv[i]);
+            ret = EXIT_FAILURE;
+            continue;
+        }
+        size_t first;
+        size_t n = fd_xref_to(&index, addr, addr + 1, &first);
+        for (size_t j = first; j < first + n; j++) {
+            size_t pos;
+            fd_xref_from(&index, index.sources[j], index.sources[j] + 1, &pos);
+            printf("%016" PRIx64 " <- %016" PRIx64 " %s\n", addr,
+                   index.sources[j], kind_names[kinds[pos]]);
+        }
+        n = fd_xref_from(&index, addr, addr + 1, &first);
+        for (size_t j = first; j < first + n; j++)
+            printf("%016" PRIx64 " -> %016" PRIx64 " %s\n", addr,
+                   refs[j].to, kind_names[kinds[j]]);
+    }
+
+    free(refs);
+    free(kinds);
+    free(scratch);
+    binary_unload(&bin);
+    return ret;
+}
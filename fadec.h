@@ -34,11 +34,36 @@ typedef enum {
 #undef FD_MNEMONIC
 } FdInstrType;
 
+/** ISA extensions from the F= column of the instruction table, see
+ * fd_instr_features. Hyphens in names are replaced by underscores.
+ * ABI STABILITY NOTE: like FdInstrType, the values depend on the build. **/
+typedef enum {
+#define FD_MNEMONIC(name,value)
+#define FD_FEATURE(name,value) FD_FEAT_ ## name = value,
+#include <fadec-decode-public.inc>
+#undef FD_FEATURE
+#undef FD_MNEMONIC
+} FdFeature;
+
+/** Number of 64-bit words of a feature mask. **/
+#define FD_FEATURE_WORDS 2
+
+/** Reference micro-architectures of the cost model, declared in costs.txt.
+ * ABI STABILITY NOTE: like FdInstrType, the values depend on the build. **/
+typedef enum {
+#define FD_MNEMONIC(name,value)
+#define FD_UARCH(name,value) FD_UARCH_ ## name = value,
+#include <fadec-decode-public.inc>
+#undef FD_UARCH
+#undef FD_MNEMONIC
+} FdUarch;
+
 /** Internal use only. **/
 enum {
     FD_FLAG_LOCK = 1 << 0,
     FD_FLAG_REP = 1 << 1,
     FD_FLAG_REPNZ = 1 << 2,
+    FD_FLAG_MOFFS = 1 << 3,
     FD_FLAG_64 = 1 << 7,
 };
 
@@ -93,6 +118,23 @@ typedef enum {
     FD_RC_SAE = 6,
 } FdRoundControl;
 
+/** Status flags and control flags of the EFLAGS register, as returned by
+ * fd_instr_flags_read and related functions. The values match the bit
+ * positions in the register. **/
+enum {
+    FD_EFL_CF = 1 << 0,
+    FD_EFL_PF = 1 << 2,
+    FD_EFL_AF = 1 << 4,
+    FD_EFL_ZF = 1 << 6,
+    FD_EFL_SF = 1 << 7,
+    FD_EFL_IF = 1 << 9,
+    FD_EFL_DF = 1 << 10,
+    FD_EFL_OF = 1 << 11,
+    /** All status flags. **/
+    FD_EFL_STATUS = FD_EFL_CF | FD_EFL_PF | FD_EFL_AF | FD_EFL_ZF |
+                    FD_EFL_SF | FD_EFL_OF,
+};
+
 /** Internal use only. **/
 typedef struct {
     uint8_t type;
@@ -144,6 +186,13 @@ typedef enum {
 int fd_decode(const uint8_t* buf, size_t len, int mode, uintptr_t address,
               FdInstr* out_instr);
 
+/** Get a hash of the decode tables, which changes whenever the instruction
+ * types, lengths, or control-flow kinds of decoded instructions may change,
+ * e.g. to detect data derived from decoding with another version.
+ * \return The hash of the decode tables.
+ **/
+uint64_t fd_table_hash(void);
+
 /** Format an instruction to a string.
  * \param instr The instruction.
  * \param buf The buffer to hold the formatted string.
@@ -162,6 +211,227 @@ void fd_format(const FdInstr* instr, char* buf, size_t len);
  **/
 void fd_format_abs(const FdInstr* instr, uint64_t addr, char* buf, size_t len);
 
+/** Format an instruction in AT&T syntax as accepted by the GNU assembler:
+ * operands in reverse order, %-prefixed registers, $-prefixed immediates,
+ * memory operands as seg:disp(base,index,scale), and a b/w/l/q size suffix on
+ * the mnemonic if no register operand implies the operand size. Otherwise the
+ * same as fd_format_abs.
+ *
+ * \param instr The instruction.
+ * \param addr The base address to use for printing FD_OT_OFF operands.
+ * \param buf The buffer to hold the formatted string.
+ * \param len The length of the buffer.
+ **/
+void fd_format_att(const FdInstr* instr, uint64_t addr, char* buf, size_t len);
+
+/** Flags for fd_format_listing. **/
+enum {
+    /** Omit the address column **/
+    FD_LISTING_NO_ADDR = 1 << 0,
+    /** Omit the instruction bytes **/
+    FD_LISTING_NO_BYTES = 1 << 1,
+    /** Format instructions with fd_format_att instead of fd_format_abs **/
+    FD_LISTING_ATT = 1 << 2,
+};
+
+/** Maximum number of bytes fd_format_listing writes for one instruction. **/
+#define FD_LISTING_LINE_MAX 256
+
+/** Format consecutive instructions as a listing in the style of objdump: one
+ * line per instruction with the address, up to 8 instruction bytes in hex, and
+ * the instruction as formatted by fd_format_abs. Columns are aligned; bytes of
+ * longer instructions continue on the next line. Lines end with '\n' and the
+ * output is not NUL-terminated, so it can be passed directly to write(2).
+ * Only complete lines are written; a buffer of count * FD_LISTING_LINE_MAX
+ * bytes is always sufficient.
+ *
+ * \param instrs The instructions, which are consecutive in memory.
+ * \param count The number of instructions.
+ * \param base_addr The address of the first instruction.
+ * \param bytes The encoded instructions, or NULL to omit the bytes column.
+ * \param out The output buffer.
+ * \param cap The size of the output buffer.
+ * \param flags A combination of FD_LISTING_* flags.
+ * \return The number of bytes written.
+ **/
+size_t fd_format_listing(const FdInstr* instrs, size_t count,
+                         uint64_t base_addr, const uint8_t* bytes, char* out,
+                         size_t cap, unsigned flags);
+
+/** Symbolizer for fd_format_sym. **/
+typedef struct FdSymbolizer {
+    /** Find the symbol for an address, usually the closest one at or before
+     * the address. Returns its NUL-terminated name and stores the offset of
+     * the address from the symbol in *off, or returns NULL if there is no
+     * symbol. **/
+    const char* (*lookup)(void* ctx, uint64_t addr, uint64_t* off);
+    /** Passed to lookup. **/
+    void* ctx;
+} FdSymbolizer;
+
+/** Flags for fd_format_sym. **/
+enum {
+    /** Use AT&T syntax, as fd_format_att **/
+    FD_FORMAT_ATT = 1 << 0,
+};
+
+/** Buffer size for fd_format_sym which is sufficient for all instructions.
+ * Symbol names are truncated to 100 characters. **/
+#define FD_FORMAT_SYM_MAX 256
+
+/** Format an instruction like fd_format_abs or fd_format_att, but replace
+ * branch targets and RIP-relative addresses with symbol names where sym finds
+ * one, e.g. "call func+0x1c" or "mov eax, dword ptr [rip+var]". The lookup is
+ * done while formatting, at most once per instruction.
+ *
+ * \param instr The instruction.
+ * \param addr The address of the instruction.
+ * \param sym The symbolizer, or NULL to format without symbols.
+ * \param flags A combination of FD_FORMAT_* flags.
+ * \param buf The buffer to hold the formatted string.
+ * \param len The length of the buffer.
+ **/
+void fd_format_sym(const FdInstr* instr, uint64_t addr, const FdSymbolizer* sym,
+                   unsigned flags, char* buf, size_t len);
+
+/** Kinds of tokens of the formatted text, see fd_format_tokens. **/
+typedef enum {
+    FD_TOK_PREFIX, /** e.g. "lock", "rep", "fs" (segment override) **/
+    FD_TOK_MNEMONIC, /** including an AT&T size suffix **/
+    FD_TOK_REG, /** including "%" and segment registers of memory operands **/
+    FD_TOK_IMM, /** immediates and branch targets, including "$" **/
+    FD_TOK_DISP, /** memory displacement **/
+    FD_TOK_SCALE, /** memory index scale **/
+    FD_TOK_SIZE, /** e.g. "dword ptr" **/
+    FD_TOK_MEM_OPEN, /** "[" or "(" **/
+    FD_TOK_MEM_CLOSE, /** "]" or ")" **/
+    FD_TOK_SYMBOL, /** symbol name, including an offset like "+0x1c" **/
+    FD_TOK_DECORATOR, /** e.g. "{k1}", "{z}", "{1to8}", "{rn-sae}" **/
+    FD_TOK_PUNCT, /** ",", "+", "-", "*", ":" **/
+} FdTokenKind;
+
+/** A token of the formatted text; whitespace is not part of any token. **/
+typedef struct FdToken {
+    /** Offset of the token in the text. **/
+    uint16_t offset;
+    /** Length of the token in bytes. **/
+    uint8_t length;
+    /** Token kind, one of FdTokenKind. **/
+    uint8_t kind;
+    /** Index of the operand in Intel order or FD_TOKEN_NO_OPERAND. **/
+    uint8_t operand;
+} FdToken;
+
+#define FD_TOKEN_NO_OPERAND 0xff
+
+/** Number of tokens which is sufficient for all instructions. **/
+#define FD_TOKENS_MAX 48
+
+/** Format an instruction like fd_format_sym and split the text into tokens,
+ * for syntax highlighting or structured output without parsing the text. The
+ * tokens are collected while formatting, in text order.
+ *
+ * \param instr The instruction.
+ * \param addr The address of the instruction.
+ * \param sym The symbolizer, or NULL to format without symbols.
+ * \param flags A combination of FD_FORMAT_* flags.
+ * \param buf The buffer to hold the formatted string.
+ * \param len The length of the buffer.
+ * \param toks The buffer to hold the tokens.
+ * \param cap The number of tokens that fit into toks.
+ * \return The number of tokens, which can be larger than cap. Tokens beyond
+ * cap are not stored; tokens are clipped to a truncated text.
+ **/
+size_t fd_format_tokens(const FdInstr* instr, uint64_t addr,
+                        const FdSymbolizer* sym, unsigned flags, char* buf,
+                        size_t len, FdToken* toks, size_t cap);
+
+/** A symbol for FdSymtab. **/
+typedef struct FdSymbol {
+    uint64_t addr;
+    uint64_t size;
+    const char* name;
+} FdSymbol;
+
+/** Sorted symbol index for address lookups. The symbols are stored in
+ * Eytzinger (breadth-first) order, so that a lookup touches few cache lines
+ * and its search loop is free of unpredictable branches. **/
+typedef struct FdSymtab {
+    /** Symbols in Eytzinger order, starting at index 1. **/
+    FdSymbol* nodes;
+    /** Addresses of nodes, searched by fd_symtab_lookup. **/
+    uint64_t* keys;
+    /** Number of symbols. **/
+    size_t count;
+} FdSymtab;
+
+/** Build a symbol index. No memory is allocated: the index is stored in nodes
+ * and keys, which each need space for count + 1 elements. Of several symbols
+ * with the same address, only the largest is kept. Names are not copied.
+ *
+ * \param tab The index to initialize.
+ * \param syms The symbols in any order; the array is sorted and deduplicated
+ *        in place.
+ * \param count The number of symbols.
+ * \param nodes Storage for the index, count + 1 elements.
+ * \param keys Storage for the index, count + 1 elements.
+ * \return The number of symbols in the index.
+ **/
+size_t fd_symtab_init(FdSymtab* tab, FdSymbol* syms, size_t count,
+                      FdSymbol* nodes, uint64_t* keys);
+
+/** Find the symbol with the highest address not greater than addr.
+ * \param tab The index.
+ * \param addr The address.
+ * \return The symbol, or NULL if all symbols are above addr.
+ **/
+const FdSymbol* fd_symtab_lookup(const FdSymtab* tab, uint64_t addr);
+
+/** FdSymbolizer lookup function for an FdSymtab passed as ctx. **/
+const char* fd_symtab_symbolize(void* ctx, uint64_t addr, uint64_t* off);
+
+/** Collect the defined function, object, and untyped symbols from the .symtab
+ * and .dynsym sections of a little-endian ELF32 or ELF64 image, e.g. a file
+ * mapped into memory. Names point into the image.
+ *
+ * \param image The ELF file contents.
+ * \param len The size of the image.
+ * \param out Array for the symbols, may be NULL if cap is zero.
+ * \param cap The capacity of out.
+ * \return The total number of symbols, which may exceed cap; zero if the image
+ *         is not a valid ELF file.
+ **/
+size_t fd_elf_symbols(const void* image, size_t len, FdSymbol* out,
+                      size_t cap);
+
+/** Collect the code ranges of the FDEs in the .eh_frame section of a
+ * little-endian ELF32 or ELF64 image, which usually describe every function
+ * compiled with unwind tables, even in stripped files. FDEs with an
+ * unsupported pointer encoding are skipped.
+ *
+ * \param image The ELF file contents.
+ * \param len The size of the image.
+ * \param out Array for the ranges in section order as symbols without name,
+ *        may be NULL if cap is zero.
+ * \param cap The capacity of out.
+ * \return The total number of FDEs, which may exceed cap.
+ **/
+size_t fd_elf_eh_frame(const void* image, size_t len, FdSymbol* out,
+                       size_t cap);
+
+/** Get the GNU build ID of a little-endian ELF32 or ELF64 image from its
+ * NT_GNU_BUILD_ID note, which identifies the file contents.
+ *
+ * \param image The ELF file contents.
+ * \param len The size of the image.
+ * \param out Buffer for the build ID, may be NULL if cap is zero.
+ * \param cap The size of out.
+ * \return The size of the build ID, which may exceed cap; zero if there is
+ *         none.
+ **/
+size_t fd_elf_build_id(const void* image, size_t len, uint8_t* out,
+                       size_t cap);
+
 /** Get the stringified name of an instruction type.
  * NOTE: API stability is currently not guaranteed for this function; changes
  * to the signature and/or the returned string can be expected. E.g., a future
@@ -174,6 +444,224 @@ void fd_format_abs(const FdInstr* instr, uint64_t addr, char* buf, size_t len);
  **/
 const char* fdi_name(FdInstrType ty);
 
+/** Get the flags read by an instruction, see FD_EFL_*. Flags which are only
+ * modified under some condition, e.g. for shifts by CL or for REPZ CMPS, are
+ * also considered as read, as their previous value may be retained.
+ *
+ * \param instr The instruction.
+ * \return The mask of read flags.
+ **/
+unsigned fd_instr_flags_read(const FdInstr* instr);
+
+/** Get the flags possibly written by an instruction, see FD_EFL_*. This
+ * includes flags that are set to a constant or left undefined.
+ *
+ * \param instr The instruction.
+ * \return The mask of written flags.
+ **/
+unsigned fd_instr_flags_written(const FdInstr* instr);
+
+/** Get the flags left in an undefined state by an instruction, a subset of the
+ * flags returned by fd_instr_flags_written.
+ *
+ * \param instr The instruction.
+ * \return The mask of undefined flags.
+ **/
+unsigned fd_instr_flags_undefined(const FdInstr* instr);
+
+/** Get the registers read by an instruction, including implicit operands
+ * (e.g., rDX:rAX for MUL, rSI/rDI/rCX for string instructions, rSP for stack
+ * operations) and registers used for memory addressing.
+ *
+ * A write to an 8-bit or 16-bit general purpose register, a legacy SSE write
+ * to a vector register, and an EVEX write with merge-masking preserve the
+ * remaining parts of the register; such registers are therefore also reported
+ * as read. 32-bit writes zero-extend and are full writes. x87 instructions that
+ * push or pop the register stack read and write all ST(i).
+ *
+ * \param instr The instruction.
+ * \param out_mask Array of 16 register masks, indexed by FdRegType. Bit n
+ *        refers to register n of that type; high-byte registers are reported
+ *        as FD_RT_GPL and RIP as bit FD_REG_IP of FD_RT_GPL.
+ **/
+void fd_instr_regs_read(const FdInstr* instr, uint64_t out_mask[16]);
+
+/** Get the registers possibly written by an instruction, including implicit
+ * operands. See fd_instr_regs_read for details.
+ *
+ * \param instr The instruction.
+ * \param out_mask Array of 16 register masks, indexed by FdRegType.
+ **/
+void fd_instr_regs_written(const FdInstr* instr, uint64_t out_mask[16]);
+
+/** Memory access kinds, see fd_mem_access. **/
+enum {
+    FD_MEM_READ = 1,
+    FD_MEM_WRITE = 2,
+};
+
+/** Get the kind of access to an explicit memory operand. Operands which only
+ * compute an address (LEA, prefetches, cache line flushes, multi-byte NOPs)
+ * are not accessed. Masked vector stores and scatters are reported as writes,
+ * even though elements may be skipped at run time.
+ *
+ * \param instr The instruction.
+ * \param idx The operand index.
+ * \return A combination of FD_MEM_READ and FD_MEM_WRITE, or zero if the
+ *         operand is not a memory operand or not accessed.
+ **/
+unsigned fd_mem_access(const FdInstr* instr, unsigned idx);
+
+/** Get the exact width of an explicit memory operand in bytes. Unlike
+ * FD_OP_SIZE, this covers far pointers, descriptor tables, x87 80-bit and
+ * environment operands, CMPXCHG8B/16B, BOUND and broadcasts. For VSIB operands
+ * and compress/expand instructions, the size of a single element is returned.
+ *
+ * \param instr The instruction.
+ * \param idx The operand index.
+ * \return The size in bytes, or zero if the operand is not a memory operand
+ *         or the size depends on processor state (XSAVE family).
+ **/
+unsigned fd_mem_size(const FdInstr* instr, unsigned idx);
+
+/** Compute the effective address of an explicit memory operand. Segment bases
+ * other than FS and GS are assumed to be zero. The address is truncated to the
+ * address size before adding the segment base. For VSIB operands, the index
+ * contribution is zero; use fd_mem_ea_vsib instead.
+ *
+ * \param instr The instruction.
+ * \param idx The operand index, must refer to a memory operand.
+ * \param regs The general purpose registers indexed by FdReg; regs[FD_REG_IP]
+ *        holds the address of the instruction itself.
+ * \param fsbase The FS segment base.
+ * \param gsbase The GS segment base.
+ * \return The linear address.
+ **/
+uint64_t fd_mem_ea(const FdInstr* instr, unsigned idx, const uint64_t regs[17],
+                   uint64_t fsbase, uint64_t gsbase);
+
+/** Compute the address of a single element of a VSIB memory operand. For other
+ * memory operands, this is the same as fd_mem_ea.
+ *
+ * \param vec_index The sign-extended index element of the vector register.
+ **/
+uint64_t fd_mem_ea_vsib(const FdInstr* instr, unsigned idx,
+                        const uint64_t regs[17], uint64_t fsbase,
+                        uint64_t gsbase, int64_t vec_index);
+
+/** Get the ISA extensions required by an instruction. Instructions of the
+ * base architecture require no features. The features are those of the
+ * mnemonic; some mnemonics with several encodings (e.g., PEXTRW) report the
+ * features of all of them.
+ *
+ * \param instr The instruction.
+ * \param out_mask Feature mask; bit n of word n/64 refers to FdFeature n.
+ **/
+void fd_instr_features(const FdInstr* instr,
+                       uint64_t out_mask[FD_FEATURE_WORDS]);
+
+/** Get the name of a feature as in the instruction table, e.g. "AVX512F".
+ * \param feature The feature.
+ * \return The name, or NULL if the feature is out of range.
+ **/
+const char* fd_feature_name(unsigned feature);
+
+/** Get the x86-64 micro-architecture level (x86-64-v1 to v4) required by an
+ * instruction. Extensions not part of any level (e.g., AES-NI, SHA) do not
+ * raise the level; AVX-512 extensions require level 4.
+ *
+ * \param instr The instruction.
+ * \return The level, from 1 to 4.
+ **/
+unsigned fd_instr_x86_64_level(const FdInstr* instr);
+
+/** Compute flag liveness backwards over a sequence of instructions, typically
+ * a basic block. The flags instrs[i] writes that are actually used later are
+ *   fd_instr_flags_written(&instrs[i]) & live_after[i]
+ * everything else need not be computed.
+ *
+ * \param instrs The decoded instructions, in program order.
+ * \param count The number of instructions.
+ * \param live_out The flags live after the last instruction; pass ~0u if
+ *        unknown.
+ * \param live_after Optional array of count elements to hold the flags live
+ *        after each instruction, or NULL.
+ * \return The flags live before the first instruction.
+ **/
+unsigned fd_flags_liveness(const FdInstr* instrs, size_t count,
+                           unsigned live_out, unsigned* live_after);
+
+/** Static cost of a single instruction, see fd_instr_cost. **/
+typedef struct {
+    /** Number of micro-ops, including those of memory loads and stores **/
+    unsigned uops;
+    /** Latency in cycles from the input to the output registers, excluding
+     * the latency of a memory load **/
+    unsigned latency;
+    /** Additional latency of a memory load, or zero if no memory is read **/
+    unsigned load_latency;
+    /** Ports the computational micro-ops can execute on, bit n refers to
+     * port n; zero if the instruction needs no execution port **/
+    unsigned ports;
+} FdCost;
+
+/** Get the static cost of an instruction on a reference micro-architecture.
+ * Costs are per mnemonic and form (with or without memory operand) and taken
+ * from the costs.txt data file; they are representative values rather than
+ * exact for every operand size.
+ *
+ * \param instr The instruction.
+ * \param uarch The micro-architecture.
+ * \param out_cost Receives the cost.
+ * \return Zero on success, -1 if the micro-architecture is invalid.
+ **/
+int fd_instr_cost(const FdInstr* instr, FdUarch uarch, FdCost* out_cost);
+
+/** Get the name of a micro-architecture, e.g. "SKL".
+ * \return The name, or NULL if the micro-architecture is invalid. **/
+const char* fd_uarch_name(unsigned uarch);
+
+/** Get the name of an execution port of a micro-architecture, e.g. "p5".
+ * \return The name, or NULL if the port does not exist. **/
+const char* fd_uarch_port_name(unsigned uarch, unsigned port);
+
+/** Throughput estimate of a basic block, see fd_block_cost. **/
+typedef struct {
+    /** Estimated cycles per iteration when executing the block in a loop,
+     * the maximum of the three bounds below. **/
+    double cycles;
+    /** Bound from the issue width of the front-end **/
+    double issue_cycles;
+    /** Bound from the most used execution port, bottleneck_port **/
+    double port_cycles;
+    /** Bound from register and flag dependencies carried from one iteration
+     * to the next **/
+    double latency_cycles;
+    /** Port with the highest pressure, or -1 if no port is used **/
+    int bottleneck_port;
+    /** Length of the longest dependency chain within one iteration **/
+    unsigned critical_path;
+    /** Number of micro-ops of one iteration **/
+    unsigned uops;
+    /** Micro-ops per iteration executed on each port **/
+    double port_pressure[16];
+} FdBlockCost;
+
+/** Estimate the throughput of a basic block from the static instruction
+ * costs. Micro-ops are distributed evenly over their ports, dependencies are
+ * tracked through registers and flags. Dependencies through memory, branch
+ * mispredictions, and cache misses are not modelled. Zero idioms (e.g.,
+ * XOR EAX, EAX) do not depend on their inputs.
+ *
+ * \param instrs The decoded instructions, in program order.
+ * \param count The number of instructions.
+ * \param uarch The micro-architecture.
+ * \param out_cost Receives the estimate.
+ * \return Zero on success, -1 if the micro-architecture is invalid.
+ **/
+int fd_block_cost(const FdInstr* instrs, size_t count, FdUarch uarch,
+                  FdBlockCost* out_cost);
+
 
 /** Gets the type/mnemonic of the instruction.
  * ABI STABILITY NOTE: different versions or builds of the library may use
@@ -277,6 +765,77 @@ const char* fdi_name(FdInstrType ty);
 /** Get rounding mode for EVEX-encoded instructions. See FdRoundControl. **/
 #define FD_ROUNDCONTROL(instr) ((FdRoundControl) (((instr)->evex & 0x70) >> 4))
 
+/** Control-flow kinds, see fd_cf_kind. **/
+typedef enum {
+    FD_CF_NONE = 0,
+    /** Direct jump **/
+    FD_CF_JMP,
+    /** Indirect jump through register or memory **/
+    FD_CF_JMP_IND,
+    /** Direct conditional jump, including XBEGIN **/
+    FD_CF_JCC,
+    /** JCXZ/JECXZ/JRCXZ and LOOP/LOOPZ/LOOPNZ **/
+    FD_CF_LOOP,
+    /** Direct call **/
+    FD_CF_CALL,
+    /** Indirect call through register or memory **/
+    FD_CF_CALL_IND,
+    /** Near return **/
+    FD_CF_RET,
+    /** Transfer to the operating system or hypervisor, which usually returns
+     * to the next instruction: SYSCALL, SYSENTER, INT n, VMCALL, etc. **/
+    FD_CF_SYSCALL,
+    /** Far or privilege-changing transfer: far JMP/CALL/RET, IRET, SYSRET,
+     * SYSEXIT, VMLAUNCH, etc. **/
+    FD_CF_FAR,
+    /** Trap or invalid opcode: INT3, INT1, INTO, UD0/UD1/UD2 **/
+    FD_CF_TRAP,
+} FdCfKind;
+
+/** Internal table for fd_cf_kind, indexed by FdInstrType. **/
+extern const uint8_t fd_cf_table[];
+
+/** Get the control-flow kind of an instruction.
+ * \param instr The instruction.
+ * \return The control-flow kind, FD_CF_NONE for other instructions.
+ **/
+static inline FdCfKind fd_cf_kind(const FdInstr* instr) {
+    unsigned cf = fd_cf_table[FD_TYPE(instr)];
+    // Bit 7: indirect if the target is in a register or memory.
+    unsigned ind = (cf >> 7) & (FD_OP_TYPE(instr, 0) == FD_OT_REG ||
+                                FD_OP_TYPE(instr, 0) == FD_OT_MEM);
+    return (FdCfKind) ((cf & 0x7f) + ind);
+}
+
+/** Get the target of a direct jump, conditional jump, or call.
+ * \param instr The instruction.
+ * \param addr The address of the instruction. Unused if the instruction was
+ *        decoded with a non-zero address, as the target is then absolute.
+ * \return The target address, truncated to the operand size, or zero for
+ *         other instructions.
+ **/
+static inline uint64_t fd_branch_target(const FdInstr* instr, uint64_t addr) {
+    uint64_t target;
+    switch (fd_cf_kind(instr)) {
+    case FD_CF_JMP:
+    case FD_CF_JCC:
+    case FD_CF_LOOP:
+    case FD_CF_CALL:
+        break;
+    default:
+        return 0;
+    }
+    if (FD_OP_TYPE(instr, 0) == FD_OT_IMM)
+        target = FD_OP_IMM(instr, 0);
+    else
+        target = addr + FD_SIZE(instr) + FD_OP_IMM(instr, 0);
+    if (FD_OP_SIZE(instr, 0) == 2)
+        target &= 0xffff;
+    else if (FD_OP_SIZE(instr, 0) == 4)
+        target &= 0xffffffff;
+    return target;
+}
+
 #ifdef __cplusplus
 }
 #endif
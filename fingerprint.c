@@ -0,0 +1,208 @@
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fadec.h>
+#include <fadec-fingerprint.h>
+
+
+// Immediates and displacements outside of this range may be addresses.
+#define SMALL_LIMIT (1 << 16)
+
+// Token of an undecodable byte.
+#define TOKEN_INVALID 0xffff
+
+static uint64_t
+mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Cheap combination of words; the features are mixed with mix64 once.
+static uint64_t
+combine(uint64_t h, uint64_t val) {
+    h = (h ^ val) * 0x9e3779b97f4a7c15ull;
+    return h ^ h >> 29;
+}
+
+static bool
+is_small(int64_t val) {
+    return val > -SMALL_LIMIT && val < SMALL_LIMIT;
+}
+
+// Normalize an operand: addresses are masked, except for branch targets
+// inside the function, which are replaced by their offset from its start.
+static uint64_t
+operand_token(const FdFpState* st, const FdInstr* instr, unsigned idx,
+              uint64_t addr) {
+    FdOpType kind = FD_OP_TYPE(instr, idx);
+    uint64_t tok = kind | (uint64_t) FD_OP_SIZELG(instr, idx) << 4;
+    switch (kind) {
+    case FD_OT_REG:
+        return tok | (uint64_t) FD_OP_REG_TYPE(instr, idx) << 8 |
+               (uint64_t) FD_OP_REG(instr, idx) << 16;
+    case FD_OT_IMM: {
+        int64_t imm = FD_OP_IMM(instr, idx);
+        if (FD_OP_SIZE(instr, idx) >= 4 && !is_small(imm))
+            return tok | 1 << 7;
+        return tok ^ (uint64_t) imm << 8;
+    }
+    case FD_OT_MEM:
+    case FD_OT_MEMBCST: {
+        FdReg base = FD_OP_BASE(instr, idx);
+        FdReg index = FD_OP_INDEX(instr, idx);
+        int64_t disp = FD_OP_DISP(instr, idx);
+        tok |= (uint64_t) base << 8 | (uint64_t) index << 16 |
+               (uint64_t) FD_OP_SCALE(instr, idx) << 24 |
+               (uint64_t) FD_SEGMENT(instr) << 26;
+        if (base == FD_REG_IP || (base == FD_REG_NONE && index == FD_REG_NONE) ||
+            !is_small(disp))
+            return tok | 1 << 7;
+        return tok ^ (uint64_t) disp << 32;
+    }
+    case FD_OT_OFF: {
+        uint64_t target = fd_branch_target(instr, addr);
+        if (target < st->start || target >= st->end)
+            return tok | 1 << 7;
+        return tok ^ (target - st->start) << 8;
+    }
+    case FD_OT_NONE:
+    default:
+        return tok;
+    }
+}
+
+void
+fd_fp_begin(FdFpState* st, uint64_t start, uint64_t end) {
+    *st = (FdFpState) { .start = start, .end = end };
+    for (unsigned i = 0; i < FD_FP_SLOTS; i++)
+        st->minhash[i] = UINT32_MAX;
+}
+
+static void
+fp_flush(FdFpState* st) {
+    for (unsigned j = 0; j < 8; j++) {
+        for (unsigned b = 0; b < 8; b++)
+            st->counts[8 * b + j] += st->lanes[j] >> 8 * b & 0xff;
+        st->lanes[j] = 0;
+    }
+}
+
+static void
+fp_feature(FdFpState* st, uint64_t feature) {
+    uint64_t h = mix64(feature);
+    // One permutation hashing: the top bits select the slot.
+    unsigned slot = h >> (64 - FD_FP_SLOTS_LG);
+    if ((uint32_t) h < st->minhash[slot])
+        st->minhash[slot] = (uint32_t) h;
+    // Count the set bits of each position in byte counters, eight per word:
+    // byte b of lanes[j] counts bit 8 * b + j. They are added to the full
+    // counters before they overflow.
+    for (unsigned j = 0; j < 8; j++)
+        st->lanes[j] += h >> j & 0x0101010101010101ull;
+    if (++st->nfeatures % 255 == 0)
+        fp_flush(st);
+}
+
+static void
+fp_token(FdFpState* st, uint64_t tok, uint64_t coarse) {
+    st->hash = combine(st->hash, tok);
+    // Trigrams capture the order of the instructions, the coarse unigrams
+    // without registers keep functions with different register allocation
+    // similar.
+    fp_feature(st, combine(combine(st->prev[1], st->prev[0]), tok));
+    fp_feature(st, coarse ^ 0x8000000000000000ull);
+    st->prev[1] = st->prev[0];
+    st->prev[0] = tok;
+    st->ninstrs++;
+}
+
+void
+fd_fp_add(FdFpState* st, const FdInstr* instr, uint64_t addr) {
+    uint64_t tok = FD_TYPE(instr) | (uint64_t) FD_OPSIZELG(instr) << 16 |
+                   (uint64_t) FD_ADDRSIZELG(instr) << 20 |
+                   (uint64_t) (FD_HAS_LOCK(instr) != 0) << 24 |
+                   (uint64_t) (FD_HAS_REP(instr) != 0) << 25 |
+                   (uint64_t) (FD_HAS_REPNZ(instr) != 0) << 26;
+    uint64_t coarse = tok;
+    for (unsigned i = 0; i < 4 && FD_OP_TYPE(instr, i) != FD_OT_NONE; i++) {
+        tok = combine(tok, operand_token(st, instr, i, addr));
+        coarse |= (uint64_t) FD_OP_TYPE(instr, i) << (32 + 4 * i);
+    }
+    fp_token(st, tok, coarse);
+}
+
+void
+fd_fp_end(FdFpState* st, FdFingerprint* out) {
+    out->hash = mix64(st->hash ^ st->ninstrs);
+    fp_flush(st);
+    out->simhash = 0;
+    for (unsigned i = 0; i < 64; i++)
+        out->simhash |= (uint64_t) (2 * (uint64_t) st->counts[i] >
+                                    st->nfeatures) << i;
+    out->ninstrs = st->ninstrs;
+
+    // Densify: an empty slot takes the value of the next non-empty slot,
+    // rehashed with the distance, so that small functions stay comparable.
+    unsigned first = 0;
+    while (first < FD_FP_SLOTS && st->minhash[first] == UINT32_MAX)
+        first++;
+    for (unsigned i = 0; i < FD_FP_SLOTS; i++) {
+        uint32_t val = st->minhash[i];
+        if (val == UINT32_MAX && first < FD_FP_SLOTS) {
+            unsigned dist = 1;
+            while (st->minhash[(i + dist) % FD_FP_SLOTS] == UINT32_MAX)
+                dist++;
+            val = (uint32_t) mix64(st->minhash[(i + dist) % FD_FP_SLOTS] +
+                                   ((uint64_t) dist << 32));
+        }
+        out->minhash[i] = val;
+    }
+}
+
+size_t
+fd_fp_scan(const uint8_t* buf, size_t len, uint64_t base, int mode,
+           const FdSymbol* funcs, size_t count, FdFingerprint* out) {
+    size_t done = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t start = funcs[i].addr;
+        uint64_t end = start + funcs[i].size;
+        if (!funcs[i].size)
+            end = i + 1 < count && funcs[i + 1].addr > start ? funcs[i + 1].addr
+                                                            : base + len;
+        if (start - base > len)
+            start = end = base;
+        else if (end - base > len || end < start)
+            end = base + len;
+
+        FdFpState st;
+        fd_fp_begin(&st, start, end);
+        for (size_t off = start - base; off < end - base; ) {
+            FdInstr instr;
+            int ret = fd_decode(buf + off, end - base - off, mode, 0, &instr);
+            if (ret < 0) {
+                fp_token(&st, TOKEN_INVALID, TOKEN_INVALID);
+                off++;
+                continue;
+            }
+            fd_fp_add(&st, &instr, base + off);
+            off += ret;
+        }
+        fd_fp_end(&st, &out[i]);
+        done += start != end;
+    }
+    return done;
+}
+
+unsigned
+fd_fp_similarity(const FdFingerprint* a, const FdFingerprint* b) {
+    unsigned equal = 0;
+    for (unsigned i = 0; i < FD_FP_SLOTS; i++)
+        equal += a->minhash[i] == b->minhash[i];
+    return equal;
+}
@@ -73,12 +73,11 @@ fd_clz64(uint64_t v) {
 #include <immintrin.h>
 #endif
 
-static char*
-fd_strpcatnum(char dst[DECLARE_ARRAY_SIZE(18)], uint64_t val) {
-    unsigned lz = fd_clz64(val|1);
-    unsigned numbytes = 16 - (lz / 4);
+// Write the 16 hex digits of val, most significant first.
+static void
+fd_strhex16(char dst[DECLARE_ARRAY_SIZE(16)], uint64_t val) {
 #if defined(__SSE2__)
-    __m128i mv = _mm_set_epi64x(0, val << (lz & -4));
+    __m128i mv = _mm_set_epi64x(0, val);
     __m128i mvp = _mm_unpacklo_epi8(mv, mv);
     __m128i mva = _mm_srli_epi16(mvp, 12);
     __m128i mvb = _mm_and_si128(mvp, _mm_set1_epi16(0x0f00u));
@@ -89,14 +88,18 @@ fd_strpcatnum(char dst[DECLARE_ARRAY_SIZE(18)], uint64_t val) {
     __m128i ma = _mm_add_epi8(mn, mgtm);
     __m128i msw = _mm_shufflehi_epi16(_mm_shufflelo_epi16(ma, 0x1b), 0x1b);
     __m128i ms = _mm_shuffle_epi32(msw, 0x4e);
-    _mm_storeu_si128((__m128i_u*) (dst + 2), ms);
+    _mm_storeu_si128((__m128i_u*) dst, ms);
 #else
-    unsigned idx = numbytes + 2;
-    do {
-        dst[--idx] = "0123456789abcdef"[val % 16];
-        val /= 16;
-    } while (val);
+    for (unsigned i = 0; i < 16; i++)
+        dst[i] = "0123456789abcdef"[(val >> (60 - 4 * i)) & 0xf];
 #endif
+}
+
+static char*
+fd_strpcatnum(char dst[DECLARE_ARRAY_SIZE(18)], uint64_t val) {
+    unsigned lz = fd_clz64(val|1);
+    unsigned numbytes = 16 - (lz / 4);
+    fd_strhex16(dst + 2, val << (lz & -4));
     dst[0] = '0';
     dst[1] = 'x';
     return dst + numbytes + 2;
@@ -166,8 +169,47 @@ fdi_name(FdInstrType ty) {
     return "(invalid)";
 }
 
+// Token output of fd_format_tokens; count may exceed cap.
+struct FdTokSink {
+    FdToken* toks;
+    size_t count;
+    size_t cap;
+    const char* base;
+};
+
+static void
+fd_tok(struct FdTokSink* sink, FdTokenKind kind, int op, const char* start,
+       const char* end) {
+    if (sink->count < sink->cap) {
+        FdToken* tok = &sink->toks[sink->count];
+        tok->offset = start - sink->base;
+        tok->length = end - start;
+        tok->kind = kind;
+        tok->operand = op;
+    }
+    sink->count++;
+}
+
+// Record a token from start to the current output position buf.
+#define TOK(kind, op, start) do { \
+        if (UNLIKELY(toks != NULL)) \
+            fd_tok(toks, (kind), (op), (start), buf); \
+    } while (0)
+#define NOOP FD_TOKEN_NO_OPERAND
+
+// Size suffix classes of AT&T mnemonics for memory operands without a register
+// operand of the same size, see att_suffix in parseinstrs.py.
+enum {
+    ATT_SUFFIX_NONE = 0,
+    ATT_SUFFIX_GP = 1, // b/w/l/q
+    ATT_SUFFIX_FLOAT = 2, // x87 s/l/t
+    ATT_SUFFIX_INT = 3, // x87 s/l/ll
+};
+
 static char*
-fd_mnemonic(char buf[DECLARE_RESTRICTED_ARRAY_SIZE(48)], const FdInstr* instr) {
+fd_mnemonic(char buf[DECLARE_RESTRICTED_ARRAY_SIZE(48)], const FdInstr* instr,
+            bool att, struct FdTokSink* toks) {
+    char* start = buf;
 #define FD_DECODE_TABLE_STRTAB1
     static const char* mnemonic_str =
 #include <fadec-decode-private.inc>
@@ -186,8 +228,22 @@ fd_mnemonic(char buf[DECLARE_RESTRICTED_ARRAY_SIZE(48)], const FdInstr* instr) {
     };
 #undef FD_DECODE_TABLE_STRTAB3
 
+#define FD_DECODE_TABLE_ATT_SUFFIX
+    static const uint8_t mnemonic_att_suffix[] = {
+#include <fadec-decode-private.inc>
+    };
+#undef FD_DECODE_TABLE_ATT_SUFFIX
+
+    // AT&T names which differ from the Intel names, in slots of 8 bytes.
+    static const char att_mnemonic_str[] =
+        "cbtwcwtlcltq\0\0\0\0" "cwtdcltdcqto\0\0\0\0"
+        "movabs\0\0" "ljmp\0\0\0\0" "lcall\0\0\0" "lret\0\0\0\0"
+        "movs\0\0\0\0" "movz\0\0\0\0"
+        "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"; // 15 NULL Bytes to prevent overflow
+
     const char* mnem = &mnemonic_str[mnemonic_offs[FD_TYPE(instr)]];
     unsigned mnemlen = mnemonic_lens[FD_TYPE(instr)];
+    const char* sizechars = att ? "bwlq" : "bwdq";
 
     bool prefix_xacq_xrel = false;
     bool prefix_segment = false;
@@ -294,12 +350,113 @@ fd_mnemonic(char buf[DECLARE_RESTRICTED_ARRAY_SIZE(48)], const FdInstr* instr) {
     case FDI_IRET:
     case FDI_IN:
     case FDI_OUT:
-        sizesuffix[0] = "bwdq"[FD_OPSIZELG(instr)];
+        sizesuffix[0] = sizechars[FD_OPSIZELG(instr)];
         sizesuffixlen = 1;
         break;
     default: break;
     }
 
+    if (att) {
+        switch (UNLIKELY(FD_TYPE(instr))) {
+        case FDI_C_EX:
+            mnem = att_mnemonic_str + (FD_OPSIZE(instr) & 0xc);
+            mnemlen = 4;
+            break;
+        case FDI_C_SEP:
+            mnem = att_mnemonic_str + 16 + (FD_OPSIZE(instr) & 0xc);
+            mnemlen = 4;
+            break;
+        case FDI_MOVABS:
+        case FDI_MOV:
+            // GAS only accepts movabs for a 64-bit immediate or offset.
+            if (FD_TYPE(instr) == FDI_MOVABS ? FD_OP_SIZELG(instr, 1) == 3 :
+                (instr->flags & FD_FLAG_MOFFS) && FD_ADDRSIZELG(instr) == 3) {
+                mnem = att_mnemonic_str + 32;
+                mnemlen = 6;
+            }
+            break;
+        case FDI_FSUB:
+        case FDI_FSUBR:
+        case FDI_FDIV:
+        case FDI_FDIVR:
+            // Only the forms with %st(i) as destination are swapped.
+            if (FD_OP_TYPE(instr, 0) != FD_OT_REG || !FD_OP_REG(instr, 0))
+                break;
+            // FALLTHROUGH
+        case FDI_FSUBP:
+        case FDI_FSUBRP:
+        case FDI_FDIVP:
+        case FDI_FDIVRP: {
+            // GAS swaps the reverse forms with %st(i) as destination, so the
+            // mnemonic of the other form assembles to the same instruction.
+            // With %st(0) as both operands, either mnemonic computes the same.
+            FdInstrType type;
+            switch (FD_TYPE(instr)) {
+            case FDI_FSUB: type = FDI_FSUBR; break;
+            case FDI_FSUBR: type = FDI_FSUB; break;
+            case FDI_FDIV: type = FDI_FDIVR; break;
+            case FDI_FDIVR: type = FDI_FDIV; break;
+            case FDI_FSUBP: type = FDI_FSUBRP; break;
+            case FDI_FSUBRP: type = FDI_FSUBP; break;
+            case FDI_FDIVP: type = FDI_FDIVRP; break;
+            default: type = FDI_FDIVP; break;
+            }
+            mnem = &mnemonic_str[mnemonic_offs[type]];
+            mnemlen = mnemonic_lens[type];
+            break;
+        }
+        case FDI_JMPF: mnem = att_mnemonic_str + 40; mnemlen = 4; break;
+        case FDI_CALLF: mnem = att_mnemonic_str + 48; mnemlen = 5; break;
+        case FDI_RETF: mnem = att_mnemonic_str + 56; mnemlen = 4; break;
+        case FDI_MOVSX:
+        case FDI_MOVZX:
+            mnem = att_mnemonic_str + (FD_TYPE(instr) == FDI_MOVSX ? 64 : 72);
+            mnemlen = 4;
+            sizesuffix[0] = "bwlq"[FD_OP_SIZELG(instr, 1)];
+            sizesuffix[1] = "bwlq"[FD_OP_SIZELG(instr, 0)];
+            sizesuffixlen = 2;
+            break;
+        default: break;
+        }
+
+        // The size of a memory operand is otherwise implied by a register
+        // operand of the same size.
+        unsigned suffix = mnemonic_att_suffix[FD_TYPE(instr)];
+        if (UNLIKELY(suffix != ATT_SUFFIX_NONE && !sizesuffixlen)) {
+            int memsize = -2;
+            bool implied = false;
+            for (int i = 0; i < 4; i++) {
+                if (FD_OP_TYPE(instr, i) == FD_OT_MEM)
+                    memsize = FD_OP_SIZELG(instr, i);
+            }
+            for (int i = 0; i < 4; i++) {
+                if (FD_OP_TYPE(instr, i) == FD_OT_REG &&
+                    (FD_OP_REG_TYPE(instr, i) == FD_RT_GPL ||
+                     FD_OP_REG_TYPE(instr, i) == FD_RT_GPH) &&
+                    FD_OP_SIZELG(instr, i) == memsize)
+                    implied = true;
+            }
+            if (memsize == -2 || implied)
+                suffix = ATT_SUFFIX_NONE;
+            switch (suffix) {
+            default: break;
+            case ATT_SUFFIX_GP:
+                sizesuffix[0] = "bwlq"[memsize & 3];
+                sizesuffixlen = 1;
+                break;
+            case ATT_SUFFIX_FLOAT:
+                sizesuffix[0] = memsize == 2 ? 's' : memsize == 3 ? 'l' : 't';
+                sizesuffixlen = 1;
+                break;
+            case ATT_SUFFIX_INT:
+                sizesuffix[0] = memsize == 1 ? 's' : 'l';
+                sizesuffix[1] = memsize == 3 ? 'l' : '\0';
+                sizesuffixlen = memsize == 3 ? 2 : 1;
+                break;
+            }
+        }
+    }
+
     if (UNLIKELY(prefix_xacq_xrel || FD_HAS_LOCK(instr))) {
         if (FD_HAS_REP(instr))
             buf = fd_strpcat(buf, fd_stre("xrelease "));
@@ -314,28 +471,134 @@ fd_mnemonic(char buf[DECLARE_RESTRICTED_ARRAY_SIZE(48)], const FdInstr* instr) {
         *buf++ = ' ';
     }
 
+    // Prefixes are separated by a space each.
+    if (UNLIKELY(toks != NULL)) {
+        for (char* p = start; p != buf; p++) {
+            if (*p == ' ') {
+                fd_tok(toks, FD_TOK_PREFIX, NOOP, start, p);
+                start = p + 1;
+            }
+        }
+    }
+
     for (unsigned i = 0; i < 16; i++)
         buf[i] = mnem[i];
     buf += mnemlen;
     for (unsigned i = 0; i < 4; i++)
         buf[i] = sizesuffix[i];
     buf += sizesuffixlen;
+    TOK(FD_TOK_MNEMONIC, NOOP, start);
 
     return buf;
 }
 
+// Get type and size of the index register of memory operands, which is a vector
+// register for VSIB addressing of gathers and scatters.
+static unsigned
+fd_memidx_size(const FdInstr* instr, unsigned* idx_rt) {
+    *idx_rt = FD_RT_VEC;
+    switch (FD_TYPE(instr)) {
+    case FDI_VPGATHERQD:
+    case FDI_VGATHERQPS:
+    case FDI_EVX_PGATHERQD:
+    case FDI_EVX_GATHERQPS:
+        return FD_OP_SIZELG(instr, 0) + 1;
+    case FDI_EVX_PSCATTERQD:
+    case FDI_EVX_SCATTERQPS:
+        return FD_OP_SIZELG(instr, 1) + 1;
+    case FDI_VPGATHERDQ:
+    case FDI_VGATHERDPD:
+    case FDI_EVX_PGATHERDQ:
+    case FDI_EVX_GATHERDPD:
+        return FD_OP_SIZELG(instr, 0) - 1;
+    case FDI_EVX_PSCATTERDQ:
+    case FDI_EVX_SCATTERDPD:
+        return FD_OP_SIZELG(instr, 1) - 1;
+    case FDI_VPGATHERDD:
+    case FDI_VPGATHERQQ:
+    case FDI_VGATHERDPS:
+    case FDI_VGATHERQPD:
+    case FDI_EVX_PGATHERDD:
+    case FDI_EVX_PGATHERQQ:
+    case FDI_EVX_GATHERDPS:
+    case FDI_EVX_GATHERQPD:
+        return FD_OP_SIZELG(instr, 0);
+    case FDI_EVX_PSCATTERDD:
+    case FDI_EVX_PSCATTERQQ:
+    case FDI_EVX_SCATTERDPS:
+    case FDI_EVX_SCATTERQPD:
+        return FD_OP_SIZELG(instr, 1);
+    default:
+        *idx_rt = FD_RT_GPL;
+        return FD_ADDRSIZELG(instr);
+    }
+}
+
+// Write the broadcast of operand i as {1toX}.
 static char*
-fd_format_impl(char buf[DECLARE_RESTRICTED_ARRAY_SIZE(128)], const FdInstr* instr, uint64_t addr) {
-    buf = fd_mnemonic(buf, instr);
+fd_strpcatbcst(char* restrict dst, const FdInstr* instr, int i) {
+    // {1toX}, X = FD_OP_SIZE(instr, i) / BCSTSZ (=> 2/4/8/16/32)
+    unsigned bcstszidx = FD_OP_SIZELG(instr, i) - FD_OP_BCSTSZLG(instr, i) - 1;
+    const char* bcstsizes = "\6{1to2} \6{1to4} \6{1to8} \7{1to16}\7{1to32}         ";
+    const char* bcstsize = bcstsizes + bcstszidx * 8;
+    return fd_strpcat(dst, (struct FdStr) { bcstsize+1, *bcstsize });
+}
+
+// Write the static rounding mode or suppress-all-exceptions marker.
+static char*
+fd_strpcatrc(char* restrict dst, const FdInstr* instr) {
+    switch (FD_ROUNDCONTROL(instr)) {
+    case FD_RC_RN: return fd_strpcat(dst, fd_stre("{rn-sae}"));
+    case FD_RC_RD: return fd_strpcat(dst, fd_stre("{rd-sae}"));
+    case FD_RC_RU: return fd_strpcat(dst, fd_stre("{ru-sae}"));
+    case FD_RC_RZ: return fd_strpcat(dst, fd_stre("{rz-sae}"));
+    case FD_RC_SAE: return fd_strpcat(dst, fd_stre("{sae}"));
+    default: return dst; // should not happen
+    }
+}
+
+// Longest symbol name written by fd_format_sym, see FD_FORMAT_SYM_MAX.
+#define SYM_NAME_MAX 100
+
+// Write "name" or "name+0xoff" for addr; returns NULL if there is no symbol.
+static char*
+fd_strpcatsym(char* restrict dst, const FdSymbolizer* sym, uint64_t addr) {
+    uint64_t off = 0;
+    const char* name = sym->lookup(sym->ctx, addr, &off);
+    if (!name)
+        return NULL;
+    for (unsigned i = 0; i < SYM_NAME_MAX && name[i]; i++)
+        *dst++ = name[i];
+    if (off) {
+        *dst++ = '+';
+        dst = fd_strpcatnum(dst, off);
+    }
+    return dst;
+}
+
+// Get the address referenced by a RIP-relative memory operand.
+static uint64_t
+fd_riptarget(const FdInstr* instr, uint64_t addr) {
+    uint64_t target = addr + FD_SIZE(instr) + FD_OP_DISP(instr, 0);
+    return FD_ADDRSIZELG(instr) == 2 ? target & 0xffffffff : target;
+}
+
+static char*
+fd_format_impl(char buf[DECLARE_RESTRICTED_ARRAY_SIZE(128)], const FdInstr* instr, uint64_t addr,
+               const FdSymbolizer* sym, struct FdTokSink* toks) {
+    buf = fd_mnemonic(buf, instr, false, toks);
 
     for (int i = 0; i < 4; i++)
     {
         FdOpType op_type = FD_OP_TYPE(instr, i);
         if (op_type == FD_OT_NONE)
             break;
-        if (i > 0)
+        if (i > 0) {
             *buf++ = ',';
+            TOK(FD_TOK_PUNCT, NOOP, buf - 1);
+        }
         *buf++ = ' ';
+        char* start = buf;
 
         int size = FD_OP_SIZELG(instr, i);
 
@@ -343,9 +606,10 @@ fd_format_impl(char buf[DECLARE_RESTRICTED_ARRAY_SIZE(128)], const FdInstr* inst
             unsigned type = FD_OP_REG_TYPE(instr, i);
             unsigned idx = FD_OP_REG(instr, i);
             buf = fd_strpcatreg(buf, type, idx, size);
+            TOK(FD_TOK_REG, i, start);
         } else if (op_type == FD_OT_MEM || op_type == FD_OT_MEMBCST) {
-            unsigned idx_rt = FD_RT_GPL;
-            unsigned idx_sz = FD_ADDRSIZELG(instr);
+            unsigned idx_rt;
+            unsigned idx_sz = fd_memidx_size(instr, &idx_rt);
             switch (FD_TYPE(instr)) {
             case FDI_CMPXCHGD: size = FD_OPSIZELG(instr) + 1; break;
             case FDI_BOUND: size += 1; break;
@@ -364,48 +628,6 @@ fd_format_impl(char buf[DECLARE_RESTRICTED_ARRAY_SIZE(128)], const FdInstr* inst
             case FDI_FBSTP:
                 size = size >= 0 ? size : 9;
                 break;
-            case FDI_VPGATHERQD:
-            case FDI_VGATHERQPS:
-            case FDI_EVX_PGATHERQD:
-            case FDI_EVX_GATHERQPS:
-                idx_rt = FD_RT_VEC;
-                idx_sz = FD_OP_SIZELG(instr, 0) + 1;
-                break;
-            case FDI_EVX_PSCATTERQD:
-            case FDI_EVX_SCATTERQPS:
-                idx_rt = FD_RT_VEC;
-                idx_sz = FD_OP_SIZELG(instr, 1) + 1;
-                break;
-            case FDI_VPGATHERDQ:
-            case FDI_VGATHERDPD:
-            case FDI_EVX_PGATHERDQ:
-            case FDI_EVX_GATHERDPD:
-                idx_rt = FD_RT_VEC;
-                idx_sz = FD_OP_SIZELG(instr, 0) - 1;
-                break;
-            case FDI_EVX_PSCATTERDQ:
-            case FDI_EVX_SCATTERDPD:
-                idx_rt = FD_RT_VEC;
-                idx_sz = FD_OP_SIZELG(instr, 1) - 1;
-                break;
-            case FDI_VPGATHERDD:
-            case FDI_VPGATHERQQ:
-            case FDI_VGATHERDPS:
-            case FDI_VGATHERQPD:
-            case FDI_EVX_PGATHERDD:
-            case FDI_EVX_PGATHERQQ:
-            case FDI_EVX_GATHERDPS:
-            case FDI_EVX_GATHERQPD:
-                idx_rt = FD_RT_VEC;
-                idx_sz = FD_OP_SIZELG(instr, 0);
-                break;
-            case FDI_EVX_PSCATTERDD:
-            case FDI_EVX_PSCATTERQQ:
-            case FDI_EVX_SCATTERDPS:
-            case FDI_EVX_SCATTERQPD:
-                idx_rt = FD_RT_VEC;
-                idx_sz = FD_OP_SIZELG(instr, 1);
-                break;
             default: break;
             }
 
@@ -426,29 +648,60 @@ fd_format_impl(char buf[DECLARE_RESTRICTED_ARRAY_SIZE(128)], const FdInstr* inst
                 "\12tbyte ptr      "; // far ptr/FPU; qword + 2
             const char* ptrsize = ptrsizes + 16 * (size + 1);
             buf = fd_strpcat(buf, (struct FdStr) { ptrsize+1, *ptrsize });
+            if (*ptrsize) {
+                buf--; // without the trailing space
+                TOK(FD_TOK_SIZE, i, start);
+                buf++;
+            }
 
             unsigned seg = FD_SEGMENT(instr);
             if (seg != FD_REG_NONE) {
+                start = buf;
                 *buf++ = "ecsdfg\0"[seg & 7];
                 *buf++ = 's';
+                TOK(FD_TOK_REG, i, start);
                 *buf++ = ':';
+                TOK(FD_TOK_PUNCT, i, buf - 1);
             }
             *buf++ = '[';
+            TOK(FD_TOK_MEM_OPEN, i, buf - 1);
 
             bool has_base = FD_OP_BASE(instr, i) != FD_REG_NONE;
             bool has_idx = FD_OP_INDEX(instr, i) != FD_REG_NONE;
-            if (has_base)
+            if (has_base) {
+                start = buf;
                 buf = fd_strpcatreg(buf, FD_RT_GPL, FD_OP_BASE(instr, i), FD_ADDRSIZELG(instr));
+                TOK(FD_TOK_REG, i, start);
+            }
             if (has_idx) {
-                if (has_base)
+                if (has_base) {
                     *buf++ = '+';
+                    TOK(FD_TOK_PUNCT, i, buf - 1);
+                }
                 *buf++ = '0' + (1 << FD_OP_SCALE(instr, i));
+                TOK(FD_TOK_SCALE, i, buf - 1);
                 *buf++ = '*';
+                TOK(FD_TOK_PUNCT, i, buf - 1);
+                start = buf;
                 buf = fd_strpcatreg(buf, idx_rt, FD_OP_INDEX(instr, i), idx_sz);
+                TOK(FD_TOK_REG, i, start);
             }
             uint64_t disp = FD_OP_DISP(instr, i);
+            if (UNLIKELY(sym != NULL) && FD_OP_BASE(instr, i) == FD_REG_IP) {
+                *buf = '+';
+                char* symend = fd_strpcatsym(buf + 1, sym, fd_riptarget(instr, addr));
+                if (symend) {
+                    buf++;
+                    TOK(FD_TOK_PUNCT, i, buf - 1);
+                    start = buf;
+                    buf = symend;
+                    TOK(FD_TOK_SYMBOL, i, start);
+                    disp = 0;
+                }
+            }
             if (disp && (has_base || has_idx)) {
                 *buf++ = (int64_t) disp < 0 ? '-' : '+';
+                TOK(FD_TOK_PUNCT, i, buf - 1);
                 if ((int64_t) disp < 0)
                     disp = -disp;
             }
@@ -456,16 +709,18 @@ fd_format_impl(char buf[DECLARE_RESTRICTED_ARRAY_SIZE(128)], const FdInstr* inst
                 disp &= 0xffff;
             else if (FD_ADDRSIZELG(instr) == 2)
                 disp &= 0xffffffff;
-            if (disp || (!has_base && !has_idx))
+            if (disp || (!has_base && !has_idx)) {
+                start = buf;
                 buf = fd_strpcatnum(buf, disp);
+                TOK(FD_TOK_DISP, i, start);
+            }
             *buf++ = ']';
+            TOK(FD_TOK_MEM_CLOSE, i, buf - 1);
 
             if (UNLIKELY(op_type == FD_OT_MEMBCST)) {
-                // {1toX}, X = FD_OP_SIZE(instr, i) / BCSTSZ (=> 2/4/8/16/32)
-                unsigned bcstszidx = FD_OP_SIZELG(instr, i) - FD_OP_BCSTSZLG(instr, i) - 1;
-                const char* bcstsizes = "\6{1to2} \6{1to4} \6{1to8} \7{1to16}\7{1to32}         ";
-                const char* bcstsize = bcstsizes + bcstszidx * 8;
-                buf = fd_strpcat(buf, (struct FdStr) { bcstsize+1, *bcstsize });
+                start = buf;
+                buf = fd_strpcatbcst(buf, instr, i);
+                TOK(FD_TOK_DECORATOR, i, start);
             }
         } else if (op_type == FD_OT_IMM || op_type == FD_OT_OFF) {
             size_t immediate = FD_OP_IMM(instr, i);
@@ -477,21 +732,30 @@ fd_format_impl(char buf[DECLARE_RESTRICTED_ARRAY_SIZE(128)], const FdInstr* inst
             case FDI_SSE_EXTRQ:
             case FDI_SSE_INSERTQ:
                 buf = fd_strpcatnum(buf, immediate & 0xff);
-                buf = fd_strpcat(buf, fd_stre(", "));
+                TOK(FD_TOK_IMM, i, start);
+                *buf++ = ',';
+                TOK(FD_TOK_PUNCT, i, buf - 1);
+                *buf++ = ' ';
                 immediate = (immediate >> 8) & 0xff;
                 break;
             case FDI_ENTER:
                 buf = fd_strpcatnum(buf, immediate & 0xffff);
-                buf = fd_strpcat(buf, fd_stre(", "));
+                TOK(FD_TOK_IMM, i, start);
+                *buf++ = ',';
+                TOK(FD_TOK_PUNCT, i, buf - 1);
+                *buf++ = ' ';
                 immediate = (immediate >> 16) & 0xff;
                 break;
             case FDI_JMPF:
             case FDI_CALLF:
                 buf = fd_strpcatnum(buf, (immediate >> (8 << size)) & 0xffff);
+                TOK(FD_TOK_IMM, i, start);
                 *buf++ = ':';
+                TOK(FD_TOK_PUNCT, i, buf - 1);
                 // immediate is masked below.
                 break;
             }
+            start = buf;
 
         nosplitimm:
             if (op_type == FD_OT_OFF)
@@ -502,25 +766,222 @@ fd_format_impl(char buf[DECLARE_RESTRICTED_ARRAY_SIZE(128)], const FdInstr* inst
                 immediate &= 0xffff;
             else if (size == 2)
                 immediate &= 0xffffffff;
-            buf = fd_strpcatnum(buf, immediate);
+            char* symend = NULL;
+            if (UNLIKELY(sym != NULL) && op_type == FD_OT_OFF)
+                symend = fd_strpcatsym(buf, sym, immediate);
+            buf = symend ? symend : fd_strpcatnum(buf, immediate);
+            TOK(symend ? FD_TOK_SYMBOL : FD_TOK_IMM, i, start);
         }
 
         if (i == 0 && FD_MASKREG(instr)) {
+            start = buf;
             *buf++ = '{';
             buf = fd_strpcatreg(buf, FD_RT_MASK, FD_MASKREG(instr), 0);
             *buf++ = '}';
-            if (FD_MASKZERO(instr))
+            TOK(FD_TOK_DECORATOR, 0, start);
+            if (FD_MASKZERO(instr)) {
+                start = buf;
                 buf = fd_strpcat(buf, fd_stre("{z}"));
+                TOK(FD_TOK_DECORATOR, 0, start);
+            }
         }
     }
     if (UNLIKELY(FD_ROUNDCONTROL(instr) != FD_RC_MXCSR)) {
-        switch (FD_ROUNDCONTROL(instr)) {
-        case FD_RC_RN: buf = fd_strpcat(buf, fd_stre(", {rn-sae}")); break;
-        case FD_RC_RD: buf = fd_strpcat(buf, fd_stre(", {rd-sae}")); break;
-        case FD_RC_RU: buf = fd_strpcat(buf, fd_stre(", {ru-sae}")); break;
-        case FD_RC_RZ: buf = fd_strpcat(buf, fd_stre(", {rz-sae}")); break;
-        case FD_RC_SAE: buf = fd_strpcat(buf, fd_stre(", {sae}")); break;
-        default: break; // should not happen
+        *buf++ = ',';
+        TOK(FD_TOK_PUNCT, NOOP, buf - 1);
+        *buf++ = ' ';
+        char* start = buf;
+        buf = fd_strpcatrc(buf, instr);
+        TOK(FD_TOK_DECORATOR, NOOP, start);
+    }
+    *buf++ = '\0';
+    return buf;
+}
+
+static char*
+fd_format_att_impl(char buf[DECLARE_RESTRICTED_ARRAY_SIZE(128)], const FdInstr* instr, uint64_t addr,
+                   const FdSymbolizer* sym, struct FdTokSink* toks) {
+    buf = fd_mnemonic(buf, instr, true, toks);
+
+    char sep = ' ';
+    if (UNLIKELY(FD_ROUNDCONTROL(instr) != FD_RC_MXCSR)) {
+        *buf++ = sep;
+        char* start = buf;
+        buf = fd_strpcatrc(buf, instr);
+        TOK(FD_TOK_DECORATOR, NOOP, start);
+        sep = ',';
+    }
+
+    bool indirect = false;
+    switch (UNLIKELY(FD_TYPE(instr))) {
+    case FDI_JMP:
+    case FDI_CALL:
+    case FDI_JMPF:
+    case FDI_CALLF:
+        indirect = FD_OP_TYPE(instr, 0) == FD_OT_REG ||
+                   FD_OP_TYPE(instr, 0) == FD_OT_MEM;
+        break;
+    default: break;
+    }
+
+    int nops = 0;
+    while (nops < 4 && FD_OP_TYPE(instr, nops) != FD_OT_NONE)
+        nops++;
+
+    // Operands are written in reverse order: sources first, destination last.
+    for (int i = nops - 1; i >= 0; i--)
+    {
+        FdOpType op_type = FD_OP_TYPE(instr, i);
+        *buf++ = sep;
+        if (sep == ',')
+            TOK(FD_TOK_PUNCT, NOOP, buf - 1);
+        sep = ',';
+        if (UNLIKELY(indirect)) {
+            *buf++ = '*';
+            TOK(FD_TOK_PUNCT, i, buf - 1);
+        }
+        char* start = buf;
+
+        int size = FD_OP_SIZELG(instr, i);
+
+        if (op_type == FD_OT_REG) {
+            unsigned type = FD_OP_REG_TYPE(instr, i);
+            unsigned idx = FD_OP_REG(instr, i);
+            *buf++ = '%';
+            buf = fd_strpcatreg(buf, type, idx, size);
+            TOK(FD_TOK_REG, i, start);
+        } else if (op_type == FD_OT_MEM || op_type == FD_OT_MEMBCST) {
+            unsigned idx_rt;
+            unsigned idx_sz = fd_memidx_size(instr, &idx_rt);
+
+            unsigned seg = FD_SEGMENT(instr);
+            if (seg != FD_REG_NONE) {
+                *buf++ = '%';
+                *buf++ = "ecsdfg\0"[seg & 7];
+                *buf++ = 's';
+                TOK(FD_TOK_REG, i, start);
+                *buf++ = ':';
+                TOK(FD_TOK_PUNCT, i, buf - 1);
+            }
+
+            bool has_base = FD_OP_BASE(instr, i) != FD_REG_NONE;
+            bool has_idx = FD_OP_INDEX(instr, i) != FD_REG_NONE;
+            uint64_t disp = FD_OP_DISP(instr, i);
+            char* symend = NULL;
+            if (UNLIKELY(sym != NULL) && FD_OP_BASE(instr, i) == FD_REG_IP)
+                symend = fd_strpcatsym(buf, sym, fd_riptarget(instr, addr));
+            start = buf;
+            if (symend) {
+                buf = symend;
+                TOK(FD_TOK_SYMBOL, i, start);
+            } else {
+                if ((has_base || has_idx) && (int64_t) disp < 0) {
+                    *buf++ = '-';
+                    TOK(FD_TOK_PUNCT, i, start);
+                    start = buf;
+                    disp = -disp;
+                }
+                if (FD_ADDRSIZELG(instr) == 1)
+                    disp &= 0xffff;
+                else if (FD_ADDRSIZELG(instr) == 2)
+                    disp &= 0xffffffff;
+                // Like objdump, write a zero displacement without base register.
+                if (disp || !has_base) {
+                    buf = fd_strpcatnum(buf, disp);
+                    TOK(FD_TOK_DISP, i, start);
+                }
+            }
+
+            if (has_base || has_idx) {
+                *buf++ = '(';
+                TOK(FD_TOK_MEM_OPEN, i, buf - 1);
+                if (has_base) {
+                    start = buf;
+                    *buf++ = '%';
+                    buf = fd_strpcatreg(buf, FD_RT_GPL, FD_OP_BASE(instr, i), FD_ADDRSIZELG(instr));
+                    TOK(FD_TOK_REG, i, start);
+                }
+                if (has_idx) {
+                    *buf++ = ',';
+                    TOK(FD_TOK_PUNCT, i, buf - 1);
+                    start = buf;
+                    *buf++ = '%';
+                    buf = fd_strpcatreg(buf, idx_rt, FD_OP_INDEX(instr, i), idx_sz);
+                    TOK(FD_TOK_REG, i, start);
+                    *buf++ = ',';
+                    TOK(FD_TOK_PUNCT, i, buf - 1);
+                    *buf++ = '0' + (1 << FD_OP_SCALE(instr, i));
+                    TOK(FD_TOK_SCALE, i, buf - 1);
+                }
+                *buf++ = ')';
+                TOK(FD_TOK_MEM_CLOSE, i, buf - 1);
+            }
+
+            if (UNLIKELY(op_type == FD_OT_MEMBCST)) {
+                start = buf;
+                buf = fd_strpcatbcst(buf, instr, i);
+                TOK(FD_TOK_DECORATOR, i, start);
+            }
+        } else if (op_type == FD_OT_IMM || op_type == FD_OT_OFF) {
+            size_t immediate = FD_OP_IMM(instr, i);
+            // Split combined immediates; unlike other operands, their order is
+            // the same as in Intel syntax except for EXTRQ/INSERTQ.
+            switch (FD_TYPE(instr)) {
+            default:
+                goto nosplitimm;
+            case FDI_SSE_EXTRQ:
+            case FDI_SSE_INSERTQ:
+                *buf++ = '$';
+                buf = fd_strpcatnum(buf, (immediate >> 8) & 0xff);
+                immediate &= 0xff;
+                break;
+            case FDI_ENTER:
+                *buf++ = '$';
+                buf = fd_strpcatnum(buf, immediate & 0xffff);
+                immediate = (immediate >> 16) & 0xff;
+                break;
+            case FDI_JMPF:
+            case FDI_CALLF:
+                *buf++ = '$';
+                buf = fd_strpcatnum(buf, (immediate >> (8 << size)) & 0xffff);
+                // immediate is masked below.
+                break;
+            }
+            TOK(FD_TOK_IMM, i, start);
+            *buf++ = ',';
+            TOK(FD_TOK_PUNCT, i, buf - 1);
+            start = buf;
+
+        nosplitimm:
+            if (op_type == FD_OT_OFF)
+                immediate += addr + FD_SIZE(instr);
+            else
+                *buf++ = '$';
+            if (size == 0)
+                immediate &= 0xff;
+            else if (size == 1)
+                immediate &= 0xffff;
+            else if (size == 2)
+                immediate &= 0xffffffff;
+            char* symend = NULL;
+            if (UNLIKELY(sym != NULL) && op_type == FD_OT_OFF)
+                symend = fd_strpcatsym(buf, sym, immediate);
+            buf = symend ? symend : fd_strpcatnum(buf, immediate);
+            TOK(symend ? FD_TOK_SYMBOL : FD_TOK_IMM, i, start);
+        }
+
+        if (i == 0 && FD_MASKREG(instr)) {
+            start = buf;
+            *buf++ = '{';
+            *buf++ = '%';
+            buf = fd_strpcatreg(buf, FD_RT_MASK, FD_MASKREG(instr), 0);
+            *buf++ = '}';
+            TOK(FD_TOK_DECORATOR, 0, start);
+            if (FD_MASKZERO(instr)) {
+                start = buf;
+                buf = fd_strpcat(buf, fd_stre("{z}"));
+                TOK(FD_TOK_DECORATOR, 0, start);
+            }
         }
     }
     *buf++ = '\0';
@@ -533,22 +994,167 @@ fd_format(const FdInstr* instr, char* buffer, size_t len)
     fd_format_abs(instr, 0, buffer, len);
 }
 
-void
-fd_format_abs(const FdInstr* instr, uint64_t addr, char* restrict buffer, size_t len) {
-    char tmp[128];
+// Returns the length of the formatted text in buffer.
+static size_t
+fd_format_buf(const FdInstr* instr, uint64_t addr, char* restrict buffer,
+              size_t len, bool att, const FdSymbolizer* sym,
+              struct FdTokSink* toks) {
+    char tmp[FD_FORMAT_SYM_MAX];
     char* buf = buffer;
-    if (UNLIKELY(len < 128)) {
+    if (UNLIKELY(len < (sym ? FD_FORMAT_SYM_MAX : 128))) {
         if (!len)
-            return;
+            return 0;
         buf = tmp;
     }
+    if (UNLIKELY(toks != NULL))
+        toks->base = buf;
 
-    char* end = fd_format_impl(buf, instr, addr);
+    char* end = att ? fd_format_att_impl(buf, instr, addr, sym, toks)
+                    : fd_format_impl(buf, instr, addr, sym, toks);
 
     if (buf != buffer) {
         unsigned i;
         for (i = 0; i < (end - tmp) && i < len-1; i++)
             buffer[i] = tmp[i];
         buffer[i] = '\0';
+        return i;
+    }
+    return end - buf - 1;
+}
+
+void
+fd_format_abs(const FdInstr* instr, uint64_t addr, char* restrict buffer, size_t len) {
+    fd_format_buf(instr, addr, buffer, len, false, NULL, NULL);
+}
+
+void
+fd_format_att(const FdInstr* instr, uint64_t addr, char* restrict buffer, size_t len) {
+    fd_format_buf(instr, addr, buffer, len, true, NULL, NULL);
+}
+
+void
+fd_format_sym(const FdInstr* instr, uint64_t addr, const FdSymbolizer* sym,
+              unsigned flags, char* restrict buffer, size_t len) {
+    fd_format_buf(instr, addr, buffer, len, flags & FD_FORMAT_ATT, sym, NULL);
+}
+
+size_t
+fd_format_tokens(const FdInstr* instr, uint64_t addr, const FdSymbolizer* sym,
+                 unsigned flags, char* restrict buffer, size_t len,
+                 FdToken* toks, size_t cap) {
+    struct FdTokSink sink = { toks, 0, cap, buffer };
+    size_t textlen = fd_format_buf(instr, addr, buffer, len,
+                                   flags & FD_FORMAT_ATT, sym, &sink);
+
+    // Clip tokens to the possibly truncated text; drop those outside.
+    size_t stored = sink.count < cap ? sink.count : cap;
+    size_t count = 0;
+    for (size_t i = 0; i < stored; i++) {
+        if (toks[i].offset >= textlen)
+            break;
+        toks[count] = toks[i];
+        if (toks[count].offset + toks[count].length > textlen)
+            toks[count].length = textlen - toks[count].offset;
+        count++;
+    }
+    return count < stored ? count : sink.count;
+}
+
+// Bytes shown per line of a listing; longer instructions continue on the
+// next line, as in objdump.
+#define LISTING_BYTES 8
+
+// Write an address right-aligned in a field of width hex digits.
+static char*
+fd_strpcataddr(char* restrict dst, uint64_t addr, unsigned width) {
+    unsigned digits = 16 - fd_clz64(addr|1) / 4;
+    fd_strhex16(dst, addr << (64 - 4 * width));
+    for (unsigned i = digits; i < width; i++)
+        dst[width - 1 - i] = ' ';
+    dst[width] = ':';
+    dst[width + 1] = ' ';
+    return dst + width + 2;
+}
+
+// Write up to LISTING_BYTES bytes as "xx xx ..."; pad is the column width.
+static char*
+fd_strpcatbytes(char* restrict dst, const uint8_t* bytes, unsigned len,
+                unsigned pad) {
+    uint64_t val = 0;
+    for (unsigned i = 0; i < len; i++)
+        val |= (uint64_t) bytes[i] << (56 - 8 * i);
+    char hex[16];
+    fd_strhex16(hex, val);
+    for (unsigned i = 0; i < LISTING_BYTES; i++) {
+        dst[3 * i] = hex[2 * i];
+        dst[3 * i + 1] = hex[2 * i + 1];
+        dst[3 * i + 2] = ' ';
+    }
+    for (unsigned i = len * 3; i < pad; i++)
+        dst[i] = ' ';
+    return dst + (len * 3 > pad ? len * 3 : pad);
+}
+
+// Write the listing lines of one instruction, at most FD_LISTING_LINE_MAX bytes.
+static char*
+fd_format_listing_line(char* restrict buf, const FdInstr* instr, uint64_t addr,
+                       const uint8_t* bytes, unsigned width, unsigned flags) {
+    bool show_addr = !(flags & FD_LISTING_NO_ADDR);
+    bool show_bytes = bytes && !(flags & FD_LISTING_NO_BYTES);
+    unsigned size = FD_SIZE(instr);
+    unsigned first = size < LISTING_BYTES ? size : LISTING_BYTES;
+
+    if (show_addr)
+        buf = fd_strpcataddr(buf, addr, width);
+    if (show_bytes)
+        buf = fd_strpcatbytes(buf, bytes, first, 3 * LISTING_BYTES);
+    if (flags & FD_LISTING_ATT)
+        buf = fd_format_att_impl(buf, instr, addr, NULL, NULL) - 1;
+    else
+        buf = fd_format_impl(buf, instr, addr, NULL, NULL) - 1;
+    *buf++ = '\n';
+    for (unsigned off = first; show_bytes && off < size; off += LISTING_BYTES) {
+        unsigned len = size - off < LISTING_BYTES ? size - off : LISTING_BYTES;
+        if (show_addr)
+            buf = fd_strpcataddr(buf, addr + off, width);
+        // Replace the trailing space with the line break.
+        buf = fd_strpcatbytes(buf, bytes + off, len, 0) - 1;
+        *buf++ = '\n';
+    }
+    return buf;
+}
+
+size_t
+fd_format_listing(const FdInstr* instrs, size_t count, uint64_t base_addr,
+                  const uint8_t* bytes, char* restrict out, size_t cap,
+                  unsigned flags) {
+    // All addresses are aligned to the width of the largest one.
+    uint64_t end_addr = base_addr;
+    for (size_t i = 0; i < count; i++)
+        end_addr += FD_SIZE(&instrs[i]);
+    unsigned width = 16 - fd_clz64((end_addr - 1)|1) / 4;
+
+    char* buf = out;
+    uint64_t addr = base_addr;
+    for (size_t i = 0; i < count; i++) {
+        size_t avail = out + cap - buf;
+        if (LIKELY(avail >= FD_LISTING_LINE_MAX)) {
+            buf = fd_format_listing_line(buf, &instrs[i], addr, bytes, width,
+                                         flags);
+        } else {
+            // Near the end of the buffer, only copy complete lines.
+            char tmp[FD_LISTING_LINE_MAX];
+            size_t len = fd_format_listing_line(tmp, &instrs[i], addr, bytes,
+                                                width, flags) - tmp;
+            if (len > avail)
+                break;
+            for (size_t j = 0; j < len; j++)
+                buf[j] = tmp[j];
+            buf += len;
+        }
+        addr += FD_SIZE(&instrs[i]);
+        if (bytes)
+            bytes += FD_SIZE(&instrs[i]);
     }
+    return buf - out;
 }
@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fadec.h>
+#include <fadec-analysis.h>
+
+#include "tools-common.h"
+
+
+#define CHUNK_SIZE (64 << 10)
+
+struct Cands {
+    FdFuncCand* data;
+    size_t len;
+    size_t cap;
+};
+
+struct Job {
+    struct Binary* bin;
+    FdSweep* sweeps; // one per section
+    bool scan;
+    // Scan phase: chunk (section, index) pairs are taken in order.
+    atomic_size_t next;
+    size_t nchunks;
+    struct Cands* cands; // one per worker
+};
+
+static void
+cands_reserve(struct Cands* cands, size_t len) {
+    if (cands->cap - cands->len >= len)
+        return;
+    size_t cap = cands->cap ? cands->cap : 1 << 12;
+    while (cap - cands->len < len)
+        cap *= 2;
+    cands->data = xrealloc(cands->data, cap * sizeof *cands->data);
+    cands->cap = cap;
+}
+
+static void
+worker(void* arg, unsigned id) {
+    struct Job* job = arg;
+    struct Binary* bin = job->bin;
+    if (!job->scan) {
+        for (size_t i = 0; i < bin->nsections; i++)
+            fd_sweep_run(&job->sweeps[i], id);
+        return;
+    }
+
+    // Chunks are numbered consecutively across the sections.
+    struct Cands* cands = &job->cands[id];
+    size_t sec = 0, first = 0;
+    for (;;) {
+        size_t idx = atomic_fetch_add(&job->next, 1);
+        if (idx >= job->nchunks)
+            break;
+        while (idx - first >= job->sweeps[sec].nchunks)
+            first += job->sweeps[sec++].nchunks;
+        const struct Section* s = &bin->sections[sec];
+        const FdSweepChunk* chunk = &job->sweeps[sec].chunks[idx - first];
+        for (;;) {
+            size_t avail = cands->cap - cands->len;
+            size_t n = fd_func_scan(s->code, s->size, s->addr, bin->mode,
+                                    chunk->entry, chunk->exit,
+                                    cands->data + cands->len, avail);
+            if (n <= avail) {
+                cands->len += n;
+                break;
+            }
+            cands_reserve(cands, n);
+        }
+    }
+}
+
+static int
+cmp_sym(const void* a, const void* b) {
+    const FdSymbol* sa = a;
+    const FdSymbol* sb = b;
+    return sa->addr < sb->addr ? -1 : sa->addr > sb->addr;
+}
+
+// Find the function starts of a binary; returns the number of entries, which
+// are stored in *out.
+static size_t
+binary_entries(struct Binary* bin, unsigned nworkers, bool stats,
+               FdFuncCand** out) {
+    uint64_t t0 = now_ns();
+    uint64_t* queues = xrealloc(NULL, (bin->nsections * nworkers + 1) *
+                                      sizeof *queues);
+    struct Job job = { .bin = bin };
+    job.sweeps = xrealloc(NULL, (bin->nsections + 1) * sizeof *job.sweeps);
+    atomic_init(&job.next, 0);
+    for (size_t i = 0; i < bin->nsections; i++) {
+        const struct Section* s = &bin->sections[i];
+        size_t nchunks = FD_SWEEP_CHUNKS(s->size, CHUNK_SIZE);
+        fd_sweep_init(&job.sweeps[i], s->code, s->size, bin->mode, CHUNK_SIZE,
+                      xrealloc(NULL, (s->size + 7) / 8),
+                      xrealloc(NULL, nchunks * sizeof(FdSweepChunk)),
+                      queues + i * nworkers, nworkers);
+        job.nchunks += nchunks;
+    }
+
+    job.cands = calloc(nworkers, sizeof *job.cands);
+    if (!job.cands) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    run_workers(nworkers, worker, &job);
+    for (size_t i = 0; i < bin->nsections; i++)
+        fd_sweep_resolve(&job.sweeps[i]);
+    uint64_t t1 = now_ns();
+    job.scan = true;
+    run_workers(nworkers, worker, &job);
+    uint64_t t2 = now_ns();
+
+    // Merge the candidates of all workers with the FDE starts in the
+    // scanned sections.
+    size_t total = 0;
+    for (unsigned i = 0; i < nworkers; i++)
+        total += job.cands[i].len;
+    size_t nfdes = fd_elf_eh_frame(bin->map, bin->map_size, NULL, 0);
+    FdSymbol* fdes = xrealloc(NULL, (nfdes + 1) * sizeof *fdes);
+    fd_elf_eh_frame(bin->map, bin->map_size, fdes, nfdes);
+    qsort(fdes, nfdes, sizeof *fdes, cmp_sym);
+    FdFuncCand* cands = xrealloc(NULL, (total + nfdes + 1) * sizeof *cands);
+    size_t count = 0;
+    for (size_t i = 0; i < nfdes; i++) {
+        for (size_t j = 0; j < bin->nsections; j++) {
+            const struct Section* s = &bin->sections[j];
+            if (fdes[i].addr - s->addr < s->size) {
+                cands[count++] = (FdFuncCand) {
+                    .addr = fdes[i].addr, .sources = FD_FUNC_EH_FRAME,
+                };
+                break;
+            }
+        }
+    }
+    for (unsigned i = 0; i < nworkers; i++) {
+        memcpy(cands + count, job.cands[i].data,
+               job.cands[i].len * sizeof *cands);
+        count += job.cands[i].len;
+        free(job.cands[i].data);
+    }
+    count = fd_func_reconcile(cands, count, fdes, nfdes);
+    uint64_t t3 = now_ns();
+
+    if (stats) {
+        size_t code = 0;
+        for (size_t i = 0; i < bin->nsections; i++)
+            code += bin->sections[i].size;
+        fprintf(stderr, "%s: %zu code bytes, %zu candidates, %zu entries; "
+                "sweep %.3f s, scan %.3f s, reconcile %.3f s, %u threads\n",
+                bin->path, code, total + nfdes, count, (t1 - t0) / 1e9,
+                (t2 - t1) / 1e9, (t3 - t2) / 1e9, nworkers);
+    }
+
+    for (size_t i = 0; i < bin->nsections; i++) {
+        free(job.sweeps[i].starts);
+        free(job.sweeps[i].chunks);
+    }
+    free(fdes);
+    free(job.cands);
+    free(job.sweeps);
+    free(queues);
+    *out = cands;
+    return count;
+}
+
+static int
+cmp_u64(const void* a, const void* b) {
+    uint64_t ua = *(const uint64_t*) a, ub = *(const uint64_t*) b;
+    return ua < ub ? -1 : ua > ub;
+}
+
+// Compare the entries with the sized symbols of a reference file, e.g. the
+// unstripped copy, within the scanned sections.
+static bool
+evaluate(const struct Binary* bin, const char* ref_path,
+         const FdFuncCand* entries, size_t count) {
+    struct Binary ref;
+    if (!binary_load(&ref, ref_path))
+        return false;
+    size_t nsyms = fd_elf_symbols(ref.map, ref.map_size, NULL, 0);
+    FdSymbol* syms = xrealloc(NULL, (nsyms + 1) * sizeof *syms);
+    fd_elf_symbols(ref.map, ref.map_size, syms, nsyms);
+    uint64_t* funcs = xrealloc(NULL, (nsyms + 1) * sizeof *funcs);
+    size_t nfuncs = 0;
+    for (size_t i = 0; i < nsyms; i++) {
+        if (!syms[i].size)
+            continue;
+        for (size_t j = 0; j < bin->nsections; j++) {
+            const struct Section* s = &bin->sections[j];
+            if (syms[i].addr - s->addr < s->size) {
+                funcs[nfuncs++] = syms[i].addr;
+                break;
+            }
+        }
+    }
+    qsort(funcs, nfuncs, sizeof *funcs, cmp_u64);
+    size_t unique = 0;
+    for (size_t i = 0; i < nfuncs; i++)
+        if (!unique || funcs[i] != funcs[unique - 1])
+            funcs[unique++] = funcs[i];
+    nfuncs = unique;
+
+    // Matches per evidence bit, to judge the sources separately.
+    size_t found[8] = {0}, correct[8] = {0};
+    size_t hits = 0;
+    for (size_t i = 0, j = 0; i < count; i++) {
+        uint64_t addr = entries[i].addr;
+        while (j < nfuncs && funcs[j] < addr)
+            j++;
+        bool hit = j < nfuncs && funcs[j] == addr;
+        hits += hit;
+        for (unsigned bit = 0; bit < 8; bit++) {
+            if (entries[i].sources >> bit & 1) {
+                found[bit]++;
+                correct[bit] += hit;
+            }
+        }
+    }
+
+    printf("%s: %zu entries, %zu functions in %s, %zu correct, "
+           "precision %.2f%%, recall %.2f%%\n", bin->path, count, nfuncs,
+           ref_path, hits, count ? 100.0 * hits / count : 100.0,
+           nfuncs ? 100.0 * hits / nfuncs : 100.0);
+    static const char* const names[] = {
+        "call", "endbr", "prologue", "gap", "padded", "eh_frame",
+    };
+    for (unsigned bit = 0; bit < sizeof names / sizeof names[0]; bit++)
+        printf("  %-9s %8zu entries, %8zu correct\n", names[bit],
+               found[bit], correct[bit]);
+
+    free(funcs);
+    free(syms);
+    binary_unload(&ref);
+    return true;
+}
+
+static void
+usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-j threads] [-r reference] [-q] [-t] file\n"
+                    "  -j  number of threads (default: number of CPUs)\n"
+                    "  -r  compare with the symbols of an unstripped copy\n"
+                    "  -q  do not list the entries\n"
+                    "  -t  print timing statistics to stderr\n"
+                    "Lists the function starts in the executable sections of "
+                    "an x86 ELF file\nwithout using its symbols, with the "
+                    "evidence: c=call, b=endbr, p=prologue,\ng=gap after "
+                    "jump or return, a=after padding, e=eh_frame.\n", prog);
+}
+
+int
+main(int argc, char** argv) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nworkers = ncpus > 0 ? ncpus : 1;
+    const char* ref = NULL;
+    bool list = true, stats = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:r:qth")) != -1) {
+        switch (opt) {
+        case 'j': nworkers = strtoul(optarg, NULL, 0); break;
+        case 'r': ref = optarg; break;
+        case 'q': list = false; break;
+        case 't': stats = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind + 1 != argc || nworkers == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct Binary bin;
+    if (!binary_load(&bin, argv[optind]))
+        return EXIT_FAILURE;
+    // PLT stubs are no functions of the binary itself.
+    size_t nsections = 0;
+    for (size_t i = 0; i < bin.nsections; i++)
+        if (strncmp(bin.sections[i].name, ".plt", 4))
+            bin.sections[nsections++] = bin.sections[i];
+    bin.nsections = nsections;
+    FdFuncCand* entries;
+    size_t count = binary_entries(&bin, nworkers, stats, &entries);
+    if (list) {
+        static const char letters[] = "cbpgae";
+        for (size_t i = 0; i < count; i++) {
+            char evidence[sizeof letters];
+            for (unsigned bit = 0; bit < sizeof letters - 1; bit++)
+                evidence[bit] = entries[i].sources >> bit & 1 ? letters[bit] :
+                                '-';
+            evidence[sizeof letters - 1] = '\0';
+            printf("%016" PRIx64 " %s\n", entries[i].addr, evidence);
+        }
+    }
+    int ret = EXIT_SUCCESS;
+    if (ref && !evaluate(&bin, ref, entries, count))
+        ret = EXIT_FAILURE;
+    free(entries);
+    binary_unload(&bin);
+    return ret;
+}
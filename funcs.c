@@ -0,0 +1,184 @@
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fadec.h>
+#include <fadec-analysis.h>
+
+
+static size_t
+cand_add(FdFuncCand* out, size_t cap, size_t total, uint64_t addr,
+         unsigned sources) {
+    if (total < cap)
+        out[total] = (FdFuncCand) { .addr = addr, .sources = sources };
+    return total + 1;
+}
+
+static bool
+is_reg(const FdInstr* instr, unsigned idx, FdReg reg, int size) {
+    return FD_OP_TYPE(instr, idx) == FD_OT_REG && FD_OP_REG(instr, idx) == reg &&
+           FD_OP_REG_TYPE(instr, idx) == FD_RT_GPL &&
+           FD_OP_SIZE(instr, idx) == size;
+}
+
+// Whether a call of the given size ends at off. Looking back instead of
+// remembering the previous instruction keeps chunks independent.
+static bool
+call_before(const uint8_t* buf, size_t off, int mode, unsigned size) {
+    FdInstr instr;
+    if (off < size ||
+        fd_decode(buf + off - size, size, mode, 0, &instr) != (int) size)
+        return false;
+    FdCfKind kind = fd_cf_kind(&instr);
+    return kind == FD_CF_CALL || kind == FD_CF_CALL_IND;
+}
+
+static bool
+endbr_before(const uint8_t* buf, size_t off) {
+    return off >= 4 && buf[off - 4] == 0xf3 && buf[off - 3] == 0x0f &&
+           buf[off - 2] == 0x1e && (buf[off - 1] & 0xfe) == 0xfa;
+}
+
+size_t
+fd_func_scan(const uint8_t* buf, size_t len, uint64_t base, int mode,
+             size_t start, size_t end, FdFuncCand* out, size_t cap) {
+    int ptr_size = mode == 64 ? 8 : 4;
+    size_t total = 0;
+    // After an instruction which does not continue with the next one, the
+    // next instruction which is no padding is a candidate.
+    bool gap = start == 0;
+    bool padded = start == 0;
+    // Address of the prologue if the previous instruction was push rbp.
+    uint64_t prologue = 0;
+    bool after_push = false;
+
+    size_t off = start;
+    while (off < len && (off < end || gap || after_push)) {
+        FdInstr instr;
+        int ret = fd_decode(buf + off, len - off, mode, 0, &instr);
+        if (ret < 0) {
+            off++;
+            gap = after_push = false;
+            continue;
+        }
+        size_t cur = off;
+        uint64_t addr = base + off;
+        off += ret;
+
+        FdInstrType type = FD_TYPE(&instr);
+        if (type == FDI_NOP || type == FDI_INT3) {
+            padded = gap;
+            after_push = false;
+            continue;
+        }
+        if (gap) {
+            total = cand_add(out, cap, total, addr,
+                             FD_FUNC_GAP | (padded ? FD_FUNC_PADDED : 0));
+            gap = padded = false;
+        }
+        if (after_push && type == FDI_MOV &&
+            is_reg(&instr, 0, FD_REG_BP, ptr_size) &&
+            is_reg(&instr, 1, FD_REG_SP, ptr_size))
+            total = cand_add(out, cap, total, prologue, FD_FUNC_PROLOGUE);
+        // After the end, only the pending candidates are completed.
+        if (cur >= end)
+            break;
+
+        after_push = type == FDI_PUSH && is_reg(&instr, 0, FD_REG_BP, ptr_size);
+        if (after_push)
+            prologue = endbr_before(buf, cur) ? addr - 4 : addr;
+
+        // Returns-twice functions like setjmp return to an ENDBR. Direct
+        // calls have 5 bytes, or 6 with a BND prefix or through the GOT.
+        if ((type == FDI_ENDBR64 || type == FDI_ENDBR32) &&
+            !call_before(buf, cur, mode, 5) && !call_before(buf, cur, mode, 6))
+            total = cand_add(out, cap, total, addr, FD_FUNC_ENDBR);
+
+        FdCfKind kind = fd_cf_kind(&instr);
+        switch (kind) {
+        case FD_CF_CALL: {
+            // A call to the next instruction only obtains the address.
+            uint64_t target = fd_branch_target(&instr, addr);
+            if (target != addr + ret && target - base < len)
+                total = cand_add(out, cap, total, target, FD_FUNC_CALL);
+            break;
+        }
+        case FD_CF_JMP:
+        case FD_CF_JCC:
+        case FD_CF_LOOP: {
+            uint64_t target = fd_branch_target(&instr, addr);
+            if (target - base < len)
+                total = cand_add(out, cap, total, target, FD_FUNC_JUMP);
+            gap = kind == FD_CF_JMP;
+            break;
+        }
+        case FD_CF_JMP_IND:
+        case FD_CF_RET:
+        case FD_CF_FAR:
+        case FD_CF_TRAP:
+            gap = true;
+            break;
+        default:
+            gap = type == FDI_HLT;
+            break;
+        }
+    }
+    return total;
+}
+
+static void
+cand_sift_down(FdFuncCand* cands, size_t root, size_t count) {
+    FdFuncCand tmp = cands[root];
+    for (size_t child; (child = 2 * root + 1) < count; root = child) {
+        if (child + 1 < count && cands[child].addr < cands[child + 1].addr)
+            child++;
+        if (tmp.addr >= cands[child].addr)
+            break;
+        cands[root] = cands[child];
+    }
+    cands[root] = tmp;
+}
+
+size_t
+fd_func_reconcile(FdFuncCand* cands, size_t count, const FdSymbol* known,
+                  size_t nknown) {
+    // Heapsort, as the candidates of the chunks are not sorted and no
+    // scratch memory is available.
+    for (size_t i = count / 2; i-- > 0; )
+        cand_sift_down(cands, i, count);
+    for (size_t i = count; i-- > 1; ) {
+        FdFuncCand tmp = cands[0];
+        cands[0] = cands[i];
+        cands[i] = tmp;
+        cand_sift_down(cands, 0, i);
+    }
+
+    size_t kept = 0;
+    size_t k = 0;
+    uint64_t known_end = 0; // end of the known functions before addr
+    for (size_t i = 0; i < count; ) {
+        uint64_t addr = cands[i].addr;
+        unsigned sources = 0;
+        for (; i < count && cands[i].addr == addr; i++)
+            sources |= cands[i].sources;
+        for (; k < nknown && known[k].addr < addr; k++)
+            if (known[k].addr + known[k].size > known_end)
+                known_end = known[k].addr + known[k].size;
+
+        // Code after a jump or return is often the rest of the same
+        // function, aligned as branch target; then it is also reached by a
+        // jump or lies inside the function. Otherwise, functions start after
+        // padding or aligned. With shrink-wrapping, the frame setup may be
+        // in the middle of a function, too.
+        bool inside = addr < known_end;
+        bool likely = sources & (FD_FUNC_CALL | FD_FUNC_ENDBR |
+                                 FD_FUNC_EH_FRAME | FD_FUNC_SYMBOL);
+        bool prologue = (sources & FD_FUNC_PROLOGUE) && !inside;
+        bool gap = (sources & FD_FUNC_GAP) && !(sources & FD_FUNC_JUMP) &&
+                   !inside && ((sources & FD_FUNC_PADDED) || addr % 16 == 0);
+        if (likely || prologue || gap)
+            cands[kept++] = (FdFuncCand) { .addr = addr, .sources = sources };
+    }
+    return kept;
+}
@@ -0,0 +1,463 @@
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fadec.h>
+#include <fadec-analysis.h>
+#include <fadec-index.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t) 7)
+
+// Up to 15 bytes before an address may start the instruction containing it.
+#define MAX_INSTR_SIZE 15
+
+static uint64_t
+words_count(uint64_t size) {
+    return (size + 63) / 64;
+}
+
+static uint64_t
+ranks_count(uint64_t size) {
+    return size / 512 + 1;
+}
+
+static unsigned
+fd_popcount64(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(v);
+#else
+    unsigned count = 0;
+    for (; v; v &= v - 1)
+        count++;
+    return count;
+#endif
+}
+
+// Index of the lowest set bit; v must not be zero.
+static unsigned
+fd_ctz64(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(v);
+#elif defined(_MSC_VER) && INTPTR_MAX == INT64_MAX
+    unsigned long index;
+    _BitScanForward64(&index, v);
+    return index;
+#else
+    unsigned index = 0;
+    for (; !(v & 1); v >>= 1)
+        index++;
+    return index;
+#endif
+}
+
+// Number of instruction starts before offset off.
+static uint64_t
+starts_rank(const uint64_t* words, const uint64_t* ranks, uint64_t off) {
+    uint64_t rank = ranks[off / 512];
+    for (uint64_t w = off / 512 * 8; w < off / 64; w++)
+        rank += fd_popcount64(words[w]);
+    if (off % 64)
+        rank += fd_popcount64(words[off / 64] &
+                              (((uint64_t) 1 << off % 64) - 1));
+    return rank;
+}
+
+static bool
+starts_test(const uint64_t* words, uint64_t off) {
+    return (words[off / 64] >> off % 64) & 1;
+}
+
+// Whether a reference is stored relative to its source.
+static bool
+ref_near(const FdXref* ref) {
+    int64_t rel = (int64_t) (ref->to - ref->from);
+    return rel >= INT32_MIN && rel <= INT32_MAX;
+}
+
+size_t
+fd_index_init(void* out, size_t cap, const uint8_t* build_id,
+              size_t build_id_len, const FdIndexInput* secs, size_t nsecs) {
+    if (build_id_len > sizeof ((FdIndexHeader*) 0)->build_id)
+        return 0;
+    if ((uintptr_t) out % 8)
+        return 0;
+    for (size_t i = 0; i < nsecs; i++) {
+        if (secs[i].mode != 32 && secs[i].mode != 64)
+            return 0;
+        if (i && secs[i].addr - secs[i - 1].addr < secs[i - 1].size)
+            return 0;
+        if (i && secs[i].addr < secs[i - 1].addr)
+            return 0;
+    }
+
+    // First pass for the size, second pass writes if it fits. The buffer and
+    // all offsets are aligned to eight bytes, which the casts below rely on.
+    uint8_t* file = out;
+    uint64_t size = 0;
+    for (int write = 0; write < 2; write++) {
+        if (write && size > cap)
+            break;
+        uint64_t pos = sizeof(FdIndexHeader);
+        FdIndexSection* tab = NULL;
+        if (write) {
+            tab = (FdIndexSection*) (void*) (file + pos);
+            FdIndexHeader* hdr = out;
+            hdr->magic = FD_INDEX_MAGIC;
+            hdr->version = FD_INDEX_VERSION;
+            hdr->nsections = nsecs;
+            hdr->table_hash = fd_table_hash();
+            hdr->size = size;
+            hdr->build_id_len = build_id_len;
+            for (size_t j = 0; j < sizeof hdr->build_id; j++)
+                hdr->build_id[j] = j < build_id_len ? build_id[j] : 0;
+            hdr->sections = pos;
+        }
+        pos += nsecs * sizeof(FdIndexSection);
+
+        for (size_t i = 0; i < nsecs; i++) {
+            const FdIndexInput* in = &secs[i];
+            const FdXrefIndex* xrefs = in->xrefs;
+            FdIndexSection sec = {0};
+            for (size_t j = 0; j < sizeof sec.name - 1 && in->name[j]; j++)
+                sec.name[j] = in->name[j];
+            sec.addr = in->addr;
+            sec.size = in->size;
+            sec.mode = in->mode;
+            for (size_t j = 0; j < in->size / 8; j++)
+                sec.ninstrs += fd_popcount64(in->starts[j]);
+            if (in->size % 8)
+                sec.ninstrs += fd_popcount64(in->starts[in->size / 8] &
+                                             ((1u << in->size % 8) - 1));
+            sec.ntargets = xrefs ? xrefs->ntargets : 0;
+            sec.nsources = xrefs ? xrefs->count : 0;
+            for (size_t j = 0; j < sec.nsources; j++)
+                sec.nfars += !ref_near(&xrefs->refs[j]);
+            sec.nfuncs = in->nfuncs;
+
+            sec.starts = pos;
+            pos += 8 * words_count(sec.size);
+            sec.ranks = pos;
+            pos += 8 * ranks_count(sec.size);
+            sec.records = pos;
+            pos += sizeof(FdIndexRecord) * sec.ninstrs;
+            sec.targets = pos;
+            pos += 8 * sec.ntargets;
+            sec.first = pos;
+            pos += 8 * (sec.ntargets + 1);
+            sec.sources = pos;
+            pos += 8 * sec.nsources;
+            sec.fars = pos;
+            pos += sizeof(FdXref) * sec.nfars;
+            sec.funcs = pos;
+            pos += sizeof(FdIndexFunc) * sec.nfuncs;
+            if (!write)
+                continue;
+
+            tab[i] = sec;
+            uint8_t* starts = file + sec.starts;
+            for (size_t j = 0; j < 8 * words_count(sec.size); j++)
+                starts[j] = j < (in->size + 7) / 8 ? in->starts[j] : 0;
+            // Bits beyond the section are cleared.
+            if (sec.size % 8)
+                starts[sec.size / 8] &= (1u << sec.size % 8) - 1;
+            uint64_t* ranks = (uint64_t*) (void*) (file + sec.ranks);
+            const uint64_t* words = (const uint64_t*) (const void*) starts;
+            ranks[0] = 0;
+            for (size_t j = 1; j < ranks_count(sec.size); j++) {
+                ranks[j] = ranks[j - 1];
+                for (size_t w = 8 * (j - 1); w < 8 * j &&
+                     w < words_count(sec.size); w++)
+                    ranks[j] += fd_popcount64(words[w]);
+            }
+
+            uint64_t* targets = (uint64_t*) (void*) (file + sec.targets);
+            uint64_t* first = (uint64_t*) (void*) (file + sec.first);
+            uint64_t* sources = (uint64_t*) (void*) (file + sec.sources);
+            FdXref* fars = (FdXref*) (void*) (file + sec.fars);
+            for (size_t j = 0; j < sec.ntargets; j++) {
+                targets[j] = xrefs->targets[j];
+                first[j] = xrefs->first[j];
+            }
+            first[sec.ntargets] = sec.nsources;
+            for (size_t j = 0, k = 0; j < sec.nsources; j++) {
+                sources[j] = xrefs->sources[j];
+                if (!ref_near(&xrefs->refs[j]))
+                    fars[k++] = xrefs->refs[j];
+            }
+            FdIndexFunc* funcs = (FdIndexFunc*) (void*) (file + sec.funcs);
+            for (size_t j = 0; j < sec.nfuncs; j++)
+                funcs[j] = in->funcs[j];
+        }
+        size = ALIGN8(pos);
+    }
+    return size;
+}
+
+void
+fd_index_fill(void* out, const FdIndexInput* secs, size_t sec, size_t start,
+              size_t end) {
+    // The offsets are aligned to eight bytes, as is the file.
+    const uint8_t* file = out;
+    const FdIndexHeader* hdr = out;
+    const void* sections = file + hdr->sections;
+    const FdIndexSection* tab = sections;
+    const FdIndexSection* s = &tab[sec];
+    const FdIndexInput* in = &secs[sec];
+    const uint64_t* words = (const uint64_t*) (const void*) (file + s->starts);
+    const uint64_t* ranks = (const uint64_t*) (const void*) (file + s->ranks);
+    FdIndexRecord* recs = (FdIndexRecord*) (void*) (file + s->records);
+    if (end > in->size)
+        end = in->size;
+    if (start >= end)
+        return;
+
+    // The references are ascending by source, like the records.
+    size_t ref = 0, nrefs = 0;
+    if (in->xrefs)
+        nrefs = fd_xref_from(in->xrefs, in->addr + start, in->addr + end, &ref);
+    size_t ref_end = ref + nrefs;
+
+    uint64_t idx = starts_rank(words, ranks, start);
+    for (size_t off = start; off < end; off++) {
+        if (!starts_test(words, off))
+            continue;
+        FdIndexRecord* rec = &recs[idx++];
+        FdInstr instr;
+        if (fd_decode(in->buf + off, in->size - off, in->mode, 0, &instr) < 0) {
+            *rec = (FdIndexRecord) {0};
+            continue;
+        }
+        rec->type = FD_TYPE(&instr);
+        rec->size = FD_SIZE(&instr);
+        rec->flags = fd_cf_kind(&instr);
+        rec->target = 0;
+
+        uint64_t addr = in->addr + off;
+        while (ref < ref_end && in->xrefs->refs[ref].from < addr)
+            ref++;
+        if (ref < ref_end && in->xrefs->refs[ref].from == addr) {
+            const FdXref* r = &in->xrefs->refs[ref];
+            rec->flags |= (in->xrefs->kinds[ref] + 1) << 4;
+            if (ref_near(r))
+                rec->target = (int32_t) (r->to - r->from);
+            else
+                rec->flags |= FD_INDEX_FAR;
+        }
+    }
+}
+
+// Array at an offset which index_array checked, which implies the alignment.
+#define INDEX_ARRAY(index, type, off) \
+        ((const type*) (const void*) ((index)->data + (off)))
+
+static bool
+index_array(const FdIndex* index, uint64_t off, uint64_t count, size_t elem) {
+    return off % 8 == 0 && off <= index->size &&
+           count <= (index->size - off) / elem;
+}
+
+int
+fd_index_open(FdIndex* index, const void* data, size_t size) {
+    const FdIndexHeader* hdr = data;
+    if (size < sizeof(FdIndexHeader) || (uintptr_t) data % 8 ||
+        hdr->magic != FD_INDEX_MAGIC || hdr->version != FD_INDEX_VERSION ||
+        hdr->size != size || hdr->build_id_len > sizeof hdr->build_id)
+        return -1;
+    index->data = data;
+    index->size = size;
+    index->header = hdr;
+    if (!index_array(index, hdr->sections, hdr->nsections,
+                     sizeof(FdIndexSection)))
+        return -1;
+    index->sections = INDEX_ARRAY(index, FdIndexSection, hdr->sections);
+    index->nsections = hdr->nsections;
+
+    for (size_t i = 0; i < index->nsections; i++) {
+        const FdIndexSection* sec = &index->sections[i];
+        if (sec->name[sizeof sec->name - 1] ||
+            (i && sec->addr - sec[-1].addr < sec[-1].size) ||
+            (i && sec->addr < sec[-1].addr) ||
+            !index_array(index, sec->starts, words_count(sec->size), 8) ||
+            !index_array(index, sec->ranks, ranks_count(sec->size), 8) ||
+            !index_array(index, sec->records, sec->ninstrs,
+                         sizeof(FdIndexRecord)) ||
+            !index_array(index, sec->targets, sec->ntargets, 8) ||
+            sec->ntargets == UINT64_MAX ||
+            !index_array(index, sec->first, sec->ntargets + 1, 8) ||
+            !index_array(index, sec->sources, sec->nsources, 8) ||
+            !index_array(index, sec->fars, sec->nfars, sizeof(FdXref)) ||
+            !index_array(index, sec->funcs, sec->nfuncs, sizeof(FdIndexFunc)))
+            return -1;
+    }
+    // The structure is valid, but the records were decoded differently.
+    if (hdr->table_hash != fd_table_hash())
+        return -2;
+    return 0;
+}
+
+
+const FdIndexSection*
+fd_index_section(const FdIndex* index, const char* name) {
+    for (size_t i = 0; i < index->nsections; i++) {
+        const char* secname = index->sections[i].name;
+        size_t j = 0;
+        while (j < sizeof index->sections[i].name - 1 && secname[j] &&
+               secname[j] == name[j])
+            j++;
+        // Long names match their truncation.
+        if (j == sizeof index->sections[i].name - 1 || secname[j] == name[j])
+            return &index->sections[i];
+    }
+    return NULL;
+}
+
+const FdIndexSection*
+fd_index_section_at(const FdIndex* index, uint64_t addr) {
+    size_t lo = 0, count = index->nsections;
+    while (count) {
+        size_t half = count / 2;
+        if (index->sections[lo + half].addr <= addr) {
+            lo += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    const FdIndexSection* sec = lo ? &index->sections[lo - 1] : NULL;
+    return sec && addr - sec->addr < sec->size ? sec : NULL;
+}
+
+static const FdIndexRecord*
+index_record(const FdIndex* index, const FdIndexSection* sec, uint64_t off) {
+    const uint64_t* words = INDEX_ARRAY(index, uint64_t, sec->starts);
+    const uint64_t* ranks = INDEX_ARRAY(index, uint64_t, sec->ranks);
+    uint64_t idx = starts_rank(words, ranks, off);
+    if (idx >= sec->ninstrs)
+        return NULL;
+    return INDEX_ARRAY(index, FdIndexRecord, sec->records) + idx;
+}
+
+const FdIndexRecord*
+fd_index_instr(const FdIndex* index, uint64_t addr, uint64_t* start) {
+    const FdIndexSection* sec = fd_index_section_at(index, addr);
+    if (!sec)
+        return NULL;
+    const uint64_t* words = INDEX_ARRAY(index, uint64_t, sec->starts);
+    uint64_t off = addr - sec->addr;
+    for (uint64_t back = 0; back < MAX_INSTR_SIZE && back <= off; back++) {
+        if (!starts_test(words, off - back))
+            continue;
+        // Instructions do not overlap, so only the closest start can cover
+        // the address.
+        const FdIndexRecord* rec = index_record(index, sec, off - back);
+        if (!rec || back >= rec->size)
+            return NULL;
+        *start = addr - back;
+        return rec;
+    }
+    return NULL;
+}
+
+const FdIndexRecord*
+fd_index_next(const FdIndex* index, uint64_t addr, uint64_t* start) {
+    const FdIndexSection* sec = fd_index_section_at(index, addr);
+    if (!sec)
+        return NULL;
+    const uint64_t* words = INDEX_ARRAY(index, uint64_t, sec->starts);
+    uint64_t off = addr - sec->addr;
+    uint64_t w = off / 64;
+    uint64_t bits = words[w] & ~(((uint64_t) 1 << off % 64) - 1);
+    while (!bits) {
+        if (++w == words_count(sec->size))
+            return NULL;
+        bits = words[w];
+    }
+    off = 64 * w + fd_ctz64(bits);
+    if (off >= sec->size)
+        return NULL;
+    *start = sec->addr + off;
+    return index_record(index, sec, off);
+}
+
+uint64_t
+fd_index_target(const FdIndex* index, const FdIndexRecord* rec,
+                uint64_t addr) {
+    if (!FD_INDEX_HAS_REF(rec))
+        return 0;
+    if (!(rec->flags & FD_INDEX_FAR))
+        return addr + (int64_t) rec->target;
+
+    const FdIndexSection* sec = fd_index_section_at(index, addr);
+    if (!sec)
+        return 0;
+    const FdXref* fars = INDEX_ARRAY(index, FdXref, sec->fars);
+    size_t lo = 0, count = sec->nfars;
+    while (count) {
+        size_t half = count / 2;
+        if (fars[lo + half].from < addr) {
+            lo += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    return lo < sec->nfars && fars[lo].from == addr ? fars[lo].to : 0;
+}
+
+// First index of an ascending array with an element not less than key.
+static size_t
+lower_bound(const uint64_t* arr, size_t count, uint64_t key) {
+    size_t lo = 0;
+    while (count) {
+        size_t half = count / 2;
+        if (arr[lo + half] < key) {
+            lo += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    return lo;
+}
+
+size_t
+fd_index_refs_to(const FdIndex* index, const FdIndexSection* sec, uint64_t lo,
+                 uint64_t hi, const uint64_t** sources) {
+    const uint64_t* targets = INDEX_ARRAY(index, uint64_t, sec->targets);
+    const uint64_t* first = INDEX_ARRAY(index, uint64_t, sec->first);
+    size_t begin = lower_bound(targets, sec->ntargets, lo);
+    size_t end = begin + lower_bound(targets + begin, sec->ntargets - begin,
+                                     hi);
+    *sources = INDEX_ARRAY(index, uint64_t, sec->sources);
+    if (first[begin] > first[end] || first[end] > sec->nsources)
+        return 0;
+    *sources += first[begin];
+    return first[end] - first[begin];
+}
+
+const FdIndexFunc*
+fd_index_func(const FdIndex* index, uint64_t addr) {
+    const FdIndexSection* sec = fd_index_section_at(index, addr);
+    if (!sec)
+        return NULL;
+    const FdIndexFunc* funcs = INDEX_ARRAY(index, FdIndexFunc, sec->funcs);
+    size_t lo = 0, count = sec->nfuncs;
+    while (count) {
+        size_t half = count / 2;
+        if (funcs[lo + half].addr <= addr) {
+            lo += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    if (!lo || addr - funcs[lo - 1].addr >= funcs[lo - 1].size)
+        return NULL;
+    return &funcs[lo - 1];
+}
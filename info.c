@@ -0,0 +1,743 @@
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fadec.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+
+struct EflagsDesc {
+    uint16_t read;
+    uint16_t written;
+    uint16_t undef;
+    uint16_t cond;
+};
+
+enum {
+    EFL_COND_NONE = 0,
+    // Flags are not modified if the count (last operand) is zero
+    EFL_COND_COUNT = 1,
+    // Flags are not modified with REP prefix and rCX zero
+    EFL_COND_REP = 2,
+};
+
+enum EflagsEffect {
+    EFL_NEVER,
+    EFL_MAYBE,
+    EFL_ALWAYS,
+};
+
+static const struct EflagsDesc*
+eflags_desc(const FdInstr* instr) {
+    static const struct EflagsDesc descs[] = {
+#define FD_DECODE_TABLE_EFLAGS
+#include <fadec-decode-private.inc>
+#undef FD_DECODE_TABLE_EFLAGS
+    };
+    return &descs[FD_TYPE(instr)];
+}
+
+static enum EflagsEffect
+eflags_effect(const FdInstr* instr, const struct EflagsDesc* desc) {
+    switch (desc->cond) {
+    case EFL_COND_COUNT: {
+        unsigned idx = FD_OP_TYPE(instr, 2) != FD_OT_NONE ? 2 : 1;
+        if (FD_OP_TYPE(instr, idx) != FD_OT_IMM)
+            return EFL_MAYBE;
+        unsigned mask = FD_OP_SIZE(instr, 0) == 8 ? 0x3f : 0x1f;
+        return FD_OP_IMM(instr, idx) & mask ? EFL_ALWAYS : EFL_NEVER;
+    }
+    case EFL_COND_REP:
+        return FD_HAS_REP(instr) || FD_HAS_REPNZ(instr) ? EFL_MAYBE : EFL_ALWAYS;
+    default:
+        return EFL_ALWAYS;
+    }
+}
+
+unsigned
+fd_instr_flags_read(const FdInstr* instr) {
+    const struct EflagsDesc* desc = eflags_desc(instr);
+    switch (eflags_effect(instr, desc)) {
+    case EFL_ALWAYS: return desc->read;
+    case EFL_MAYBE: return desc->read | desc->written;
+    default: return 0;
+    }
+}
+
+unsigned
+fd_instr_flags_written(const FdInstr* instr) {
+    const struct EflagsDesc* desc = eflags_desc(instr);
+    return eflags_effect(instr, desc) != EFL_NEVER ? desc->written : 0;
+}
+
+unsigned
+fd_instr_flags_undefined(const FdInstr* instr) {
+    const struct EflagsDesc* desc = eflags_desc(instr);
+    return eflags_effect(instr, desc) != EFL_NEVER ? desc->undef : 0;
+}
+
+unsigned
+fd_flags_liveness(const FdInstr* instrs, size_t count, unsigned live_out,
+                  unsigned* live_after) {
+    unsigned live = live_out;
+    for (size_t i = count; i-- > 0;) {
+        if (live_after)
+            live_after[i] = live;
+        const struct EflagsDesc* desc = eflags_desc(&instrs[i]);
+        switch (eflags_effect(&instrs[i], desc)) {
+        case EFL_ALWAYS: live = (live & ~desc->written) | desc->read; break;
+        case EFL_MAYBE: live |= desc->read; break;
+        default: break;
+        }
+    }
+    return live;
+}
+
+const uint8_t fd_cf_table[] = {
+#define FD_DECODE_TABLE_CF
+#include <fadec-decode-private.inc>
+#undef FD_DECODE_TABLE_CF
+};
+
+struct RegsDesc {
+    // Access of explicit operands by operand count, 2 bits per operand.
+    uint8_t ops[5];
+    // Bit n: implicit registers apply with n explicit operands
+    uint8_t impl_nops;
+    uint8_t flags;
+    uint8_t fpu_read;
+    uint8_t fpu_written;
+    uint16_t vec_read;
+    uint16_t vec_written;
+    // Implicit GP registers, indexed by REGS_SZ_*
+    uint16_t gp_read[5];
+    uint16_t gp_written[5];
+};
+
+enum {
+    REGS_R = 1,
+    REGS_W = 2,
+};
+
+enum {
+    REGS_REP_RCX = 1 << 0,
+    REGS_VSIB = 1 << 1,
+    REGS_FPU_STACK = 1 << 2,
+    REGS_STATE_READ = 1 << 3,
+    REGS_STATE_WRITE = 1 << 4,
+    REGS_VEC_PARTIAL = 1 << 5,
+    REGS_MASK_WRITE = 1 << 6,
+};
+
+enum {
+    REGS_SZ_OP = 0, // operand size
+    REGS_SZ_OP_NOT8 = 1, // operand size, not accessed for 8-bit operations
+    REGS_SZ_ADDR = 2, // address size
+    REGS_SZ_FULL = 3, // full register, 32-bit writes zero-extend
+    REGS_SZ_PARTIAL = 4, // 8/16-bit part of the register
+};
+
+static void
+regs_state(uint64_t mask[16]) {
+    mask[FD_RT_VEC] |= 0xffffffff;
+    mask[FD_RT_FPU] |= 0xff;
+    mask[FD_RT_MMX] |= 0xff;
+    mask[FD_RT_MASK] |= 0xff;
+}
+
+static const struct RegsDesc*
+regs_desc(const FdInstr* instr) {
+    static const struct RegsDesc descs[] = {
+#define FD_DECODE_TABLE_REGS
+#include <fadec-decode-private.inc>
+#undef FD_DECODE_TABLE_REGS
+    };
+    static const uint8_t desc_idx[] = {
+#define FD_DECODE_TABLE_REGS_IDX
+#include <fadec-decode-private.inc>
+#undef FD_DECODE_TABLE_REGS_IDX
+    };
+    return &descs[desc_idx[FD_TYPE(instr)]];
+}
+
+static unsigned
+instr_nops(const FdInstr* instr) {
+    unsigned nops = 0;
+    while (nops < 4 && FD_OP_TYPE(instr, nops) != FD_OT_NONE)
+        nops++;
+    return nops;
+}
+
+static void
+fd_instr_regs(const FdInstr* instr, uint64_t read[16], uint64_t written[16]) {
+    const struct RegsDesc* desc = regs_desc(instr);
+
+    for (unsigned i = 0; i < 16; i++)
+        read[i] = written[i] = 0;
+
+    unsigned nops = instr_nops(instr);
+
+    unsigned access = desc->ops[nops];
+    for (unsigned i = 0; i < nops; i++, access >>= 2) {
+        FdOpType ot = FD_OP_TYPE(instr, i);
+        if (ot == FD_OT_REG) {
+            unsigned rt = FD_OP_REG_TYPE(instr, i);
+            unsigned reg = FD_OP_REG(instr, i);
+            bool partial = false;
+            if (rt == FD_RT_GPH) {
+                rt = FD_RT_GPL;
+                reg -= FD_REG_AH;
+                partial = true;
+            } else if (rt == FD_RT_GPL) {
+                partial = FD_OP_SIZE(instr, i) <= 2;
+            } else if (rt == FD_RT_VEC) {
+                // Legacy SSE and EVEX merge-masking keep unmodified parts.
+                partial = (desc->flags & REGS_VEC_PARTIAL) ||
+                          (FD_MASKREG(instr) && !FD_MASKZERO(instr));
+            }
+            uint64_t bit = (uint64_t) 1 << reg;
+            if (access & REGS_R)
+                read[rt] |= bit;
+            if (access & REGS_W) {
+                written[rt] |= bit;
+                if (partial)
+                    read[rt] |= bit;
+            }
+        } else if (ot == FD_OT_MEM || ot == FD_OT_MEMBCST) {
+            if (FD_OP_BASE(instr, i) != FD_REG_NONE)
+                read[FD_RT_GPL] |= (uint64_t) 1 << FD_OP_BASE(instr, i);
+            if (FD_OP_INDEX(instr, i) != FD_REG_NONE) {
+                unsigned rt = desc->flags & REGS_VSIB ? FD_RT_VEC : FD_RT_GPL;
+                read[rt] |= (uint64_t) 1 << FD_OP_INDEX(instr, i);
+            }
+            if (FD_SEGMENT(instr) != FD_REG_NONE)
+                read[FD_RT_SEG] |= (uint64_t) 1 << FD_SEGMENT(instr);
+        }
+    }
+
+    if (FD_MASKREG(instr)) {
+        read[FD_RT_MASK] |= (uint64_t) 1 << FD_MASKREG(instr);
+        if (desc->flags & REGS_MASK_WRITE)
+            written[FD_RT_MASK] |= (uint64_t) 1 << FD_MASKREG(instr);
+    }
+
+    if (desc->impl_nops >> nops & 1) {
+        unsigned opsize = nops ? FD_OP_SIZE(instr, 0) : FD_OPSIZE(instr);
+        bool partial[5] = {
+            [REGS_SZ_OP] = opsize <= 2,
+            [REGS_SZ_OP_NOT8] = opsize <= 2,
+            [REGS_SZ_ADDR] = FD_ADDRSIZE(instr) <= 2,
+            [REGS_SZ_FULL] = false,
+            [REGS_SZ_PARTIAL] = true,
+        };
+        for (unsigned i = 0; i < 5; i++) {
+            if (i == REGS_SZ_OP_NOT8 && opsize == 1)
+                continue;
+            read[FD_RT_GPL] |= desc->gp_read[i];
+            written[FD_RT_GPL] |= desc->gp_written[i];
+            if (partial[i])
+                read[FD_RT_GPL] |= desc->gp_written[i];
+        }
+        read[FD_RT_FPU] |= desc->fpu_read;
+        written[FD_RT_FPU] |= desc->fpu_written;
+        read[FD_RT_VEC] |= desc->vec_read;
+        written[FD_RT_VEC] |= desc->vec_written;
+    }
+
+    if ((desc->flags & REGS_REP_RCX) && (FD_HAS_REP(instr) || FD_HAS_REPNZ(instr))) {
+        read[FD_RT_GPL] |= 1 << FD_REG_CX;
+        written[FD_RT_GPL] |= 1 << FD_REG_CX;
+    }
+    if (desc->flags & REGS_FPU_STACK) {
+        read[FD_RT_FPU] |= 0xff;
+        written[FD_RT_FPU] |= 0xff;
+    }
+    if (desc->flags & REGS_STATE_READ)
+        regs_state(read);
+    if (desc->flags & REGS_STATE_WRITE)
+        regs_state(written);
+}
+
+void
+fd_instr_regs_read(const FdInstr* instr, uint64_t out_mask[16]) {
+    uint64_t written[16];
+    fd_instr_regs(instr, out_mask, written);
+}
+
+void
+fd_instr_regs_written(const FdInstr* instr, uint64_t out_mask[16]) {
+    uint64_t read[16];
+    fd_instr_regs(instr, read, out_mask);
+}
+
+struct MemDesc {
+    // Access of explicit memory operands by operand count, 2 bits per operand.
+    uint8_t ops[5];
+    // MEM_SZ_* << 12 | size in bytes
+    uint16_t size;
+};
+
+enum {
+    MEM_SZ_OP = 0, // operand size; the given size if the operand size is zero
+    MEM_SZ_FIXED = 1, // given size, zero if it depends on the processor state
+    MEM_SZ_DTR = 2, // descriptor table register: 6 bytes, 10 in 64-bit mode
+    MEM_SZ_DOUBLE = 3, // twice the operand size
+    MEM_SZ_FAR = 4, // far pointer: offset of operand size and a selector
+};
+
+static const struct MemDesc*
+mem_desc(const FdInstr* instr) {
+    static const struct MemDesc descs[] = {
+#define FD_DECODE_TABLE_MEM
+#include <fadec-decode-private.inc>
+#undef FD_DECODE_TABLE_MEM
+    };
+    static const uint8_t desc_idx[] = {
+#define FD_DECODE_TABLE_MEM_IDX
+#include <fadec-decode-private.inc>
+#undef FD_DECODE_TABLE_MEM_IDX
+    };
+    return &descs[desc_idx[FD_TYPE(instr)]];
+}
+
+static bool
+is_mem(const FdInstr* instr, unsigned idx) {
+    if (idx >= 4)
+        return false;
+    FdOpType ot = FD_OP_TYPE(instr, idx);
+    return ot == FD_OT_MEM || ot == FD_OT_MEMBCST;
+}
+
+unsigned
+fd_mem_access(const FdInstr* instr, unsigned idx) {
+    if (!is_mem(instr, idx))
+        return 0;
+    const struct MemDesc* desc = mem_desc(instr);
+    return desc->ops[instr_nops(instr)] >> (2 * idx) & 3;
+}
+
+unsigned
+fd_mem_size(const FdInstr* instr, unsigned idx) {
+    if (!is_mem(instr, idx))
+        return 0;
+    if (FD_OP_TYPE(instr, idx) == FD_OT_MEMBCST)
+        return FD_OP_BCSTSZ(instr, idx);
+    const struct MemDesc* desc = mem_desc(instr);
+    unsigned size = FD_OP_SIZE(instr, idx);
+    unsigned value = desc->size & 0xfff;
+    switch (desc->size >> 12) {
+    case MEM_SZ_FIXED: return value;
+    case MEM_SZ_DTR: return instr->flags & FD_FLAG_64 ? 10 : 6;
+    case MEM_SZ_DOUBLE: return 2 * (size ? size : (unsigned) FD_OPSIZE(instr));
+    case MEM_SZ_FAR: return size + 2;
+    default: return size ? size : value;
+    }
+}
+
+uint64_t
+fd_mem_ea_vsib(const FdInstr* instr, unsigned idx, const uint64_t regs[17],
+               uint64_t fsbase, uint64_t gsbase, int64_t vec_index) {
+    uint64_t addr = FD_OP_DISP(instr, idx);
+    unsigned base = FD_OP_BASE(instr, idx);
+    if (base == FD_REG_IP)
+        addr += regs[FD_REG_IP] + FD_SIZE(instr);
+    else if (base != FD_REG_NONE)
+        addr += regs[base];
+    unsigned index = FD_OP_INDEX(instr, idx);
+    if (index != FD_REG_NONE) {
+        uint64_t index_val = regs_desc(instr)->flags & REGS_VSIB ?
+                             (uint64_t) vec_index : regs[index];
+        addr += index_val << FD_OP_SCALE(instr, idx);
+    }
+
+    if (FD_ADDRSIZE(instr) == 2)
+        addr &= 0xffff;
+    else if (FD_ADDRSIZE(instr) == 4)
+        addr &= 0xffffffff;
+
+    if (FD_SEGMENT(instr) == FD_REG_FS)
+        addr += fsbase;
+    else if (FD_SEGMENT(instr) == FD_REG_GS)
+        addr += gsbase;
+    if (!(instr->flags & FD_FLAG_64))
+        addr &= 0xffffffff;
+    return addr;
+}
+
+uint64_t
+fd_mem_ea(const FdInstr* instr, unsigned idx, const uint64_t regs[17],
+          uint64_t fsbase, uint64_t gsbase) {
+    return fd_mem_ea_vsib(instr, idx, regs, fsbase, gsbase, 0);
+}
+
+struct FeatureDesc {
+    uint64_t mask[FD_FEATURE_WORDS];
+    uint8_t level;
+};
+
+static const struct FeatureDesc*
+feature_desc(const FdInstr* instr) {
+    static const struct FeatureDesc descs[] = {
+#define FD_DECODE_TABLE_FEATURES
+#include <fadec-decode-private.inc>
+#undef FD_DECODE_TABLE_FEATURES
+    };
+    static const uint8_t desc_idx[] = {
+#define FD_DECODE_TABLE_FEATURES_IDX
+#include <fadec-decode-private.inc>
+#undef FD_DECODE_TABLE_FEATURES_IDX
+    };
+    return &descs[desc_idx[FD_TYPE(instr)]];
+}
+
+void
+fd_instr_features(const FdInstr* instr, uint64_t out_mask[FD_FEATURE_WORDS]) {
+    const struct FeatureDesc* desc = feature_desc(instr);
+    for (unsigned i = 0; i < FD_FEATURE_WORDS; i++)
+        out_mask[i] = desc->mask[i];
+}
+
+const char*
+fd_feature_name(unsigned feature) {
+    static const char* const names[] = {
+#define FD_DECODE_TABLE_FEATURE_NAMES
+#include <fadec-decode-private.inc>
+#undef FD_DECODE_TABLE_FEATURE_NAMES
+    };
+    return feature < sizeof names / sizeof names[0] ? names[feature] : NULL;
+}
+
+unsigned
+fd_instr_x86_64_level(const FdInstr* instr) {
+    unsigned level = feature_desc(instr)->level;
+    if (level >= 2 || !(instr->flags & FD_FLAG_64))
+        return level;
+    // CMPXCHG16B and LAHF/SAHF in 64-bit mode are part of x86-64-v2.
+    switch (FD_TYPE(instr)) {
+    case FDI_CMPXCHGD: return FD_OPSIZE(instr) == 8 ? 2 : level;
+    case FDI_LAHF:
+    case FDI_SAHF: return 2;
+    default: return level;
+    }
+}
+
+struct UarchDesc {
+    const char* name;
+    uint8_t width;
+    uint8_t nports;
+    uint8_t load_latency;
+    uint16_t load_ports;
+    uint8_t nstores;
+    uint16_t store_ports[2];
+    const char* port_names[16];
+};
+
+struct CostDesc {
+    uint8_t uops;
+    uint8_t latency;
+    uint16_t ports;
+};
+
+static const struct UarchDesc uarch_descs[] = {
+#define FD_DECODE_TABLE_UARCHS
+#include <fadec-decode-private.inc>
+#undef FD_DECODE_TABLE_UARCHS
+};
+
+#define UARCH_COUNT (sizeof uarch_descs / sizeof uarch_descs[0])
+
+static const struct CostDesc*
+cost_desc(const FdInstr* instr, unsigned uarch, bool mem) {
+    static const struct CostDesc descs[] = {
+#define FD_DECODE_TABLE_COSTS
+#include <fadec-decode-private.inc>
+#undef FD_DECODE_TABLE_COSTS
+    };
+    // Indexed by micro-architecture, instruction type, and memory form.
+    static const uint8_t desc_idx[] = {
+#define FD_DECODE_TABLE_COSTS_IDX
+#include <fadec-decode-private.inc>
+#undef FD_DECODE_TABLE_COSTS_IDX
+    };
+    size_t ntypes = sizeof desc_idx / sizeof desc_idx[0] / 2 / UARCH_COUNT;
+    return &descs[desc_idx[(uarch * ntypes + FD_TYPE(instr)) * 2 + mem]];
+}
+
+// Returns the index of the memory operand, or -1 if there is none.
+static int
+instr_mem_op(const FdInstr* instr) {
+    for (unsigned i = 0; i < 4; i++)
+        if (is_mem(instr, i))
+            return i;
+    return -1;
+}
+
+static void
+instr_cost(const FdInstr* instr, const struct UarchDesc* ua, FdCost* cost,
+           unsigned* access) {
+    int mem = instr_mem_op(instr);
+    const struct CostDesc* desc = cost_desc(instr, ua - uarch_descs, mem >= 0);
+    *access = mem >= 0 ? fd_mem_access(instr, mem) : 0;
+    cost->uops = desc->uops;
+    cost->latency = desc->latency;
+    cost->load_latency = 0;
+    cost->ports = desc->ports;
+    if (*access & FD_MEM_READ) {
+        cost->uops += 1;
+        cost->load_latency = ua->load_latency;
+    }
+    if (*access & FD_MEM_WRITE)
+        cost->uops += ua->nstores;
+}
+
+int
+fd_instr_cost(const FdInstr* instr, FdUarch uarch, FdCost* out_cost) {
+    if ((unsigned) uarch >= UARCH_COUNT)
+        return -1;
+    unsigned access;
+    instr_cost(instr, &uarch_descs[uarch], out_cost, &access);
+    return 0;
+}
+
+const char*
+fd_uarch_name(unsigned uarch) {
+    return uarch < UARCH_COUNT ? uarch_descs[uarch].name : NULL;
+}
+
+const char*
+fd_uarch_port_name(unsigned uarch, unsigned port) {
+    if (uarch >= UARCH_COUNT || port >= uarch_descs[uarch].nports)
+        return NULL;
+    return uarch_descs[uarch].port_names[port];
+}
+
+// Instructions which are independent of their inputs if the last two operands
+// are the same register.
+static bool
+is_zero_idiom(const FdInstr* instr) {
+    switch (FD_TYPE(instr)) {
+    case FDI_XOR: case FDI_SUB:
+    case FDI_MMX_PXOR: case FDI_SSE_PXOR: case FDI_VPXOR:
+    case FDI_EVX_PXORD: case FDI_EVX_PXORQ:
+    case FDI_SSE_XORPS: case FDI_SSE_XORPD: case FDI_VXORPS: case FDI_VXORPD:
+    case FDI_EVX_XORPS: case FDI_EVX_XORPD:
+    case FDI_SSE_PSUBB: case FDI_SSE_PSUBW: case FDI_SSE_PSUBD:
+    case FDI_SSE_PSUBQ: case FDI_VPSUBB: case FDI_VPSUBW: case FDI_VPSUBD:
+    case FDI_VPSUBQ:
+        break;
+    default:
+        return false;
+    }
+    unsigned nops = instr_nops(instr);
+    if (nops < 2 || FD_MASKREG(instr))
+        return false;
+    unsigned a = nops - 2, b = nops - 1;
+    return FD_OP_TYPE(instr, a) == FD_OT_REG && FD_OP_TYPE(instr, b) == FD_OT_REG &&
+           FD_OP_REG_TYPE(instr, a) == FD_OP_REG_TYPE(instr, b) &&
+           FD_OP_REG(instr, a) == FD_OP_REG(instr, b);
+}
+
+// Slots for the ready times of registers and flags in the dependency analysis.
+// Bit n of a slot mask (two words) refers to slot n.
+enum {
+    DEP_VEC = 0,
+    DEP_GP = 32,
+    DEP_FPU = 48,
+    DEP_MMX = 56,
+    DEP_MASK = 64,
+    DEP_FLAGS = 72, // indexed by bit number of FD_EFL_*
+    DEP_COUNT = 84,
+};
+
+// Summary of an instruction for the dependency analysis.
+struct DepInstr {
+    uint64_t read[2];
+    // Address registers of a memory load
+    uint64_t addr[2];
+    uint64_t written[2];
+    unsigned latency;
+    unsigned load_latency;
+};
+
+// Instructions summarized at once; the summaries of blocks up to this size are
+// computed only once for all iterations.
+#define DEP_CHUNK 64
+// Iterations simulated to find the dependencies carried across iterations;
+// the latency bound is the growth over the last two iterations, which also
+// covers dependency chains that span two iterations.
+#define DEP_ITERATIONS 4
+
+static unsigned
+fd_popcount(unsigned v) {
+#if defined(__GNUC__)
+    return __builtin_popcount(v);
+#else
+    unsigned count = 0;
+    for (; v; v &= v - 1)
+        count++;
+    return count;
+#endif
+}
+
+// Index of the lowest set bit; v must not be zero.
+static unsigned
+fd_ctz64(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(v);
+#elif defined(_MSC_VER) && INTPTR_MAX == INT64_MAX
+    unsigned long index;
+    _BitScanForward64(&index, v);
+    return index;
+#else
+    unsigned index = 0;
+    for (; !(v & 1); v >>= 1)
+        index++;
+    return index;
+#endif
+}
+
+static void
+dep_regs(const uint64_t regs[16], uint64_t out[2]) {
+    out[0] = (regs[FD_RT_VEC] & 0xffffffff) |
+             (regs[FD_RT_GPL] & 0xffff) << DEP_GP |
+             (regs[FD_RT_FPU] & 0xff) << DEP_FPU |
+             (regs[FD_RT_MMX] & 0xff) << DEP_MMX;
+    out[1] = regs[FD_RT_MASK] & 0xff;
+}
+
+static void
+add_pressure(double pressure[16], unsigned ports, double uops) {
+    if (!ports)
+        return;
+    double share = uops / fd_popcount(ports);
+    for (; ports; ports &= ports - 1)
+        pressure[fd_ctz64(ports)] += share;
+}
+
+// Summarize an instruction; if res is not NULL, also add its micro-ops.
+static void
+dep_instr(const FdInstr* instr, const struct UarchDesc* ua,
+          struct DepInstr* dep, FdBlockCost* res) {
+    FdCost cost;
+    unsigned access;
+    instr_cost(instr, ua, &cost, &access);
+    if (res) {
+        res->uops += cost.uops;
+        unsigned exec_uops = cost.uops;
+        if (access & FD_MEM_READ) {
+            add_pressure(res->port_pressure, ua->load_ports, 1);
+            exec_uops -= 1;
+        }
+        if (access & FD_MEM_WRITE) {
+            for (unsigned i = 0; i < ua->nstores; i++)
+                add_pressure(res->port_pressure, ua->store_ports[i], 1);
+            exec_uops -= ua->nstores;
+        }
+        add_pressure(res->port_pressure, cost.ports, exec_uops);
+    }
+
+    uint64_t read[16], written[16];
+    fd_instr_regs(instr, read, written);
+    dep_regs(written, dep->written);
+    dep->written[1] |= (uint64_t) fd_instr_flags_written(instr) << (DEP_FLAGS - 64);
+    if (is_zero_idiom(instr)) {
+        dep->read[0] = dep->read[1] = 0;
+    } else {
+        dep_regs(read, dep->read);
+        dep->read[1] |= (uint64_t) fd_instr_flags_read(instr) << (DEP_FLAGS - 64);
+    }
+
+    dep->addr[0] = dep->addr[1] = 0;
+    if (access & FD_MEM_READ) {
+        int mem = instr_mem_op(instr);
+        if (FD_OP_BASE(instr, mem) < 16)
+            dep->addr[0] |= (uint64_t) 1 << (DEP_GP + FD_OP_BASE(instr, mem));
+        if (FD_OP_INDEX(instr, mem) != FD_REG_NONE) {
+            bool vsib = regs_desc(instr)->flags & REGS_VSIB;
+            unsigned slot = (vsib ? DEP_VEC : DEP_GP) + FD_OP_INDEX(instr, mem);
+            dep->addr[0] |= (uint64_t) 1 << slot;
+        }
+    }
+    dep->latency = cost.latency;
+    dep->load_latency = cost.load_latency;
+}
+
+static unsigned
+dep_max(const unsigned ready[DEP_COUNT], const uint64_t mask[2]) {
+    unsigned t = 0;
+    for (unsigned i = 0; i < 2; i++) {
+        for (uint64_t m = mask[i]; m; m &= m - 1) {
+            unsigned r = ready[i * 64 + fd_ctz64(m)];
+            t = r > t ? r : t;
+        }
+    }
+    return t;
+}
+
+// Simulate a part of an iteration; returns the latest completion time.
+static unsigned
+dep_run(const struct DepInstr* deps, size_t count, unsigned ready[DEP_COUNT]) {
+    unsigned end = 0;
+    for (size_t i = 0; i < count; i++) {
+        const struct DepInstr* dep = &deps[i];
+        unsigned start = dep_max(ready, dep->read);
+        if (dep->load_latency) {
+            // The load starts once the address registers are ready.
+            unsigned addr = dep_max(ready, dep->addr) + dep->load_latency;
+            start = addr > start ? addr : start;
+        }
+        unsigned done = start + dep->latency;
+        end = done > end ? done : end;
+        for (unsigned j = 0; j < 2; j++)
+            for (uint64_t m = dep->written[j]; m; m &= m - 1)
+                ready[j * 64 + fd_ctz64(m)] = done;
+    }
+    return end;
+}
+
+int
+fd_block_cost(const FdInstr* instrs, size_t count, FdUarch uarch,
+              FdBlockCost* out_cost) {
+    if ((unsigned) uarch >= UARCH_COUNT)
+        return -1;
+    const struct UarchDesc* ua = &uarch_descs[uarch];
+
+    FdBlockCost res = {0};
+    struct DepInstr deps[DEP_CHUNK];
+    unsigned ready[DEP_COUNT] = {0};
+    unsigned end[DEP_ITERATIONS] = {0};
+    for (unsigned it = 0; it < DEP_ITERATIONS; it++) {
+        for (size_t off = 0; off < count; off += DEP_CHUNK) {
+            size_t n = count - off < DEP_CHUNK ? count - off : DEP_CHUNK;
+            if (it == 0 || count > DEP_CHUNK)
+                for (size_t i = 0; i < n; i++)
+                    dep_instr(&instrs[off + i], ua, &deps[i],
+                              it == 0 ? &res : NULL);
+            unsigned t = dep_run(deps, n, ready);
+            end[it] = t > end[it] ? t : end[it];
+        }
+    }
+    res.critical_path = end[0];
+    res.latency_cycles = (end[DEP_ITERATIONS - 1] - end[DEP_ITERATIONS - 3]) / 2.0;
+
+    res.issue_cycles = (double) res.uops / ua->width;
+    res.bottleneck_port = -1;
+    for (unsigned i = 0; i < ua->nports; i++) {
+        if (res.port_pressure[i] > res.port_cycles) {
+            res.port_cycles = res.port_pressure[i];
+            res.bottleneck_port = i;
+        }
+    }
+
+    res.cycles = res.issue_cycles;
+    if (res.port_cycles > res.cycles)
+        res.cycles = res.port_cycles;
+    if (res.latency_cycles > res.cycles)
+        res.cycles = res.latency_cycles;
+    *out_cost = res;
+    return 0;
+}
@@ -0,0 +1,336 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <fadec.h>
+
+#include "tools-common.h"
+
+
+#define MAX_FEATURES (64 * FD_FEATURE_WORDS)
+// Code without symbols is split into chunks of this size for the workers.
+#define CHUNK_SIZE (256 << 10)
+
+// A range of code, either a function or a section without function ranges.
+struct Unit {
+    const uint8_t* code;
+    size_t size;
+    uint64_t addr;
+    const char* name; // NULL if the function has no symbol
+    bool func;
+    uint64_t instrs;
+    uint8_t level;
+    uint64_t level_addr; // first instruction which requires the level
+};
+
+struct Units {
+    struct Unit* data;
+    size_t len;
+    size_t cap;
+    uint64_t code_bytes; // in the executable sections
+    uint64_t skipped_bytes; // between functions, e.g. padding or data
+};
+
+struct Stats {
+    uint64_t instrs;
+    uint64_t bad_bytes;
+    uint64_t features[MAX_FEATURES];
+};
+
+struct Job {
+    struct Units* units;
+    struct Stats* stats; // one per worker
+    atomic_size_t next;
+};
+
+static void
+unit_add(struct Units* units, const uint8_t* code, size_t size, uint64_t addr,
+         const char* name, bool func) {
+    if (units->len == units->cap) {
+        units->cap = units->cap ? 2 * units->cap : 256;
+        units->data = xrealloc(units->data, units->cap * sizeof *units->data);
+    }
+    units->data[units->len++] = (struct Unit) {
+        .code = code, .size = size, .addr = addr, .name = name, .func = func,
+        .level = 1, .level_addr = addr,
+    };
+}
+
+static void
+unit_add_gap(struct Units* units, const uint8_t* code, size_t size,
+             uint64_t addr) {
+    for (size_t off = 0; off < size; off += CHUNK_SIZE) {
+        size_t len = size - off < CHUNK_SIZE ? size - off : CHUNK_SIZE;
+        unit_add(units, code + off, len, addr + off, NULL, false);
+    }
+}
+
+// Outer ranges first, and of equal ranges the one with a name.
+static int
+cmp_range(const void* a, const void* b) {
+    const FdSymbol* sa = a;
+    const FdSymbol* sb = b;
+    if (sa->addr != sb->addr)
+        return sa->addr < sb->addr ? -1 : 1;
+    if (sa->size != sb->size)
+        return sa->size > sb->size ? -1 : 1;
+    return !sa->name - !sb->name;
+}
+
+// Collect the function ranges from the sized symbols and the FDEs, which also
+// cover stripped files. Returns a sorted array.
+static FdSymbol*
+binary_ranges(const struct Binary* bin, size_t* out_count) {
+    size_t nsyms = fd_elf_symbols(bin->map, bin->map_size, NULL, 0);
+    size_t nfdes = fd_elf_eh_frame(bin->map, bin->map_size, NULL, 0);
+    FdSymbol* ranges = xrealloc(NULL, (nsyms + nfdes + 1) * sizeof *ranges);
+    fd_elf_symbols(bin->map, bin->map_size, ranges, nsyms);
+    fd_elf_eh_frame(bin->map, bin->map_size, ranges + nsyms, nfdes);
+    size_t count = 0;
+    for (size_t i = 0; i < nsyms + nfdes; i++)
+        if (ranges[i].size)
+            ranges[count++] = ranges[i];
+    qsort(ranges, count, sizeof *ranges, cmp_range);
+    *out_count = count;
+    return ranges;
+}
+
+// Split the executable sections into functions. The code between functions is
+// not scanned, as it is padding or data rather than instructions which run;
+// only sections without any function are scanned completely.
+static void
+binary_units(const struct Binary* bin, struct Units* units) {
+    size_t nranges;
+    FdSymbol* ranges = binary_ranges(bin, &nranges);
+    for (size_t i = 0; i < bin->nsections; i++) {
+        const struct Section* s = &bin->sections[i];
+        uint64_t end = s->addr + s->size;
+        uint64_t cur = s->addr;
+        size_t funcs = 0;
+        for (size_t j = 0; j < nranges; j++) {
+            uint64_t faddr = ranges[j].addr;
+            // Skip other sections and aliases/nested ranges.
+            if (faddr < cur || faddr >= end)
+                continue;
+            uint64_t fend = ranges[j].size < end - faddr ?
+                            faddr + ranges[j].size : end;
+            units->skipped_bytes += faddr - cur;
+            unit_add(units, s->code + (faddr - s->addr), fend - faddr, faddr,
+                     ranges[j].name, true);
+            cur = fend;
+            funcs++;
+        }
+        if (!funcs)
+            unit_add_gap(units, s->code, s->size, s->addr);
+        else
+            units->skipped_bytes += end - cur;
+        units->code_bytes += s->size;
+    }
+    free(ranges);
+}
+
+static void
+scan_unit(struct Unit* unit, struct Stats* stats) {
+    unsigned level = 1;
+    uint64_t level_addr = unit->addr;
+    uint64_t instrs = 0;
+    for (size_t off = 0; off < unit->size;) {
+        FdInstr instr;
+        int ret = fd_decode(unit->code + off, unit->size - off, 64, 0, &instr);
+        if (ret < 0) {
+            stats->bad_bytes++;
+            off++;
+            continue;
+        }
+        unsigned instr_level = fd_instr_x86_64_level(&instr);
+        if (instr_level > level) {
+            level = instr_level;
+            level_addr = unit->addr + off;
+        }
+        off += ret;
+        instrs++;
+
+        uint64_t mask[FD_FEATURE_WORDS];
+        fd_instr_features(&instr, mask);
+        for (unsigned w = 0; w < FD_FEATURE_WORDS; w++) {
+            for (uint64_t m = mask[w]; m; m &= m - 1)
+                stats->features[w * 64 + __builtin_ctzll(m)]++;
+        }
+    }
+    unit->level = level;
+    unit->level_addr = level_addr;
+    unit->instrs = instrs;
+    stats->instrs += instrs;
+}
+
+static void
+worker(void* arg, unsigned id) {
+    struct Job* job = arg;
+    for (;;) {
+        size_t idx = atomic_fetch_add_explicit(&job->next, 1,
+                                               memory_order_relaxed);
+        if (idx >= job->units->len)
+            break;
+        scan_unit(&job->units->data[idx], &job->stats[id]);
+    }
+}
+
+static void
+binary_scan(struct Units* units, unsigned nthreads, struct Stats* total) {
+    struct Job job = { .units = units };
+    atomic_init(&job.next, 0);
+    job.stats = calloc(nthreads, sizeof *job.stats);
+    if (!job.stats) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    run_workers(nthreads, worker, &job);
+
+    memset(total, 0, sizeof *total);
+    for (unsigned i = 0; i < nthreads; i++) {
+        total->instrs += job.stats[i].instrs;
+        total->bad_bytes += job.stats[i].bad_bytes;
+        for (unsigned j = 0; j < MAX_FEATURES; j++)
+            total->features[j] += job.stats[i].features[j];
+    }
+    free(job.stats);
+}
+
+static const uint64_t* sort_counts;
+
+static int
+cmp_feature(const void* a, const void* b) {
+    uint64_t ca = sort_counts[*(const unsigned*) a];
+    uint64_t cb = sort_counts[*(const unsigned*) b];
+    return ca > cb ? -1 : ca < cb;
+}
+
+static unsigned
+binary_report(const struct Binary* bin, const struct Units* units,
+              const struct Stats* stats, bool list_funcs, bool list_all) {
+    unsigned level = 1;
+    const struct Unit* level_unit = NULL;
+    size_t nfuncs[5] = {0};
+    for (size_t i = 0; i < units->len; i++) {
+        const struct Unit* unit = &units->data[i];
+        if (unit->level > level) {
+            level = unit->level;
+            level_unit = unit;
+        }
+        if (unit->func)
+            nfuncs[unit->level]++;
+    }
+
+    printf("%s: x86-64-v%u\n", bin->path, level);
+    if (level_unit) {
+        // Show the evidence for the level, as one instruction suffices.
+        FdInstr instr;
+        size_t off = level_unit->level_addr - level_unit->addr;
+        fd_decode(level_unit->code + off, level_unit->size - off, 64,
+                  level_unit->level_addr, &instr);
+        char buf[128];
+        fd_format(&instr, buf, sizeof buf);
+        printf("  required by %#" PRIx64 " %s%s%s\n", level_unit->level_addr,
+               buf, level_unit->name ? " in " : "",
+               level_unit->name ? level_unit->name : "");
+    }
+    printf("  instructions %" PRIu64 ", undecodable bytes %" PRIu64 "\n",
+           stats->instrs, stats->bad_bytes);
+    printf("  code bytes %" PRIu64 ", not scanned between functions %" PRIu64
+           "\n", units->code_bytes, units->skipped_bytes);
+    printf("  functions v1 %zu, v2 %zu, v3 %zu, v4 %zu\n",
+           nfuncs[1], nfuncs[2], nfuncs[3], nfuncs[4]);
+
+    unsigned order[MAX_FEATURES];
+    unsigned nfeat = 0;
+    for (unsigned i = 0; i < MAX_FEATURES && fd_feature_name(i); i++)
+        if (stats->features[i])
+            order[nfeat++] = i;
+    sort_counts = stats->features;
+    qsort(order, nfeat, sizeof *order, cmp_feature);
+    printf("  features");
+    for (unsigned i = 0; i < nfeat; i++)
+        printf("%s %s %" PRIu64, i ? "," : "", fd_feature_name(order[i]),
+               stats->features[order[i]]);
+    printf("\n");
+
+    if (list_funcs || list_all) {
+        for (size_t i = 0; i < units->len; i++) {
+            const struct Unit* unit = &units->data[i];
+            if (unit->func && (list_all || unit->level > 1))
+                printf("  v%u %#" PRIx64 "%s%s\n", unit->level, unit->addr,
+                       unit->name ? " " : "", unit->name ? unit->name : "");
+        }
+    }
+    return level;
+}
+
+static void
+usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-j threads] [-f] [-a] file...\n"
+                    "  -j  number of threads (default: number of CPUs)\n"
+                    "  -f  list functions which require more than x86-64-v1\n"
+                    "  -a  list all functions\n"
+                    "Reports the x86-64 micro-architecture level required by "
+                    "the functions in the\nexecutable sections of ELF files, "
+                    "per function and per file, and the number of\n"
+                    "instructions per ISA extension.\n", prog);
+}
+
+int
+main(int argc, char** argv) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nthreads = ncpus > 0 ? ncpus : 1;
+    bool list_funcs = false, list_all = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:fah")) != -1) {
+        switch (opt) {
+        case 'j': nthreads = strtoul(optarg, NULL, 0); break;
+        case 'f': list_funcs = true; break;
+        case 'a': list_all = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc || nthreads == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int ret = EXIT_SUCCESS;
+    unsigned max_level = 0;
+    for (int i = optind; i < argc; i++) {
+        struct Binary bin;
+        if (!binary_load(&bin, argv[i])) {
+            ret = EXIT_FAILURE;
+            continue;
+        }
+        if (bin.mode != 64) {
+            fprintf(stderr, "%s: not an x86-64 ELF file\n", argv[i]);
+            binary_unload(&bin);
+            ret = EXIT_FAILURE;
+            continue;
+        }
+        madvise((void*) bin.map, bin.map_size, MADV_WILLNEED);
+        struct Units units = {0};
+        binary_units(&bin, &units);
+        struct Stats stats;
+        binary_scan(&units, nthreads, &stats);
+        unsigned level = binary_report(&bin, &units, &stats, list_funcs,
+                                       list_all);
+        max_level = level > max_level ? level : max_level;
+        free(units.data);
+        binary_unload(&bin);
+    }
+    if (argc - optind > 1 && max_level)
+        printf("all: x86-64-v%u\n", max_level);
+    return ret;
+}
@@ -2,6 +2,7 @@
 
 import argparse
 import bisect
+import hashlib
 from collections import OrderedDict, defaultdict, namedtuple, Counter
 from enum import Enum
 from itertools import product
@@ -215,6 +216,11 @@ class InstrDesc(NamedTuple):
         operands = tuple(OpKind.parse(op) for op in desc[1:5] if op != "-")
         return cls(mnem, desc[0], operands, flags)
 
+    @property
+    def features(self):
+        return tuple(f for flag in sorted(self.flags) if flag.startswith("F=")
+                       for f in flag[2:].split(","))
+
     def imm_size(self, opsz):
         flags = ENCODINGS[self.encoding]
         if flags.imm_control < 3:
@@ -615,11 +621,409 @@ def superstring(strs):
             merged += realstrs.pop()
     return merged
 
+# Bit positions in EFLAGS of the flags listed in the EFL= column.
+EFLAGS_BITS = (11, 10, 9, 7, 6, 4, 2, 0) # OF DF IF SF ZF AF PF CF
+# Flags are not modified if the (masked) count is zero.
+EFLAGS_COND_COUNT = {"ROL", "ROR", "RCL", "RCR", "SHL", "SHR", "SAR", "SHLD",
+                     "SHRD"}
+
+def eflags_masks(desc):
+    efl = next((f[4:] for f in desc.flags if f.startswith("EFL=")), "--------")
+    read = sum(1 << b for b, c in zip(EFLAGS_BITS, efl) if c in "tM")
+    written = sum(1 << b for b, c in zip(EFLAGS_BITS, efl) if c in "mMu01")
+    undef = sum(1 << b for b, c in zip(EFLAGS_BITS, efl) if c == "u")
+    cond = 0
+    if desc.mnemonic in EFLAGS_COND_COUNT:
+        cond = 1 # EFL_COND_COUNT
+    elif "ENC_REPCC" in desc.flags:
+        cond = 2 # EFL_COND_REP, not modified if REP and rCX is zero
+    return read, written, undef, cond
+
+# Implicit register operands. Each item is access:size:registers, with access
+# r/w/rw and size v = operand size, V = operand size but not for 8-bit
+# operations, a = address size, f = full register (32-bit writes zero-extend),
+# b = always a partial write (AH, AL, AX).
+IMPLICIT_REGS = {
+    "MUL": "r:v:ax w:v:ax w:V:dx", "IMUL": "r:v:ax w:v:ax w:V:dx",
+    "DIV": "rw:v:ax r:V:dx w:V:dx", "IDIV": "rw:v:ax r:V:dx w:V:dx",
+    "C_EX": "r:v:ax w:v:ax", "C_SEP": "r:v:ax w:v:dx",
+    "AAA": "rw:b:ax", "AAS": "rw:b:ax", "DAA": "rw:b:ax", "DAS": "rw:b:ax",
+    "AAM": "rw:b:ax", "AAD": "rw:b:ax", "SALC": "w:b:ax",
+    "LAHF": "w:b:ax", "SAHF": "r:b:ax", "XLATB": "r:a:bx rw:b:ax",
+    "CMPXCHG": "rw:v:ax", "CMPXCHGD": "rw:v:ax,dx r:v:bx,cx",
+    "CPUID": "rw:f:ax,cx w:f:bx,dx", "RDTSC": "w:f:ax,dx",
+    "RDTSCP": "w:f:ax,dx,cx", "RDMSR": "r:f:cx w:f:ax,dx",
+    "WRMSR": "r:f:ax,cx,dx", "WRMSRNS": "r:f:ax,cx,dx",
+    "RDMSRLIST": "rw:f:si,di,cx", "WRMSRLIST": "rw:f:si,di,cx",
+    "RDPMC": "r:f:cx w:f:ax,dx", "RDPRU": "r:f:cx w:f:ax,dx",
+    "XGETBV": "r:f:cx w:f:ax,dx", "XSETBV": "r:f:ax,cx,dx",
+    "RDPKRU": "r:f:cx w:f:ax,dx", "WRPKRU": "r:f:ax,cx,dx",
+    "XSAVE": "r:f:ax,dx", "XSAVEC": "r:f:ax,dx", "XSAVEOPT": "r:f:ax,dx",
+    "XSAVES": "r:f:ax,dx", "XRSTOR": "r:f:ax,dx", "XRSTORS": "r:f:ax,dx",
+    "MONITOR": "r:a:ax r:f:cx,dx", "MONITORX": "r:a:ax r:f:cx,dx",
+    "MWAIT": "r:f:ax,cx", "MWAITX": "r:f:ax,bx,cx",
+    "UMWAIT": "r:f:ax,dx", "TPAUSE": "r:f:ax,dx", "HRESET": "r:f:ax",
+    "INVLPGA": "r:a:ax r:f:cx", "INVLPGB": "r:a:ax r:f:cx,dx",
+    "SKINIT": "r:f:ax", "VMRUN": "r:a:ax", "VMLOAD": "r:a:ax",
+    "VMSAVE": "r:a:ax", "CLZERO": "", "PVALIDATE": "rw:f:ax r:f:cx,dx",
+    "RMPADJUST": "rw:f:ax r:f:cx,dx", "RMPUPDATE": "rw:f:ax r:f:cx",
+    "PSMASH": "rw:f:ax", "PCONFIG": "rw:f:ax r:f:bx,cx,dx",
+    "ENCLS": "rw:f:ax,bx,cx,dx", "ENCLU": "rw:f:ax,bx,cx,dx",
+    "ENCLV": "rw:f:ax,bx,cx,dx", "GETSEC": "rw:f:ax,bx,cx,dx",
+    "SEAMCALL": "rw:f:ax,cx,dx,r8,r9,r10,r11", "SEAMOPS": "rw:f:ax,cx,dx",
+    "SEAMRET": "r:f:ax", "TDCALL": "rw:f:ax,cx,dx,r8,r9,r10,r11",
+    "SYSCALL": "w:f:cx,r11", "SYSRET": "r:f:cx,r11",
+    "SYSENTER": "w:f:sp", "SYSEXIT": "r:f:cx,dx w:f:sp",
+    "LOADIWKEY": "r:f:ax r:-:xmm0", "ENCODEKEY128": "rw:-:xmm0 w:-:xmm1,xmm2,xmm4,xmm5,xmm6",
+    "ENCODEKEY256": "rw:-:xmm0,xmm1 w:-:xmm2,xmm3,xmm4,xmm5,xmm6",
+    "AESENCWIDE128KL": "rw:-:xmm0,xmm1,xmm2,xmm3,xmm4,xmm5,xmm6,xmm7",
+    "AESENCWIDE256KL": "rw:-:xmm0,xmm1,xmm2,xmm3,xmm4,xmm5,xmm6,xmm7",
+    "AESDECWIDE128KL": "rw:-:xmm0,xmm1,xmm2,xmm3,xmm4,xmm5,xmm6,xmm7",
+    "AESDECWIDE256KL": "rw:-:xmm0,xmm1,xmm2,xmm3,xmm4,xmm5,xmm6,xmm7",
+    "SSE_PCMPESTRI": "r:v:ax,dx w:f:cx", "VPCMPESTRI": "r:v:ax,dx w:f:cx",
+    "SSE_PCMPISTRI": "w:f:cx", "VPCMPISTRI": "w:f:cx",
+    "SSE_PCMPESTRM": "r:v:ax,dx rw:-:xmm0", "VPCMPESTRM": "r:v:ax,dx w:-:xmm0",
+    "SSE_PCMPISTRM": "rw:-:xmm0", "VPCMPISTRM": "w:-:xmm0",
+    "SSE_BLENDVPS": "r:-:xmm0", "SSE_BLENDVPD": "r:-:xmm0",
+    "SSE_PBLENDVB": "r:-:xmm0", "SHA256RNDS2": "r:-:xmm0",
+    "MULX": "r:v:dx", "MMX_MASKMOVQ": "r:a:di", "SSE_MASKMOVDQU": "r:a:di",
+    "VMASKMOVDQU": "r:a:di",
+    "VZEROUPPER": "rw:-:" + ",".join(f"xmm{i}" for i in range(16)),
+    "VZEROALL": "w:-:" + ",".join(f"xmm{i}" for i in range(16)),
+    # Stack
+    "PUSH": "rw:f:sp", "POP": "rw:f:sp", "PUSHF": "rw:f:sp", "POPF": "rw:f:sp",
+    "CALL": "rw:f:sp", "CALLF": "rw:f:sp", "RET": "rw:f:sp", "RETF": "rw:f:sp",
+    "INT": "rw:f:sp", "INT1": "rw:f:sp", "INT3": "rw:f:sp", "INTO": "rw:f:sp",
+    "IRET": "rw:f:sp", "UIRET": "rw:f:sp", "ERETS": "rw:f:sp",
+    "ERETU": "rw:f:sp", "ENTER": "rw:f:sp,bp", "LEAVE": "rw:f:sp,bp",
+    "PUSHA": "r:v:ax,cx,dx,bx,bp,si,di rw:f:sp",
+    "POPA": "w:v:ax,cx,dx,bx,bp,si,di rw:f:sp",
+    # String instructions, rCX for REP is added separately
+    "MOVS": "rw:a:si,di", "CMPS": "rw:a:si,di", "LODS": "rw:a:si w:v:ax",
+    "STOS": "rw:a:di r:v:ax", "SCAS": "rw:a:di r:v:ax",
+    "INS": "rw:a:di r:f:dx", "OUTS": "rw:a:si r:f:dx",
+    "IN": "r:f:dx w:v:ax", "OUT": "r:f:dx,ax",
+    "XSTORE": "rw:a:di r:f:dx w:f:ax", "REP_XSTORE": "rw:a:di,cx r:f:dx w:f:ax",
+    "REP_XCRYPTECB": "rw:a:si,di,cx r:a:bx,dx", "REP_XCRYPTCBC": "rw:a:si,di,cx,ax r:a:bx,dx",
+    "REP_XCRYPTCTR": "rw:a:si,di,cx,ax r:a:bx,dx", "REP_XCRYPTCFB": "rw:a:si,di,cx,ax r:a:bx,dx",
+    "REP_XCRYPTOFB": "rw:a:si,di,cx,ax r:a:bx,dx", "REP_XSHA1": "rw:a:si,di,cx,ax",
+    "REP_XSHA256": "rw:a:si,di,cx,ax", "REP_MONTMUL": "rw:f:ax,cx,dx,si,di",
+    "LOOP": "rw:a:cx", "LOOPZ": "rw:a:cx", "LOOPNZ": "rw:a:cx", "JCXZ": "r:a:cx",
+    # x87, only for the forms without explicit register operands
+    "FADD": "rw:-:st0", "FSUB": "rw:-:st0", "FSUBR": "rw:-:st0",
+    "FMUL": "rw:-:st0", "FDIV": "rw:-:st0", "FDIVR": "rw:-:st0",
+    "FIADD": "rw:-:st0", "FISUB": "rw:-:st0", "FISUBR": "rw:-:st0",
+    "FIMUL": "rw:-:st0", "FIDIV": "rw:-:st0", "FIDIVR": "rw:-:st0",
+    "FCOM": "r:-:st0", "FUCOM": "r:-:st0", "FCOMI": "r:-:st0",
+    "FUCOMI": "r:-:st0", "FICOM": "r:-:st0", "FST": "r:-:st0",
+    "FIST": "r:-:st0", "FTST": "r:-:st0", "FXAM": "r:-:st0",
+    "FCHS": "rw:-:st0", "FABS": "rw:-:st0", "FSQRT": "rw:-:st0",
+    "FRNDINT": "rw:-:st0", "FSIN": "rw:-:st0", "FCOS": "rw:-:st0",
+    "F2XM1": "rw:-:st0", "FSCALE": "rw:-:st0 r:-:st1", "FPREM": "rw:-:st0 r:-:st1",
+    "FPREM1": "rw:-:st0 r:-:st1", "FCMOVB": "rw:-:st0", "FCMOVBE": "rw:-:st0",
+    "FCMOVE": "rw:-:st0", "FCMOVNB": "rw:-:st0", "FCMOVNBE": "rw:-:st0",
+    "FCMOVNE": "rw:-:st0", "FCMOVNU": "rw:-:st0", "FCMOVU": "rw:-:st0",
+    "FXCH": "rw:-:st0", "FINIT": "w:-:" + ",".join(f"st{i}" for i in range(8)),
+    "FRSTOR": "w:-:" + ",".join(f"st{i}" for i in range(8)),
+    "FLDENV": "w:-:" + ",".join(f"st{i}" for i in range(8)),
+    "MMX_EMMS": "w:-:" + ",".join(f"st{i}" for i in range(8)),
+    "FEMMS": "w:-:" + ",".join(f"st{i}" for i in range(8)),
+}
+# Explicit operand counts for which the implicit registers apply, if the
+# mnemonic also has other forms.
+IMPLICIT_NOPS = {
+    "IMUL": (1,), "IN": (0,), "OUT": (0,), "FXCH": (1,),
+    "FADD": (1,), "FSUB": (1,), "FSUBR": (1,), "FMUL": (1,), "FDIV": (1,),
+    "FDIVR": (1,), "FCOM": (0, 1), "FUCOM": (0, 1), "FCOMI": (1,),
+    "FUCOMI": (1,),
+}
+# x87 instructions which push or pop the register stack, all ST(i) change.
+REGS_FPU_STACK = {
+    "FLD", "FILD", "FBLD", "FLD1", "FLDL2E", "FLDL2T", "FLDLG2", "FLDLN2",
+    "FLDPI", "FLDZ", "FSTP", "FSTPNCE", "FISTP", "FISTTP", "FBSTP", "FADDP",
+    "FSUBP", "FSUBRP", "FMULP", "FDIVP", "FDIVRP", "FCOMP", "FCOMPP", "FUCOMP",
+    "FUCOMPP", "FCOMIP", "FUCOMIP", "FICOMP", "FINCSTP", "FDECSTP", "FFREEP",
+    "FXTRACT", "FPTAN", "FSINCOS", "FPATAN", "FYL2X", "FYL2XP1",
+}
+# Instructions saving (1) or restoring (2) the FPU/vector register state.
+REGS_STATE = {
+    "FSAVE": 1, "FXSAVE": 1, "XSAVE": 1, "XSAVEC": 1, "XSAVEOPT": 1,
+    "XSAVES": 1, "FXRSTOR": 2, "XRSTOR": 2, "XRSTORS": 2,
+}
+# No explicit operand is written.
+REGS_OPS_READ = {
+    "CMP", "TEST", "BT", "PUSH", "PUSH_SEG", "CALL", "CALLF", "JMP", "JMPF",
+    "JCXZ", "LOOP", "LOOPZ", "LOOPNZ", "XBEGIN", "RET", "RETF", "INT",
+    "ENTER", "HRESET", "XABORT", "BOUND", "VERR", "VERW", "LLDT", "LTR",
+    "LMSW", "LKGS", "LGDT", "LIDT", "INVLPG", "INVEPT", "INVPCID", "INVVPID",
+    "CLFLUSH", "CLFLUSHOPT", "CLWB", "CLDEMOTE", "PTWRITE", "WRFSBASE",
+    "WRGSBASE", "INCSSP", "SENDUIPI", "UMONITOR", "TPAUSE", "UMWAIT", "NOP",
+    "RESERVED_NOP", "UD0", "UD1", "LDMXCSR", "VLDMXCSR", "FLDCW", "FLDENV",
+    "FRSTOR", "FXRSTOR", "XRSTOR", "XRSTORS", "RSTORSSP", "VMPTRLD",
+    "VMCLEAR", "VMXON", "VMWRITE", "ENQCMD", "ENQCMDS", "MOVDIR64B", "OUT",
+    "CLZERO", "MMX_MASKMOVQ", "SSE_MASKMOVDQU", "VMASKMOVDQU", "SSE_PTEST",
+    "VPTEST", "VTESTPS", "VTESTPD", "SSE_COMISS", "SSE_COMISD",
+    "SSE_UCOMISS", "SSE_UCOMISD", "VCOMISS", "VCOMISD", "VUCOMISS",
+    "VUCOMISD", "EVX_COMISS", "EVX_COMISD", "EVX_COMISH", "EVX_UCOMISS",
+    "EVX_UCOMISD", "EVX_UCOMISH", "SSE_PCMPESTRI", "SSE_PCMPESTRM",
+    "SSE_PCMPISTRI", "SSE_PCMPISTRM", "VPCMPESTRI", "VPCMPESTRM",
+    "VPCMPISTRI", "VPCMPISTRM", "FCOM", "FCOMP", "FCOMPP", "FUCOM", "FUCOMP",
+    "FUCOMPP", "FCOMI", "FCOMIP", "FUCOMI", "FUCOMIP", "FICOM", "FICOMP",
+    "FLD", "FILD", "FBLD", "FCMOVB", "FCMOVBE", "FCMOVE", "FCMOVNB",
+    "FCMOVNBE", "FCMOVNE", "FCMOVNU", "FCMOVU", "FIADD", "FISUB", "FISUBR",
+    "FIMUL", "FIDIV", "FIDIVR", "LOADIWKEY", "MUL", "DIV", "IDIV",
+}
+# The first explicit operand is read and written.
+REGS_OPS_RMW = {
+    "ADD", "OR", "ADC", "SBB", "AND", "SUB", "XOR", "INC", "DEC", "NEG", "NOT",
+    "ROL", "ROR", "RCL", "RCR", "SHL", "SHR", "SAR", "SHLD", "SHRD", "BTS",
+    "BTR", "BTC", "BSF", "BSR", "BSWAP", "CRC32", "ADCX", "ADOX", "LAR",
+    "LSL", "ARPL", "AADD", "AAND", "AOR", "AXOR", "XADD", "XCHG", "XCHG_NOP",
+    "CMPXCHG", "CMPXCHGD", "AESENC128KL", "AESENC256KL", "AESDEC128KL",
+    "AESDEC256KL", "FXCH", "EVX_FIXUPIMMPD", "EVX_FIXUPIMMPS",
+    "EVX_FIXUPIMMSD", "EVX_FIXUPIMMSS",
+}
+# The second explicit operand is read and written.
+REGS_OPS_RMW2 = {"XADD", "XCHG", "XCHG_NOP", "FXCH"}
+REGS_OPS_RMW_REGEX = re.compile(r"^(CMOV|CMP.*XADD$|(EVX_|V)(F(N?M(ADD|SUB)|"
+                                r"MADDSUB|MSUBADD)\d|FC?MADDC|PERM[IT]2|PDP|"
+                                r"PMADD52|PTERNLOG|PSH[LR]DV|DPBF16|P?GATHER))")
+# Legacy MMX instructions which do not read their destination.
+REGS_MMX_WRITE = {"MMX_MOVD", "MMX_MOVQ", "MMX_MOVD_M2G", "MMX_MOVD_G2M",
+                  "MMX_MOVQ_M2G", "MMX_MOVQ_G2M", "SSE_MOVDQ2Q", "MMX_PSHUFW",
+                  "SSE_CVTPS2PI", "SSE_CVTTPS2PI", "SSE_CVTPD2PI",
+                  "SSE_CVTTPD2PI"}
+
+def regs_desc_ops(opcode, desc, mem=False):
+    mnem, ops = desc.mnemonic, desc.operands
+    access = [1] * len(ops) # read
+    if not ops or mnem in REGS_OPS_READ or (mnem == "IMUL" and len(ops) == 1):
+        return access
+    if mnem in REGS_FPU_STACK or mnem in ("FXSAVE", "FSAVE", "FSTENV",
+                                          "FSTCW", "FSTSW", "FST", "FIST",
+                                          "FFREE", "FNSTSW"):
+        access[0] = 2
+    elif (mnem in REGS_OPS_RMW or REGS_OPS_RMW_REGEX.match(mnem) or
+          (mnem == "IMUL" and len(ops) == 2) or
+          # Legacy SSE/MMX register writes are partial, memory writes are not.
+          (not mem and ops[0].kind == "XMM" and opcode.vex == 0 and
+           ops[0].regkind != "W") or
+          (not mem and ops[0].kind == "MMX" and mnem not in REGS_MMX_WRITE) or
+          (ops[0].kind == "FPU" and len(ops) == 2)):
+        access[0] = 3
+    else:
+        access[0] = 2
+    if mnem in REGS_OPS_RMW2 and len(ops) > 1:
+        access[1] = 3
+    if mnem.startswith("CMP") and mnem.endswith("XADD"):
+        access[1] = 3
+    if mnem == "MULX":
+        access[1] = 2 # low half of the product
+    if mnem.startswith("VPGATHER") or mnem.startswith("VGATHER"):
+        access[2] = 3 # mask register is cleared
+    return access
+
+REGS_GP_NAMES = ("ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "r8", "r9",
+                 "r10", "r11", "r12", "r13", "r14", "r15")
+REGS_SIZES = "vVafb" # see REGS_SZ_* in info.c
+
+def regs_desc(opcode, desc, mnem):
+    access = regs_desc_ops(opcode, desc)
+    ops = [0] * 5
+    ops[len(access)] = sum(a << (2 * i) for i, a in enumerate(access))
+    impl_nops = 0x1f
+    if mnem in IMPLICIT_NOPS:
+        impl_nops = sum(1 << n for n in IMPLICIT_NOPS[mnem])
+    flags = 0
+    if "ENC_REP" in desc.flags or "ENC_REPCC" in desc.flags:
+        flags |= 1 # REGS_REP_RCX
+    if "VSIB" in desc.flags:
+        flags |= 2 # REGS_VSIB
+    if mnem in REGS_FPU_STACK:
+        flags |= 4 # REGS_FPU_STACK
+    flags |= {1: 8, 2: 16}.get(REGS_STATE.get(mnem), 0) # REGS_STATE_READ/WRITE
+    if re.match(r"^EVX_P?(GATHER|SCATTER)", mnem):
+        flags |= 64 # REGS_MASK_WRITE, the mask register is cleared
+    if opcode.vex == 0:
+        flags |= 32 # REGS_VEC_PARTIAL, legacy SSE keeps the upper vector part
+    fpu, vec, gp = [0, 0], [0, 0], [[0] * 5, [0] * 5]
+    for item in IMPLICIT_REGS.get(mnem, "").split():
+        acc, size, regs = item.split(":")
+        for reg in regs.split(","):
+            for i, c in enumerate("rw"):
+                if c not in acc:
+                    continue
+                if reg.startswith("xmm"):
+                    vec[i] |= 1 << int(reg[3:])
+                elif reg.startswith("st"):
+                    fpu[i] |= 1 << int(reg[2:])
+                else:
+                    gp[i][REGS_SIZES.index(size)] |= 1 << REGS_GP_NAMES.index(reg)
+    return (tuple(ops), impl_nops, flags, *fpu, *vec, tuple(gp[0]), tuple(gp[1]))
+
+def regs_desc_merge(a, b):
+    if a is None:
+        return b
+    ops = tuple(x | y for x, y in zip(a[0], b[0]))
+    return (ops,) + a[1:3] + (a[3] | b[3],) + a[4:]
+
+# Memory operands which are not accessed at all, or only read although the
+# register form writes its (first) operand.
+MEM_NONE = {
+    "LEA", "NOP", "RESERVED_NOP", "PREFETCH", "PREFETCHW", "PREFETCHWT1",
+    "PREFETCHNTA", "PREFETCHT0", "PREFETCHT1", "PREFETCHT2", "PREFETCHIT0",
+    "PREFETCHIT1", "RESERVED_PREFETCH", "CLFLUSH", "CLFLUSHOPT", "CLWB",
+    "CLDEMOTE", "INVLPG", "UD0", "UD1",
+}
+MEM_READ = {
+    "FLD", "FILD", "FBLD", "FADD", "FMUL", "FSUB", "FSUBR", "FDIV", "FDIVR",
+    "AESENCWIDE128KL", "AESENCWIDE256KL", "AESDECWIDE128KL", "AESDECWIDE256KL",
+}
+# Memory operand sizes not given by the operand size; see MEM_SZ_* in info.c.
+# The 16-bit x87 environment formats (66h prefix) are not distinguished.
+MEM_SIZES = {
+    "FLD": (0, 10), "FSTP": (0, 10), "FBLD": (0, 10), "FBSTP": (0, 10),
+    "FLDENV": (1, 28), "FSTENV": (1, 28), "FRSTOR": (1, 108), "FSAVE": (1, 108),
+    "FXSAVE": (1, 512), "FXRSTOR": (1, 512),
+    "XSAVE": (1, 0), "XSAVEC": (1, 0), "XSAVEOPT": (1, 0), "XSAVES": (1, 0),
+    "XRSTOR": (1, 0), "XRSTORS": (1, 0),
+    "AESENC128KL": (1, 48), "AESDEC128KL": (1, 48),
+    "AESENCWIDE128KL": (1, 48), "AESDECWIDE128KL": (1, 48),
+    "AESENC256KL": (1, 64), "AESDEC256KL": (1, 64),
+    "AESENCWIDE256KL": (1, 64), "AESDECWIDE256KL": (1, 64),
+    "LGDT": (2, 0), "LIDT": (2, 0), "SGDT": (2, 0), "SIDT": (2, 0),
+    "CMPXCHGD": (3, 0), "BOUND": (3, 0),
+    "JMPF": (4, 0), "CALLF": (4, 0), "LDS": (4, 0), "LES": (4, 0),
+    "LFS": (4, 0), "LGS": (4, 0), "LSS": (4, 0),
+}
+
+def mem_desc(opcode, desc, mnem):
+    access = regs_desc_ops(opcode, desc, mem=True)
+    if mnem in MEM_NONE:
+        access = [0] * len(access)
+    elif mnem in MEM_READ and access:
+        access[0] = 1
+    # Only operands which can refer to memory; a register destination of the
+    # same mnemonic must not leak its read-modify-write access.
+    oporder = ENCODING_OPORDER[desc.encoding]
+    has_mem = not opcode.opcext and (opcode.modreg or (0, "m"))[1] != "r"
+    access = [a if op.kind == "MEM" or (has_mem and oporder[i] == "modrm") else 0
+              for i, (a, op) in enumerate(zip(access, desc.operands))]
+    ops = [0] * 5
+    ops[len(access)] = sum(a << (2 * i) for i, a in enumerate(access))
+    kind, value = MEM_SIZES.get(mnem, (0, 0))
+    if mnem in MEM_NONE:
+        kind = 1
+    return tuple(ops), kind << 12 | value
+
+def mem_desc_merge(a, b):
+    if a is None:
+        return b
+    if a[1] != b[1]:
+        raise Exception(f"conflicting memory sizes {a[1]:#x}/{b[1]:#x}")
+    return tuple(x | y for x, y in zip(a[0], b[0])), a[1]
+
+# Control-flow kinds, see FdCfKind in fadec.h. CF_INDIRECT marks mnemonics
+# which are indirect if the first operand is a register or memory.
+CF_NONE, CF_JMP, CF_JMP_IND, CF_JCC, CF_LOOP, CF_CALL, CF_CALL_IND, CF_RET, \
+    CF_SYSCALL, CF_FAR, CF_TRAP = range(11)
+CF_INDIRECT = 0x80
+CF_KINDS = {
+    "JMP": CF_JMP | CF_INDIRECT, "CALL": CF_CALL | CF_INDIRECT, "RET": CF_RET,
+    "LOOP": CF_LOOP, "LOOPZ": CF_LOOP, "LOOPNZ": CF_LOOP, "JCXZ": CF_LOOP,
+    "XBEGIN": CF_JCC,
+    "SYSCALL": CF_SYSCALL, "SYSENTER": CF_SYSCALL, "INT": CF_SYSCALL,
+    "VMCALL": CF_SYSCALL, "VMMCALL": CF_SYSCALL, "TDCALL": CF_SYSCALL,
+    "SEAMCALL": CF_SYSCALL,
+    "JMPF": CF_FAR, "CALLF": CF_FAR, "RETF": CF_FAR, "IRET": CF_FAR,
+    "SYSRET": CF_FAR, "SYSEXIT": CF_FAR, "UIRET": CF_FAR, "ERETU": CF_FAR,
+    "ERETS": CF_FAR, "RSM": CF_FAR, "SEAMRET": CF_FAR, "VMLAUNCH": CF_FAR,
+    "VMRESUME": CF_FAR,
+    "INT3": CF_TRAP, "INT1": CF_TRAP, "INTO": CF_TRAP, "UD0": CF_TRAP,
+    "UD1": CF_TRAP, "UD2": CF_TRAP,
+}
+
+def cf_kind(desc, mnem):
+    if mnem in CF_KINDS:
+        return CF_KINDS[mnem]
+    if mnem.startswith("J") and any(op.regkind == "J" for op in desc.operands):
+        return CF_JCC
+    return CF_NONE
+
+# x86-64 micro-architecture levels (psABI) of features; all AVX-512 features
+# require x86-64-v4 hardware. CMPXCHG16B and LAHF/SAHF are handled in info.c.
+ISA_LEVELS = {
+    "SSE3": 2, "SSSE3": 2, "SSE41": 2, "SSE42": 2, "POPCNT": 2,
+    "AVX": 3, "AVX2": 3, "BMI1": 3, "BMI2": 3, "F16C": 3, "FMA": 3,
+    "LZCNT": 3, "MOVBE": 3,
+}
+
+def isa_level(features):
+    return max([1] + [4 if f.startswith("AVX512") else ISA_LEVELS.get(f, 1)
+                      for f in features])
+
+# Cost model data, see costs.txt. Returns the micro-architectures as tuples
+# (name, width, load latency, load ports, store ports, port names) and the
+# rules as (regex, form, [(uops, latency, ports) per micro-architecture]).
+def parse_costs(lines):
+    def ports(s):
+        return 0 if s == "-" else sum(1 << int(c, 16) for c in s)
+    uarchs, rules = [], []
+    for line in lines:
+        line = line.split("#", 1)[0].split()
+        if not line:
+            continue
+        if line[0][0] == "@":
+            name, width, load_lat, load_ports, store_ports, *names = line
+            store_ports = [ports(p) for p in store_ports.split(",")]
+            if len(store_ports) > 2 or len(names) > 16:
+                raise Exception(f"too many store uops or ports in {name}")
+            uarchs.append((name[1:], int(width), int(load_lat),
+                           ports(load_ports), store_ports, names))
+            continue
+        pattern, form = (line[0].rsplit(":", 1) + [""])[:2]
+        if len(line) != len(uarchs) + 1 or form not in ("", "r", "m"):
+            raise Exception(f"invalid cost line {' '.join(line)}")
+        costs = []
+        for cost in line[1:]:
+            uops, latency, port_str = cost.split("/")
+            costs.append((int(uops), int(latency), ports(port_str)))
+        rules.append((re.compile(pattern), form, costs))
+    return uarchs, rules
+
+def cost_desc(rules, uarch_idx, mnem, form):
+    for pattern, rule_form, costs in rules:
+        if rule_form in ("", form) and pattern.fullmatch(mnem):
+            return costs[uarch_idx]
+    raise Exception(f"no cost for {mnem}:{form}")
+
+# AT&T size suffix classes, see fd_format_att in format.c. Mnemonics get a
+# suffix if the size of their memory operand is not fixed (and not implied by
+# a register operand).
+ATT_SUFFIX_NONE, ATT_SUFFIX_GP, ATT_SUFFIX_FLOAT, ATT_SUFFIX_INT = range(4)
+
+def att_mem_sizes(desc):
+    if "ENC_NOSZ" in desc.flags:
+        return set()
+    return {op.size for op in desc.operands
+            if op.regkind in "EMO" and op.size in (-1, 1, 2, 4, 8, 10)}
+
+def att_suffix(mnem, sizes):
+    if mnem in ("JMP", "CALL", "JMPF", "CALLF") or not (-1 in sizes or len(sizes) > 1):
+        return ATT_SUFFIX_NONE
+    if mnem.startswith("FI"):
+        return ATT_SUFFIX_INT
+    return ATT_SUFFIX_FLOAT if mnem.startswith("F") else ATT_SUFFIX_GP
+
 def decode_table(entries, args):
     modes = args.modes
 
     trie = Trie(root_count=len(modes))
     mnems, descs, desc_map = set(), [], {}
+    mnem_eflags = defaultdict(lambda: (0, 0, 0, 0))
+    mnem_regs, mnem_mem, mnem_cf = {}, {}, {}
+    mnem_features = defaultdict(set)
+    mnem_att_sizes = defaultdict(set)
     for weak, opcode, desc in entries:
         ign66 = opcode.prefix in ("NP", "66", "F2", "F3")
         modrm = opcode.modreg or opcode.opcext
@@ -635,6 +1039,16 @@ def decode_table(entries, args):
             "VMOVQ_X2G": "VMOVQ", "VMOVQ_G2X": "VMOVQ",
         }.get(desc.mnemonic, desc.mnemonic)
         mnems.add(mnem)
+        mnem_eflags[mnem] = tuple(a | b for a, b in zip(mnem_eflags[mnem],
+                                                       eflags_masks(desc)))
+        mnem_regs[mnem] = regs_desc_merge(mnem_regs.get(mnem),
+                                          regs_desc(opcode, desc, mnem))
+        mnem_mem[mnem] = mem_desc_merge(mnem_mem.get(mnem),
+                                        mem_desc(opcode, desc, mnem))
+        if mnem_cf.setdefault(mnem, cf_kind(desc, mnem)) != cf_kind(desc, mnem):
+            raise Exception(f"conflicting control-flow kinds for {mnem}")
+        mnem_features[mnem] |= set(desc.features)
+        mnem_att_sizes[mnem] |= att_mem_sizes(desc)
         descenc = desc.encode(mnem, ign66, modrm)
         desc_idx = desc_map.get(descenc)
         if desc_idx is None:
@@ -670,7 +1084,56 @@ def decode_table(entries, args):
               f"Mnems -- {len(mnemonics_str)} + {3*len(mnemonics_intel)} bytes")
 
     defines = ["FD_TABLE_OFFSET_%d %d\n"%k for k in zip(modes, root_offsets)]
-
+    # Identifies the decoded instruction types, lengths and control flow, e.g.
+    # to detect stale persistent indexes.
+    table_hash = hashlib.sha256(repr((table_data, descs, mnems,
+                                      [mnem_cf[mnem] for mnem in mnems]))
+                                .encode()).digest()
+    defines.append(f"FD_TABLE_HASH {int.from_bytes(table_hash[:8], 'little'):#018x}\n")
+
+    regs_descs = sorted(set(mnem_regs.values()))
+    regs_idx = {d: i for i, d in enumerate(regs_descs)}
+    def regs_fmt(d):
+        ops, impl_nops, flags, fr, fw, vr, vw, gr, gw = d
+        return (f"{{{{{','.join(map(str, ops))}}},{impl_nops:#x},{flags:#x},"
+                f"{fr:#x},{fw:#x},{vr:#x},{vw:#x},"
+                f"{{{','.join(map(hex, gr))}}},{{{','.join(map(hex, gw))}}}}}")
+
+    mem_descs = sorted(set(mnem_mem.values()))
+    mem_idx = {d: i for i, d in enumerate(mem_descs)}
+
+    features = sorted(set().union(*mnem_features.values()))
+    if len(features) > 128: # FD_FEATURE_WORDS
+        raise Exception("too many features")
+    feature_lines = [f"FD_FEATURE({f.replace('-', '_')},{i})\n"
+                     for i, f in enumerate(features)]
+    def feature_desc(mnem):
+        mask = sum(1 << features.index(f) for f in mnem_features[mnem])
+        return mask & (2**64-1), mask >> 64, isa_level(mnem_features[mnem])
+    feature_descs = sorted(set(feature_desc(mnem) for mnem in mnems))
+    feature_idx = {d: i for i, d in enumerate(feature_descs)}
+    if len(feature_descs) > 256:
+        raise Exception("too many feature sets")
+
+    if not args.costs:
+        raise Exception("decode table requires --costs")
+    uarchs, cost_rules = parse_costs(args.costs.read().splitlines())
+    mnem_costs = [cost_desc(cost_rules, i, mnem, form)
+                  for i in range(len(uarchs)) for mnem in mnems
+                  for form in ("r", "m")]
+    cost_descs = sorted(set(mnem_costs))
+    cost_idx = {d: i for i, d in enumerate(cost_descs)}
+    if len(cost_descs) > 256 or any(max(d[:2]) > 255 for d in cost_descs):
+        raise Exception("too many or too large costs")
+    def uarch_fmt(u):
+        name, width, load_lat, load_ports, store_ports, names = u
+        return (f'{{"{name}",{width},{len(names)},{load_lat},{load_ports:#x},'
+                f'{len(store_ports)},{{{",".join(map(hex, store_ports))}}},'
+                f'{{{",".join(f"{chr(34)}{n}{chr(34)}" for n in names)}}}}}')
+    uarch_lines = [f"FD_UARCH({u[0]},{i})\n" for i, u in enumerate(uarchs)]
+
+    decode_mnems_lines += ["#if defined(FD_FEATURE)\n", *feature_lines, "#endif\n"]
+    decode_mnems_lines += ["#if defined(FD_UARCH)\n", *uarch_lines, "#endif\n"]
     return "".join(decode_mnems_lines), f"""// Auto-generated file -- do not modify!
 #if defined(FD_DECODE_TABLE_DATA)
 {"".join(f"{e:#06x}," for e in table_data)}
@@ -682,6 +1145,32 @@ def decode_table(entries, args):
 {",".join(str(mnemonics_str.index(mnem)) for mnem in mnemonics_intel)}
 #elif defined(FD_DECODE_TABLE_STRTAB3)
 {",".join(str(len(mnem)) for mnem in mnemonics_intel)}
+#elif defined(FD_DECODE_TABLE_ATT_SUFFIX)
+{",".join(str(att_suffix(mnem, mnem_att_sizes[mnem])) for mnem in mnems)}
+#elif defined(FD_DECODE_TABLE_EFLAGS)
+{",".join("{%#x,%#x,%#x,%d}"%mnem_eflags[mnem] for mnem in mnems)}
+#elif defined(FD_DECODE_TABLE_REGS)
+{",".join(regs_fmt(d) for d in regs_descs)}
+#elif defined(FD_DECODE_TABLE_REGS_IDX)
+{",".join(str(regs_idx[mnem_regs[mnem]]) for mnem in mnems)}
+#elif defined(FD_DECODE_TABLE_MEM)
+{",".join("{{%s},%#x}"%(",".join(map(str, d[0])), d[1]) for d in mem_descs)}
+#elif defined(FD_DECODE_TABLE_MEM_IDX)
+{",".join(str(mem_idx[mnem_mem[mnem]]) for mnem in mnems)}
+#elif defined(FD_DECODE_TABLE_CF)
+{",".join(f"{mnem_cf[mnem]:#x}" for mnem in mnems)}
+#elif defined(FD_DECODE_TABLE_FEATURES)
+{",".join("{{%#x,%#x},%d}"%d for d in feature_descs)}
+#elif defined(FD_DECODE_TABLE_FEATURES_IDX)
+{",".join(str(feature_idx[feature_desc(mnem)]) for mnem in mnems)}
+#elif defined(FD_DECODE_TABLE_FEATURE_NAMES)
+{",".join(f'"{f}"' for f in features)}
+#elif defined(FD_DECODE_TABLE_UARCHS)
+{",".join(uarch_fmt(u) for u in uarchs)}
+#elif defined(FD_DECODE_TABLE_COSTS)
+{",".join("{%d,%d,%#x}"%d for d in cost_descs)}
+#elif defined(FD_DECODE_TABLE_COSTS_IDX)
+{",".join(str(cost_idx[d]) for d in mnem_costs)}
 #elif defined(FD_DECODE_TABLE_DEFINES)
 {"".join("#define " + line for line in defines)}
 #else
@@ -1023,12 +1512,125 @@ def encode2_table(entries, args):
 
     return enc_decls, enc_code
 
+CORPUS_FAMILIES = ("base", "x87", "mmx", "sse", "avx", "bmi", "avx512",
+                   "system", "other")
+CORPUS_SYSTEM_FEATURES = {"VMX", "SVM", "SGX", "SEAM", "SMX", "SNP", "SEVES",
+                          "SKINIT", "INVLPGB", "UINTR", "FRED", "MSRLIST",
+                          "WRMSRNS", "PCONFIG", "HRESET", "ENQCMD"}
+CORPUS_BASE_FEATURES = {"LM", "486", "586", "686", "CMOV", "RDTSCP", "RDRAND",
+                        "RDSEED", "RDPID", "FSGSBASE", "CET", "CLFLSH",
+                        "CLFLUSHOPT", "CLWB", "PREFETCHW", "SERIALIZE",
+                        "XSAVE", "XSAVEOPT", "XSAVEC", "XSS", "FXSR", "HLERTM"}
+
+def corpus_family(opcode, desc):
+    feats = set(desc.features)
+    kinds = {op.kind for op in desc.operands}
+    if "CPL0" in desc.flags or feats & CORPUS_SYSTEM_FEATURES or kinds & {"CR", "DR"}:
+        return "system"
+    if opcode.vex == 2 or any(f.startswith("AVX512") for f in feats):
+        return "avx512"
+    if opcode.vex:
+        return "avx" if kinds & {"XMM"} else "bmi"
+    if "387" in feats:
+        return "x87"
+    if "MMX" in kinds or feats & {"MMX", "3DNOW"}:
+        return "mmx"
+    if "XMM" in kinds:
+        return "sse"
+    if feats & {"BMI1", "BMI2", "LZCNT", "POPCNT", "ADX", "MOVBE"}:
+        return "bmi"
+    if not feats or feats <= CORPUS_BASE_FEATURES:
+        return "base"
+    return "other"
+
+def corpus_table(entries, args):
+    rows = []
+    def emit_row(enc, family, flags, ops, extra):
+        opstr = ",".join(f"{{'{ot}',CK_{kind},{size},{fixed},{slot}}}"
+                         for ot, kind, size, fixed, slot in ops)
+        opstr = f",.ops={{{opstr}}}" if ops else ""
+        rows.append(f"{{{extra}.enc={enc},.family={CORPUS_FAMILIES.index(family)},"
+                    f".flags={flags:#x},.nops={len(ops)}{opstr}}},\n")
+
+    # Legacy and VEX instructions are generated using the encoder, the
+    # mnemonics match the FE_* constants from the encode table.
+    for (mnem, opsize, ots), variants in encode_mnems(entries).items():
+        opcode, desc = variants[0]
+        supports_high_regs = desc.mnemonic in ("MOVSX", "MOVZX") or opsize == 8
+        flags = 0
+        if mnem.startswith(("LOCK_", "REP_", "REPZ_", "REPNZ_")) or opsize == 16:
+            flags |= 1 # CORPUS_PREFIXED
+        if "VSIB" in desc.flags:
+            flags |= 2 # CORPUS_VSIB
+        ops = []
+        for i, (ot, op) in enumerate(zip(ots, desc.operands)):
+            size, fixed = 0, -1
+            if ot == "r":
+                kind = op.kind
+                if (kind == "GP" and supports_high_regs and
+                    op.abssize(opsize//8) == 1):
+                    kind = "GP8H"
+                # Implicit registers without VEX prefix are fixed, e.g. CL.
+                fixed_vals = set()
+                for opc, var in variants:
+                    enc = ENCODINGS[var.encoding]
+                    if enc.vexreg_idx and enc.vexreg_idx ^ 3 == i and not opc.vex:
+                        fixed_vals.add(enc.zeroreg_val)
+                    else:
+                        fixed_vals.add(-1)
+                if len(fixed_vals) == 1:
+                    fixed = fixed_vals.pop()
+            elif ot == "m":
+                kind = "MEM"
+            elif ot == "a":
+                kind = "MOFFS"
+            else:
+                kind = "OFF" if ot == "o" else "IMM"
+                size = max(var.imm_size(opsize//8) for _, var in variants)
+            ops.append((ot, kind, size, fixed, 0))
+        emit_row(opcode.vex, corpus_family(opcode, desc), flags, ops,
+                 f".mnem=FE_{mnem},")
+
+    # EVEX instructions are not supported by the encoder; they are described
+    # by their opcode and assembled by the corpus generator itself.
+    for weak, opcode, desc in entries:
+        if opcode.vex != 2 or "I64" in desc.flags:
+            continue
+        flags = 0
+        if "VSIB" in desc.flags: flags |= 2 # CORPUS_VSIB
+        if "MASK" in desc.flags: flags |= 4 # CORPUS_MASK
+        if "BCST" in desc.flags: flags |= 8 # CORPUS_BCST
+        if "SAE" in desc.flags: flags |= 0x10 # CORPUS_SAE
+        if "ER" in desc.flags: flags |= 0x20 # CORPUS_ER
+        ops = []
+        for i, op in enumerate(desc.operands):
+            slot = ENCODING_OPORDER[desc.encoding][i]
+            size = 0
+            if slot == "imm":
+                ot, kind, size = "i", "IMM", 1
+            elif slot == "modrm" and op.kind != "MEM":
+                ot, kind = "M", op.kind
+            else:
+                ot, kind = "rm"[op.kind == "MEM"], op.kind
+            ops.append((ot, kind, size, -1, ENCODING_OPTYS.index(slot)))
+        modreg, mod = opcode.modreg or (None, "rm")
+        vexl = {None: 7, "IG": 7, "0": 1, "1": 2, "2": 4, "12": 6}[opcode.vexl]
+        evex = (f".evex={{{['NP', '66', 'F3', 'F2'].index(opcode.prefix)},"
+                f"{opcode.escape},{ {'0': 0, '1': 1, None: 2}[opcode.rexw]},"
+                f"{vexl},{opcode.opc:#x},{-1 if modreg is None else modreg},"
+                f"'{mod[0] if len(mod) == 1 else 'b'}'}},")
+        emit_row(2, corpus_family(opcode, desc), flags, ops, evex)
+
+    families = "".join(f"CORPUS_FAMILY({f})\n" for f in CORPUS_FAMILIES)
+    return families, "// Auto-generated file -- do not modify!\n" + "".join(rows)
+
 
 if __name__ == "__main__":
     generators = {
         "decode": decode_table,
         "encode": encode_table,
         "encode2": encode2_table,
+        "corpus": corpus_table,
     }
 
     parser = argparse.ArgumentParser()
@@ -1036,6 +1638,7 @@ if __name__ == "__main__":
     parser.add_argument("--64", dest="modes", action="append_const", const=64)
     parser.add_argument("--with-undoc", action="store_true")
     parser.add_argument("--stats", action="store_true")
+    parser.add_argument("--costs", type=argparse.FileType('r'))
     parser.add_argument("mode", choices=generators.keys())
     parser.add_argument("table", type=argparse.FileType('r'))
     parser.add_argument("out_public", type=argparse.FileType('w'))
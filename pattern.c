@@ -0,0 +1,730 @@
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fadec.h>
+#include <fadec-pattern.h>
+
+
+static const char* const type_names[] = {
+#define FD_MNEMONIC(name,value) [value] = #name,
+#include <fadec-decode-public.inc>
+#undef FD_MNEMONIC
+};
+
+#define NTYPES (sizeof type_names / sizeof *type_names)
+
+enum {
+    STEP_LOCK = 1 << 0,
+    STEP_REP = 1 << 1,
+    STEP_REPNZ = 1 << 2,
+    STEP_GAP = 1 << 3, // skips min to max instructions
+    STEP_FIRST = 1 << 4,
+    STEP_LAST = 1 << 5,
+    STEP_MORE = 1 << 6, // further operands are allowed
+};
+
+enum {
+    OP_ANY,
+    OP_REG,
+    OP_IMM,
+    OP_MEM,
+    OP_OFF,
+};
+
+// Wildcards of FdPatOperand.reg_type and reg.
+#define PAT_ANY 0xff
+#define PAT_GP 0xfe // FD_RT_GPL or FD_RT_GPH
+// Key of the first steps which match any instruction type.
+#define ANY_TYPE 0xffff
+
+struct PatParser {
+    const char* text;
+    const char* cur;
+    char names[FD_PAT_CAPTURES][16];
+    unsigned ncaps;
+};
+
+static bool
+is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool
+is_ident(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_';
+}
+
+static char
+lower(char c) {
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static void
+skip_space(struct PatParser* p) {
+    while (is_space(*p->cur))
+        p->cur++;
+}
+
+static bool
+accept(struct PatParser* p, char c) {
+    skip_space(p);
+    if (*p->cur != c)
+        return false;
+    p->cur++;
+    return true;
+}
+
+// Read an identifier in lower case; false if there is none or it is too long.
+static bool
+ident(struct PatParser* p, char buf[16]) {
+    skip_space(p);
+    unsigned len = 0;
+    for (; is_ident(p->cur[len]); len++) {
+        if (len == 15)
+            return false;
+        buf[len] = lower(p->cur[len]);
+    }
+    buf[len] = '\0';
+    p->cur += len;
+    return len != 0;
+}
+
+static bool
+str_eq(const char* a, const char* b) {
+    while (*a && *a == *b)
+        a++, b++;
+    return *a == *b;
+}
+
+// Compare a lower-case identifier with an upper-case type name.
+static bool
+type_eq(const char* ident_lower, const char* name) {
+    while (*ident_lower && *ident_lower == lower(*name))
+        ident_lower++, name++;
+    return !*ident_lower && !*name;
+}
+
+static bool
+number(struct PatParser* p, int64_t* val) {
+    skip_space(p);
+    bool neg = *p->cur == '-';
+    const char* c = p->cur + neg;
+    unsigned base = 10;
+    if (c[0] == '0' && lower(c[1]) == 'x' && is_ident(c[2]))
+        base = 16, c += 2;
+    if (!(*c >= '0' && *c <= '9') && base == 10)
+        return false;
+    uint64_t v = 0;
+    for (;; c++) {
+        unsigned digit;
+        if (*c >= '0' && *c <= '9')
+            digit = *c - '0';
+        else if (base == 16 && lower(*c) >= 'a' && lower(*c) <= 'f')
+            digit = lower(*c) - 'a' + 10;
+        else
+            break;
+        v = v * base + digit;
+    }
+    if (is_ident(*c))
+        return false;
+    p->cur = c;
+    *val = neg ? -(int64_t) v : (int64_t) v;
+    return true;
+}
+
+// Parse "[lo..hi]" after imm or inside mem[...].
+static bool
+range(struct PatParser* p, FdPatOperand* op) {
+    if (!number(p, &op->lo) || !accept(p, '.') || *p->cur != '.')
+        return false;
+    p->cur++;
+    return number(p, &op->hi) && op->lo <= op->hi;
+}
+
+// Get a register by name, e.g. rax, r8d, ah, xmm3, k1, fs, rip.
+static bool
+reg_name(const char* name, FdPatOperand* op) {
+    static const char gp[4][8][4] = {
+        { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil" },
+        { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di" },
+        { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi" },
+        { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi" },
+    };
+    static const char high[4][3] = { "ah", "ch", "dh", "bh" };
+    static const char seg[6][3] = { "es", "cs", "ss", "ds", "fs", "gs" };
+    for (unsigned size = 0; size < 4; size++) {
+        for (unsigned i = 0; i < 8; i++) {
+            if (str_eq(name, gp[size][i])) {
+                op->reg_type = FD_RT_GPL, op->reg = i, op->size = 1 << size;
+                return true;
+            }
+        }
+    }
+    for (unsigned i = 0; i < 4; i++) {
+        if (str_eq(name, high[i])) {
+            op->reg_type = FD_RT_GPH, op->reg = FD_REG_AH + i, op->size = 1;
+            return true;
+        }
+    }
+    for (unsigned i = 0; i < 6; i++) {
+        if (str_eq(name, seg[i])) {
+            op->reg_type = FD_RT_SEG, op->reg = i, op->size = 0;
+            return true;
+        }
+    }
+    if (str_eq(name, "rip")) {
+        op->reg_type = FD_RT_GPL, op->reg = FD_REG_IP, op->size = 8;
+        return true;
+    }
+
+    // Numbered registers: r8 to r15 with suffix, vector and mask registers.
+    const char* c = name;
+    unsigned type, size;
+    if (c[0] == 'r')
+        type = FD_RT_GPL, size = 8, c += 1;
+    else if (c[0] == 'k')
+        type = FD_RT_MASK, size = 0, c += 1;
+    else if ((c[0] == 'x' || c[0] == 'y' || c[0] == 'z') && c[1] == 'm' &&
+             c[2] == 'm')
+        type = FD_RT_VEC, size = c[0] == 'x' ? 16 : c[0] == 'y' ? 32 : 64,
+        c += 3;
+    else
+        return false;
+    unsigned idx = 0, digits = 0;
+    for (; *c >= '0' && *c <= '9' && digits < 2; c++, digits++)
+        idx = idx * 10 + *c - '0';
+    if (!digits || (digits == 2 && idx < 10))
+        return false;
+    if (type == FD_RT_GPL) {
+        if (idx < 8 || idx > 15)
+            return false;
+        size = *c == 'b' ? 1 : *c == 'w' ? 2 : *c == 'd' ? 4 : 8;
+        c += size != 8;
+    }
+    if (*c || idx >= (type == FD_RT_MASK ? 8u : 32u))
+        return false;
+    op->reg_type = type, op->reg = idx, op->size = size;
+    return true;
+}
+
+// Get a register class by name: reg, gp, gp8 to gp64, xmm, ymm, zmm, vec, k.
+static bool
+reg_class(const char* name, FdPatOperand* op) {
+    static const struct {
+        char name[5];
+        uint8_t type;
+        uint8_t size;
+    } classes[] = {
+        { "reg", PAT_ANY, 0 }, { "gp", PAT_GP, 0 }, { "gp8", PAT_GP, 1 },
+        { "gp16", FD_RT_GPL, 2 }, { "gp32", FD_RT_GPL, 4 },
+        { "gp64", FD_RT_GPL, 8 }, { "xmm", FD_RT_VEC, 16 },
+        { "ymm", FD_RT_VEC, 32 }, { "zmm", FD_RT_VEC, 64 },
+        { "vec", FD_RT_VEC, 0 }, { "k", FD_RT_MASK, 0 },
+        { "seg", FD_RT_SEG, 0 },
+    };
+    for (unsigned i = 0; i < sizeof classes / sizeof *classes; i++) {
+        if (str_eq(name, classes[i].name)) {
+            op->reg_type = classes[i].type;
+            op->reg = PAT_ANY;
+            op->size = classes[i].size;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parse "$name", returning the capture slot plus one; zero on error.
+static unsigned
+capture(struct PatParser* p) {
+    char name[16];
+    if (!ident(p, name))
+        return 0;
+    for (unsigned i = 0; i < p->ncaps; i++)
+        if (str_eq(name, p->names[i]))
+            return i + 1;
+    if (p->ncaps == FD_PAT_CAPTURES)
+        return 0;
+    for (unsigned i = 0; i < 16; i++)
+        p->names[p->ncaps][i] = name[i];
+    return ++p->ncaps;
+}
+
+// Parse the base register of mem[...]: *, none, a register or a capture.
+static bool
+mem_base(struct PatParser* p, FdPatOperand* op) {
+    char name[16];
+    if (accept(p, '*'))
+        return true;
+    if (accept(p, '$')) {
+        op->capture = capture(p);
+        return op->capture != 0;
+    }
+    if (!ident(p, name))
+        return false;
+    if (str_eq(name, "none")) {
+        op->reg = FD_REG_NONE;
+        return true;
+    }
+    // Only the register number of the address is compared.
+    FdPatOperand reg;
+    if (!reg_name(name, &reg) || reg.reg_type != FD_RT_GPL || reg.size == 1)
+        return false;
+    op->reg = reg.reg;
+    return true;
+}
+
+static bool
+operand(struct PatParser* p, FdPatOperand* op) {
+    *op = (FdPatOperand) {
+        .kind = OP_ANY, .reg_type = PAT_ANY, .reg = PAT_ANY,
+        .lo = INT64_MIN, .hi = INT64_MAX,
+    };
+    char name[16];
+    if (accept(p, '*'))
+        return true;
+    if (accept(p, '$')) {
+        op->kind = OP_REG;
+        op->capture = capture(p);
+        if (!op->capture)
+            return false;
+        if (!accept(p, ':'))
+            return true;
+        unsigned slot = op->capture;
+        if (!ident(p, name) || (!reg_class(name, op) && !reg_name(name, op)))
+            return false;
+        op->capture = slot;
+        return true;
+    }
+    skip_space(p);
+    if (*p->cur == '-' || (*p->cur >= '0' && *p->cur <= '9')) {
+        op->kind = OP_IMM;
+        if (!number(p, &op->lo))
+            return false;
+        op->hi = op->lo;
+        return true;
+    }
+    if (!ident(p, name))
+        return false;
+    if (str_eq(name, "imm")) {
+        op->kind = OP_IMM;
+        return !accept(p, '[') || (range(p, op) && accept(p, ']'));
+    }
+    if (str_eq(name, "rel")) {
+        op->kind = OP_OFF;
+        return true;
+    }
+    if (str_eq(name, "mem")) {
+        op->kind = OP_MEM;
+        if (!accept(p, '['))
+            return true;
+        if (!mem_base(p, op))
+            return false;
+        if (accept(p, ',') && !range(p, op))
+            return false;
+        return accept(p, ']');
+    }
+    op->kind = OP_REG;
+    return reg_class(name, op) || reg_name(name, op);
+}
+
+static bool
+mnemonic(struct PatParser* p, FdPatStep* step) {
+    char name[16];
+    const char* save;
+    for (;;) {
+        save = p->cur;
+        if (!ident(p, name))
+            break;
+        unsigned prefix = str_eq(name, "lock") ? STEP_LOCK :
+                          str_eq(name, "rep") || str_eq(name, "repz") ||
+                          str_eq(name, "repe") ? STEP_REP :
+                          str_eq(name, "repnz") || str_eq(name, "repne")
+                          ? STEP_REPNZ : 0;
+        skip_space(p);
+        // A prefix is followed by the mnemonic.
+        if (prefix && (is_ident(*p->cur) || *p->cur == '*')) {
+            step->flags |= prefix;
+            continue;
+        }
+        break;
+    }
+    p->cur = save;
+
+    if (accept(p, '*'))
+        return true;
+    do {
+        if (step->ntypes == FD_PAT_ALTS || !ident(p, name))
+            return false;
+        unsigned ty = 0;
+        while (ty < NTYPES && !(type_names[ty] && type_eq(name, type_names[ty])))
+            ty++;
+        if (ty == NTYPES)
+            return false;
+        step->types[step->ntypes++] = ty;
+        // The decoder has a separate type for mov with register and
+        // immediate, which is written as mov.
+        if (ty == FDI_MOV) {
+            if (step->ntypes == FD_PAT_ALTS)
+                return false;
+            step->types[step->ntypes++] = FDI_MOVABS;
+        }
+    } while (accept(p, '|'));
+    return true;
+}
+
+// Parse one step; false on a syntax error.
+static bool
+step_parse(struct PatParser* p, FdPatStep* step) {
+    skip_space(p);
+    if (p->cur[0] == '*') {
+        const char* save = p->cur++;
+        if (accept(p, '{')) {
+            int64_t min, max;
+            step->flags |= STEP_GAP;
+            if (!number(p, &min) || !accept(p, ',') || !number(p, &max) ||
+                !accept(p, '}') || min < 0 || min > max || max > UINT16_MAX)
+                return false;
+            step->min = min;
+            step->max = max;
+            return true;
+        }
+        p->cur = save;
+    }
+    if (!mnemonic(p, step))
+        return false;
+
+    skip_space(p);
+    if (!*p->cur || *p->cur == ';') {
+        step->flags |= STEP_MORE;
+        return true;
+    }
+    do {
+        skip_space(p);
+        if (p->cur[0] == '.' && p->cur[1] == '.' && p->cur[2] == '.') {
+            p->cur += 3;
+            step->flags |= STEP_MORE;
+            break;
+        }
+        if (step->nops == 4 || !operand(p, &step->ops[step->nops++]))
+            return false;
+    } while (accept(p, ','));
+    skip_space(p);
+    return !*p->cur || *p->cur == ';';
+}
+
+size_t
+fd_pat_compile(const char* text, uint32_t pattern, FdPatStep* steps,
+               size_t cap, size_t* error) {
+    struct PatParser p = { .text = text, .cur = text };
+    size_t count = 0;
+    bool gap = false;
+    do {
+        FdPatStep step = { .pattern = pattern };
+        skip_space(&p);
+        const char* start = p.cur;
+        if (!step_parse(&p, &step)) {
+            *error = p.cur - text;
+            return 0;
+        }
+        // Gaps are between instructions.
+        bool prev_gap = gap;
+        gap = step.flags & STEP_GAP;
+        if (gap && (!count || prev_gap)) {
+            *error = start - text;
+            return 0;
+        }
+        if (count < cap)
+            steps[count] = step;
+        count++;
+    } while (accept(&p, ';'));
+    skip_space(&p);
+    if (*p.cur || gap) {
+        *error = p.cur - text;
+        return 0;
+    }
+    if (count <= cap) {
+        steps[0].flags |= STEP_FIRST;
+        steps[count - 1].flags |= STEP_LAST;
+    }
+    return count;
+}
+
+static void
+key_sift_down(uint64_t* keys, size_t root, size_t count) {
+    uint64_t tmp = keys[root];
+    for (size_t child; (child = 2 * root + 1) < count; root = child) {
+        if (child + 1 < count && keys[child] < keys[child + 1])
+            child++;
+        if (tmp >= keys[child])
+            break;
+        keys[root] = keys[child];
+    }
+    keys[root] = tmp;
+}
+
+int
+fd_pat_init(FdPatSet* set, const FdPatStep* steps, size_t nsteps,
+            uint64_t* index, size_t cap) {
+    size_t count = 0;
+    for (size_t i = 0; i < nsteps; i++) {
+        if (!(steps[i].flags & STEP_FIRST))
+            continue;
+        size_t last = i;
+        while (last < nsteps && !(steps[last].flags & STEP_LAST))
+            last++;
+        if (last == nsteps)
+            return -1;
+        // Each alternative type of the first step dispatches the pattern.
+        unsigned ntypes = steps[i].ntypes ? steps[i].ntypes : 1;
+        for (unsigned j = 0; j < ntypes; j++) {
+            uint64_t ty = steps[i].ntypes ? steps[i].types[j] : ANY_TYPE;
+            if (count == cap)
+                return -1;
+            index[count++] = ty << 32 | i;
+        }
+    }
+    for (size_t i = count / 2; i-- > 0; )
+        key_sift_down(index, i, count);
+    for (size_t i = count; i-- > 1; ) {
+        uint64_t tmp = index[0];
+        index[0] = index[i];
+        index[i] = tmp;
+        key_sift_down(index, 0, i);
+    }
+    set->steps = steps;
+    set->nsteps = nsteps;
+    set->index = index;
+    set->nindex = count;
+    return 0;
+}
+
+static bool
+reg_match(const FdPatOperand* op, unsigned type, unsigned reg, unsigned size,
+          FdPatThread* t) {
+    if (op->reg_type == PAT_GP ? type != FD_RT_GPL && type != FD_RT_GPH
+                               : op->reg_type != PAT_ANY && op->reg_type != type)
+        return false;
+    if ((op->reg != PAT_ANY && op->reg != reg) || (op->size && op->size != size))
+        return false;
+    if (op->capture) {
+        unsigned slot = op->capture - 1;
+        if (t->regs[slot] == FD_REG_NONE) {
+            t->regs[slot] = reg;
+            t->reg_types[slot] = type;
+        } else if (t->regs[slot] != reg || t->reg_types[slot] != type) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool
+operand_match(const FdPatOperand* op, const FdInstr* instr, unsigned idx,
+              FdPatThread* t) {
+    unsigned kind = FD_OP_TYPE(instr, idx);
+    switch (op->kind) {
+    case OP_REG:
+        return kind == FD_OT_REG &&
+               reg_match(op, FD_OP_REG_TYPE(instr, idx), FD_OP_REG(instr, idx),
+                         FD_OP_SIZE(instr, idx), t);
+    case OP_IMM: {
+        if (kind != FD_OT_IMM)
+            return false;
+        // Either the sign- or the zero-extended value is in the range, so
+        // that e.g. 0xffffffff and -1 match a 32-bit all-ones immediate.
+        int64_t val = FD_OP_IMM(instr, idx);
+        unsigned size = FD_OP_SIZE(instr, idx);
+        int64_t zext = size && size < 8
+                     ? (int64_t) ((uint64_t) val & (((uint64_t) 1 << 8 * size) - 1))
+                     : val;
+        return (val >= op->lo && val <= op->hi) ||
+               (zext >= op->lo && zext <= op->hi);
+    }
+    case OP_MEM: {
+        if (kind != FD_OT_MEM && kind != FD_OT_MEMBCST)
+            return false;
+        int64_t disp = FD_OP_DISP(instr, idx);
+        unsigned base = FD_OP_BASE(instr, idx);
+        if (disp < op->lo || disp > op->hi)
+            return false;
+        if (op->capture && base == FD_REG_NONE)
+            return false;
+        return reg_match(op, FD_RT_GPL, base, 0, t);
+    }
+    case OP_OFF:
+        return kind == FD_OT_OFF;
+    default:
+        return kind != FD_OT_NONE;
+    }
+}
+
+// Match one instruction step, binding captures in *t.
+static bool
+step_match(const FdPatStep* step, const FdInstr* instr, FdPatThread* t) {
+    if (step->ntypes) {
+        unsigned i = 0;
+        while (i < step->ntypes && step->types[i] != FD_TYPE(instr))
+            i++;
+        if (i == step->ntypes)
+            return false;
+    }
+    if (((step->flags & STEP_LOCK) && !FD_HAS_LOCK(instr)) ||
+        ((step->flags & STEP_REP) && !FD_HAS_REP(instr)) ||
+        ((step->flags & STEP_REPNZ) && !FD_HAS_REPNZ(instr)))
+        return false;
+    unsigned nops = 0;
+    while (nops < 4 && FD_OP_TYPE(instr, nops) != FD_OT_NONE)
+        nops++;
+    if (step->flags & STEP_MORE ? nops < step->nops : nops != step->nops)
+        return false;
+    for (unsigned i = 0; i < step->nops; i++)
+        if (!operand_match(&step->ops[i], instr, i, t))
+            return false;
+    return true;
+}
+
+struct PatScan {
+    const FdPatSet* set;
+    const FdInstr* instr;
+    uint64_t addr;
+    FdPatThread* next;
+    size_t nnext;
+    size_t nthreads;
+    FdPatMatch* out;
+    size_t cap;
+    size_t total;
+    size_t first; // first match which ends at this instruction
+};
+
+static void
+emit(struct PatScan* s, const FdPatThread* t) {
+    for (size_t i = 0; i < s->nnext; i++) {
+        const FdPatThread* u = &s->next[i];
+        if (u->start == t->start && u->step == t->step &&
+            u->count == t->count) {
+            unsigned j = 0;
+            while (j < FD_PAT_CAPTURES && u->regs[j] == t->regs[j] &&
+                   u->reg_types[j] == t->reg_types[j])
+                j++;
+            if (j == FD_PAT_CAPTURES)
+                return;
+        }
+    }
+    // Without space, the partial matches which started later are dropped.
+    if (s->nnext < s->nthreads)
+        s->next[s->nnext++] = *t;
+}
+
+static void
+report(struct PatScan* s, const FdPatThread* t, uint32_t pattern) {
+    // Different paths through gaps can complete the same match.
+    for (size_t i = s->first; i < s->total && i < s->cap; i++)
+        if (s->out[i].start == t->start && s->out[i].pattern == pattern)
+            return;
+    if (s->total < s->cap) {
+        FdPatMatch* m = &s->out[s->total];
+        m->start = t->start;
+        m->end = s->addr + FD_SIZE(s->instr);
+        m->pattern = pattern;
+        for (unsigned i = 0; i < FD_PAT_CAPTURES; i++) {
+            m->regs[i] = t->regs[i];
+            m->reg_types[i] = t->reg_types[i];
+        }
+    }
+    s->total++;
+}
+
+// The thread matched the instruction step idx.
+static void
+advance(struct PatScan* s, FdPatThread* t, uint32_t idx) {
+    const FdPatStep* step = &s->set->steps[idx];
+    if (step->flags & STEP_LAST) {
+        report(s, t, step->pattern);
+        return;
+    }
+    t->step = idx + 1;
+    t->count = 0;
+    emit(s, t);
+}
+
+static void
+step_thread(struct PatScan* s, FdPatThread t) {
+    const FdPatStep* step = &s->set->steps[t.step];
+    if (!(step->flags & STEP_GAP)) {
+        if (step_match(step, s->instr, &t))
+            advance(s, &t, t.step);
+        return;
+    }
+    if (t.count >= step->min) {
+        FdPatThread u = t;
+        if (step_match(step + 1, s->instr, &u))
+            advance(s, &u, t.step + 1);
+    }
+    if (t.count < step->max) {
+        t.count++;
+        emit(s, &t);
+    }
+}
+
+// Start the patterns dispatched by the key range of a type.
+static void
+start_type(struct PatScan* s, uint64_t type) {
+    const uint64_t* index = s->set->index;
+    size_t lo = 0, count = s->set->nindex;
+    while (count) {
+        size_t half = count / 2;
+        if (index[lo + half] >> 32 < type) {
+            lo += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    for (; lo < s->set->nindex && index[lo] >> 32 == type; lo++) {
+        FdPatThread t = { .start = s->addr, .step = (uint32_t) index[lo] };
+        for (unsigned i = 0; i < FD_PAT_CAPTURES; i++)
+            t.regs[i] = t.reg_types[i] = FD_REG_NONE;
+        step_thread(s, t);
+    }
+}
+
+size_t
+fd_pat_scan(const FdPatSet* set, const uint8_t* buf, size_t len,
+            uint64_t base, int mode, size_t start, size_t end,
+            FdPatThread* threads, size_t nthreads, FdPatMatch* out,
+            size_t cap) {
+    struct PatScan s = {
+        .set = set, .nthreads = nthreads, .out = out, .cap = cap,
+    };
+    FdPatThread* cur = threads;
+    size_t ncur = 0;
+    size_t off = start;
+    // After end, only the partial matches are completed.
+    while (off < len && (off < end || ncur)) {
+        FdInstr instr;
+        int ret = fd_decode(buf + off, len - off, mode, 0, &instr);
+        if (ret < 0) {
+            ncur = 0;
+            off++;
+            continue;
+        }
+        s.instr = &instr;
+        s.addr = base + off;
+        s.next = cur == threads ? threads + nthreads : threads;
+        s.nnext = 0;
+        s.first = s.total;
+        for (size_t i = 0; i < ncur; i++)
+            step_thread(&s, cur[i]);
+        if (off < end) {
+            start_type(&s, FD_TYPE(&instr));
+            start_type(&s, ANY_TYPE);
+        }
+        cur = s.next;
+        ncur = s.nnext;
+        off += ret;
+    }
+    return s.total;
+}
@@ -0,0 +1,172 @@
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fadec.h>
+#include <fadec-profile.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+
+// Bits per digit of fd_profile_sort.
+#define SORT_BITS 11
+
+// Index of the lowest set bit; v must not be zero.
+static unsigned
+fd_ctz64(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(v);
+#elif defined(_MSC_VER) && INTPTR_MAX == INT64_MAX
+    unsigned long index;
+    _BitScanForward64(&index, v);
+    return index;
+#else
+    unsigned index = 0;
+    for (; !(v & 1); v >>= 1)
+        index++;
+    return index;
+#endif
+}
+
+// Number of bits up to and including the highest set bit.
+static unsigned
+fd_bitlen64(uint64_t v) {
+#if defined(__GNUC__)
+    return v ? 64 - __builtin_clzll(v) : 0;
+#elif defined(_MSC_VER) && INTPTR_MAX == INT64_MAX
+    unsigned long index;
+    return _BitScanReverse64(&index, v) ? index + 1 : 0;
+#else
+    unsigned len = 0;
+    for (; v; v >>= 1)
+        len++;
+    return len;
+#endif
+}
+
+void
+fd_profile_sort(uint64_t* ips, size_t count, uint64_t* tmp) {
+    if (count == 0)
+        return;
+    // Only bits which differ between addresses need to be sorted; addresses
+    // of one binary usually span less than 32 bits.
+    uint64_t diff = 0;
+    for (size_t i = 0; i < count; i++)
+        diff |= ips[i] ^ ips[0];
+    if (!diff)
+        return;
+    unsigned lo = fd_ctz64(diff);
+    unsigned span = fd_bitlen64(diff) - lo;
+    unsigned npasses = (span + SORT_BITS - 1) / SORT_BITS;
+    unsigned bits = (span + npasses - 1) / npasses;
+    uint64_t mask = (1u << bits) - 1;
+
+    uint64_t* src = ips;
+    uint64_t* dst = tmp;
+    for (unsigned shift = lo; shift < lo + span; shift += bits) {
+        size_t hist[1 << SORT_BITS] = {0};
+        for (size_t i = 0; i < count; i++)
+            hist[src[i] >> shift & mask]++;
+        size_t pos = 0;
+        for (size_t v = 0; v <= mask; v++) {
+            size_t n = hist[v];
+            hist[v] = pos;
+            pos += n;
+        }
+        for (size_t i = 0; i < count; i++)
+            dst[hist[src[i] >> shift & mask]++] = src[i];
+        uint64_t* swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != ips)
+        for (size_t i = 0; i < count; i++)
+            ips[i] = src[i];
+}
+
+size_t
+fd_profile_count(const uint64_t* ips, size_t count, FdProfileSample* out) {
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (n && out[n - 1].addr == ips[i]) {
+            out[n - 1].count++;
+            continue;
+        }
+        out[n++] = (FdProfileSample) { ips[i], 1 };
+    }
+    return n;
+}
+
+// Index of the instruction at addr, or count.
+static size_t
+find_instr(const FdProfileInstr* instrs, size_t count, uint64_t addr) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (instrs[mid].addr < addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < count && instrs[lo].addr == addr ? lo : count;
+}
+
+size_t
+fd_profile_sweep(const uint8_t* buf, size_t len, uint64_t base, int mode,
+                 size_t start, size_t end, const FdProfileSample* samples,
+                 size_t nsamples, FdProfileInstr* out, size_t cap) {
+    // Decode, keeping the targets of direct branches in the sample field
+    // until the blocks are marked.
+    size_t total = 0;
+    bool block = true;
+    for (size_t off = start; off < end && off < len; total++) {
+        FdInstr instr;
+        int ret = fd_decode(buf + off, len - off, mode, 0, &instr);
+        unsigned flags = block ? FD_PROF_BLOCK : 0;
+        uint64_t target = 0;
+        if (ret < 0) {
+            flags |= FD_PROF_CF;
+            ret = 0;
+        } else if (fd_cf_kind(&instr) != FD_CF_NONE) {
+            flags |= FD_PROF_CF;
+            target = fd_branch_target(&instr, base + off);
+        }
+        if (total < cap)
+            out[total] = (FdProfileInstr) {
+                .addr = base + off, .samples = target, .size = ret,
+                .flags = flags,
+            };
+        block = flags & FD_PROF_CF;
+        off += ret ? (size_t) ret : 1;
+    }
+
+    size_t count = total < cap ? total : cap;
+    if (!count)
+        return total;
+    uint64_t lo = out[0].addr;
+    uint64_t hi = out[count - 1].addr + out[count - 1].size;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t target = out[i].samples;
+        if (!(out[i].flags & FD_PROF_CF) || target < lo || target >= hi)
+            continue;
+        size_t idx = find_instr(out, count, target);
+        if (idx < count)
+            out[idx].flags |= FD_PROF_BLOCK;
+    }
+
+    // Merge the sorted samples with the instructions.
+    size_t j = 0;
+    while (j < nsamples && samples[j].addr < lo)
+        j++;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t instr_end = out[i].addr + (out[i].size ? out[i].size : 1);
+        uint64_t sum = 0;
+        for (; j < nsamples && samples[j].addr < instr_end; j++)
+            sum += samples[j].count;
+        out[i].samples = sum;
+    }
+    return total;
+}
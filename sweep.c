@@ -0,0 +1,256 @@
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fadec.h>
+#include <fadec-analysis.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+
+// A work queue is a range of chunk indices [lo, hi), packed into one word as
+// lo | hi << 32 so that both ends are updated with a single compare-exchange:
+// the owner takes chunks from the front, thieves take from the back.
+#define QUEUE(lo, hi) ((uint64_t) (lo) | (uint64_t) (hi) << 32)
+#define QUEUE_LO(q) ((size_t) ((q) & 0xffffffff))
+#define QUEUE_HI(q) ((size_t) ((q) >> 32))
+
+#if defined(__GNUC__)
+static uint64_t
+queue_load(uint64_t* q) {
+    return __atomic_load_n(q, __ATOMIC_ACQUIRE);
+}
+
+static void
+queue_store(uint64_t* q, uint64_t val) {
+    __atomic_store_n(q, val, __ATOMIC_RELEASE);
+}
+
+static bool
+queue_cas(uint64_t* q, uint64_t old, uint64_t val) {
+    return __atomic_compare_exchange_n(q, &old, val, false, __ATOMIC_ACQ_REL,
+                                       __ATOMIC_ACQUIRE);
+}
+#elif defined(_MSC_VER)
+static uint64_t
+queue_load(uint64_t* q) {
+    return _InterlockedCompareExchange64((volatile long long*) q, 0, 0);
+}
+
+static void
+queue_store(uint64_t* q, uint64_t val) {
+    _InterlockedExchange64((volatile long long*) q, val);
+}
+
+static bool
+queue_cas(uint64_t* q, uint64_t old, uint64_t val) {
+    return (uint64_t) _InterlockedCompareExchange64((volatile long long*) q,
+                                                    val, old) == old;
+}
+#else
+// Without atomic operations, all workers must run on the same thread.
+static uint64_t
+queue_load(uint64_t* q) {
+    return *q;
+}
+
+static void
+queue_store(uint64_t* q, uint64_t val) {
+    *q = val;
+}
+
+static bool
+queue_cas(uint64_t* q, uint64_t old, uint64_t val) {
+    if (*q != old)
+        return false;
+    *q = val;
+    return true;
+}
+#endif
+
+#define BIT_TEST(bits, i) ((bits)[(i) / 8] >> ((i) % 8) & 1)
+#define BIT_SET(bits, i) ((bits)[(i) / 8] |= 1 << ((i) % 8))
+#define BIT_CLEAR(bits, i) ((bits)[(i) / 8] &= ~(1 << ((i) % 8)))
+
+int
+fd_sweep_init(FdSweep* sweep, const uint8_t* buf, size_t len, int mode,
+              size_t chunk_size, uint8_t* starts, FdSweepChunk* chunks,
+              uint64_t* queues, unsigned nworkers) {
+    if (!chunk_size || chunk_size % 64 || !nworkers || (mode != 32 && mode != 64))
+        return -1;
+    size_t nchunks = FD_SWEEP_CHUNKS(len, chunk_size);
+    if (nchunks > 0xffffffff)
+        return -1;
+
+    sweep->buf = buf;
+    sweep->len = len;
+    sweep->mode = mode;
+    sweep->chunk_size = chunk_size;
+    sweep->nchunks = nchunks;
+    sweep->starts = starts;
+    sweep->chunks = chunks;
+    sweep->queues = queues;
+    sweep->nworkers = nworkers;
+    for (unsigned i = 0; i < nworkers; i++)
+        queues[i] = QUEUE(nchunks * i / nworkers, nchunks * (i + 1) / nworkers);
+    return 0;
+}
+
+// Decode from off, marking instruction starts, up to the first instruction
+// which ends at or after end. Returns the offset after that instruction.
+static size_t
+sweep_decode(const FdSweep* sweep, size_t off, size_t end) {
+    while (off < end) {
+        BIT_SET(sweep->starts, off);
+        FdInstr instr;
+        int ret = fd_decode(sweep->buf + off, sweep->len - off, sweep->mode, 0,
+                            &instr);
+        off += ret > 0 ? (size_t) ret : 1;
+    }
+    return off;
+}
+
+// Speculatively decode a chunk from its first byte. Chunks are multiples of
+// 64 bytes, so no two chunks share a byte of the bitmap.
+static void
+sweep_chunk(FdSweep* sweep, size_t idx) {
+    size_t start = idx * sweep->chunk_size;
+    size_t end = sweep->len - start < sweep->chunk_size ? sweep->len
+                                                        : start + sweep->chunk_size;
+    for (size_t i = start / 8; i < (end + 7) / 8; i++)
+        sweep->starts[i] = 0;
+    sweep->chunks[idx].entry = start;
+    sweep->chunks[idx].exit = sweep_decode(sweep, start, end);
+}
+
+// Take the first chunk of the own queue.
+static bool
+sweep_pop(uint64_t* queue, size_t* idx) {
+    for (;;) {
+        uint64_t q = queue_load(queue);
+        size_t lo = QUEUE_LO(q), hi = QUEUE_HI(q);
+        if (lo >= hi)
+            return false;
+        if (queue_cas(queue, q, QUEUE(lo + 1, hi))) {
+            *idx = lo;
+            return true;
+        }
+    }
+}
+
+// Move the back half of the chunks of another worker to the own queue.
+static bool
+sweep_steal(FdSweep* sweep, unsigned worker) {
+    for (unsigned i = 1; i < sweep->nworkers; i++) {
+        uint64_t* victim = &sweep->queues[(worker + i) % sweep->nworkers];
+        for (;;) {
+            uint64_t q = queue_load(victim);
+            size_t lo = QUEUE_LO(q), hi = QUEUE_HI(q);
+            if (lo >= hi)
+                break;
+            size_t mid = lo + (hi - lo) / 2;
+            if (queue_cas(victim, q, QUEUE(lo, mid))) {
+                queue_store(&sweep->queues[worker], QUEUE(mid, hi));
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void
+fd_sweep_run(FdSweep* sweep, unsigned worker) {
+    for (;;) {
+        size_t idx;
+        if (sweep_pop(&sweep->queues[worker], &idx))
+            sweep_chunk(sweep, idx);
+        else if (!sweep_steal(sweep, worker))
+            break;
+    }
+}
+
+size_t
+fd_sweep_resolve(FdSweep* sweep) {
+    size_t redone = 0;
+    size_t entry = 0;
+    for (size_t idx = 0; idx < sweep->nchunks; idx++) {
+        FdSweepChunk* chunk = &sweep->chunks[idx];
+        size_t start = idx * sweep->chunk_size;
+        size_t end = sweep->len - start < sweep->chunk_size ? sweep->len
+                                                            : start + sweep->chunk_size;
+        // Bytes before the entry belong to the last instruction of the
+        // previous chunk.
+        size_t off = start;
+        for (; off < entry && off < end; off++)
+            BIT_CLEAR(sweep->starts, off);
+        chunk->entry = entry;
+        if (entry >= end) {
+            chunk->exit = entry;
+            continue;
+        }
+
+        // Decode until reaching an instruction start of the speculative
+        // sweep; from there on, both are the same. Speculative starts which
+        // are skipped over are wrong.
+        for (off = entry; off < end && !BIT_TEST(sweep->starts, off); ) {
+            size_t next = sweep_decode(sweep, off, off + 1);
+            for (size_t i = off + 1; i < next && i < end; i++)
+                BIT_CLEAR(sweep->starts, i);
+            redone += next - off;
+            off = next;
+        }
+        // Without convergence, the chunk ends elsewhere.
+        if (off >= end)
+            chunk->exit = off;
+        entry = chunk->exit;
+    }
+    return redone;
+}
+
+size_t
+fd_sweep_patch(FdSweep* sweep, size_t off, size_t len, size_t* lo,
+               size_t* hi) {
+    *lo = *hi = off;
+    if (off >= sweep->len || !len)
+        return 0;
+    size_t patch_end = sweep->len - off < len ? sweep->len : off + len;
+
+    // Instructions read at most 15 bytes, so an instruction which starts
+    // before off - 14 is decoded as before. Later ones may change, also
+    // where a byte was skipped because the instruction was undecodable.
+    size_t start = off < 15 ? 0 : off - 15;
+    while (start && !BIT_TEST(sweep->starts, start))
+        start--;
+
+    // Behind the patch, the decoding converges at the first instruction
+    // start of the old sweep. Old starts which are skipped over are wrong.
+    size_t cur = start;
+    while (cur < sweep->len &&
+           (cur < patch_end || !BIT_TEST(sweep->starts, cur))) {
+        size_t next = sweep_decode(sweep, cur, cur + 1);
+        for (size_t i = cur + 1; i < next && i < sweep->len; i++)
+            BIT_CLEAR(sweep->starts, i);
+        cur = next;
+    }
+
+    // The first instruction of each chunk in the range may have moved. A
+    // chunk is left where the next one is entered.
+    for (size_t idx = start / sweep->chunk_size + 1;
+         idx < sweep->nchunks && idx * sweep->chunk_size <= cur; idx++) {
+        size_t entry = idx * sweep->chunk_size;
+        while (entry < sweep->len && !BIT_TEST(sweep->starts, entry))
+            entry++;
+        sweep->chunks[idx].entry = entry;
+        sweep->chunks[idx - 1].exit = entry;
+        if (idx + 1 < sweep->nchunks)
+            sweep->chunks[idx].exit = sweep->chunks[idx + 1].entry;
+        else if (sweep->chunks[idx].exit < entry)
+            sweep->chunks[idx].exit = entry;
+    }
+    *lo = start;
+    *hi = cur;
+    return cur - start;
+}
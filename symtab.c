@@ -0,0 +1,444 @@
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fadec.h>
+
+
+#define LOAD_LE_1(buf) ((uint64_t) *(const uint8_t*) (buf))
+#define LOAD_LE_2(buf) (LOAD_LE_1(buf) | LOAD_LE_1((const uint8_t*) (buf) + 1)<<8)
+#define LOAD_LE_4(buf) (LOAD_LE_2(buf) | LOAD_LE_2((const uint8_t*) (buf) + 2)<<16)
+#define LOAD_LE_8(buf) (LOAD_LE_4(buf) | LOAD_LE_4((const uint8_t*) (buf) + 4)<<32)
+
+// Order by address; of symbols with the same address, the largest one first.
+static bool
+sym_less(const FdSymbol* a, const FdSymbol* b) {
+    return a->addr < b->addr || (a->addr == b->addr && a->size > b->size);
+}
+
+static void
+sym_sift_down(FdSymbol* syms, size_t root, size_t count) {
+    FdSymbol tmp = syms[root];
+    for (size_t child; (child = 2 * root + 1) < count; root = child) {
+        if (child + 1 < count && sym_less(&syms[child], &syms[child + 1]))
+            child++;
+        if (!sym_less(&tmp, &syms[child]))
+            break;
+        syms[root] = syms[child];
+    }
+    syms[root] = tmp;
+}
+
+// Heapsort: in place, without recursion and independent of the input order.
+static void
+sym_sort(FdSymbol* syms, size_t count) {
+    for (size_t i = count / 2; i-- > 0; )
+        sym_sift_down(syms, i, count);
+    for (size_t i = count; i-- > 1; ) {
+        FdSymbol tmp = syms[0];
+        syms[0] = syms[i];
+        syms[i] = tmp;
+        sym_sift_down(syms, 0, i);
+    }
+}
+
+// Place the sorted symbols in Eytzinger (BFS) order in descending address
+// order by an in-order traversal of the implicit tree rooted at k.
+static size_t
+sym_eytzinger(FdSymtab* tab, const FdSymbol* sorted, size_t pos, size_t k) {
+    if (k > tab->count)
+        return pos;
+    pos = sym_eytzinger(tab, sorted, pos, 2 * k);
+    tab->nodes[k] = sorted[tab->count - 1 - pos];
+    tab->keys[k] = sorted[tab->count - 1 - pos].addr;
+    return sym_eytzinger(tab, sorted, pos + 1, 2 * k + 1);
+}
+
+size_t
+fd_symtab_init(FdSymtab* tab, FdSymbol* syms, size_t count, FdSymbol* nodes,
+               uint64_t* keys) {
+    sym_sort(syms, count);
+
+    // Keep only the first (largest) symbol of each address.
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++)
+        if (!unique || syms[i].addr != syms[unique - 1].addr)
+            syms[unique++] = syms[i];
+
+    tab->nodes = nodes;
+    tab->keys = keys;
+    tab->count = unique;
+    sym_eytzinger(tab, syms, 0, 1);
+    return unique;
+}
+
+const FdSymbol*
+fd_symtab_lookup(const FdSymtab* tab, uint64_t addr) {
+    // Keys are in descending order, so the search for the first key not
+    // greater than addr yields the closest symbol at or before addr. The
+    // descent is branch-free; the final position is found by removing the
+    // trailing right turns (one bits) and the last left turn.
+    size_t k = 1;
+    while (k <= tab->count)
+        k = 2 * k + (tab->keys[k] > addr);
+#ifdef __GNUC__
+    k >>= __builtin_ctzll(~(unsigned long long) k) + 1;
+#else
+    while (k & 1)
+        k >>= 1;
+    k >>= 1;
+#endif
+    return k ? &tab->nodes[k] : NULL;
+}
+
+const char*
+fd_symtab_symbolize(void* ctx, uint64_t addr, uint64_t* off) {
+    const FdSymbol* sym = fd_symtab_lookup(ctx, addr);
+    if (!sym)
+        return NULL;
+    *off = addr - sym->addr;
+    return sym->name;
+}
+
+enum {
+    ELF_SHT_SYMTAB = 2,
+    ELF_SHT_NOTE = 7,
+    ELF_SHT_DYNSYM = 11,
+    ELF_NT_GNU_BUILD_ID = 3,
+    ELF_STT_NOTYPE = 0,
+    ELF_STT_OBJECT = 1,
+    ELF_STT_FUNC = 2,
+};
+
+size_t
+fd_elf_symbols(const void* image, size_t len, FdSymbol* out, size_t cap) {
+    const uint8_t* elf = image;
+    if (len < 0x34 || LOAD_LE_4(elf) != 0x464c457f || elf[5] != 1)
+        return 0;
+    bool is64 = elf[4] == 2;
+    if (!is64 && elf[4] != 1)
+        return 0;
+    if (is64 && len < 0x40)
+        return 0;
+
+    uint64_t shoff = is64 ? LOAD_LE_8(elf + 0x28) : LOAD_LE_4(elf + 0x20);
+    size_t shentsize = LOAD_LE_2(elf + (is64 ? 0x3a : 0x2e));
+    size_t shnum = LOAD_LE_2(elf + (is64 ? 0x3c : 0x30));
+    if (shentsize < (is64 ? 0x40u : 0x28u) || shoff > len ||
+        shnum > (len - shoff) / shentsize)
+        return 0;
+
+    size_t total = 0;
+    for (size_t i = 0; i < shnum; i++) {
+        const uint8_t* sh = elf + shoff + i * shentsize;
+        uint32_t type = LOAD_LE_4(sh + 4);
+        if (type != ELF_SHT_SYMTAB && type != ELF_SHT_DYNSYM)
+            continue;
+        uint64_t off = is64 ? LOAD_LE_8(sh + 0x18) : LOAD_LE_4(sh + 0x10);
+        uint64_t size = is64 ? LOAD_LE_8(sh + 0x20) : LOAD_LE_4(sh + 0x14);
+        uint32_t link = LOAD_LE_4(sh + (is64 ? 0x28 : 0x18));
+        uint64_t entsize = is64 ? LOAD_LE_8(sh + 0x38) : LOAD_LE_4(sh + 0x24);
+        if (entsize < (is64 ? 24u : 16u) || off > len || size > len - off ||
+            link >= shnum)
+            continue;
+
+        const uint8_t* strsh = elf + shoff + link * shentsize;
+        uint64_t stroff = is64 ? LOAD_LE_8(strsh + 0x18) : LOAD_LE_4(strsh + 0x10);
+        uint64_t strsize = is64 ? LOAD_LE_8(strsh + 0x20) : LOAD_LE_4(strsh + 0x14);
+        if (stroff > len || strsize > len - stroff || !strsize ||
+            elf[stroff + strsize - 1] != '\0')
+            continue;
+
+        for (uint64_t j = 1; j < size / entsize; j++) {
+            const uint8_t* sym = elf + off + j * entsize;
+            uint32_t name = LOAD_LE_4(sym);
+            unsigned info = sym[is64 ? 4 : 12];
+            unsigned shndx = LOAD_LE_2(sym + (is64 ? 6 : 14));
+            uint64_t value = is64 ? LOAD_LE_8(sym + 8) : LOAD_LE_4(sym + 4);
+            uint64_t symsize = is64 ? LOAD_LE_8(sym + 16) : LOAD_LE_4(sym + 8);
+            unsigned symtype = info & 0xf;
+            // Only defined functions and objects in a regular section.
+            if (symtype != ELF_STT_NOTYPE && symtype != ELF_STT_OBJECT &&
+                symtype != ELF_STT_FUNC)
+                continue;
+            if (shndx == 0 || shndx >= 0xff00 || !name || name >= strsize ||
+                !elf[stroff + name])
+                continue;
+            if (total < cap) {
+                out[total].addr = value;
+                out[total].size = symsize;
+                out[total].name = (const char*) elf + stroff + name;
+            }
+            total++;
+        }
+    }
+    return total;
+}
+
+// Read an unsigned LEB128 number; false if it exceeds the data.
+static bool
+eh_uleb(const uint8_t* data, size_t size, size_t* pos, uint64_t* val) {
+    *val = 0;
+    for (unsigned shift = 0; *pos < size; shift += 7) {
+        uint8_t byte = data[(*pos)++];
+        if (shift < 64)
+            *val |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+enum {
+    DW_EH_PE_absptr = 0x00,
+    DW_EH_PE_uleb128 = 0x01,
+    DW_EH_PE_udata2 = 0x02,
+    DW_EH_PE_udata4 = 0x03,
+    DW_EH_PE_udata8 = 0x04,
+    DW_EH_PE_sleb128 = 0x09,
+    DW_EH_PE_sdata2 = 0x0a,
+    DW_EH_PE_sdata4 = 0x0b,
+    DW_EH_PE_sdata8 = 0x0c,
+    DW_EH_PE_pcrel = 0x10,
+};
+
+// Read a pointer in a DW_EH_PE encoding; only absolute and PC-relative
+// pointers are supported. addr is the address of data.
+static bool
+eh_pointer(const uint8_t* data, size_t size, size_t* pos, unsigned enc,
+           bool is64, uint64_t addr, uint64_t* val) {
+    uint64_t field = addr + *pos;
+    size_t width = 0;
+    switch (enc & 0x0f) {
+    case DW_EH_PE_absptr: width = is64 ? 8 : 4; break;
+    case DW_EH_PE_udata2: case DW_EH_PE_sdata2: width = 2; break;
+    case DW_EH_PE_udata4: case DW_EH_PE_sdata4: width = 4; break;
+    case DW_EH_PE_udata8: case DW_EH_PE_sdata8: width = 8; break;
+    case DW_EH_PE_uleb128: case DW_EH_PE_sleb128: break;
+    default: return false;
+    }
+    if ((enc & 0x70) != DW_EH_PE_absptr && (enc & 0x70) != DW_EH_PE_pcrel)
+        return false;
+    if (enc & 0x80) // indirect
+        return false;
+
+    if (!width) {
+        size_t start = *pos;
+        if (!eh_uleb(data, size, pos, val))
+            return false;
+        unsigned bits = 7 * (*pos - start);
+        if ((enc & 0x0f) == DW_EH_PE_sleb128 && bits < 64 &&
+            (*val >> (bits - 1) & 1))
+            *val |= ~(uint64_t) 0 << bits;
+    } else {
+        if (size - *pos < width)
+            return false;
+        const uint8_t* p = data + *pos;
+        *val = width == 2 ? LOAD_LE_2(p) : width == 4 ? LOAD_LE_4(p) : LOAD_LE_8(p);
+        *pos += width;
+        if ((enc & 0x08) && width < 8 && (*val >> (8 * width - 1) & 1))
+            *val |= ~(uint64_t) 0 << (8 * width);
+    }
+    if ((enc & 0x70) == DW_EH_PE_pcrel)
+        *val += field;
+    if (!is64)
+        *val &= 0xffffffff;
+    return true;
+}
+
+// Get the FDE pointer encoding from the augmentation of the CIE at offset cie.
+static bool
+eh_cie_encoding(const uint8_t* data, size_t size, size_t cie, bool is64,
+                unsigned* enc) {
+    if (size - cie < 4)
+        return false;
+    size_t pos = cie + 4;
+    if (LOAD_LE_4(data + cie) == 0xffffffff)
+        pos += 8;
+    if (pos > size || size - pos < 5 || LOAD_LE_4(data + pos) != 0)
+        return false;
+    pos += 4;
+    unsigned version = data[pos++];
+    size_t aug = pos;
+    while (pos < size && data[pos])
+        pos++;
+    if (pos++ >= size)
+        return false;
+    *enc = DW_EH_PE_absptr;
+    if (data[aug] == '\0')
+        return true;
+    if (data[aug] != 'z')
+        return false;
+
+    uint64_t tmp;
+    if (version == 4) // address and segment selector size
+        pos += 2;
+    if (pos > size || !eh_uleb(data, size, &pos, &tmp) || // code alignment
+        !eh_uleb(data, size, &pos, &tmp)) // data alignment
+        return false;
+    if (version == 1)
+        pos++;
+    else if (!eh_uleb(data, size, &pos, &tmp)) // return address register
+        return false;
+    if (pos > size || !eh_uleb(data, size, &pos, &tmp)) // augmentation length
+        return false;
+    for (size_t i = aug + 1; data[i]; i++) {
+        if (pos >= size)
+            return false;
+        switch (data[i]) {
+        case 'R':
+            *enc = data[pos];
+            return true;
+        case 'P': {
+            unsigned penc = data[pos++];
+            // The personality routine is not needed, only its size.
+            if (!eh_pointer(data, size, &pos, penc, is64, 0, &tmp))
+                return false;
+            break;
+        }
+        case 'L':
+            pos++;
+            break;
+        case 'S': case 'B': case 'G':
+            break;
+        default:
+            // Unknown augmentation data precedes the encoding.
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t
+fd_elf_eh_frame(const void* image, size_t len, FdSymbol* out, size_t cap) {
+    const uint8_t* elf = image;
+    if (len < 0x34 || LOAD_LE_4(elf) != 0x464c457f || elf[5] != 1)
+        return 0;
+    bool is64 = elf[4] == 2;
+    if (!is64 && elf[4] != 1)
+        return 0;
+    if (is64 && len < 0x40)
+        return 0;
+
+    uint64_t shoff = is64 ? LOAD_LE_8(elf + 0x28) : LOAD_LE_4(elf + 0x20);
+    size_t shentsize = LOAD_LE_2(elf + (is64 ? 0x3a : 0x2e));
+    size_t shnum = LOAD_LE_2(elf + (is64 ? 0x3c : 0x30));
+    size_t shstrndx = LOAD_LE_2(elf + (is64 ? 0x3e : 0x32));
+    if (shentsize < (is64 ? 0x40u : 0x28u) || shoff > len ||
+        shnum > (len - shoff) / shentsize || shstrndx >= shnum)
+        return 0;
+
+    const uint8_t* strsh = elf + shoff + shstrndx * shentsize;
+    uint64_t stroff = is64 ? LOAD_LE_8(strsh + 0x18) : LOAD_LE_4(strsh + 0x10);
+    uint64_t strsize = is64 ? LOAD_LE_8(strsh + 0x20) : LOAD_LE_4(strsh + 0x14);
+    if (stroff > len || strsize > len - stroff || !strsize ||
+        elf[stroff + strsize - 1] != '\0')
+        return 0;
+
+    size_t total = 0;
+    for (size_t i = 0; i < shnum; i++) {
+        const uint8_t* sh = elf + shoff + i * shentsize;
+        uint32_t name = LOAD_LE_4(sh);
+        uint64_t addr = is64 ? LOAD_LE_8(sh + 0x10) : LOAD_LE_4(sh + 0x0c);
+        uint64_t off = is64 ? LOAD_LE_8(sh + 0x18) : LOAD_LE_4(sh + 0x10);
+        uint64_t size = is64 ? LOAD_LE_8(sh + 0x20) : LOAD_LE_4(sh + 0x14);
+        if (name >= strsize || off > len || size > len - off)
+            continue;
+        const char* secname = (const char*) elf + stroff + name;
+        const char* want = ".eh_frame";
+        size_t j = 0;
+        while (want[j] && secname[j] == want[j])
+            j++;
+        if (want[j] || secname[j])
+            continue;
+
+        const uint8_t* data = elf + off;
+        for (size_t pos = 0; size - pos >= 4; ) {
+            uint64_t reclen = LOAD_LE_4(data + pos);
+            pos += 4;
+            if (reclen == 0) // terminator
+                break;
+            if (reclen == 0xffffffff) {
+                if (size - pos < 8)
+                    break;
+                reclen = LOAD_LE_8(data + pos);
+                pos += 8;
+            }
+            if (reclen < 4 || reclen > size - pos)
+                break;
+            size_t rec = pos;
+            pos += reclen;
+
+            // The CIE pointer of an FDE is relative to its own position and
+            // points to the length of the CIE.
+            uint32_t cie_ptr = LOAD_LE_4(data + rec);
+            if (cie_ptr == 0 || cie_ptr > rec)
+                continue;
+            unsigned enc;
+            if (!eh_cie_encoding(data, size, rec - cie_ptr, is64, &enc))
+                continue;
+            // The size has the format of the start, but is not relative.
+            size_t fde = rec + 4;
+            uint64_t start, range;
+            if (!eh_pointer(data, pos, &fde, enc, is64, addr, &start) ||
+                !eh_pointer(data, pos, &fde, enc & 0x0f, is64, 0, &range) ||
+                !start)
+                continue;
+            if (total < cap) {
+                out[total].addr = start;
+                out[total].size = range;
+                out[total].name = NULL;
+            }
+            total++;
+        }
+    }
+    return total;
+}
+
+size_t
+fd_elf_build_id(const void* image, size_t len, uint8_t* out, size_t cap) {
+    const uint8_t* elf = image;
+    if (len < 0x34 || LOAD_LE_4(elf) != 0x464c457f || elf[5] != 1)
+        return 0;
+    bool is64 = elf[4] == 2;
+    if (!is64 && elf[4] != 1)
+        return 0;
+    if (is64 && len < 0x40)
+        return 0;
+
+    uint64_t shoff = is64 ? LOAD_LE_8(elf + 0x28) : LOAD_LE_4(elf + 0x20);
+    size_t shentsize = LOAD_LE_2(elf + (is64 ? 0x3a : 0x2e));
+    size_t shnum = LOAD_LE_2(elf + (is64 ? 0x3c : 0x30));
+    if (shentsize < (is64 ? 0x40u : 0x28u) || shoff > len ||
+        shnum > (len - shoff) / shentsize)
+        return 0;
+
+    for (size_t i = 0; i < shnum; i++) {
+        const uint8_t* sh = elf + shoff + i * shentsize;
+        uint64_t off = is64 ? LOAD_LE_8(sh + 0x18) : LOAD_LE_4(sh + 0x10);
+        uint64_t size = is64 ? LOAD_LE_8(sh + 0x20) : LOAD_LE_4(sh + 0x14);
+        if (LOAD_LE_4(sh + 4) != ELF_SHT_NOTE || off > len || size > len - off)
+            continue;
+
+        // Name and descriptor are padded to four bytes in both classes.
+        const uint8_t* note = elf + off;
+        for (uint64_t pos = 0; pos <= size && size - pos >= 12; ) {
+            uint64_t namesz = LOAD_LE_4(note + pos);
+            uint64_t descsz = LOAD_LE_4(note + pos + 4);
+            uint32_t type = LOAD_LE_4(note + pos + 8);
+            uint64_t name = pos + 12;
+            uint64_t desc = name + ((namesz + 3) & ~(uint64_t) 3);
+            if (desc > size || descsz > size - desc)
+                break;
+            pos = desc + ((descsz + 3) & ~(uint64_t) 3);
+            if (type != ELF_NT_GNU_BUILD_ID || namesz != 4 ||
+                LOAD_LE_4(note + name) != 0x00554e47) // "GNU"
+                continue;
+            for (size_t j = 0; j < descsz && j < cap; j++)
+                out[j] = note[desc + j];
+            return descsz;
+        }
+    }
+    return 0;
+}
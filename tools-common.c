@@ -0,0 +1,186 @@
+#define _GNU_SOURCE
+#include <elf.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tools-common.h"
+
+
+uint64_t
+now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void*
+xrealloc(void* ptr, size_t size) {
+    ptr = realloc(ptr, size);
+    if (!ptr) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+const uint8_t*
+map_file(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        fprintf(stderr, "%s: not a regular file\n", path);
+        close(fd);
+        return NULL;
+    }
+    *size = st.st_size;
+    const uint8_t* map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path);
+        return NULL;
+    }
+    return map;
+}
+
+// Fields of a section header of either class.
+struct Shdr {
+    uint64_t name, type, flags, addr, off, size;
+};
+
+// The headers are copied, as nothing guarantees their alignment in the file.
+static struct Shdr
+shdr_read(const uint8_t* sh, bool is64) {
+    if (is64) {
+        Elf64_Shdr shdr;
+        memcpy(&shdr, sh, sizeof shdr);
+        return (struct Shdr) {
+            shdr.sh_name, shdr.sh_type, shdr.sh_flags, shdr.sh_addr,
+            shdr.sh_offset, shdr.sh_size,
+        };
+    }
+    Elf32_Shdr shdr;
+    memcpy(&shdr, sh, sizeof shdr);
+    return (struct Shdr) {
+        shdr.sh_name, shdr.sh_type, shdr.sh_flags, shdr.sh_addr,
+        shdr.sh_offset, shdr.sh_size,
+    };
+}
+
+bool
+binary_load(struct Binary* bin, const char* path) {
+    *bin = (struct Binary) { .path = path };
+    bin->map = map_file(path, &bin->map_size);
+    if (!bin->map)
+        return false;
+
+    const uint8_t* elf = bin->map;
+    bool is64 = bin->map_size >= sizeof(Elf64_Ehdr) &&
+                elf[EI_CLASS] == ELFCLASS64;
+    uint64_t shoff = 0;
+    unsigned shnum = 0, shentsize = 0, shstrndx = 0, machine = EM_NONE;
+    if (is64) {
+        Elf64_Ehdr eh;
+        memcpy(&eh, elf, sizeof eh);
+        shoff = eh.e_shoff;
+        shnum = eh.e_shnum;
+        shentsize = eh.e_shentsize;
+        shstrndx = eh.e_shstrndx;
+        machine = eh.e_machine;
+    } else if (bin->map_size >= sizeof(Elf32_Ehdr)) {
+        Elf32_Ehdr eh;
+        memcpy(&eh, elf, sizeof eh);
+        shoff = eh.e_shoff;
+        shnum = eh.e_shnum;
+        shentsize = eh.e_shentsize;
+        shstrndx = eh.e_shstrndx;
+        machine = eh.e_machine;
+    }
+    if (machine == EM_X86_64 && is64)
+        bin->mode = 64;
+    else if (machine == EM_386 && !is64)
+        bin->mode = 32;
+    if (!bin->mode || memcmp(elf, ELFMAG, SELFMAG) ||
+        shentsize != (is64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr)) ||
+        shoff > bin->map_size || shnum > (bin->map_size - shoff) / shentsize) {
+        fprintf(stderr, "%s: not an x86 ELF file\n", path);
+        munmap((void*) bin->map, bin->map_size);
+        bin->map = NULL;
+        return false;
+    }
+
+    const char* shstr = NULL;
+    uint64_t shstrsize = 0;
+    if (shstrndx < shnum) {
+        struct Shdr sh = shdr_read(elf + shoff + shstrndx * shentsize, is64);
+        if (sh.off <= bin->map_size && sh.size <= bin->map_size - sh.off &&
+            sh.size && !elf[sh.off + sh.size - 1]) {
+            shstr = (const char*) elf + sh.off;
+            shstrsize = sh.size;
+        }
+    }
+
+    bin->sections = xrealloc(NULL, (shnum + 1) * sizeof *bin->sections);
+    for (unsigned i = 0; i < shnum; i++) {
+        struct Shdr sh = shdr_read(elf + shoff + i * shentsize, is64);
+        if (sh.off > bin->map_size || sh.size > bin->map_size - sh.off)
+            continue;
+        if (sh.type != SHT_PROGBITS || !(sh.flags & SHF_EXECINSTR) ||
+            !sh.size)
+            continue;
+        bin->sections[bin->nsections++] = (struct Section) {
+            .name = sh.name < shstrsize ? shstr + sh.name : "",
+            .code = elf + sh.off, .addr = sh.addr, .size = sh.size,
+        };
+    }
+    return true;
+}
+
+void
+binary_unload(struct Binary* bin) {
+    free(bin->sections);
+    munmap((void*) bin->map, bin->map_size);
+}
+
+struct Thread {
+    void (*fn)(void* arg, unsigned id);
+    void* arg;
+    unsigned id;
+    pthread_t thread;
+};
+
+static void*
+thread_main(void* arg) {
+    struct Thread* t = arg;
+    t->fn(t->arg, t->id);
+    return NULL;
+}
+
+void
+run_workers(unsigned nworkers, void (*fn)(void* arg, unsigned id),
+            void* arg) {
+    struct Thread* threads = xrealloc(NULL, nworkers * sizeof *threads);
+    for (unsigned i = 1; i < nworkers; i++) {
+        threads[i] = (struct Thread) { .fn = fn, .arg = arg, .id = i };
+        if (pthread_create(&threads[i].thread, NULL, thread_main,
+                           &threads[i])) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    fn(arg, 0);
+    for (unsigned i = 1; i < nworkers; i++)
+        pthread_join(threads[i].thread, NULL);
+    free(threads);
+}
@@ -0,0 +1,46 @@
+#ifndef FD_TOOLS_COMMON_H_
+#define FD_TOOLS_COMMON_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Helpers shared by the command line tools, which are not part of the library.
+
+// An executable section of a binary.
+struct Section {
+    const char* name; // empty if the file has no section names
+    const uint8_t* code;
+    uint64_t addr;
+    size_t size;
+};
+
+// A read-only mapping of an x86 ELF file.
+struct Binary {
+    const char* path;
+    const uint8_t* map;
+    size_t map_size;
+    int mode; // 32 or 64, see fd_decode
+    struct Section* sections; // in file order
+    size_t nsections;
+};
+
+uint64_t now_ns(void);
+
+// Like realloc, but exits on failure.
+void* xrealloc(void* ptr, size_t size);
+
+// Map a regular file read-only; prints an error and returns NULL on failure.
+const uint8_t* map_file(const char* path, size_t* size);
+
+// Map an x86-64 or x86-32 ELF file and find its executable sections; prints
+// an error and returns false on failure, then bin->map is NULL.
+bool binary_load(struct Binary* bin, const char* path);
+void binary_unload(struct Binary* bin);
+
+// Call fn with the ids 0 to nworkers - 1 in parallel and wait for all of them;
+// id 0 runs on the calling thread.
+void run_workers(unsigned nworkers, void (*fn)(void* arg, unsigned id),
+                 void* arg);
+
+#endif
@@ -0,0 +1,300 @@
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fadec.h>
+#include <fadec-analysis.h>
+
+
+#define RADIX_SIZE ((size_t) 1 << FD_XREF_RADIX_BITS)
+
+enum {
+    PHASE_INIT,
+    PHASE_MINMAX,
+    PHASE_HIST,
+    PHASE_SCATTER,
+    PHASE_DONE,
+};
+
+// Get the reference of an instruction; false if it has none.
+static bool
+xref_instr(const FdInstr* instr, uint64_t addr, uint64_t* target,
+           FdXrefKind* kind) {
+    FdCfKind cf = fd_cf_kind(instr);
+    if (cf == FD_CF_CALL || cf == FD_CF_JMP || cf == FD_CF_JCC ||
+        cf == FD_CF_LOOP) {
+        *kind = cf == FD_CF_CALL ? FD_XREF_CALL :
+                cf == FD_CF_JMP ? FD_XREF_JUMP : FD_XREF_BRANCH;
+        *target = fd_branch_target(instr, addr);
+        return true;
+    }
+
+    // At most one operand is a memory operand with displacement.
+    for (unsigned i = 0; i < 4; i++) {
+        if (FD_OP_TYPE(instr, i) != FD_OT_MEM &&
+            FD_OP_TYPE(instr, i) != FD_OT_MEMBCST)
+            continue;
+        uint64_t disp = FD_OP_DISP(instr, i);
+        if (FD_OP_BASE(instr, i) == FD_REG_IP) {
+            *target = addr + FD_SIZE(instr) + disp;
+        } else if (FD_OP_BASE(instr, i) == FD_REG_NONE &&
+                   FD_OP_INDEX(instr, i) == FD_REG_NONE &&
+                   FD_SEGMENT(instr) != FD_REG_FS &&
+                   FD_SEGMENT(instr) != FD_REG_GS) {
+            // Absolute address, common in 32-bit code; thread-local data
+            // is relative to FS or GS.
+            *target = FD_ADDRSIZE(instr) == 8 ? disp :
+                      disp & (((uint64_t) 1 << 8 * FD_ADDRSIZE(instr)) - 1);
+        } else {
+            return false;
+        }
+        *kind = FD_TYPE(instr) == FDI_LEA ? FD_XREF_ADDR : FD_XREF_MEM;
+        return true;
+    }
+    return false;
+}
+
+size_t
+fd_xref_scan(const uint8_t* buf, size_t len, uint64_t base, int mode,
+             size_t start, size_t end, FdXref* out, uint8_t* kinds,
+             size_t cap) {
+    size_t total = 0;
+    for (size_t off = start; off < end && off < len; ) {
+        FdInstr instr;
+        int ret = fd_decode(buf + off, len - off, mode, 0, &instr);
+        if (ret < 0) {
+            off++;
+            continue;
+        }
+        uint64_t addr = base + off;
+        off += ret;
+
+        uint64_t target;
+        FdXrefKind kind;
+        if (!xref_instr(&instr, addr, &target, &kind))
+            continue;
+        if (total < cap) {
+            out[total].from = addr;
+            out[total].to = target;
+            kinds[total] = kind;
+        }
+        total++;
+    }
+    return total;
+}
+
+int
+fd_xref_init(FdXrefIndex* index, const FdXref* refs, const uint8_t* kinds,
+             size_t count, FdXref* scratch, uint64_t* hist,
+             unsigned nworkers) {
+    if (!nworkers)
+        return -1;
+    index->refs = refs;
+    index->kinds = kinds;
+    index->count = count;
+    index->targets = NULL;
+    index->first = NULL;
+    index->sources = NULL;
+    index->ntargets = 0;
+    index->scratch = scratch;
+    index->hist = hist;
+    index->nworkers = nworkers;
+    index->phase = PHASE_INIT;
+    index->pass = 0;
+    index->npasses = 1;
+    return 0;
+}
+
+// The sorted references are in the second half of the scratch memory, so
+// that the passes alternate between the halves accordingly.
+static FdXref*
+xref_dst(const FdXrefIndex* index, unsigned pass) {
+    bool upper = (index->npasses - 1 - pass) % 2 == 0;
+    return index->scratch + (upper ? index->count : 0);
+}
+
+static const FdXref*
+xref_src(const FdXrefIndex* index, unsigned pass) {
+    return pass ? xref_dst(index, pass - 1) : index->refs;
+}
+
+static size_t
+xref_digit(const FdXrefIndex* index, const FdXref* ref) {
+    return ((ref->to - index->min) >> (index->pass * index->bits)) &
+           ((1u << index->bits) - 1);
+}
+
+// Build the CSR arrays from the references sorted by target. The sources and
+// targets overwrite the first half of the scratch memory; the offsets
+// overwrite the sorted references behind the read position.
+static void
+xref_compact(FdXrefIndex* index) {
+    const FdXref* sorted = index->scratch + index->count;
+    uint64_t* sources = (uint64_t*) index->scratch;
+    uint64_t* targets = sources + index->count;
+    uint64_t* first = (uint64_t*) (index->scratch + index->count);
+    size_t ntargets = 0;
+    for (size_t i = 0; i < index->count; i++) {
+        FdXref ref = sorted[i];
+        sources[i] = ref.from;
+        if (!ntargets || ref.to != targets[ntargets - 1]) {
+            targets[ntargets] = ref.to;
+            first[ntargets++] = i;
+        }
+    }
+    first[ntargets] = index->count;
+    index->sources = sources;
+    index->targets = targets;
+    index->first = first;
+    index->ntargets = ntargets;
+}
+
+int
+fd_xref_step(FdXrefIndex* index) {
+    size_t nworkers = index->nworkers;
+    switch (index->phase) {
+    case PHASE_INIT:
+        index->phase = PHASE_MINMAX;
+        return 1;
+    case PHASE_MINMAX: {
+        uint64_t min = UINT64_MAX, max = 0;
+        for (size_t w = 0; w < nworkers; w++) {
+            if (index->hist[w * RADIX_SIZE] < min)
+                min = index->hist[w * RADIX_SIZE];
+            if (index->hist[w * RADIX_SIZE + 1] > max)
+                max = index->hist[w * RADIX_SIZE + 1];
+        }
+        // Only the bits in which the targets differ are sorted, in passes
+        // of at most FD_XREF_RADIX_BITS bits.
+        unsigned bits = 0;
+        if (min < max)
+            while (bits < 64 && (max - min) >> bits)
+                bits++;
+        index->min = min < max ? min : 0;
+        index->npasses = bits ? (bits + FD_XREF_RADIX_BITS - 1) /
+                                FD_XREF_RADIX_BITS : 1;
+        index->bits = (bits + index->npasses - 1) / index->npasses;
+        index->pass = 0;
+        index->phase = PHASE_HIST;
+        return 1;
+    }
+    case PHASE_HIST: {
+        // Each worker scatters its digits to the positions after those of
+        // all smaller digits and of the same digit of the previous workers.
+        uint64_t pos = 0;
+        for (size_t d = 0; d < ((size_t) 1 << index->bits); d++) {
+            for (size_t w = 0; w < nworkers; w++) {
+                uint64_t cnt = index->hist[w * RADIX_SIZE + d];
+                index->hist[w * RADIX_SIZE + d] = pos;
+                pos += cnt;
+            }
+        }
+        index->phase = PHASE_SCATTER;
+        return 1;
+    }
+    case PHASE_SCATTER:
+        if (++index->pass < index->npasses) {
+            index->phase = PHASE_HIST;
+            return 1;
+        }
+        xref_compact(index);
+        index->phase = PHASE_DONE;
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+void
+fd_xref_run(FdXrefIndex* index, unsigned worker) {
+    size_t lo = index->count * worker / index->nworkers;
+    size_t hi = index->count * (worker + 1) / index->nworkers;
+    uint64_t* hist = index->hist + worker * RADIX_SIZE;
+    const FdXref* src = xref_src(index, index->pass);
+    switch (index->phase) {
+    case PHASE_MINMAX: {
+        uint64_t min = UINT64_MAX, max = 0;
+        for (size_t i = lo; i < hi; i++) {
+            if (index->refs[i].to < min)
+                min = index->refs[i].to;
+            if (index->refs[i].to > max)
+                max = index->refs[i].to;
+        }
+        hist[0] = min;
+        hist[1] = max;
+        break;
+    }
+    case PHASE_HIST:
+        for (size_t d = 0; d < ((size_t) 1 << index->bits); d++)
+            hist[d] = 0;
+        for (size_t i = lo; i < hi; i++)
+            hist[xref_digit(index, &src[i])]++;
+        break;
+    case PHASE_SCATTER: {
+        // Stable, so that the sources of a target remain ascending.
+        FdXref* dst = xref_dst(index, index->pass);
+        for (size_t i = lo; i < hi; i++)
+            dst[hist[xref_digit(index, &src[i])]++] = src[i];
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// First index of a sorted array with an element not less than key.
+static size_t
+lower_bound(const uint64_t* arr, size_t count, uint64_t key) {
+    size_t lo = 0;
+    while (count) {
+        size_t half = count / 2;
+        if (arr[lo + half] < key) {
+            lo += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    return lo;
+}
+
+// First index of references sorted by source with a source not less than key.
+static size_t
+refs_lower_bound(const FdXref* refs, size_t count, uint64_t key) {
+    size_t lo = 0;
+    while (count) {
+        size_t half = count / 2;
+        if (refs[lo + half].from < key) {
+            lo += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    return lo;
+}
+
+size_t
+fd_xref_from(const FdXrefIndex* index, uint64_t lo, uint64_t hi,
+             size_t* first) {
+    size_t begin = refs_lower_bound(index->refs, index->count, lo);
+    size_t end = begin + refs_lower_bound(index->refs + begin,
+                                          index->count - begin, hi);
+    *first = begin;
+    return end - begin;
+}
+
+size_t
+fd_xref_to(const FdXrefIndex* index, uint64_t lo, uint64_t hi,
+           size_t* first) {
+    if (index->phase != PHASE_DONE) {
+        *first = 0;
+        return 0;
+    }
+    size_t begin = lower_bound(index->targets, index->ntargets, lo);
+    size_t end = begin + lower_bound(index->targets + begin,
+                                     index->ntargets - begin, hi);
+    *first = index->first[begin];
+    return index->first[end] - index->first[begin];
+}